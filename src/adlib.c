@@ -29,6 +29,8 @@
 
 #include "audio.h"
 #include "ports.h"
+#include "snapshot.h"
+#include "timing.h"
 
 //static double samprateadjust = 1.0;
 //static uint8_t optable[0x16] = { 0, 0, 0, 1, 1, 1, 255, 255, 0, 0, 0, 1, 1, 1, 255, 255, 0, 0, 0, 1, 1, 1 };
@@ -256,4 +258,24 @@ void initadlib ( uint16_t baseport )
 {
 	set_port_write_redirector(baseport, baseport + 1, &outadlib);
 	set_port_read_redirector(baseport, baseport + 1, &inadlib);
+	timing_register(TIMING_ADLIB, tickadlib);
+	if (!machine->headless)
+		timing_periodic(TIMING_ADLIB, 1, 48000);
+}
+
+
+// The state of the card, for the snapshots
+void adlib_snapshot ( struct snapshot *s )
+{
+	SNAPSHOT_ITEM(s, adlibregmem);
+	SNAPSHOT_ITEM(s, adlibaddr);
+	SNAPSHOT_ITEM(s, adlibch);
+	SNAPSHOT_ITEM(s, adlibenv);
+	SNAPSHOT_ITEM(s, adlibdecay);
+	SNAPSHOT_ITEM(s, adlibattack);
+	SNAPSHOT_ITEM(s, adlibdidattack);
+	SNAPSHOT_ITEM(s, adlibpercussion);
+	SNAPSHOT_ITEM(s, adlibstatus);
+	SNAPSHOT_ITEM(s, fullstep);
+	SNAPSHOT_ITEM(s, adlibstep);
 }
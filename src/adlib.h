@@ -27,4 +27,7 @@ extern void	initadlib	( uint16_t baseport );
 extern void	outadlib	( uint16_t portnum, uint8_t value );
 extern void	tickadlib	( void );
 
+struct snapshot;
+extern void	adlib_snapshot	( struct snapshot *s );
+
 #endif
@@ -127,6 +127,18 @@ void tickaudio(void) {
 }
 
 
+// The audio sample event, -slowsys generates four samples at a time
+static void audio_event ( void )
+{
+	tickaudio();
+	if (slowsystem) {
+		tickaudio();
+		tickaudio();
+		tickaudio();
+	}
+}
+
+
 // FIXME: it was int8_t I modified to uint8_t ...
 static void fill_audio ( void *udata, uint8_t *stream, int len )
 {
@@ -168,6 +180,8 @@ void initaudio ( void )
 	audbufptr = usebuffersize;
 	//create_output_wav("fake86.wav");
 	SDL_PauseAudio(0);
+	timing_register(TIMING_AUDIO, audio_event);
+	timing_periodic(TIMING_AUDIO, 1, gensamplerate);
 	return;
 }
 
@@ -27,6 +27,7 @@
 
 #include "cpu.h"
 #include "disk.h"
+#include "fanout.h"
 #include "sermouse.h"
 #include "ports.h"
 // FIXME we don't need this:
@@ -65,8 +66,8 @@ int internalbios = 0;
 		bios_putstr(_buf_);				\
 	} while (0)
 
-#define pokeb(a,b) RAM[a]=(b)
-#define peekb(a)   RAM[a]
+#define pokeb(a,b) machine_ram[a]=(b)
+#define peekb(a)   machine_ram[a]
 static inline void pokew ( int a, uint16_t w )
 {
 	pokeb(a, w & 0xFF);
@@ -97,7 +98,7 @@ static void place_trap_vector ( int addr, int trap )
 
 static void place_jmp_to_trap_vector ( int addr, int trap )
 {
-	RAM[addr] = 0xEA;	// opcode of "far jump"
+	machine_ram[addr] = 0xEA;	// opcode of "far jump"
 	place_trap_vector(addr + 1, trap);
 }
 
@@ -108,9 +109,9 @@ void bios_internal_install ( void )
 	internalbios = 1;	// make sure to switch it on
 	// Build our trap table
 	for (int a = 0; a < 0x200; a++) {
-		RAM[INTERNAL_BIOS_TRAP_SEG * 16 + a] = 0xF4;	// opcode of HLT
+		machine_ram[INTERNAL_BIOS_TRAP_SEG * 16 + a] = 0xF4;	// opcode of HLT
 	}
-	RAM[INTERNAL_BIOS_TRAP_SEG * 16 + 0x1FF] = 0xCF;		// an IRET to be used for various purposes (@ trapseg:0x1FF)
+	machine_ram[INTERNAL_BIOS_TRAP_SEG * 16 + 0x1FF] = 0xCF;		// an IRET to be used for various purposes (@ trapseg:0x1FF)
 	// Entry points
 	place_jmp_to_trap_vector(0xFFFF0, BIOS_TRAP_RESET);	// CPU reset address will trap to our BIOS init routine
 	place_jmp_to_trap_vector(0xF6000, BIOS_TRAP_BASIC);	// Common entry point for ROM BASIc.
@@ -121,18 +122,18 @@ void bios_internal_install ( void )
 		'1','0','/','2','8','/','1','7',
 		0x00, 0xFE, 0xAD
 	};
-	memcpy(RAM + 0xFFFF5, bios_signature, 11);
+	memcpy(machine_ram + 0xFFFF5, bios_signature, 11);
 	printf("BIOS: installed, trap_segment = %04Xh\n", INTERNAL_BIOS_TRAP_SEG);
 }
 
 
-static int do_not_IRET;
+static _Thread_local int do_not_IRET;
 
 
 // INT 19h
 static void bios_boot_interrupt ( void )
 {
-	if (!disk[bootdrive].inserted) {
+	if (!machine_disk[bootdrive].inserted) {
 		fprintf(stderr, "BIOS: ERROR! Requested boot drive %02Xh is not inserted!", bootdrive);
 		exit(1);
 	}
@@ -156,7 +157,7 @@ static void bios_boot_interrupt ( void )
 	do_not_IRET = 1;
 }
 
-static int color = 7;
+#define color	(machine->bios_color)
 
 #if 0
 static struct biostime {
@@ -228,20 +229,20 @@ static void bios_reset ( void )
 	color = 7;
 	bios_printf("CPU type : %s\nMemory   : %dK\nCOM1     : %Xh (mouse)\n", CPU_TYPE_STR, (int)(RAM_SIZE - 0x60000) >> 10, sermouse.baseport);
 	for (int a = 0; a < 0x100; a++) {
-		if (disk[a].inserted) {
+		if (machine_disk[a].inserted) {
 			bios_printf("Drive %02X : %s CHS=%d/%d/%d SIZE=%u%c %s\n",
 				a,
 				a < 0x80 ? "FDD" : "HDD",
-				disk[a].cyls,
-				disk[a].heads,
-				disk[a].sects,
-				(unsigned int)(disk[a].filesize >= 10*1024*1024 ? disk[a].filesize >> 20 : disk[a].filesize >> 10),
-				disk[a].filesize >= 10*1024*1024 ? 'M' : 'K',
-				disk[a].readonly ? "RO" : "RW"
+				machine_disk[a].cyls,
+				machine_disk[a].heads,
+				machine_disk[a].sects,
+				(unsigned int)(machine_disk[a].filesize >= 10*1024*1024 ? machine_disk[a].filesize >> 20 : machine_disk[a].filesize >> 10),
+				machine_disk[a].filesize >= 10*1024*1024 ? 'M' : 'K',
+				machine_disk[a].writeprotected ? "RO" : "RW"
 			);
 		}
 	}
-	memset(RAM, 0, 0x500);	// clear some part of the main RAM to be sure
+	memset(machine_ram, 0, 0x500);	// clear some part of the main RAM to be sure
 	// Install fake interrupt table
 	for (int a = 0; a < 0x100; a++)
 		place_trap_vector(a * 4, a);
@@ -390,16 +391,17 @@ static void bios_reset ( void )
 
 
 // FIXME: should be moved bios putchar etc routines to use the BDAT (bios data) area
-#define CURX RAM[0x450 + (bios_video_page << 1)]
-#define CURY RAM[0x451 + (bios_video_page << 1)]
+#define CURX machine_ram[0x450 + (bios_video_page << 1)]
+#define CURY machine_ram[0x451 + (bios_video_page << 1)]
 
 
 static void bios_putchar ( const char c )
 {
-	static int x = 0, y = 0;
+#define x	(machine->bios_x)
+#define y	(machine->bios_y)
 	if ((unsigned)c >= 32) {
-		RAM[0xB8000 + (y * 160) + x * 2] = c & 0xFF;
-		RAM[0xB8001 + (y * 160) + x * 2] = color;
+		machine_ram[0xB8000 + (y * 160) + x * 2] = c & 0xFF;
+		machine_ram[0xB8001 + (y * 160) + x * 2] = color;
 		if (x == 79) {
 			x = 0;
 			y++;
@@ -412,18 +414,20 @@ static void bios_putchar ( const char c )
 		x = 0;
 	} else if (c == 8 && x > 0) {
 		x--;
-		RAM[0xB8000 + (y * 160) + x * 2] = 32;
+		machine_ram[0xB8000 + (y * 160) + x * 2] = 32;
 	}
 	if (y == 25) {
 		y = 24;
-		memmove(RAM + 0xB8000, RAM + 0xB8000 + 160, 80 * 25 * 2);
+		memmove(machine_ram + 0xB8000, machine_ram + 0xB8000 + 160, 80 * 25 * 2);
 		for (int a = 0; a < 80; a++) {
-			RAM[0xB8000 + 24 * 160 + a * 2 + 0] = 32;
-			RAM[0xB8000 + 24 * 160 + a * 2 + 1] = color;
+			machine_ram[0xB8000 + 24 * 160 + a * 2 + 0] = 32;
+			machine_ram[0xB8000 + 24 * 160 + a * 2 + 1] = color;
 		}
 	}
 	cursx = x;
 	cursy = y;
+#undef x
+#undef y
 }
 
 
@@ -475,9 +479,9 @@ static uint16_t kbd_get_buffer ( int to_remove )
 static void kbd_set_mod0 ( int mask, int scan )
 {
 	if ((scan & 0x80))
-		RAM[0x417] &= ~mask;
+		machine_ram[0x417] &= ~mask;
 	else
-		RAM[0x417] |= mask;
+		machine_ram[0x417] |= mask;
 }
 
 
@@ -550,7 +554,7 @@ static void bios_irq1_handler ( void )
 						ascii = scan2ascii[scan];
 					else
 						ascii = 0;
-					if ((RAM[0x417] & 3)) {
+					if ((machine_ram[0x417] & 3)) {
 						if (ascii == ';')
 							ascii = ':';
 					}
@@ -574,6 +578,7 @@ static void bios_internal_trap ( unsigned int trap )
 	uint16_t stack_ip = peekw(CPU_SS * 16 + CPU_SP);
 	uint16_t stack_cs = peekw(CPU_SS * 16 + ((CPU_SP + 2) & 0xFFFF));
 	do_not_IRET = 0;
+	CPU_SYNC_FLAGS();	// traps may read or override ZF directly
 	if (trap < 0x100)
 		CPU_FL_CF = 0;	// by default we set carry flag to zero. INT handlers may set it '1' in case of error!
 	//printf("BIOS_TRAP: %04Xh STACK_RET=%04X:%04X AX=%04Xh\n", trap, return_segment, return_offset, CPU_AX);
@@ -670,7 +675,7 @@ static void bios_internal_trap ( unsigned int trap )
 						CPU_FL_ZF = 1;
 					break;
 				case 2:	// get kbd status
-					CPU_AL = RAM[0x417];	// shift, etc status
+					CPU_AL = machine_ram[0x417];	// shift, etc status
 					break;
 				case 5:				// PUSH into kbd buffer by user call!!
 					CPU_AL = kbd_push_buffer(CPU_CX);
@@ -736,7 +741,12 @@ static void bios_internal_trap ( unsigned int trap )
 					break;
 				case 0xFF:
 					puts("HOSTFS: requested terminate");
-					running = 0;
+					machine_running = 0;
+					machine_attention();
+					break;
+				default:
+					if (fanout_gateway())
+						CPU_FL_CF = 1;
 					break;
 			}
 			break;
@@ -763,6 +773,8 @@ static void bios_internal_trap ( unsigned int trap )
 			break;
 		case BIOS_TRAP_EMUGW:
 			// emulation gateway functionality can be used by special tools running inside Fake86
+			if (fanout_gateway())
+				CPU_FL_CF = 1;
 			do_not_IRET = 1;
 			// do our FAR-RET here instead!
 			CPU_IP = cpu_pop();
@@ -799,11 +811,14 @@ static void bios_internal_trap ( unsigned int trap )
 
 int cpu_hlt_handler ( void )
 {
-	if (!internalbios || CPU_CS != INTERNAL_BIOS_TRAP_SEG || cpu.saveip >= 0x1FF) {
-		puts("BIOS: critical warning, HLT outside of trap area?!");
+	if (!internalbios || CPU_CS != INTERNAL_BIOS_TRAP_SEG || machine_cpu.saveip >= 0x1FF) {
+		// a real halt, DOS idle loops do it all the time, it's only
+		// suspicious in our own trap segment
+		if (internalbios && CPU_CS == INTERNAL_BIOS_TRAP_SEG)
+			puts("BIOS: critical warning, HLT outside of trap area?!");
 		return 1;	// Yes, it was really a halt, since it does not fit into our trap area
 	}
-	bios_internal_trap(cpu.saveip);
+	bios_internal_trap(machine_cpu.saveip);
 	return 0;	// no, it wasn't a HLT, it's our trap!
 }
 
@@ -866,7 +881,7 @@ int bios_fake86_intcall86_dispatch ( uint8_t intnum )
 #ifndef DISK_CONTROLLER_ATA
 	case 0x19: // bootstrap
 #ifdef BENCHMARK_BIOS
-		running = 0;
+		machine_running = 0;
 #endif
 		if (bootdrive < 255) { // read first sector of boot drive into
 				       // 07C0:0000 and execute it
@@ -45,13 +45,13 @@ static void bufNewData ( uint8_t value )
 	blaster.memptr++;
 }
 
+// The sample event runs at the sample rate, not on headless machines
 static void setsampleticks ( void )
 {
-	if (blaster.samplerate == 0) {
-		blaster.sampleticks = 0;
-		return;
-	}
-	blaster.sampleticks = hostfreq / (uint64_t)blaster.samplerate;
+	if (blaster.samplerate == 0 || machine->headless)
+		timing_stop(TIMING_BLASTER);
+	else
+		timing_periodic(TIMING_BLASTER, 1, blaster.samplerate);
 }
 
 
@@ -77,6 +77,7 @@ static void cmdBlaster ( uint8_t value )
 #endif
 					blaster.usingdma = 1;
 					blaster.blockstep = 0;
+					blaster.dmapos = blaster.dmalen = 0;
 					blaster.useautoinit = 0;
 					blaster.paused8 = 0;
 					blaster.speakerstate = 1;
@@ -138,6 +139,7 @@ static void cmdBlaster ( uint8_t value )
 			case 0x2C:
 				blaster.usingdma = 1;
 				blaster.blockstep = 0;
+				blaster.dmapos = blaster.dmalen = 0;
 				blaster.useautoinit = 1;
 				blaster.paused8 = 0;
 				blaster.speakerstate = 1;
@@ -296,7 +298,22 @@ void tickBlaster( void )
 		return;
 	  }*/
 	//printf("tickBlaster();\n");
-	blaster.sample = read8237 (blaster.sbdma);
+	if (blaster.dmapos == blaster.dmalen) {
+		// the rest of the block, up to the size of the FIFO, in one read; the
+		// DMA channel itself is only moved below, sample by sample
+		uint32_t want = blaster.blocksize + 1 - blaster.blockstep;
+		if (want > BLASTER_DMA_FIFO || blaster.blockstep > blaster.blocksize)
+			want = BLASTER_DMA_FIFO;
+		blaster.dmapos = 0;
+		blaster.dmalen = (uint8_t)i8237_peek_block(blaster.sbdma, blaster.dmafifo, want);
+	}
+	if (blaster.dmapos < blaster.dmalen && i8237_advance(blaster.sbdma, 1))
+		blaster.sample = blaster.dmafifo[blaster.dmapos++];
+	else {
+		// masked or stopped since the FIFO was filled: the rest is dropped
+		blaster.dmapos = blaster.dmalen = 0;
+		blaster.sample = 128;
+	}
 	blaster.blockstep++;
 	if (blaster.blockstep > blaster.blocksize) {
 		doirq (blaster.sbirq);
@@ -338,4 +355,5 @@ void initBlaster ( uint16_t baseport, uint8_t irq )
 	mixerReset();
 	set_port_write_redirector(baseport, baseport + 0xE, &outBlaster);
 	set_port_read_redirector(baseport, baseport + 0xE, &inBlaster);
+	timing_register(TIMING_BLASTER, tickBlaster);
 }
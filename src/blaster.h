@@ -23,6 +23,9 @@
 
 #include <stdint.h>
 
+// samples fetched by one DMA block transfer, at most
+#define BLASTER_DMA_FIFO	32
+
 struct blaster_s {
 	uint8_t mem[1024];
 	uint16_t memptr;
@@ -44,7 +47,8 @@ struct blaster_s {
 	uint8_t useautoinit;
 	uint32_t blocksize;
 	uint32_t blockstep;
-	uint64_t sampleticks;
+	uint8_t dmafifo[BLASTER_DMA_FIFO];	// read ahead of the DMA channel, which only moves as they are played
+	uint8_t dmapos, dmalen;
 	struct mixer_s {
 		uint8_t index;
 		uint8_t reg[256];
@@ -0,0 +1,47 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_BYTEORDER_H_INCLUDED
+#define FAKE86_BYTEORDER_H_INCLUDED
+
+#include <stdint.h>
+
+/* The packed and the overlay image formats (see diskpack.h and
+   diskoverlay.h) store their numbers little-endian. These give the host value of a little-endian
+   number read into n as it is, and also the other way around, the
+   little-endian form of a host value to be written: nothing on
+   little-endian hosts, a byte swap on big-endian ones. */
+
+static inline uint32_t le32 ( uint32_t n )
+{
+	const uint8_t *p = (const uint8_t*)&n;
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t le64 ( uint64_t n )
+{
+	const uint8_t *p = (const uint8_t*)&n;
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+#endif
@@ -36,6 +36,10 @@
 // Highly experimental, and not work at all!!!!
 #define USE_KVM
 
+// Compile in the x86-64 dynamic translator for hot 8086 code (you still need -jit switch to use it then!).
+// Note, that this will be undefined at the end of this file, if not built for a 64 bit x86 UNIX host with a GNU compiler
+#define USE_JIT
+
 #define USE_OSD
 
 // Protect video emulation thread with a mutex when accessing screen.
@@ -85,10 +89,54 @@
 //by default, i just leave this disabled because it wastes a very very
 //small amount of CPU power. however, for the sake of more accurate
 //emulation, it can be enabled by uncommenting the line below and recompiling.
+//note: the prefetch queue and CPU_ADDR_MODE_CACHE are process wide, they
+//are not part of the machine context (machine.h), use them with one machine.
 //#define USE_PREFETCH_QUEUE
 
 //#define CPU_ADDR_MODE_CACHE
 
+//when CPU_INSTRUCTION_FLOW_CACHE is defined, the CPU emulator records the
+//instructions it executes into a cache of predecoded basic blocks (prefixes,
+//ModR/M, displacement and immediates), so hot code is not fetched and decoded
+//again and again. writes to cached code invalidate the affected 4K page.
+//it supersedes CPU_ADDR_MODE_CACHE, and it's not used with USE_PREFETCH_QUEUE.
+#define CPU_INSTRUCTION_FLOW_CACHE
+
+//when CPU_THREADED_DISPATCH is defined, exec86() dispatches opcodes through a
+//table of label addresses (GCC's "labels as values" extension) and chains
+//straight from one instruction to the next when no timing, trap, interrupt or
+//halt work is pending. it's silently turned off on non-GNU compilers, where
+//the classic switch() based dispatch is used instead.
+#define CPU_THREADED_DISPATCH
+
+//when CPU_LAZY_FLAGS is defined, arithmetic and logic instructions only record
+//the kind of the operation with its operands and result, and ZF, SF, PF, OF
+//and AF are computed from those when something actually reads them (Jcc,
+//LOOPcc, PUSHF, LAHF, interrupts ...). the carry flag is always kept up to date.
+#define CPU_LAZY_FLAGS
+
+//when CPU_BULK_STRING_OPS is defined, REP MOVS/STOS/LODS/CMPS/SCAS run over
+//whole runs of plain RAM at once (memmove, memset, memchr ...) instead of
+//being dispatched again for every element. they still stop where the timer,
+//the interrupt checks or the end of the exec86() time slice would come.
+#define CPU_BULK_STRING_OPS
+
+//when CPU_SUPERINSTRUCTIONS is defined, some common instruction pairs (CMP,
+//TEST or DEC followed by a conditional jump, LODSB followed by STOSB) are run
+//as one step, if the flow cache has the second one already decoded and there
+//is no interrupt, trap, timing or JIT entry due between the two. the branch of
+//a CMP+Jcc pair is decided by comparing the operands directly. it needs both
+//CPU_INSTRUCTION_FLOW_CACHE and CPU_THREADED_DISPATCH.
+#define CPU_SUPERINSTRUCTIONS
+
+//when CPU_PROFILER is defined, the CPU emulator counts the executed opcodes
+//(with their prefixes and register/memory form), samples CS:IP into a hot
+//address histogram, and measures the host time spent on each class of
+//instructions (see profiler.c). the results are printed at exit, and by the
+//"prof" command of the console. it slows down the emulation considerably,
+//and it's process wide, so leave it disabled unless you need the numbers.
+//#define CPU_PROFILER
+
 //when compiled with network support, fake86 needs libpcap/winpcap.
 //if it is disabled, the ethernet card is still emulated, but no actual
 //communication is possible -- as if the ethernet cable was unplugged.
@@ -127,6 +175,7 @@ extern void UNREACHABLE_FATAL_ERROR ( void );
 #ifdef __GNUC__
 #	define LIKELY(__x__)		__builtin_expect(!!(__x__), 1)
 #	define UNLIKELY(__x__)		__builtin_expect(!!(__x__), 0)
+#	define CTZ(__x__)		__builtin_ctz(__x__)
 #	ifdef DO_NOT_FORCE_UNREACHABLE
 #		define UNREACHABLE()	UNREACHABLE_FATAL_ERROR()
 #	else
@@ -142,10 +191,40 @@ extern void UNREACHABLE_FATAL_ERROR ( void );
 #	define UNLIKELY(__x__)	(__x__)
 #	define INLINE		inline
 #	define UNREACHABLE()	UNREACHABLE_FATAL_ERROR()
+// count trailing zeros, of a non-zero value
+static inline int CTZ ( unsigned int x )
+{
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+}
 #endif
 
 #if defined(USE_KVM) && !defined(__linux__)
 #undef USE_KVM
 #endif
 
+#if defined(USE_JIT) && (!defined(__x86_64__) || !defined(__GNUC__) || defined(_WIN32))
+#undef USE_JIT
+#endif
+
+#if defined(CPU_THREADED_DISPATCH) && !defined(__GNUC__)
+#undef CPU_THREADED_DISPATCH
+#endif
+
+#if defined(CPU_INSTRUCTION_FLOW_CACHE) && defined(USE_PREFETCH_QUEUE)
+#undef CPU_INSTRUCTION_FLOW_CACHE
+#endif
+
+#if defined(CPU_INSTRUCTION_FLOW_CACHE) && defined(CPU_ADDR_MODE_CACHE)
+#undef CPU_ADDR_MODE_CACHE
+#endif
+
+#if defined(CPU_SUPERINSTRUCTIONS) && (!defined(CPU_INSTRUCTION_FLOW_CACHE) || !defined(CPU_THREADED_DISPATCH))
+#undef CPU_SUPERINSTRUCTIONS
+#endif
+
 #endif
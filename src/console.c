@@ -36,8 +36,11 @@
 #include "console.h"
 
 #include "disk.h"
+#include "diskcache.h"
 #include "cpu.h"
 #include "input.h"
+#include "snapshot.h"
+#include "profiler.h"
 
 
 #ifdef USE_OSD
@@ -103,7 +106,7 @@ static void waitforcmd ( const char *prompt, char *dst, uint16_t maxlen, const c
 		osd.cursor = 1;
 		console_write(prompt);
 		hijacked_input = 1;
-		while (running) {
+		while (machine_running) {
 			char key = inp_key;
 			inp_key = 0;
 			if (key) {
@@ -131,7 +134,7 @@ static void waitforcmd ( const char *prompt, char *dst, uint16_t maxlen, const c
 	inputptr = 0;
 	maxlen -= 2;
 	dst[0] = 0;
-	while (running) {
+	while (machine_running) {
 		if (_kbhit() ) {
 			uint8_t cc = (uint8_t)_getch();
 			switch (cc) {
@@ -184,7 +187,7 @@ static void hexdump ( uint16_t seg, uint16_t ofs, unsigned int *put_seg, unsigne
 {
 	int skip = ofs & 15;
 	ofs &= 0xFFF0;
-	uint8_t *p = RAM + (seg <<4) + ofs;
+	uint8_t *p = machine_ram + (seg <<4) + ofs;
 	for (int a = 0; a < 0x100; a++) {
 		char ascii[17];
 		if ((a & 15) == 0)
@@ -219,13 +222,25 @@ static inline void consolehelp ( void ) {
 		"  The console is not very robust yet. There are only a few commands:\n\n"
 		"    chdisk drv fn     Attach/remove drive 'drv' (fd0,fd1,hd0,hd1) to image file 'fn' (or - to remove)\n"
 		"    reset             Reset machine\n"
+		"    flush             Write the cached sectors into the disk image files\n"
+		"    diskstat          Show the cache and readahead statistics of the disks\n"
+		"    savestate fn      Save a snapshot of the machine into file 'fn' (see -loadstate)\n"
 		"    dump seg ofs      Show memory dump at seg ofs (ofs is optional). All numbers are in hex\n"
+#ifdef CPU_PROFILER
+		"    prof [reset]      Show (or clear) the execution profile of the CPU\n"
+#endif
 		"    help              This help display.\n"
 		"    quit              Immediately abort emulation and quit Fake86."
 	);
 }
 
 
+static void console_print ( const char *s )
+{
+	console_write(s);
+}
+
+
 static const char parameter_separator_chars[] = "\t\n\r ";
 static const char console_prompt[] = "FAKE86> ";
 #define NEXT_TOKEN()	strtok(NULL, parameter_separator_chars)
@@ -240,7 +255,7 @@ int ConsoleThread ( void *ptr )
 		osd_setcolors(0xFFFFFFFFU, 0x0000FFFFU, 0xFF0000FFU);
 #endif
 	console_writeln("\nFake86 management console\nType \"help\" for a summary of commands.");
-	while (running) {
+	while (machine_running) {
 		static const char dump_cmd_name[] = "dump";
 		waitforcmd(console_prompt, inputline, sizeof(inputline), "close");
 		const char *cmd = strtok(inputline, parameter_separator_chars);
@@ -268,7 +283,7 @@ int ConsoleThread ( void *ptr )
 				continue;
 			}
 			if (strcmpi(fn, "-")) {
-				if (disk[drive].inserted)
+				if (machine_disk[drive].inserted)
 					console_printf("Disk %s (%02Xh) is not inserted yet\n", drivestr, drive);
 				else
 					ejectdisk(drive);
@@ -282,10 +297,31 @@ int ConsoleThread ( void *ptr )
 				CPU_CS, CPU_IP, CPU_SS, CPU_SP, CPU_DS, CPU_ES,
 				CPU_AX, CPU_BX, CPU_CX, CPU_DX, CPU_SI, CPU_DI, CPU_BP
 			);
+#ifdef CPU_PROFILER
+		} else if (!strcmpi(cmd, "prof")) {
+			const char *arg = NEXT_TOKEN();
+			if (arg && !strcmpi(arg, "reset")) {
+				prof_reset();
+				console_writeln("Profile data cleared.");
+			} else
+				prof_report(console_print);
+#endif
+		} else if (!strcmpi(cmd, "flush")) {
+			diskcache_flush_all();
+			console_writeln("Disk caches have been flushed.");
+		} else if (!strcmpi(cmd, "diskstat")) {
+			diskcache_report(console_print);
+		} else if (!strcmpi(cmd, "savestate")) {
+			const char *fn = NEXT_TOKEN();
+			if (!fn || NEXT_TOKEN()) {
+				console_writeln("Bad usage, one parameter needed, the file name");
+				continue;
+			}
+			snapshot_request(fn);
 		} else if (!strcmpi(cmd, "help")) {
 			consolehelp();
 		} else if (!strcmpi(cmd, "quit")) {
-			running = 0;
+			machine_running = 0;
 		} else if (!strcmpi(cmd, "close")) {
 			console_writeln("Closing management console on request (or cannot read from console).");
 			break;
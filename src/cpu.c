@@ -23,10 +23,10 @@
  * Fake86. */
 
 #include "config.h"
-#ifndef CPU_INSTRUCTION_FLOW_CACHE
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "cpu.h"
 
@@ -38,11 +38,29 @@
 #include "timing.h"
 #include "parsecl.h"
 #include "bios.h"
+#include "fanout.h"
+#include "profiler.h"
 
 #ifdef NETWORKING_ENABLED
 #include "netcard.h"
 #endif
 
+#ifdef USE_JIT
+#include "jit.h"
+#define JIT_ENTRY()	(machine->jit && jit_is_entry(machine_cpu.segregs[regcs], machine_cpu.ip))
+#else
+#define JIT_ENTRY()	0
+#endif
+
+// Reaching F000:E066 means the BIOS has been restarted, didbootstrap is
+// cleared then. With the flow cache, its decoder takes care of it, as it
+// never caches the instruction there.
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+#define BIOS_ENTRY_POINT()	0
+#else
+#define BIOS_ENTRY_POINT()	((machine_cpu.ip == 0xE066) && (machine_cpu.segregs[regcs] == 0xF000))
+#endif
+
 #ifdef CPU_ADDR_MODE_CACHE
 struct addrmodecache_s addrcache[0x100000];
 uint8_t addrcachevalid[0x100000];
@@ -55,6 +73,87 @@ uint64_t cached_access_count = 0, uncached_access_count = 0;
 
 static uint8_t byteregtable[8] = {regal, regcl, regdl, regbl, regah, regch, regdh, regbh};
 
+/* Clock cycles of the instructions on an 8088, for exec86_cycles(). It is
+ * the cost of the register form of the instruction (and the not taken case
+ * of the conditional jumps), cycles_mem[] is added to it for the memory
+ * forms together with the effective address calculation. The word memory
+ * transfers include the 4 extra cycles of the 8 bit bus. The prefixes cost
+ * 2 cycles each. A REP string instruction is dispatched for each iteration,
+ * so it is charged (with its prefixes) for each element. The NEC V20 only opcodes (60-6F, C0, C1, C8, C9) are given their
+ * V20 timings. */
+static const uint8_t cycles_base[0x100] = {
+	/* 00 */  3,  3,  3,  3,  4,  4, 14, 12,  3,  3,  3,  3,  4,  4, 14, 12,
+	/* 10 */  3,  3,  3,  3,  4,  4, 14, 12,  3,  3,  3,  3,  4,  4, 14, 12,
+	/* 20 */  3,  3,  3,  3,  4,  4,  2,  4,  3,  3,  3,  3,  4,  4,  2,  4,
+	/* 30 */  3,  3,  3,  3,  4,  4,  2,  8,  3,  3,  3,  3,  4,  4,  2,  8,
+	/* 40 */  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,
+	/* 50 */ 15, 15, 15, 15, 15, 15, 15, 15, 12, 12, 12, 12, 12, 12, 12, 12,
+	/* 60 */ 67, 75, 33,  2,  2,  2,  2,  2, 14, 30, 14, 30, 14, 18, 14, 18,
+	/* 70 */  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,
+	/* 80 */  4,  4,  4,  4,  3,  3,  4,  4,  2,  2,  2,  2,  2,  2,  2, 12,
+	/* 90 */  3,  3,  3,  3,  3,  3,  3,  3,  2,  5, 36,  4, 14, 12,  4,  4,
+	/* A0 */ 10, 14, 10, 14, 18, 26, 22, 30,  4,  4, 11, 15, 12, 16, 15, 19,
+	/* B0 */  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,
+	/* C0 */  5,  5, 24, 20,  2,  2,  4,  4, 15,  8, 33, 34, 72, 71,  4, 44,
+	/* D0 */  2,  2,  8,  8, 83, 60,  3, 11,  2,  2,  2,  2,  2,  2,  2,  2,
+	/* E0 */  5,  6,  5,  6, 10, 14, 10, 14, 23, 15, 15, 15,  8, 12,  8, 12,
+	/* F0 */  2,  2,  2,  2,  2,  2,  3,  3,  2,  2,  2,  2,  2,  2,  3,  3
+};
+
+static const uint8_t cycles_mem[0x100] = {
+	/* 00 */ 13, 21,  6, 10,  0,  0,  0,  0, 13, 21,  6, 10,  0,  0,  0,  0,
+	/* 10 */ 13, 21,  6, 10,  0,  0,  0,  0, 13, 21,  6, 10,  0,  0,  0,  0,
+	/* 20 */ 13, 21,  6, 10,  0,  0,  0,  0, 13, 21,  6, 10,  0,  0,  0,  0,
+	/* 30 */ 13, 21,  6, 10,  0,  0,  0,  0,  6, 10,  6, 10,  0,  0,  0,  0,
+	/* 40 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 50 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 60 */  0,  0,  0,  0,  0,  0,  0,  0,  0, 10,  0, 10,  0,  0,  0,  0,
+	/* 70 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 80 */ 13, 21, 13, 21,  6, 10, 13, 21,  7, 11,  6, 10, 11,  0, 10, 13,
+	/* 90 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* A0 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* B0 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* C0 */ 12, 20,  0,  0, 22, 22,  6, 10,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* D0 */ 13, 21, 12, 20,  0,  0,  0,  0,  6,  6,  6,  6,  6,  6,  6,  6,
+	/* E0 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* F0 */  0,  0,  0,  0,  0,  0, 13, 21,  0,  0,  0,  0,  0,  0, 13, 21
+};
+
+// Effective address calculation, indexed by mode << 3 | rm
+static const uint8_t cycles_ea[0x20] = {
+	 7,  8,  8,  7,  5,  5,  6,  5,		// [BX+SI] [BX+DI] [BP+SI] [BP+DI] [SI] [DI] [disp16] [BX]
+	11, 12, 12, 11,  9,  9,  9,  9,		// the same + disp8
+	11, 12, 12, 11,  9,  9,  9,  9,		// the same + disp16
+	 0,  0,  0,  0,  0,  0,  0,  0		// register operand
+};
+
+// The reg field dependent part of the F6/F7 (TEST/NOT/NEG/MUL/IMUL/DIV/IDIV) and FF groups
+static const uint8_t cycles_grp3_8[8]  = { 2, 2, 0, 0,  67,  86,  82, 104 };
+static const uint8_t cycles_grp3_16[8] = { 2, 2, 0, 0, 115, 135, 150, 172 };
+static const uint8_t cycles_grp5[8]    = { 0, 0, 21, 50, 8, 21, 12, 0 };
+
+#define CYCLES_HALTED		4	// charged for each wakeup in HLT state, besides the time waited
+
+// Cycles of a whole instruction (without the prefixes and the taken branch
+// extras), for the users outside of exec86() which do not go through modregrm()
+unsigned int cpu_insn_cycles(uint8_t opcode, uint8_t mode, uint8_t reg, uint8_t rm) {
+	unsigned int cycles = cycles_base[opcode];
+	if (mode != 3)
+		cycles += cycles_mem[opcode] + cycles_ea[(mode << 3) | rm];
+	if (opcode == 0xF6)
+		cycles += cycles_grp3_8[reg];
+	else if (opcode == 0xF7)
+		cycles += cycles_grp3_16[reg];
+	else if (opcode == 0xFF)
+		cycles += cycles_grp5[reg];
+	return cycles;
+}
+
+#define JUMP_SHORT(rel)	do { \
+	machine_cpu.ip += (rel); \
+	totalcycles += CYCLES_SHORT_JUMP_TAKEN; \
+} while (0)
+
 static const uint8_t parity[0x100] = {
 	1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1,
 	1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
@@ -69,81 +168,148 @@ static const uint8_t parity[0x100] = {
 	1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
 };
 
-#ifdef USE_KVM
-uint8_t *RAM;
-#else
-uint8_t RAM[RAM_SIZE];
-#endif
-
-
-struct cpu cpu;
-
-
-uint8_t readonly[RAM_SIZE];
 //static uint8_t hltstate = 0;
 //static uint8_t /*opcode,*/ cpu.segoverride /*, reptype */;
 //uint16_t cpu.segregs[4];
 //static uint16_t cpu.savecs, cpu.saveip, ip, cpu.useseg;
 //uint8_t cf, zf;
 //static uint8_t pf, af, sf, tf, ifl, df, of;
-static uint8_t mode, reg, rm;
-static uint16_t oper1, oper2, res16, disp16, stacksize, frametemp;
-static uint8_t oper1b, oper2b, res8, nestlev, addrbyte;
+// Decoder and ALU temporaries, only live within a single instruction, thus
+// they belong to the host thread rather than to a machine.
+static _Thread_local uint8_t mode, reg, rm;
+static _Thread_local uint16_t oper1, oper2, res16, disp16, stacksize, frametemp;
+static _Thread_local uint8_t oper1b, oper2b, res8, nestlev, addrbyte;
 //static uint8_t disp8;	// this seems not to be used ever, just setting it ...
 //static uint8_t temp8;
 //static uint32_t *temp1, temp2, temp3, tempaddr32;
-static uint32_t ea;
+static _Thread_local uint32_t ea;
 //static uint32_t temp4, temp5, temp32;
 //static int32_t result;
-uint64_t totalexec;
-
 union _bytewordregs_ regs;
 
-uint8_t running = 0;
-static uint8_t /*verbose,*/ didbootstrap = 0;
+#define didbootstrap	(machine->didbootstrap)
+
+// The BIOS data area hack of mem_read_checked() depends on didbootstrap,
+// so page 0 is remapped when it changes
+static void set_didbootstrap(uint8_t value) {
+	if (didbootstrap != value) {
+		didbootstrap = value;
+		cpu_mem_remap();
+	}
+}
 //static uint8_t debugmode, showcsip, /*verbose,*/ mouseemu;
 //uint8_t ethif;
 
 static void intcall86(uint8_t intnum);
 
-#define StepIP(x)		cpu.ip += (x)
+#define StepIP(x)		machine_cpu.ip += (x)
 #define getmem8(x, y)		read86(segbase(x) + (y))
 #define getmem16(x, y)		readw86(segbase(x) + (y))
 #define putmem8(x, y, z)	write86(segbase(x) + (y), (z))
 #define putmem16(x, y, z)	writew86(segbase(x) + (y), (z))
 #define signext(value)		(int16_t)(int8_t)(value)
 #define signext32(value)	(int32_t)(int16_t)(value)
-#define getsegreg(regid)	cpu.segregs[regid]
-#define putsegreg(regid, wv)    cpu.segregs[regid] = (wv)
+#define getsegreg(regid)	machine_cpu.segregs[regid]
+#define putsegreg(regid, wv)    machine_cpu.segregs[regid] = (wv)
 #define segbase(x)		((uint32_t)(x) << 4)
 
-#define getreg16(regid)                 cpu.regs.wordregs[regid]
-#define getreg8(regid)                  cpu.regs.byteregs[byteregtable[regid]]
-#define setreg16(regid, writeval)       cpu.regs.wordregs[regid] = (writeval)
-#define setreg8(regid, writeval)        cpu.regs.byteregs[byteregtable[regid]] = (writeval)
+#define getreg16(regid)                 machine_cpu.regs.wordregs[regid]
+#define getreg8(regid)                  machine_cpu.regs.byteregs[byteregtable[regid]]
+#define setreg16(regid, writeval)       machine_cpu.regs.wordregs[regid] = (writeval)
+#define setreg8(regid, writeval)        machine_cpu.regs.byteregs[byteregtable[regid]] = (writeval)
+
+
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+/* Instruction flow cache: basic blocks of predecoded instructions, keyed
+ * by the linear address (and CS:IP) of their first instruction. Blocks are
+ * recorded while being executed the first time: every byte fetched from
+ * the instruction stream (prefixes, opcode, ModR/M, displacement,
+ * immediates) is stored into the current entry, together with the decoded
+ * prefix state and ModR/M fields. Later executions take everything from
+ * the cache without touching read86() or decoding anything again.
+ * Every cached code byte is marked in flowcache_codemap[], writes to pages
+ * with cached code take the checked path of write86() which tests that map,
+ * and a write to a cached code byte invalidates the whole 4K page by bumping
+ * its generation counter. */
+#define FLOWCACHE_NOSEG		0xFF
+
+#define FC_DECODED		1
+#define FC_MODRM		2
+#define FC_SETDISP		4
+#define FC_FORCESS		8
+
+// the cache itself is per machine, see struct flowcache in cpu.h
+#define flowcache_blocks	(machine->flowcache.blocks)
+#define flowcache_codemap	(machine->flowcache.codemap)
+#define flowcache_pagegen	(machine->flowcache.pagegen)
+#define flowcache_epoch		(machine->flowcache.epoch)
+#define flowcache_dummy		(machine->flowcache.dummy)
+#define fc_block		(machine->flowcache.block)
+#define fc_insn			(machine->flowcache.insn)
+#define fc_epoch		(machine->flowcache.block_epoch)
+
+static void flowcache_invalidate_page(unsigned int page) {
+	flowcache_pagegen[page]++;
+	flowcache_epoch++;
+	flowcache_invalidations++;
+	memset(flowcache_codemap + (page << 9), 0, 1 << 9);
+	cpu_mem_uncode_page(page, MEM_CODE_FLOWCACHE);
+}
 
+void cpu_flowcache_invalidate(uint32_t addr32, uint32_t len) {
+	if (!len)
+		return;
+	const unsigned int first = (addr32 & 0xFFFFF) >> 12;
+	const unsigned int last = ((addr32 + len - 1) & 0xFFFFF) >> 12;
+	for (unsigned int page = first;; page = (page + 1) & 0xFF) {
+		flowcache_invalidate_page(page);
+		if (page == last)
+			break;
+	}
+}
+
+static void flowcache_flush(void) {
+	for (unsigned int page = 0; page < (RAM_SIZE >> 12); page++)
+		flowcache_invalidate_page(page);
+	fc_block = NULL;
+	fc_insn = &flowcache_dummy;
+}
 
-void write86(uint32_t addr32, uint8_t value) {
-	uint32_t tempaddr32 = addr32 & 0xFFFFF;
-#ifdef CPU_ADDR_MODE_CACHE
-	if (!readonly[tempaddr32])
-		addrcachevalid[tempaddr32] = 0;
 #endif
-	if (readonly[tempaddr32] || (tempaddr32 >= 0xC0000)) {
+
+/* Memory access goes through a table of 4K page descriptors. Plain RAM and
+ * ROM pages are read directly through a host pointer, plain RAM pages are
+ * written the same way. Everything else -- the VGA window in the graphics
+ * modes, ROM (writes are dropped), pages with cached or translated code
+ * (writes must be checked against the code maps), partially read-only pages
+ * and the BIOS data area while the bootstrap hack below is active -- is
+ * handled by the "checked" functions, which implement the full rules.
+ * The table is rebuilt by cpu_mem_remap() on reset and on video mode change. */
+
+static void mem_write_checked(uint32_t addr32, uint8_t value) {
+	if (machine_readonly[addr32] || (addr32 >= 0xC0000)) {
 		return;
 	}
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	if (UNLIKELY(flowcache_codemap[addr32 >> 3] & (1 << (addr32 & 7))))
+		flowcache_invalidate_page(addr32 >> 12);
+#endif
+#ifdef USE_JIT
+	if (machine->jit && UNLIKELY(jit_codemap[addr32 >> 3] & (1 << (addr32 & 7))))
+		jit_invalidate_page(addr32 >> 12);
+#endif
 
-	if ((tempaddr32 >= 0xA0000) && (tempaddr32 <= 0xBFFFF)) {
+	if ((addr32 >= 0xA0000) && (addr32 <= 0xBFFFF)) {
 		if ((vidmode != 0x13) && (vidmode != 0x12) &&
 		    (vidmode != 0xD) && (vidmode != 0x10)) {
-			RAM[tempaddr32] = value;
+			machine_ram[addr32] = value;
 			updatedscreen = 1;
 		} else if (((VGA_SC[4] & 6) == 0) && (vidmode != 0xD) &&
 			   (vidmode != 0x10) && (vidmode != 0x12)) {
-			RAM[tempaddr32] = value;
+			machine_ram[addr32] = value;
 			updatedscreen = 1;
 		} else {
-			writeVGA(tempaddr32 - 0xA0000, value);
+			writeVGA(addr32 - 0xA0000, value);
 		}
 
 		updatedscreen = 1;
@@ -152,67 +318,496 @@ void write86(uint32_t addr32, uint8_t value) {
 		if ((addr32 & 0xFFF00) == 0x400)
 			printf("DEBUG: CPU accesses (WRITE) BDA at %Xh, value it writes: %Xh\n", addr32, value);
 #endif
-		RAM[tempaddr32] = value;
+		machine_ram[addr32] = value;
 	}
 }
 
-static inline void writew86(uint32_t addr32, uint16_t value) {
-	write86(addr32, (uint8_t)value);
-	write86(addr32 + 1, (uint8_t)(value >> 8));
-}
-
-uint8_t read86(uint32_t addr32) {
-	addr32 &= 0xFFFFF;
+static uint8_t mem_read_checked(uint32_t addr32) {
 	if ((addr32 >= 0xA0000) && (addr32 <= 0xBFFFF)) {
 		if ((vidmode == 0xD) || (vidmode == 0xE) || (vidmode == 0x10) ||
 		    (vidmode == 0x12))
 			return readVGA(addr32 - 0xA0000);
 		if ((vidmode != 0x13) && (vidmode != 0x12) && (vidmode != 0xD))
-			return RAM[addr32];
+			return machine_ram[addr32];
 		if ((VGA_SC[4] & 6) == 0)
-			return RAM[addr32];
+			return machine_ram[addr32];
 		else
 			return readVGA(addr32 - 0xA0000);
 	}
 #ifdef DEBUG_BIOS_DATA_AREA_CPU_ACCESS
 	if ((addr32 & 0xFFF00) == 0x400)
-		printf("DEBUG: CPU accesses (READ) BDA at %Xh, value there: %Xh\n", addr32, RAM[addr32]);
+		printf("DEBUG: CPU accesses (READ) BDA at %Xh, value there: %Xh\n", addr32, machine_ram[addr32]);
 #endif
 	if (!didbootstrap && !internalbios) {
-		RAM[0x410] = 0x41; // ugly hack to make BIOS always believe we
+		machine_ram[0x410] = 0x41; // ugly hack to make BIOS always believe we
 				   // have an EGA/VGA card installed
-		RAM[0x475] = hdcount; // the BIOS doesn't have any concept of
+		machine_ram[0x475] = hdcount; // the BIOS doesn't have any concept of
 				      // hard drives, so here's another hack
 	}
-	return RAM[addr32];
+	return machine_ram[addr32];
+}
+
+// Sets the direct write pointer of a page according to its current state
+static void mem_page_update_write(unsigned int page) {
+	struct mem_page *p = &mem_pages[page];
+	p->write = (p->flags & (MEM_PAGE_READONLY | MEM_PAGE_CHECKED)) || p->code ? NULL : machine_ram;
+}
+
+void cpu_mem_remap(void) {
+	for (unsigned int page = 0; page < (RAM_SIZE >> 12); page++) {
+		struct mem_page *p = &mem_pages[page];
+		const uint32_t base = page << 12;
+		int ro = 0;
+		for (unsigned int a = 0; a < 0x1000; a++)
+			ro += machine_readonly[base + a];
+		p->read = machine_ram;
+		p->read_handler = mem_read_checked;
+		p->write_handler = mem_write_checked;
+		if (base >= 0xC0000 || ro == 0x1000)
+			p->flags = MEM_PAGE_READONLY;
+		else if (ro)
+			p->flags = MEM_PAGE_CHECKED;	// only some bytes are read-only
+		else
+			p->flags = 0;
+		if (base >= 0xA0000 && base < 0xC0000) {
+			// writes always set updatedscreen, reads are planar in EGA/VGA modes
+			if (!p->flags && (vidmode != 0x13) && (vidmode != 0x12) &&
+			    (vidmode != 0xD) && (vidmode != 0x10))
+				p->flags = MEM_PAGE_VIDEO;
+			p->flags |= MEM_PAGE_CHECKED;
+			if ((vidmode == 0xD) || (vidmode == 0xE) || (vidmode == 0x10) ||
+			    (vidmode == 0x12) || (vidmode == 0x13))
+				p->read = NULL;
+		}
+		mem_page_update_write(page);
+	}
+	if (!didbootstrap && !internalbios)
+		mem_pages[0].read = NULL;	// the BDA hack in mem_read_checked()
+#ifdef DEBUG_BIOS_DATA_AREA_CPU_ACCESS
+	mem_pages[0].read = NULL;
+	mem_pages[0].flags |= MEM_PAGE_CHECKED;
+	mem_page_update_write(0);
+#endif
+}
+
+// Cached/translated code on the page: every write must be checked against the code maps
+void cpu_mem_code_page(unsigned int page, uint8_t owner) {
+	mem_pages[page].code |= owner;
+	mem_pages[page].write = NULL;
+}
+
+void cpu_mem_uncode_page(unsigned int page, uint8_t owner) {
+	mem_pages[page].code &= ~owner;
+	mem_page_update_write(page);
+}
+
+void write86(uint32_t addr32, uint8_t value) {
+	addr32 &= 0xFFFFF;
+	const struct mem_page *p = &mem_pages[addr32 >> 12];
+#ifdef CPU_ADDR_MODE_CACHE
+	if (!machine_readonly[addr32])
+		addrcachevalid[addr32] = 0;
+#endif
+	if (LIKELY(p->write))
+		p->write[addr32] = value;
+	else if (!(p->flags & MEM_PAGE_READONLY))
+		p->write_handler(addr32, value);
+}
+
+// Word accesses within a page take a single descriptor lookup (this covers
+// every aligned one), only the ones crossing a page boundary go bytewise.
+void writew86(uint32_t addr32, uint16_t value) {
+	addr32 &= 0xFFFFF;
+	const struct mem_page *p = &mem_pages[addr32 >> 12];
+	if (LIKELY(p->write && (addr32 & 0xFFF) != 0xFFF)) {
+#ifdef CPU_ADDR_MODE_CACHE
+		addrcachevalid[addr32] = addrcachevalid[addr32 + 1] = 0;
+#endif
+		p->write[addr32] = (uint8_t)value;
+		p->write[addr32 + 1] = value >> 8;
+		return;
+	}
+	write86(addr32, (uint8_t)value);
+	write86(addr32 + 1, (uint8_t)(value >> 8));
+}
+
+// Block copies between the host memory and the guest memory at a linear
+// address (wrapping at 1M), with the same effect as write86()/read86() byte
+// by byte, but copying directly on the pages which allow it (see mem_pages[])
+void cpu_mem_write_block(uint32_t addr32, const uint8_t *src, uint32_t len) {
+	while (len) {
+		addr32 &= 0xFFFFF;
+		uint32_t n = 0x1000 - (addr32 & 0xFFF);
+		if (n > len)
+			n = len;
+		const struct mem_page *p = &mem_pages[addr32 >> 12];
+		if (p->write) {
+			memcpy(p->write + addr32, src, n);
+#ifdef CPU_ADDR_MODE_CACHE
+			memset(addrcachevalid + addr32, 0, n);
+#endif
+		} else {
+			for (uint32_t i = 0; i < n; i++)
+				write86(addr32 + i, src[i]);
+		}
+		addr32 += n;
+		src += n;
+		len -= n;
+	}
 }
 
-static inline uint16_t readw86(uint32_t addr32) {
+void cpu_mem_read_block(uint32_t addr32, uint8_t *dst, uint32_t len) {
+	while (len) {
+		addr32 &= 0xFFFFF;
+		uint32_t n = 0x1000 - (addr32 & 0xFFF);
+		if (n > len)
+			n = len;
+		const struct mem_page *p = &mem_pages[addr32 >> 12];
+		if (p->read) {
+			memcpy(dst, p->read + addr32, n);
+		} else {
+			for (uint32_t i = 0; i < n; i++)
+				dst[i] = read86(addr32 + i);
+		}
+		addr32 += n;
+		dst += n;
+		len -= n;
+	}
+}
+
+uint8_t read86(uint32_t addr32) {
+	addr32 &= 0xFFFFF;
+	const struct mem_page *p = &mem_pages[addr32 >> 12];
+	if (LIKELY(p->read))
+		return p->read[addr32];
+	return p->read_handler(addr32);
+}
+
+uint16_t readw86(uint32_t addr32) {
+	addr32 &= 0xFFFFF;
+	const struct mem_page *p = &mem_pages[addr32 >> 12];
+	if (LIKELY(p->read && (addr32 & 0xFFF) != 0xFFF))
+		return (uint16_t)p->read[addr32] | (uint16_t)(p->read[addr32 + 1] << 8);
 	return (uint16_t)read86(addr32) | (uint16_t)(read86(addr32 + 1) << 8);
 }
 
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+static INLINE int flowcache_block_valid(const struct flowcache_block *b) {
+	return b->gen0 == flowcache_pagegen[b->page] && b->gen1 == flowcache_pagegen[(b->page + 1) & 0xFF];
+}
+
+static struct flowcache_insn *flowcache_lookup_slow(struct flowcache_insn *prev) {
+	const uint32_t linear = (segbase(machine_cpu.segregs[regcs]) + machine_cpu.ip) & 0xFFFFF;
+	if ((linear >= 0xA0000) && (linear < 0xC0000)) {
+		fc_block = NULL;
+		return fc_insn = &flowcache_dummy;
+	}
+	if ((machine_cpu.segregs[regcs] == 0xF000) && (machine_cpu.ip == 0xE066)) {
+		// the BIOS entry point: we've rebooted, never cached, so it's
+		// detected every time, without any check on the fast paths
+		set_didbootstrap(0);
+		fc_block = NULL;
+		return fc_insn = &flowcache_dummy;
+	}
+	struct flowcache_block *b = &flowcache_blocks[(linear * 2654435761U) >> (32 - FLOWCACHE_BLOCKS_BITS)];
+	if (b->count && b->cs == machine_cpu.segregs[regcs] && b->insn[0].ip == machine_cpu.ip && flowcache_block_valid(b)) {
+		flowcache_hits++;
+	} else {
+		flowcache_misses++;
+		b->cs = machine_cpu.segregs[regcs];
+		b->page = linear >> 12;
+		b->gen0 = flowcache_pagegen[b->page];
+		b->gen1 = flowcache_pagegen[(b->page + 1) & 0xFF];
+		b->count = 1;
+		b->insn[0].ip = machine_cpu.ip;
+		b->insn[0].len = 0;
+		b->insn[0].flags = 0;
+		b->insn[0].link = NULL;
+	}
+	if (prev)
+		prev->link = b;
+	fc_block = b;
+	fc_epoch = flowcache_epoch;
+	return fc_insn = b->insn;
+}
+
+// Finds (or starts recording) the cache entry for the instruction at CS:IP.
+// Most of the time, it's the next one in the current block, the same one
+// again (REP string instructions), or where the previous instruction jumped
+// to the last time as well (loops, calls, returns).
+static INLINE struct flowcache_insn *flowcache_lookup(void) {
+	struct flowcache_block *b = fc_block;
+	struct flowcache_insn *in = fc_insn;
+	if (UNLIKELY(b == NULL))
+		return flowcache_lookup_slow(NULL);
+	if (UNLIKELY(fc_epoch != flowcache_epoch)) {
+		if (!flowcache_block_valid(b))
+			return flowcache_lookup_slow(NULL);
+		fc_epoch = flowcache_epoch;
+	}
+	if (LIKELY(b->cs == machine_cpu.segregs[regcs])) {
+		if (in + 1 < b->insn + b->count) {
+			if (LIKELY(in[1].ip == machine_cpu.ip))
+				return fc_insn = in + 1;
+		} else if (machine_cpu.ip == (uint16_t)(in->ip + in->len) && machine_cpu.ip > in->ip &&
+			   b->count < FLOWCACHE_BLOCK_INSNS && (in->flags & FC_DECODED) &&
+			   ((segbase(b->cs) + machine_cpu.ip) & 0xFFFFF) >> 12 == b->page &&
+			   !((b->cs == 0xF000) && (machine_cpu.ip == 0xE066))) {
+			// sequential execution at the end of the block: extend it
+			in++;
+			in->ip = machine_cpu.ip;
+			in->len = 0;
+			in->flags = 0;
+			in->link = NULL;
+			b->count++;
+			return fc_insn = in;
+		}
+		if (in->ip == machine_cpu.ip)
+			return in;
+	}
+	b = in->link;
+	if (b && b->cs == machine_cpu.segregs[regcs] && b->insn[0].ip == machine_cpu.ip && flowcache_block_valid(b)) {
+		fc_block = b;
+		return fc_insn = b->insn;
+	}
+	return flowcache_lookup_slow(in);
+}
+
+// Instruction stream fetch which is not (yet) in the cache: read it from the
+// memory, and append to the current entry if it's the next byte of it.
+static uint8_t flowcache_fetch_slow(uint16_t ip) {
+	const uint32_t addr32 = segbase(machine_cpu.segregs[regcs]) + ip;
+	const uint8_t data = read86(addr32);
+	struct flowcache_insn *in = fc_insn;
+	const uint32_t linear = addr32 & 0xFFFFF;
+	if (fc_block && (uint16_t)(ip - in->ip) == in->len && ip >= in->ip &&
+	    in->len < FLOWCACHE_INSN_BYTES && machine_cpu.segregs[regcs] == fc_block->cs &&
+	    ((linear < 0xA0000) || (linear >= 0xC0000))) {
+		in->bytes[in->len++] = data;
+		flowcache_codemap[linear >> 3] |= 1 << (linear & 7);
+		if (!(mem_pages[linear >> 12].code & MEM_CODE_FLOWCACHE))
+			cpu_mem_code_page(linear >> 12, MEM_CODE_FLOWCACHE);
+	}
+	return data;
+}
+
+static INLINE uint8_t getcode8(void) {
+	const uint16_t ofs = machine_cpu.ip - fc_insn->ip;
+	if (LIKELY(ofs < fc_insn->len))
+		return fc_insn->bytes[ofs];
+	return flowcache_fetch_slow(machine_cpu.ip);
+}
+
+static INLINE uint16_t getcode16(void) {
+	const uint16_t ofs = machine_cpu.ip - fc_insn->ip;
+	if (LIKELY(ofs + 1 < fc_insn->len))
+		return fc_insn->bytes[ofs] | (fc_insn->bytes[ofs + 1] << 8);
+	if (UNLIKELY(machine_cpu.ip == 0xFFFF))	// do not record bytes wrapping around the segment
+		return getmem16(machine_cpu.segregs[regcs], machine_cpu.ip);
+	const uint8_t lo = flowcache_fetch_slow(machine_cpu.ip);
+	return lo | (flowcache_fetch_slow(machine_cpu.ip + 1) << 8);
+}
+
+static uint8_t flowcache_decode_slow(int *reptype) {
+	struct flowcache_insn *in = fc_insn;
+	uint8_t opcode, segov = FLOWCACHE_NOSEG, prefixes = 0;
+	for (;;) {
+		machine_cpu.savecs = machine_cpu.segregs[regcs];
+		machine_cpu.saveip = machine_cpu.ip;
+		opcode = getcode8();
+		StepIP(1);
+		switch (opcode) {
+			case 0x2E: segov = regcs; break;
+			case 0x3E: segov = regds; break;
+			case 0x26: segov = reges; break;
+			case 0x36: segov = regss; break;
+			case 0xF3: *reptype = 1; break;
+			case 0xF2: *reptype = 2; break;
+			default:
+				if (segov != FLOWCACHE_NOSEG) {
+					machine_cpu.useseg = machine_cpu.segregs[segov];
+					machine_cpu.segoverride = 1;
+				}
+				if (in->len > prefixes) {
+					in->opcode = opcode;
+					in->prefixes = prefixes;
+					in->reptype = *reptype;
+					in->segov = segov;
+					in->flags = FC_DECODED;
+				}
+				return opcode;
+		}
+		prefixes++;
+	}
+}
+
+// Returns the opcode of the instruction at CS:IP with the prefixes already
+// applied, and IP pointing after the opcode byte, as the fetch loop would do.
+static INLINE uint8_t flowcache_decode(int *reptype) {
+	const struct flowcache_insn *in = flowcache_lookup();
+	if (LIKELY(in->flags & FC_DECODED)) {
+		*reptype = in->reptype;
+		if (in->segov != FLOWCACHE_NOSEG) {
+			machine_cpu.useseg = machine_cpu.segregs[in->segov];
+			machine_cpu.segoverride = 1;
+		}
+		machine_cpu.savecs = machine_cpu.segregs[regcs];
+		machine_cpu.saveip = machine_cpu.ip + in->prefixes;
+		machine_cpu.ip = machine_cpu.saveip + 1;
+		return in->opcode;
+	}
+	return flowcache_decode_slow(reptype);
+}
+#else
+#define getcode8()		getmem8(machine_cpu.segregs[regcs], machine_cpu.ip)
+#define getcode16()		getmem16(machine_cpu.segregs[regcs], machine_cpu.ip)
+#endif
+
 static inline void flag_szp8(uint8_t value) {
-	cpu.zf = value ? 0 : 1;
-	cpu.sf = value >> 7;
-	cpu.pf = parity[value];
+	machine_cpu.zf = value ? 0 : 1;
+	machine_cpu.sf = value >> 7;
+	machine_cpu.pf = parity[value];
 }
 
 static inline void flag_szp16(uint16_t value) {
-	cpu.zf = value ? 0 : 1;
-	cpu.sf = value >> 15;
-	cpu.pf = parity[value & 255];
+	machine_cpu.zf = value ? 0 : 1;
+	machine_cpu.sf = value >> 15;
+	machine_cpu.pf = parity[value & 255];
+}
+
+#ifdef CPU_LAZY_FLAGS
+#define LAZY_ADD	1
+#define LAZY_SUB	2
+#define LAZY_LOG	3
+#define LAZY_WORD	4	/* or'ed to the kind for 16 bit operations */
+
+static inline uint16_t lazy_signbit(void) {
+	return (machine_cpu.lazyflags & LAZY_WORD) ? 0x8000 : 0x80;
+}
+
+static inline uint8_t lazy_zf(void) {
+	return !machine_cpu.lazyres;
+}
+
+static inline uint8_t lazy_sf(void) {
+	return (machine_cpu.lazyres & lazy_signbit()) != 0;
+}
+
+static inline uint8_t lazy_pf(void) {
+	return parity[machine_cpu.lazyres & 0xFF];
+}
+
+static inline uint8_t lazy_of(void) {
+	switch (machine_cpu.lazyflags & 3) {
+		case LAZY_ADD:
+			return ((machine_cpu.lazyres ^ machine_cpu.lazydst) & (machine_cpu.lazyres ^ machine_cpu.lazysrc) & lazy_signbit()) != 0;
+		case LAZY_SUB:
+			return ((machine_cpu.lazyres ^ machine_cpu.lazydst) & (machine_cpu.lazydst ^ machine_cpu.lazysrc) & lazy_signbit()) != 0;
+		default:
+			return 0;
+	}
+}
+
+static inline uint8_t lazy_af(void) {
+	if ((machine_cpu.lazyflags & 3) == LAZY_LOG)
+		return machine_cpu.af;	/* logic ops leave AF alone */
+	return ((machine_cpu.lazydst ^ machine_cpu.lazysrc ^ machine_cpu.lazyres) >> 4) & 1;
+}
+
+void cpu_flags_materialize(void) {
+	machine_cpu.zf = lazy_zf();
+	machine_cpu.sf = lazy_sf();
+	machine_cpu.pf = lazy_pf();
+	machine_cpu.of = lazy_of();
+	machine_cpu.af = lazy_af();
+	machine_cpu.lazyflags = 0;
+}
+
+#define FLAG_ZF()	(machine_cpu.lazyflags ? lazy_zf() : machine_cpu.zf)
+#define FLAG_SF()	(machine_cpu.lazyflags ? lazy_sf() : machine_cpu.sf)
+#define FLAG_PF()	(machine_cpu.lazyflags ? lazy_pf() : machine_cpu.pf)
+#define FLAG_OF()	(machine_cpu.lazyflags ? lazy_of() : machine_cpu.of)
+
+static inline void flag_lazy(uint8_t kind, uint16_t v1, uint16_t v2, uint16_t res) {
+	machine_cpu.lazyflags = kind;
+	machine_cpu.lazydst = v1;
+	machine_cpu.lazysrc = v2;
+	machine_cpu.lazyres = res;
+}
+
+static inline void flag_log8(uint8_t value) {
+	if (machine_cpu.lazyflags)
+		machine_cpu.af = lazy_af();	/* AF survives a logic op, keep the pending one */
+	machine_cpu.cf = 0;
+	flag_lazy(LAZY_LOG, 0, 0, value);
+}
+
+static inline void flag_log16(uint16_t value) {
+	if (machine_cpu.lazyflags)
+		machine_cpu.af = lazy_af();
+	machine_cpu.cf = 0;
+	flag_lazy(LAZY_LOG | LAZY_WORD, 0, 0, value);
+}
+
+static inline void flag_adc8(uint8_t v1, uint8_t v2, uint8_t v3) {
+	/* v1 = destination operand, v2 = source operand, v3 = carry flag */
+	const uint16_t dst = (uint16_t)v1 + (uint16_t)v2 + (uint16_t)v3;
+	machine_cpu.cf = dst > 0xFF;
+	flag_lazy(LAZY_ADD, v1, v2, dst & 0xFF);
+}
+
+static inline void flag_adc16(uint16_t v1, uint16_t v2, uint16_t v3) {
+	const uint32_t dst = (uint32_t)v1 + (uint32_t)v2 + (uint32_t)v3;
+	machine_cpu.cf = dst > 0xFFFF;
+	flag_lazy(LAZY_ADD | LAZY_WORD, v1, v2, dst & 0xFFFF);
+}
+
+static inline void flag_add8(uint8_t v1, uint8_t v2) {
+	flag_adc8(v1, v2, 0);
+}
+
+static inline void flag_add16(uint16_t v1, uint16_t v2) {
+	flag_adc16(v1, v2, 0);
+}
+
+static inline void flag_sbb8(uint8_t v1, uint8_t v2, uint8_t v3) {
+	/* v1 = destination operand, v2 = source operand, v3 = carry flag */
+	v2 += v3;
+	machine_cpu.cf = v1 < v2;
+	flag_lazy(LAZY_SUB, v1, v2, (uint8_t)(v1 - v2));
+}
+
+static inline void flag_sbb16(uint16_t v1, uint16_t v2, uint16_t v3) {
+	v2 += v3;
+	machine_cpu.cf = v1 < v2;
+	flag_lazy(LAZY_SUB | LAZY_WORD, v1, v2, (uint16_t)(v1 - v2));
+}
+
+static inline void flag_sub8(uint8_t v1, uint8_t v2) {
+	flag_sbb8(v1, v2, 0);
 }
 
+static inline void flag_sub16(uint16_t v1, uint16_t v2) {
+	flag_sbb16(v1, v2, 0);
+}
+
+#else
+
+#define FLAG_ZF()	machine_cpu.zf
+#define FLAG_SF()	machine_cpu.sf
+#define FLAG_PF()	machine_cpu.pf
+#define FLAG_OF()	machine_cpu.of
+
 static inline void flag_log8(uint8_t value) {
 	flag_szp8(value);
-	cpu.cf = 0;
-	cpu.of = 0; /* bitwise logic ops always clear carry and overflow */
+	machine_cpu.cf = 0;
+	machine_cpu.of = 0; /* bitwise logic ops always clear carry and overflow */
 }
 
 static inline void flag_log16(uint16_t value) {
 	flag_szp16(value);
-	cpu.cf = 0;
-	cpu.of = 0; /* bitwise logic ops always clear carry and overflow */
+	machine_cpu.cf = 0;
+	machine_cpu.of = 0; /* bitwise logic ops always clear carry and overflow */
 }
 
 static inline void flag_adc8(uint8_t v1, uint8_t v2, uint8_t v3) {
@@ -223,21 +818,21 @@ static inline void flag_adc8(uint8_t v1, uint8_t v2, uint8_t v3) {
 	dst = (uint16_t)v1 + (uint16_t)v2 + (uint16_t)v3;
 	flag_szp8((uint8_t)dst);
 	if (((dst ^ v1) & (dst ^ v2) & 0x80) == 0x80) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0; /* set or clear overflow flag */
+		machine_cpu.of = 0; /* set or clear overflow flag */
 	}
 
 	if (dst & 0xFF00) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0; /* set or clear carry flag */
+		machine_cpu.cf = 0; /* set or clear carry flag */
 	}
 
 	if (((v1 ^ v2 ^ dst) & 0x10) == 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0; /* set or clear auxilliary flag */
+		machine_cpu.af = 0; /* set or clear auxilliary flag */
 	}
 }
 
@@ -248,21 +843,21 @@ static inline void flag_adc16(uint16_t v1, uint16_t v2, uint16_t v3) {
 	dst = (uint32_t)v1 + (uint32_t)v2 + (uint32_t)v3;
 	flag_szp16((uint16_t)dst);
 	if ((((dst ^ v1) & (dst ^ v2)) & 0x8000) == 0x8000) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if (dst & 0xFFFF0000) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if (((v1 ^ v2 ^ dst) & 0x10) == 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
@@ -273,21 +868,21 @@ static inline void flag_add8(uint8_t v1, uint8_t v2) {
 	dst = (uint16_t)v1 + (uint16_t)v2;
 	flag_szp8((uint8_t)dst);
 	if (dst & 0xFF00) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if (((dst ^ v1) & (dst ^ v2) & 0x80) == 0x80) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if (((v1 ^ v2 ^ dst) & 0x10) == 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
@@ -298,21 +893,21 @@ static inline void flag_add16(uint16_t v1, uint16_t v2) {
 	dst = (uint32_t)v1 + (uint32_t)v2;
 	flag_szp16((uint16_t)dst);
 	if (dst & 0xFFFF0000) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if (((dst ^ v1) & (dst ^ v2) & 0x8000) == 0x8000) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if (((v1 ^ v2 ^ dst) & 0x10) == 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
@@ -325,21 +920,21 @@ static inline void flag_sbb8(uint8_t v1, uint8_t v2, uint8_t v3) {
 	dst = (uint16_t)v1 - (uint16_t)v2;
 	flag_szp8((uint8_t)dst);
 	if (dst & 0xFF00) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if ((dst ^ v1) & (v1 ^ v2) & 0x80) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if ((v1 ^ v2 ^ dst) & 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
@@ -352,21 +947,21 @@ static inline void flag_sbb16(uint16_t v1, uint16_t v2, uint16_t v3) {
 	dst = (uint32_t)v1 - (uint32_t)v2;
 	flag_szp16((uint16_t)dst);
 	if (dst & 0xFFFF0000) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if ((dst ^ v1) & (v1 ^ v2) & 0x8000) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if ((v1 ^ v2 ^ dst) & 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
@@ -378,21 +973,21 @@ static void flag_sub8(uint8_t v1, uint8_t v2) {
 	dst = (uint16_t)v1 - (uint16_t)v2;
 	flag_szp8((uint8_t)dst);
 	if (dst & 0xFF00) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if ((dst ^ v1) & (v1 ^ v2) & 0x80) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if ((v1 ^ v2 ^ dst) & 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
@@ -404,32 +999,34 @@ static void flag_sub16(uint16_t v1, uint16_t v2) {
 	dst = (uint32_t)v1 - (uint32_t)v2;
 	flag_szp16((uint16_t)dst);
 	if (dst & 0xFFFF0000) {
-		cpu.cf = 1;
+		machine_cpu.cf = 1;
 	} else {
-		cpu.cf = 0;
+		machine_cpu.cf = 0;
 	}
 
 	if ((dst ^ v1) & (v1 ^ v2) & 0x8000) {
-		cpu.of = 1;
+		machine_cpu.of = 1;
 	} else {
-		cpu.of = 0;
+		machine_cpu.of = 0;
 	}
 
 	if ((v1 ^ v2 ^ dst) & 0x10) {
-		cpu.af = 1;
+		machine_cpu.af = 1;
 	} else {
-		cpu.af = 0;
+		machine_cpu.af = 0;
 	}
 }
 
+#endif
+
 static inline void op_adc8(void) {
-	res8 = oper1b + oper2b + cpu.cf;
-	flag_adc8(oper1b, oper2b, cpu.cf);
+	res8 = oper1b + oper2b + machine_cpu.cf;
+	flag_adc8(oper1b, oper2b, machine_cpu.cf);
 }
 
 static inline void op_adc16(void) {
-	res16 = oper1 + oper2 + cpu.cf;
-	flag_adc16(oper1, oper2, cpu.cf);
+	res16 = oper1 + oper2 + machine_cpu.cf;
+	flag_adc16(oper1, oper2, machine_cpu.cf);
 }
 
 static inline void op_add8(void) {
@@ -483,13 +1080,13 @@ static inline void op_sub16(void) {
 }
 
 static inline void op_sbb8(void) {
-	res8 = oper1b - (oper2b + cpu.cf);
-	flag_sbb8(oper1b, oper2b, cpu.cf);
+	res8 = oper1b - (oper2b + machine_cpu.cf);
+	flag_sbb8(oper1b, oper2b, machine_cpu.cf);
 }
 
 static inline void op_sbb16(void) {
-	res16 = oper1 - (oper2 + cpu.cf);
-	flag_sbb16(oper1, oper2, cpu.cf);
+	res16 = oper1 - (oper2 + machine_cpu.cf);
+	flag_sbb16(oper1, oper2, machine_cpu.cf);
 }
 
 static inline void getea(uint8_t rmval) {
@@ -500,28 +1097,28 @@ static inline void getea(uint8_t rmval) {
 	case 0:
 		switch (rmval) {
 		case 0:
-			tempea = cpu.regs.wordregs[regbx] + cpu.regs.wordregs[regsi];
+			tempea = machine_cpu.regs.wordregs[regbx] + machine_cpu.regs.wordregs[regsi];
 			break;
 		case 1:
-			tempea = cpu.regs.wordregs[regbx] + cpu.regs.wordregs[regdi];
+			tempea = machine_cpu.regs.wordregs[regbx] + machine_cpu.regs.wordregs[regdi];
 			break;
 		case 2:
-			tempea = cpu.regs.wordregs[regbp] + cpu.regs.wordregs[regsi];
+			tempea = machine_cpu.regs.wordregs[regbp] + machine_cpu.regs.wordregs[regsi];
 			break;
 		case 3:
-			tempea = cpu.regs.wordregs[regbp] + cpu.regs.wordregs[regdi];
+			tempea = machine_cpu.regs.wordregs[regbp] + machine_cpu.regs.wordregs[regdi];
 			break;
 		case 4:
-			tempea = cpu.regs.wordregs[regsi];
+			tempea = machine_cpu.regs.wordregs[regsi];
 			break;
 		case 5:
-			tempea = cpu.regs.wordregs[regdi];
+			tempea = machine_cpu.regs.wordregs[regdi];
 			break;
 		case 6:
 			tempea = disp16;
 			break;
 		case 7:
-			tempea = cpu.regs.wordregs[regbx];
+			tempea = machine_cpu.regs.wordregs[regbx];
 			break;
 		}
 		break;
@@ -530,39 +1127,39 @@ static inline void getea(uint8_t rmval) {
 	case 2:
 		switch (rmval) {
 		case 0:
-			tempea = cpu.regs.wordregs[regbx] + cpu.regs.wordregs[regsi] + disp16;
+			tempea = machine_cpu.regs.wordregs[regbx] + machine_cpu.regs.wordregs[regsi] + disp16;
 			break;
 		case 1:
-			tempea = cpu.regs.wordregs[regbx] + cpu.regs.wordregs[regdi] + disp16;
+			tempea = machine_cpu.regs.wordregs[regbx] + machine_cpu.regs.wordregs[regdi] + disp16;
 			break;
 		case 2:
-			tempea = cpu.regs.wordregs[regbp] + cpu.regs.wordregs[regsi] + disp16;
+			tempea = machine_cpu.regs.wordregs[regbp] + machine_cpu.regs.wordregs[regsi] + disp16;
 			break;
 		case 3:
-			tempea = cpu.regs.wordregs[regbp] + cpu.regs.wordregs[regdi] + disp16;
+			tempea = machine_cpu.regs.wordregs[regbp] + machine_cpu.regs.wordregs[regdi] + disp16;
 			break;
 		case 4:
-			tempea = cpu.regs.wordregs[regsi] + disp16;
+			tempea = machine_cpu.regs.wordregs[regsi] + disp16;
 			break;
 		case 5:
-			tempea = cpu.regs.wordregs[regdi] + disp16;
+			tempea = machine_cpu.regs.wordregs[regdi] + disp16;
 			break;
 		case 6:
-			tempea = cpu.regs.wordregs[regbp] + disp16;
+			tempea = machine_cpu.regs.wordregs[regbp] + disp16;
 			break;
 		case 7:
-			tempea = cpu.regs.wordregs[regbx] + disp16;
+			tempea = machine_cpu.regs.wordregs[regbx] + disp16;
 			break;
 		}
 		break;
 	}
 
-	ea = (tempea & 0xFFFF) + (cpu.useseg << 4);
+	ea = (tempea & 0xFFFF) + (machine_cpu.useseg << 4);
 }
 
 static void push(uint16_t pushval) {
-	cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regsp] - 2;
-	putmem16(cpu.segregs[regss], cpu.regs.wordregs[regsp], pushval);
+	machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regsp] - 2;
+	putmem16(machine_cpu.segregs[regss], machine_cpu.regs.wordregs[regsp], pushval);
 }
 
 void cpu_push ( uint16_t pushval )
@@ -575,8 +1172,8 @@ static uint16_t pop(void) {
 
 	uint16_t tempval;
 
-	tempval = getmem16(cpu.segregs[regss], cpu.regs.wordregs[regsp]);
-	cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regsp] + 2;
+	tempval = getmem16(machine_cpu.segregs[regss], machine_cpu.regs.wordregs[regsp]);
+	machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regsp] + 2;
 	return tempval;
 }
 
@@ -588,22 +1185,36 @@ uint16_t cpu_pop ( void )
 
 void cpu_IRET ( void )
 {
-	cpu.ip = pop();
-	cpu.segregs[regcs] = pop();
+	machine_cpu.ip = pop();
+	machine_cpu.segregs[regcs] = pop();
 	decodeflagsword(pop());
 }
 
 
+// The memory (and the CPU state) was replaced as a whole, forget everything derived from it
+void cpu_mem_reload(void) {
+	machine_attention();
+	cpu_mem_remap();
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	flowcache_flush();
+#endif
+#ifdef USE_JIT
+	if (machine->jit)
+		jit_flush();
+#endif
+}
+
 void reset86(void) {
-	cpu.segregs[regcs] = 0xFFFF;
-	cpu.ip = 0x0000;
-	cpu.hltstate = 0;
+	machine_cpu.segregs[regcs] = 0xFFFF;
+	machine_cpu.ip = 0x0000;
+	machine_cpu.hltstate = 0;
+	cpu_mem_reload();
 }
 
 static uint16_t readrm16(uint8_t rmval) {
 	if (mode < 3) {
 		getea(rmval);
-		return read86(ea) | ((uint16_t)read86(ea + 1) << 8);
+		return readw86(ea);
 	} else {
 		return getreg16(rmval);
 	}
@@ -621,8 +1232,7 @@ static uint8_t readrm8(uint8_t rmval) {
 static void writerm16(uint8_t rmval, uint16_t value) {
 	if (mode < 3) {
 		getea(rmval);
-		write86(ea, value & 0xFF);
-		write86(ea + 1, value >> 8);
+		writew86(ea, value);
 	} else {
 		setreg16(rmval, value);
 	}
@@ -640,6 +1250,7 @@ static void writerm8(uint8_t rmval, uint8_t value) {
 static uint8_t op_grp2_8(uint8_t cnt) {
 
 	uint16_t s = oper1b;
+	CPU_SYNC_FLAGS();	/* shifts and rotates update the flags piecewise */
 #ifdef CPU_LIMIT_SHIFT_COUNT
 	cnt &= 0x1F;
 #endif
@@ -647,43 +1258,43 @@ static uint8_t op_grp2_8(uint8_t cnt) {
 	case 0: /* ROL r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
 			if (s & 0x80) {
-				cpu.cf = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
 			s = s << 1;
-			s = s | cpu.cf;
+			s = s | machine_cpu.cf;
 		}
 
 		if (cnt == 1) {
 			// of = cpu.cf ^ ( (s >> 7) & 1);
-			if ((s & 0x80) && cpu.cf)
-				cpu.of = 1;
+			if ((s & 0x80) && machine_cpu.cf)
+				machine_cpu.of = 1;
 			else
-				cpu.of = 0;
+				machine_cpu.of = 0;
 		} else
-			cpu.of = 0;
+			machine_cpu.of = 0;
 		break;
 
 	case 1: /* ROR r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
-			cpu.cf = s & 1;
-			s = (s >> 1) | (cpu.cf << 7);
+			machine_cpu.cf = s & 1;
+			s = (s >> 1) | (machine_cpu.cf << 7);
 		}
 
 		if (cnt == 1) {
-			cpu.of = (s >> 7) ^ ((s >> 6) & 1);
+			machine_cpu.of = (s >> 7) ^ ((s >> 6) & 1);
 		}
 		break;
 
 	case 2: /* RCL r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
-			int oldcf = cpu.cf;
+			int oldcf = machine_cpu.cf;
 			if (s & 0x80) {
-				cpu.cf = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
 			s = s << 1;
@@ -691,19 +1302,19 @@ static uint8_t op_grp2_8(uint8_t cnt) {
 		}
 
 		if (cnt == 1) {
-			cpu.of = cpu.cf ^ ((s >> 7) & 1);
+			machine_cpu.of = machine_cpu.cf ^ ((s >> 7) & 1);
 		}
 		break;
 
 	case 3: /* RCR r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
-			int oldcf = cpu.cf;
-			cpu.cf = s & 1;
+			int oldcf = machine_cpu.cf;
+			machine_cpu.cf = s & 1;
 			s = (s >> 1) | (oldcf << 7);
 		}
 
 		if (cnt == 1) {
-			cpu.of = (s >> 7) ^ ((s >> 6) & 1);
+			machine_cpu.of = (s >> 7) ^ ((s >> 6) & 1);
 		}
 		break;
 
@@ -711,18 +1322,18 @@ static uint8_t op_grp2_8(uint8_t cnt) {
 	case 6: /* SHL r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
 			if (s & 0x80) {
-				cpu.cf = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
 			s = (s << 1) & 0xFF;
 		}
 
-		if ((cnt == 1) && (cpu.cf == (s >> 7))) {
-			cpu.of = 0;
+		if ((cnt == 1) && (machine_cpu.cf == (s >> 7))) {
+			machine_cpu.of = 0;
 		} else {
-			cpu.of = 1;
+			machine_cpu.of = 1;
 		}
 
 		flag_szp8((uint8_t)s);
@@ -730,13 +1341,13 @@ static uint8_t op_grp2_8(uint8_t cnt) {
 
 	case 5: /* SHR r/m8 */
 		if ((cnt == 1) && (s & 0x80)) {
-			cpu.of = 1;
+			machine_cpu.of = 1;
 		} else {
-			cpu.of = 0;
+			machine_cpu.of = 0;
 		}
 
 		for (int a = 1; a <= cnt; a++) {
-			cpu.cf = s & 1;
+			machine_cpu.cf = s & 1;
 			s = s >> 1;
 		}
 
@@ -746,11 +1357,11 @@ static uint8_t op_grp2_8(uint8_t cnt) {
 	case 7: /* SAR r/m8 */
 		for (int a = 1; a <= cnt; a++) {
 			unsigned int msb = s & 0x80;
-			cpu.cf = s & 1;
+			machine_cpu.cf = s & 1;
 			s = (s >> 1) | msb;
 		}
 
-		cpu.of = 0;
+		machine_cpu.of = 0;
 		flag_szp8((uint8_t)s);
 		break;
 	}
@@ -761,6 +1372,7 @@ static uint8_t op_grp2_8(uint8_t cnt) {
 static uint16_t op_grp2_16(uint8_t cnt) {
 
 	uint32_t s = oper1;
+	CPU_SYNC_FLAGS();
 #ifdef CPU_LIMIT_SHIFT_COUNT
 	cnt &= 0x1F;
 #endif
@@ -768,38 +1380,38 @@ static uint16_t op_grp2_16(uint8_t cnt) {
 	case 0: /* ROL r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
 			if (s & 0x8000) {
-				cpu.cf = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
 			s = s << 1;
-			s = s | cpu.cf;
+			s = s | machine_cpu.cf;
 		}
 
 		if (cnt == 1) {
-			cpu.of = cpu.cf ^ ((s >> 15) & 1);
+			machine_cpu.of = machine_cpu.cf ^ ((s >> 15) & 1);
 		}
 		break;
 
 	case 1: /* ROR r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
-			cpu.cf = s & 1;
-			s = (s >> 1) | (cpu.cf << 15);
+			machine_cpu.cf = s & 1;
+			s = (s >> 1) | (machine_cpu.cf << 15);
 		}
 
 		if (cnt == 1) {
-			cpu.of = (s >> 15) ^ ((s >> 14) & 1);
+			machine_cpu.of = (s >> 15) ^ ((s >> 14) & 1);
 		}
 		break;
 
 	case 2: /* RCL r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
-			int oldcf = cpu.cf;
+			int oldcf = machine_cpu.cf;
 			if (s & 0x8000) {
-				cpu.cf = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
 			s = s << 1;
@@ -807,19 +1419,19 @@ static uint16_t op_grp2_16(uint8_t cnt) {
 		}
 
 		if (cnt == 1) {
-			cpu.of = cpu.cf ^ ((s >> 15) & 1);
+			machine_cpu.of = machine_cpu.cf ^ ((s >> 15) & 1);
 		}
 		break;
 
 	case 3: /* RCR r/m8 */
 		for (int shift = 1; shift <= cnt; shift++) {
-			int oldcf = cpu.cf;
-			cpu.cf = s & 1;
+			int oldcf = machine_cpu.cf;
+			machine_cpu.cf = s & 1;
 			s = (s >> 1) | (oldcf << 15);
 		}
 
 		if (cnt == 1) {
-			cpu.of = (s >> 15) ^ ((s >> 14) & 1);
+			machine_cpu.of = (s >> 15) ^ ((s >> 14) & 1);
 		}
 		break;
 
@@ -827,18 +1439,18 @@ static uint16_t op_grp2_16(uint8_t cnt) {
 	case 6: /* SHL r/m8 */
 		for (unsigned int shift = 1; shift <= cnt; shift++) {
 			if (s & 0x8000) {
-				cpu.cf = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
 			s = (s << 1) & 0xFFFF;
 		}
 
-		if ((cnt == 1) && (cpu.cf == (s >> 15))) {
-			cpu.of = 0;
+		if ((cnt == 1) && (machine_cpu.cf == (s >> 15))) {
+			machine_cpu.of = 0;
 		} else {
-			cpu.of = 1;
+			machine_cpu.of = 1;
 		}
 
 		flag_szp16((uint16_t)s);
@@ -846,13 +1458,13 @@ static uint16_t op_grp2_16(uint8_t cnt) {
 
 	case 5: /* SHR r/m8 */
 		if ((cnt == 1) && (s & 0x8000)) {
-			cpu.of = 1;
+			machine_cpu.of = 1;
 		} else {
-			cpu.of = 0;
+			machine_cpu.of = 0;
 		}
 
 		for (int shift = 1; shift <= cnt; shift++) {
-			cpu.cf = s & 1;
+			machine_cpu.cf = s & 1;
 			s = s >> 1;
 		}
 
@@ -862,11 +1474,11 @@ static uint16_t op_grp2_16(uint8_t cnt) {
 	case 7: /* SAR r/m8 */
 		for (int shift = 1, msb; shift <= cnt; shift++) {
 			msb = s & 0x8000;
-			cpu.cf = s & 1;
+			machine_cpu.cf = s & 1;
 			s = (s >> 1) | msb;
 		}
 
-		cpu.of = 0;
+		machine_cpu.of = 0;
 		flag_szp16((uint16_t)s);
 		break;
 	}
@@ -885,8 +1497,8 @@ static inline void op_div8(uint16_t valdiv, uint8_t divisor) {
 		return;
 	}
 
-	cpu.regs.byteregs[regah] = valdiv % (uint16_t)divisor;
-	cpu.regs.byteregs[regal] = valdiv / (uint16_t)divisor;
+	machine_cpu.regs.byteregs[regah] = valdiv % (uint16_t)divisor;
+	machine_cpu.regs.byteregs[regal] = valdiv / (uint16_t)divisor;
 }
 
 static inline void op_idiv8(uint16_t valdiv, uint8_t divisor) {
@@ -919,17 +1531,18 @@ static inline void op_idiv8(uint16_t valdiv, uint8_t divisor) {
 		d2 = (~d2 + 1) & 0xff;
 	}
 
-	cpu.regs.byteregs[regah] = (uint8_t)d2;
-	cpu.regs.byteregs[regal] = (uint8_t)d1;
+	machine_cpu.regs.byteregs[regah] = (uint8_t)d2;
+	machine_cpu.regs.byteregs[regal] = (uint8_t)d1;
 }
 
 static inline void op_grp3_8(void) {
+	totalcycles += cycles_grp3_8[reg];
 	oper1 = signext(oper1b);
 	oper2 = signext(oper2b);
 	switch (reg) {
 	case 0:
 	case 1: /* TEST */
-		flag_log8(oper1b & getmem8(cpu.segregs[regcs], cpu.ip));
+		flag_log8(oper1b & getcode8());
 		StepIP(1);
 		break;
 
@@ -941,34 +1554,36 @@ static inline void op_grp3_8(void) {
 		res8 = (~oper1b) + 1;
 		flag_sub8(0, oper1b);
 		if (res8 == 0) {
-			cpu.cf = 0;
+			machine_cpu.cf = 0;
 		} else {
-			cpu.cf = 1;
+			machine_cpu.cf = 1;
 		}
 		break;
 
 	case 4: /* MUL */
+		CPU_SYNC_FLAGS();
 		{
-			uint32_t temp1 = (uint32_t)oper1b * (uint32_t)cpu.regs.byteregs[regal];
-			cpu.regs.wordregs[regax] = temp1 & 0xFFFF;
+			uint32_t temp1 = (uint32_t)oper1b * (uint32_t)machine_cpu.regs.byteregs[regal];
+			machine_cpu.regs.wordregs[regax] = temp1 & 0xFFFF;
 			flag_szp8((uint8_t)temp1);
-			if (cpu.regs.byteregs[regah]) {
-				cpu.cf = 1;
-				cpu.of = 1;
+			if (machine_cpu.regs.byteregs[regah]) {
+				machine_cpu.cf = 1;
+				machine_cpu.of = 1;
 			} else {
-				cpu.cf = 0;
-				cpu.of = 0;
+				machine_cpu.cf = 0;
+				machine_cpu.of = 0;
 			}
 #ifdef CPU_CLEAR_ZF_ON_MUL
-			cpu.zf = 0;
+			machine_cpu.zf = 0;
 #endif
 		}
 		break;
 
 	case 5: /* IMUL */
+		CPU_SYNC_FLAGS();
 		{
 			oper1 = signext(oper1b);
-			uint32_t temp1 = signext(cpu.regs.byteregs[regal]);
+			uint32_t temp1 = signext(machine_cpu.regs.byteregs[regal]);
 			uint32_t temp2 = oper1;
 			if ((temp1 & 0x80) == 0x80) {
 				temp1 = temp1 | 0xFFFFFF00;
@@ -977,26 +1592,26 @@ static inline void op_grp3_8(void) {
 				temp2 = temp2 | 0xFFFFFF00;
 			}
 			uint32_t temp3 = (temp1 * temp2) & 0xFFFF;
-			cpu.regs.wordregs[regax] = temp3 & 0xFFFF;
-			if (cpu.regs.byteregs[regah]) {
-				cpu.cf = 1;
-				cpu.of = 1;
+			machine_cpu.regs.wordregs[regax] = temp3 & 0xFFFF;
+			if (machine_cpu.regs.byteregs[regah]) {
+				machine_cpu.cf = 1;
+				machine_cpu.of = 1;
 			} else {
-				cpu.cf = 0;
-				cpu.of = 0;
+				machine_cpu.cf = 0;
+				machine_cpu.of = 0;
 			}
 #ifdef CPU_CLEAR_ZF_ON_MUL
-			cpu.zf = 0;
+			machine_cpu.zf = 0;
 #endif
 		}
 		break;
 
 	case 6: /* DIV */
-		op_div8(cpu.regs.wordregs[regax], oper1b);
+		op_div8(machine_cpu.regs.wordregs[regax], oper1b);
 		break;
 
 	case 7: /* IDIV */
-		op_idiv8(cpu.regs.wordregs[regax], oper1b);
+		op_idiv8(machine_cpu.regs.wordregs[regax], oper1b);
 		break;
 	}
 }
@@ -1012,8 +1627,8 @@ static void op_div16(uint32_t valdiv, uint16_t divisor) {
 		return;
 	}
 
-	cpu.regs.wordregs[regdx] = valdiv % (uint32_t)divisor;
-	cpu.regs.wordregs[regax] = valdiv / (uint32_t)divisor;
+	machine_cpu.regs.wordregs[regdx] = valdiv % (uint32_t)divisor;
+	machine_cpu.regs.wordregs[regax] = valdiv / (uint32_t)divisor;
 }
 
 static void op_idiv16(uint32_t valdiv, uint16_t divisor) {
@@ -1047,15 +1662,16 @@ static void op_idiv16(uint32_t valdiv, uint16_t divisor) {
 		d2 = (~d2 + 1) & 0xffff;
 	}
 
-	cpu.regs.wordregs[regax] = d1;
-	cpu.regs.wordregs[regdx] = d2;
+	machine_cpu.regs.wordregs[regax] = d1;
+	machine_cpu.regs.wordregs[regdx] = d2;
 }
 
 static inline void op_grp3_16(void) {
+	totalcycles += cycles_grp3_16[reg];
 	switch (reg) {
 	case 0:
 	case 1: /* TEST */
-		flag_log16(oper1 & getmem16(cpu.segregs[regcs], cpu.ip));
+		flag_log16(oper1 & getcode16());
 		StepIP(2);
 		break;
 
@@ -1067,34 +1683,36 @@ static inline void op_grp3_16(void) {
 		res16 = (~oper1) + 1;
 		flag_sub16(0, oper1);
 		if (res16) {
-			cpu.cf = 1;
+			machine_cpu.cf = 1;
 		} else {
-			cpu.cf = 0;
+			machine_cpu.cf = 0;
 		}
 		break;
 
 	case 4: /* MUL */
+		CPU_SYNC_FLAGS();
 		{
-			uint32_t temp1 = (uint32_t)oper1 * (uint32_t)cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = temp1 & 0xFFFF;
-			cpu.regs.wordregs[regdx] = temp1 >> 16;
+			uint32_t temp1 = (uint32_t)oper1 * (uint32_t)machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = temp1 & 0xFFFF;
+			machine_cpu.regs.wordregs[regdx] = temp1 >> 16;
 			flag_szp16((uint16_t)temp1);
-			if (cpu.regs.wordregs[regdx]) {
-				cpu.cf = 1;
-				cpu.of = 1;
+			if (machine_cpu.regs.wordregs[regdx]) {
+				machine_cpu.cf = 1;
+				machine_cpu.of = 1;
 			} else {
-				cpu.cf = 0;
-				cpu.of = 0;
+				machine_cpu.cf = 0;
+				machine_cpu.of = 0;
 			}
 #ifdef CPU_CLEAR_ZF_ON_MUL
-			cpu.zf = 0;
+			machine_cpu.zf = 0;
 #endif
 		}
 		break;
 
 	case 5: /* IMUL */
+		CPU_SYNC_FLAGS();
 		{
-			uint32_t temp1 = cpu.regs.wordregs[regax];
+			uint32_t temp1 = machine_cpu.regs.wordregs[regax];
 			uint32_t temp2 = oper1;
 			if (temp1 & 0x8000) {
 				temp1 |= 0xFFFF0000;
@@ -1103,43 +1721,44 @@ static inline void op_grp3_16(void) {
 				temp2 |= 0xFFFF0000;
 			}
 			uint32_t temp3 = temp1 * temp2;
-			cpu.regs.wordregs[regax] = temp3 & 0xFFFF; /* into register ax */
-			cpu.regs.wordregs[regdx] = temp3 >> 16;    /* into register dx */
-			if (cpu.regs.wordregs[regdx]) {
-				cpu.cf = 1;
-				cpu.of = 1;
+			machine_cpu.regs.wordregs[regax] = temp3 & 0xFFFF; /* into register ax */
+			machine_cpu.regs.wordregs[regdx] = temp3 >> 16;    /* into register dx */
+			if (machine_cpu.regs.wordregs[regdx]) {
+				machine_cpu.cf = 1;
+				machine_cpu.of = 1;
 			} else {
-				cpu.cf = 0;
-				cpu.of = 0;
+				machine_cpu.cf = 0;
+				machine_cpu.of = 0;
 			}
 #ifdef CPU_CLEAR_ZF_ON_MUL
-			cpu.zf = 0;
+			machine_cpu.zf = 0;
 #endif
 		}
 		break;
 
 	case 6: /* DIV */
-		op_div16(((uint32_t)cpu.regs.wordregs[regdx] << 16) +
-			     cpu.regs.wordregs[regax],
+		op_div16(((uint32_t)machine_cpu.regs.wordregs[regdx] << 16) +
+			     machine_cpu.regs.wordregs[regax],
 			 oper1);
 		break;
 
 	case 7: /* DIV */
-		op_idiv16(((uint32_t)cpu.regs.wordregs[regdx] << 16) +
-			      cpu.regs.wordregs[regax],
+		op_idiv16(((uint32_t)machine_cpu.regs.wordregs[regdx] << 16) +
+			      machine_cpu.regs.wordregs[regax],
 			  oper1);
 		break;
 	}
 }
 
 static inline void op_grp5(void) {
+	totalcycles += cycles_grp5[reg];
 	switch (reg) {
 		case 0: /* INC Ev */
 			{
 				oper2 = 1;
-				int tempcf = cpu.cf;
+				int tempcf = machine_cpu.cf;
 				op_add16();
-				cpu.cf = tempcf;
+				machine_cpu.cf = tempcf;
 				writerm16(rm, res16);
 			}
 			break;
@@ -1147,35 +1766,35 @@ static inline void op_grp5(void) {
 		case 1: /* DEC Ev */
 			{
 				oper2 = 1;
-				int tempcf = cpu.cf;
+				int tempcf = machine_cpu.cf;
 				op_sub16();
-				cpu.cf = tempcf;
+				machine_cpu.cf = tempcf;
 				writerm16(rm, res16);
 			}
 			break;
 
 		case 2: /* CALL Ev */
-			push(cpu.ip);
-			cpu.ip = oper1;
+			push(machine_cpu.ip);
+			machine_cpu.ip = oper1;
 			break;
 
 		case 3: /* CALL Mp */
-			push(cpu.segregs[regcs]);
-			push(cpu.ip);
+			push(machine_cpu.segregs[regcs]);
+			push(machine_cpu.ip);
 			getea(rm);
-			cpu.ip = (uint16_t)read86(ea) + (uint16_t)read86(ea + 1) * 256;
-			cpu.segregs[regcs] =
+			machine_cpu.ip = (uint16_t)read86(ea) + (uint16_t)read86(ea + 1) * 256;
+			machine_cpu.segregs[regcs] =
 			    (uint16_t)read86(ea + 2) + (uint16_t)read86(ea + 3) * 256;
 			break;
 
 		case 4: /* JMP Ev */
-			cpu.ip = oper1;
+			machine_cpu.ip = oper1;
 			break;
 
 		case 5: /* JMP Mp */
 			getea(rm);
-			cpu.ip = (uint16_t)read86(ea) + (uint16_t)read86(ea + 1) * 256;
-			cpu.segregs[regcs] =
+			machine_cpu.ip = (uint16_t)read86(ea) + (uint16_t)read86(ea + 1) * 256;
+			machine_cpu.segregs[regcs] =
 			    (uint16_t)read86(ea + 2) + (uint16_t)read86(ea + 3) * 256;
 			break;
 
@@ -1190,20 +1809,18 @@ static inline void op_grp5(void) {
 //static FILE *logout;
 //static uint8_t printops = 0;
 
-uint16_t cpu_last_int_seg, cpu_last_int_ip;
 
 static void intcall86(uint8_t intnum) {
 	if (!internalbios) {
-	static uint16_t lastint10ax;
 	uint16_t oldregax;
 	// this didintr seems not to be used just a value assigned ..
 	//didintr = 1;
 
-	cpu_last_int_seg = cpu.segregs[regcs];
-	cpu_last_int_ip  = cpu.saveip;	// LGB
+	cpu_last_int_seg = machine_cpu.segregs[regcs];
+	cpu_last_int_ip  = machine_cpu.saveip;	// LGB
 
 	if (intnum == 0x19)
-		didbootstrap = 1;
+		set_didbootstrap(1);
 
 	switch (intnum) {
 	case 0x10:
@@ -1211,29 +1828,29 @@ static void intcall86(uint8_t intnum) {
 		/*if (cpu.regs.byteregs[regah]!=0x0E) {
 			printf("Int 10h AX = %04X\n", cpu.regs.wordregs[regax]);
 		}*/
-		if ((cpu.regs.byteregs[regah] == 0x00) ||
-		    (cpu.regs.byteregs[regah] == 0x10)) {
-			oldregax = cpu.regs.wordregs[regax];
+		if ((machine_cpu.regs.byteregs[regah] == 0x00) ||
+		    (machine_cpu.regs.byteregs[regah] == 0x10)) {
+			oldregax = machine_cpu.regs.wordregs[regax];
 			vidinterrupt();
-			cpu.regs.wordregs[regax] = oldregax;
-			if (cpu.regs.byteregs[regah] == 0x10)
+			machine_cpu.regs.wordregs[regax] = oldregax;
+			if (machine_cpu.regs.byteregs[regah] == 0x10)
 				return;
 			if (vidmode == 9)
 				return;
 		}
-		if ((cpu.regs.byteregs[regah] == 0x1A) &&
-		    (lastint10ax !=
+		if ((machine_cpu.regs.byteregs[regah] == 0x1A) &&
+		    (machine->last_int10ax !=
 		     0x0100)) { // the 0x0100 is a cheap hack to make it not do
 				// this if DOS EDIT/QBASIC
-			cpu.regs.byteregs[regal] = 0x1A;
-			cpu.regs.byteregs[regbl] = 0x8;
+			machine_cpu.regs.byteregs[regal] = 0x1A;
+			machine_cpu.regs.byteregs[regbl] = 0x8;
 			return;
 		}
-		lastint10ax = cpu.regs.wordregs[regax];
-		if (cpu.regs.byteregs[regah] == 0x1B) {
-			cpu.regs.byteregs[regal] = 0x1B;
-			cpu.segregs[reges] = 0xC800;
-			cpu.regs.wordregs[regdi] = 0x0000;
+		machine->last_int10ax = machine_cpu.regs.wordregs[regax];
+		if (machine_cpu.regs.byteregs[regah] == 0x1B) {
+			machine_cpu.regs.byteregs[regal] = 0x1B;
+			machine_cpu.segregs[reges] = 0xC800;
+			machine_cpu.regs.wordregs[regdi] = 0x0000;
 			writew86(0xC8000, 0x0000);
 			writew86(0xC8002, 0xC900);
 			write86(0xC9000, 0x00);
@@ -1246,25 +1863,26 @@ static void intcall86(uint8_t intnum) {
 #ifndef DISK_CONTROLLER_ATA
 	case 0x19: // bootstrap
 #ifdef BENCHMARK_BIOS
-		running = 0;
+		machine_running = 0;
+		machine_attention();
 #endif
 		if (bootdrive < 255) { // read first sector of boot drive into
 				       // 07C0:0000 and execute it
-			cpu.regs.byteregs[regdl] = bootdrive;
+			machine_cpu.regs.byteregs[regdl] = bootdrive;
 			bios_read_boot_sector(bootdrive, 0, 0x7C00);
-			if (cpu.cf) {
+			if (machine_cpu.cf) {
 				fprintf(stderr, "BOOT: cannot read boot record of drive %02X! Trying ROM basic instead!\n", bootdrive);
-				cpu.segregs[regcs] = 0xF600;
-				cpu.ip = 0;
+				machine_cpu.segregs[regcs] = 0xF600;
+				machine_cpu.ip = 0;
 			} else {
-				cpu.segregs[regcs] = 0x0000;
-				cpu.ip = 0x7C00;
-				printf("BOOT: executing boot record at %04X:%04X\n", cpu.segregs[regcs], cpu.ip);
+				machine_cpu.segregs[regcs] = 0x0000;
+				machine_cpu.ip = 0x7C00;
+				printf("BOOT: executing boot record at %04X:%04X\n", machine_cpu.segregs[regcs], machine_cpu.ip);
 			}
 		} else {
-			cpu.segregs[regcs] =
+			machine_cpu.segregs[regcs] =
 			    0xF600; // start ROM BASIC at bootstrap if requested
-			cpu.ip = 0x0000;
+			machine_cpu.ip = 0x0000;
 		}
 		return;
 
@@ -1273,6 +1891,10 @@ static void intcall86(uint8_t intnum) {
 		diskhandler();
 		return;
 #endif
+	case 0xE6: // emulation gateway, see fanout.c
+		if (!fanout_gateway())
+			return;
+		break;
 #ifdef NETWORKING_OLDCARD
 	case 0xFC:
 #ifdef NETWORKING_ENABLED
@@ -1283,16 +1905,15 @@ static void intcall86(uint8_t intnum) {
 	}
 	} // internalbios
 	push(makeflagsword());
-	push(cpu.segregs[regcs]);
-	push(cpu.ip);
-	cpu.segregs[regcs] = getmem16(0, (uint16_t)intnum * 4 + 2);
-	cpu.ip = getmem16(0, (uint16_t)intnum * 4);
-	cpu.ifl = 0;
-	cpu.tf = 0;
+	push(machine_cpu.segregs[regcs]);
+	push(machine_cpu.ip);
+	machine_cpu.segregs[regcs] = getmem16(0, (uint16_t)intnum * 4 + 2);
+	machine_cpu.ip = getmem16(0, (uint16_t)intnum * 4);
+	machine_cpu.ifl = 0;
+	machine_cpu.tf = 0;
 }
 
 //static uint64_t frametimer = 0, didwhen = 0, didticks = 0;
-uint32_t makeupticks = 0;
 //static uint64_t timerticks = 0, realticks = 0;
 //static uint64_t counterticks = 10000;
 //static uint64_t lastcountertimer = 0;
@@ -1304,10 +1925,20 @@ static uint32_t prefetch_base = 0;
 
 
 
-static void modregrm ( void )
+// Memory operand part of the clock cycles (and the profile) of an instruction
+static INLINE void modregrm_cycles(uint8_t opcode) {
+	if (mode < 3) {
+		totalcycles += cycles_mem[opcode] + cycles_ea[(mode << 3) | rm];
+#ifdef CPU_PROFILER
+		prof_memform(opcode);
+#endif
+	}
+}
+
+static void modregrm ( uint8_t opcode )
 {
 #ifdef CPU_ADDR_MODE_CACHE
-	tempaddr32 = (((uint32_t)cpu.savecs << 4) + cpu.ip) & 0xFFFFF;
+	tempaddr32 = (((uint32_t)machine_cpu.savecs << 4) + machine_cpu.ip) & 0xFFFFF;
 	if (addrcachevalid[tempaddr32]) {
 		switch (addrcache[tempaddr32].len) {
 			case 0:
@@ -1331,16 +1962,16 @@ static void modregrm ( void )
 	if (dataisvalid) {
 		cached_access_count++;
 		disp16 = addrcache[tempaddr32].disp16;
-		cpu.segregs[regcs] = addrcache[tempaddr32].exitcs;
-		cpu.ip = addrcache[tempaddr32].exitip;
+		machine_cpu.segregs[regcs] = addrcache[tempaddr32].exitcs;
+		machine_cpu.ip = addrcache[tempaddr32].exitip;
 		mode = addrcache[tempaddr32].mode;
 		reg = addrcache[tempaddr32].reg;
 		rm = addrcache[tempaddr32].rm;
-		if ((!cpu.segoverride) && addrcache[tempaddr32].forcess)
-			cpu.useseg = cpu.segregs[regss];
+		if ((!machine_cpu.segoverride) && addrcache[tempaddr32].forcess)
+			machine_cpu.useseg = machine_cpu.segregs[regss];
 	} else {
 		uncached_access_count++;
-		addrbyte = getmem8(cpu.segregs[regcs], cpu.ip);
+		addrbyte = getcode8();
 		StepIP(1);
 		mode = addrbyte >> 6;
 		reg = (addrbyte >> 3) & 7;
@@ -1350,33 +1981,33 @@ static void modregrm ( void )
 		switch (mode) {
 			case 0:
 				if(rm == 6) {
-					disp16 = getmem16(cpu.segregs[regcs], cpu.ip);
+					disp16 = getcode16();
 					addrdatalen = 2;
 					StepIP(2);
 				}
 				if ((rm == 2) || (rm == 3)) {
-					if (!cpu.segoverride)
-						cpu.useseg = cpu.segregs[regss];
+					if (!machine_cpu.segoverride)
+						machine_cpu.useseg = machine_cpu.segregs[regss];
 					addrcache[tempaddr32].forcess = 1;
 				}
 				break;
 			case 1:
-				disp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				disp16 = signext(getcode8());
 				addrdatalen = 1;
 				StepIP(1);
 				if ((rm == 2) || (rm == 3) || (rm == 6)) {
-					if (!cpu.segoverride)
-						cpu.useseg = cpu.segregs[regss];
+					if (!machine_cpu.segoverride)
+						machine_cpu.useseg = machine_cpu.segregs[regss];
 					addrcache[tempaddr32].forcess = 1;
 				}
 				break;
 			case 2:
-				disp16 = getmem16(cpu.segregs[regcs], cpu.ip);
+				disp16 = getcode16();
 				addrdatalen = 2;
 				StepIP(2);
 				if ((rm == 2) || (rm == 3) || (rm == 6)) {
-					if (!cpu.segoverride)
-						cpu.useseg = cpu.segregs[regss];
+					if (!machine_cpu.segoverride)
+						machine_cpu.useseg = machine_cpu.segregs[regss];
 					addrcache[tempaddr32].forcess = 1;
 				}
 				break;
@@ -1385,8 +2016,8 @@ static void modregrm ( void )
 				break;
 		}
 		addrcache[tempaddr32].disp16 = disp16;
-		addrcache[tempaddr32].exitcs = cpu.segregs[regcs];
-		addrcache[tempaddr32].exitip = cpu.ip;
+		addrcache[tempaddr32].exitcs = machine_cpu.segregs[regcs];
+		addrcache[tempaddr32].exitip = machine_cpu.ip;
 		addrcache[tempaddr32].mode = mode;
 		addrcache[tempaddr32].reg = reg;
 		addrcache[tempaddr32].rm = rm;
@@ -1394,7 +2025,23 @@ static void modregrm ( void )
 		memset(&addrcachevalid[tempaddr32], 1, addrdatalen+1);
 	}
 #else
-	addrbyte = getmem8(cpu.segregs[regcs], cpu.ip);
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	struct flowcache_insn *in = fc_insn;
+	if (LIKELY(in->flags & FC_MODRM)) {
+		mode = in->mode;
+		reg = in->reg;
+		rm = in->rm;
+		if (in->flags & FC_SETDISP)
+			disp16 = in->disp16;
+		if ((in->flags & FC_FORCESS) && !machine_cpu.segoverride)
+			machine_cpu.useseg = machine_cpu.segregs[regss];
+		StepIP(in->modrmlen);
+		modregrm_cycles(opcode);
+		return;
+	}
+	const uint16_t startip = machine_cpu.ip;
+#endif
+	addrbyte = getcode8();
 	StepIP(1);
 	mode = addrbyte >> 6;
 	reg = (addrbyte >> 3) & 7;
@@ -1402,25 +2049,25 @@ static void modregrm ( void )
 	switch (mode) {
 		case 0:
 			if (rm == 6) {
-				disp16 = getmem16(cpu.segregs[regcs], cpu.ip);
+				disp16 = getcode16();
 				StepIP(2);
 			}
-			if (((rm == 2) || (rm == 3)) && !cpu.segoverride) {
-				cpu.useseg = cpu.segregs[regss];
+			if (((rm == 2) || (rm == 3)) && !machine_cpu.segoverride) {
+				machine_cpu.useseg = machine_cpu.segregs[regss];
 			}
 			break;
 		case 1:
-			disp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+			disp16 = signext(getcode8());
 			StepIP(1);
-			if (((rm == 2) || (rm == 3) || (rm == 6)) && !cpu.segoverride) {
-				cpu.useseg = cpu.segregs[regss];
+			if (((rm == 2) || (rm == 3) || (rm == 6)) && !machine_cpu.segoverride) {
+				machine_cpu.useseg = machine_cpu.segregs[regss];
 			}
 			break;
 		case 2:
-			disp16 = getmem16(cpu.segregs[regcs], cpu.ip);
+			disp16 = getcode16();
 			StepIP(2);
-			if (((rm == 2) || (rm == 3) || (rm == 6)) && !cpu.segoverride) {
-				cpu.useseg = cpu.segregs[regss];
+			if (((rm == 2) || (rm == 3) || (rm == 6)) && !machine_cpu.segoverride) {
+				machine_cpu.useseg = machine_cpu.segregs[regss];
 			}
 			break;
 		default:
@@ -1428,107 +2075,733 @@ static void modregrm ( void )
 			disp16 = 0;
 			break;
 	}
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	// store the decoded ModR/M, if all of its bytes made into the cache entry
+	if (fc_block && (in->flags & FC_DECODED) && (uint16_t)(machine_cpu.ip - in->ip) <= in->len) {
+		in->mode = mode;
+		in->reg = reg;
+		in->rm = rm;
+		in->disp16 = disp16;
+		in->modrmlen = machine_cpu.ip - startip;
+		in->flags |= FC_MODRM;
+		if ((mode != 0) || (rm == 6))
+			in->flags |= FC_SETDISP;
+		if ((mode < 3) && ((rm == 2) || (rm == 3) || ((rm == 6) && (mode != 0))))
+			in->flags |= FC_FORCESS;
+	}
 #endif
+#endif
+	modregrm_cycles(opcode);
 }
 
 
+#ifdef CPU_BULK_STRING_OPS
+/* Bulk REP string instructions. Without these, every iteration of a REP
+ * string instruction is a separate pass through exec86(): the handler does
+ * one element, then sets IP back to the prefix so the instruction is
+ * dispatched again. The rep_* helpers below fast forward such iterations
+ * directly on the host memory of the pages (see mem_pages[]) in page and
+ * segment sized runs. They never do the last iteration (CX = 1) and never
+ * the one which terminates a REPE/REPNE CMPS/SCAS: that is always left to
+ * the ordinary per-element code, which sets the flags and IP. */
+
+/* Number of iterations which can be done in bulk: the ones which the per
+ * element execution would do without reaching the end of the exec86()
+ * budget, or any of the work of the instruction prologue (timing, trap,
+ * interrupt, JIT, BIOS entry). Every iteration counts as two instructions,
+ * the string instruction itself and its re-dispatch, but only one pass
+ * of the attention counter. */
+static INLINE uint32_t rep_bulk_limit(uint32_t loopcount, uint32_t execloops, uint16_t firstip, unsigned int cycles) {
+	uint32_t limit = machine_cpu.regs.wordregs[regcx] - 1;
+	if (machine->attention <= 0)
+		return 0;
+#ifndef CPU_INSTRUCTION_FLOW_CACHE
+	if ((firstip == 0xE066) && (machine_cpu.segregs[regcs] == 0xF000))
+		return 0;
+#endif
+#ifdef USE_JIT
+	if (machine->jit && jit_is_entry(machine_cpu.segregs[regcs], firstip))
+		return 0;
+#endif
+	// the per element iteration after the bulk ones counts as two as well
+	if (execloops - loopcount < 2)
+		return 0;
+	if (limit > (execloops - loopcount - 2) / 2)
+		limit = (execloops - loopcount - 2) / 2;
+	// do not run over the cycle budget of exec86_cycles() either
+	if (totalcycles >= machine->cycle_limit)
+		return 0;
+	if (machine->cycle_limit - totalcycles < (uint64_t)limit * cycles)
+		limit = (machine->cycle_limit - totalcycles) / cycles;
+	if (limit > (uint32_t)machine->attention)
+		limit = machine->attention;
+	return limit;
+}
 
-void exec86(uint32_t execloops) {
+// Number of whole elements from segment offset/linear address in the
+// current direction, which stay within both the 4K page and the segment
+static INLINE uint32_t rep_run(uint32_t linear, uint16_t offset, uint32_t size) {
+	uint32_t n;
+	if (machine_cpu.df) {
+		if (((linear & 0xFFF) + size > 0x1000) || ((uint32_t)offset + size > 0x10000))
+			return 0;
+		n = (linear & 0xFFF) < offset ? (linear & 0xFFF) : offset;
+		return n / size + 1;
+	}
+	n = 0x1000 - (linear & 0xFFF);
+	if (n > 0x10000 - (uint32_t)offset)
+		n = 0x10000 - (uint32_t)offset;
+	return n / size;
+}
 
-	uint8_t docontinue;
-	static uint16_t firstip;
-	static uint16_t trap_toggle = 0;
+static INLINE uint8_t *rep_write_ptr(uint32_t linear) {
+	const struct mem_page *p = &mem_pages[linear >> 12];
+	if (p->write)
+		return p->write;
+	if ((p->flags & MEM_PAGE_VIDEO) && !p->code) {
+		updatedscreen = 1;
+		return machine_ram;
+	}
+	return NULL;
+}
 
-	// This seems not to be used anywhere, so commented out for now.
-	//counterticks = (uint64_t)((double)timerfreq / (double)65536.0);
+static INLINE void rep_advance(uint8_t index_reg, uint32_t n, uint32_t size) {
+	if (machine_cpu.df)
+		machine_cpu.regs.wordregs[index_reg] -= n * size;
+	else
+		machine_cpu.regs.wordregs[index_reg] += n * size;
+}
 
-	for (uint32_t loopcount = 0; loopcount < execloops; loopcount++) {
+static INLINE void rep_written(uint32_t low, uint32_t bytes) {
+#ifdef CPU_ADDR_MODE_CACHE
+	memset(addrcachevalid + low, 0, bytes);
+#else
+	(void)low;
+	(void)bytes;
+#endif
+}
 
-		if ((totalexec & TIMING_INTERVAL) == 0)
-			timing();
+static uint32_t rep_movs(uint32_t max, uint32_t size) {
+	uint32_t done = 0;
+	while (done < max) {
+		const uint16_t si = machine_cpu.regs.wordregs[regsi], di = machine_cpu.regs.wordregs[regdi];
+		const uint32_t src = (segbase(machine_cpu.useseg) + si) & 0xFFFFF;
+		const uint32_t dst = (segbase(machine_cpu.segregs[reges]) + di) & 0xFFFFF;
+		const uint8_t *s = mem_pages[src >> 12].read;
+		uint8_t *d = rep_write_ptr(dst);
+		uint32_t n = rep_run(src, si, size);
+		if (n > rep_run(dst, di, size))
+			n = rep_run(dst, di, size);
+		if (n > max - done)
+			n = max - done;
+		if (!s || !d || !n)
+			break;
+		const uint32_t bytes = n * size;
+		const uint32_t slow = machine_cpu.df ? src + size - bytes : src;
+		const uint32_t dlow = machine_cpu.df ? dst + size - bytes : dst;
+		// element by element copying only differs from memmove() if the
+		// destination is ahead of the source (in the direction) and overlaps it
+		if (machine_cpu.df ? (dst < src && src - dst < bytes) : (dst > src && dst - src < bytes)) {
+			for (uint32_t i = 0; i < n; i++) {
+				const uint32_t a = machine_cpu.df ? src - i * size : src + i * size;
+				const uint32_t b = machine_cpu.df ? dst - i * size : dst + i * size;
+				const uint8_t lo = s[a], hi = size == 2 ? s[a + 1] : 0;
+				d[b] = lo;
+				if (size == 2)
+					d[b + 1] = hi;
+			}
+		} else
+			memmove(d + dlow, s + slow, bytes);
+		rep_written(dlow, bytes);
+		rep_advance(regsi, n, size);
+		rep_advance(regdi, n, size);
+		machine_cpu.regs.wordregs[regcx] -= n;
+		done += n;
+	}
+	return done;
+}
 
-		if (trap_toggle) {
-			intcall86(1);
+static uint32_t rep_stos(uint32_t max, uint32_t size) {
+	uint32_t done = 0;
+	while (done < max) {
+		const uint16_t di = machine_cpu.regs.wordregs[regdi];
+		const uint32_t dst = (segbase(machine_cpu.segregs[reges]) + di) & 0xFFFFF;
+		uint8_t *d = rep_write_ptr(dst);
+		uint32_t n = rep_run(dst, di, size);
+		if (n > max - done)
+			n = max - done;
+		if (!d || !n)
+			break;
+		const uint32_t bytes = n * size;
+		const uint32_t dlow = machine_cpu.df ? dst + size - bytes : dst;
+		if ((size == 1) || (machine_cpu.regs.byteregs[regal] == machine_cpu.regs.byteregs[regah]))
+			memset(d + dlow, machine_cpu.regs.byteregs[regal], bytes);
+		else {
+			for (uint32_t i = 0; i < bytes; i += 2) {
+				d[dlow + i] = machine_cpu.regs.byteregs[regal];
+				d[dlow + i + 1] = machine_cpu.regs.byteregs[regah];
+			}
 		}
+		rep_written(dlow, bytes);
+		rep_advance(regdi, n, size);
+		machine_cpu.regs.wordregs[regcx] -= n;
+		done += n;
+	}
+	return done;
+}
 
-		if (cpu.tf) {
-			trap_toggle = 1;
-		} else {
-			trap_toggle = 0;
-		}
+static uint32_t rep_lods(uint32_t max, uint32_t size) {
+	uint32_t done = 0;
+	while (done < max) {
+		const uint16_t si = machine_cpu.regs.wordregs[regsi];
+		const uint32_t src = (segbase(machine_cpu.useseg) + si) & 0xFFFFF;
+		const uint8_t *s = mem_pages[src >> 12].read;
+		uint32_t n = rep_run(src, si, size);
+		if (n > max - done)
+			n = max - done;
+		if (!s || !n)
+			break;
+		// only the last element loaded is visible
+		const uint32_t last = machine_cpu.df ? src - (n - 1) * size : src + (n - 1) * size;
+		if (size == 2)
+			machine_cpu.regs.wordregs[regax] = s[last] | (s[last + 1] << 8);
+		else
+			machine_cpu.regs.byteregs[regal] = s[last];
+		rep_advance(regsi, n, size);
+		machine_cpu.regs.wordregs[regcx] -= n;
+		done += n;
+	}
+	return done;
+}
+
+// REPE (reptype 1) goes on while the elements are equal, REPNE while they differ
+static INLINE int rep_goes_on(int reptype, uint16_t a, uint16_t b) {
+	return (a == b) == (reptype == 1);
+}
 
-		if (!trap_toggle && (cpu.ifl && (i8259.irr & (~i8259.imr)))) {
-			cpu.hltstate = 0;
-			intcall86(nextintr()); /* get next interrupt from the
-						  i8259, if any */
+static uint32_t rep_cmps(uint32_t max, uint32_t size, int reptype) {
+	uint32_t done = 0;
+	while (done < max) {
+		const uint16_t si = machine_cpu.regs.wordregs[regsi], di = machine_cpu.regs.wordregs[regdi];
+		const uint32_t src = (segbase(machine_cpu.useseg) + si) & 0xFFFFF;
+		const uint32_t dst = (segbase(machine_cpu.segregs[reges]) + di) & 0xFFFFF;
+		const uint8_t *s = mem_pages[src >> 12].read, *d = mem_pages[dst >> 12].read;
+		uint32_t n = rep_run(src, si, size);
+		if (n > rep_run(dst, di, size))
+			n = rep_run(dst, di, size);
+		if (n > max - done)
+			n = max - done;
+		if (!s || !d || !n)
+			break;
+		uint32_t i;
+		if ((size == 1) && !machine_cpu.df && (reptype == 1) && !memcmp(s + src, d + dst, n))
+			i = n;
+		else {
+			for (i = 0; i < n; i++) {
+				const uint32_t a = machine_cpu.df ? src - i * size : src + i * size;
+				const uint32_t b = machine_cpu.df ? dst - i * size : dst + i * size;
+				if (size == 2 ?
+				    !rep_goes_on(reptype, s[a] | (s[a + 1] << 8), d[b] | (d[b + 1] << 8)) :
+				    !rep_goes_on(reptype, s[a], d[b]))
+					break;
+			}
 		}
+		rep_advance(regsi, i, size);
+		rep_advance(regdi, i, size);
+		machine_cpu.regs.wordregs[regcx] -= i;
+		done += i;
+		if (i < n)
+			break;
+	}
+	return done;
+}
 
-		if (cpu.hltstate) {
-			puts("CPU: HALTED!!!!!");
-			goto skipexecution;
+static uint32_t rep_scas(uint32_t max, uint32_t size, int reptype) {
+	uint32_t done = 0;
+	while (done < max) {
+		const uint16_t di = machine_cpu.regs.wordregs[regdi];
+		const uint32_t dst = (segbase(machine_cpu.segregs[reges]) + di) & 0xFFFFF;
+		const uint8_t *d = mem_pages[dst >> 12].read;
+		uint32_t n = rep_run(dst, di, size);
+		if (n > max - done)
+			n = max - done;
+		if (!d || !n)
+			break;
+		uint32_t i;
+		if ((size == 1) && !machine_cpu.df && (reptype == 2)) {
+			const uint8_t *found = memchr(d + dst, machine_cpu.regs.byteregs[regal], n);
+			i = found ? (uint32_t)(found - (d + dst)) : n;
+		} else {
+			for (i = 0; i < n; i++) {
+				const uint32_t b = machine_cpu.df ? dst - i * size : dst + i * size;
+				if (size == 2 ?
+				    !rep_goes_on(reptype, machine_cpu.regs.wordregs[regax], d[b] | (d[b + 1] << 8)) :
+				    !rep_goes_on(reptype, machine_cpu.regs.byteregs[regal], d[b]))
+					break;
+			}
 		}
+		rep_advance(regdi, i, size);
+		machine_cpu.regs.wordregs[regcx] -= i;
+		done += i;
+		if (i < n)
+			break;
+	}
+	return done;
+}
+#endif
 
-		/*if ((((uint32_t)cpu.segregs[regcs] << 4) + (uint32_t)cpu.ip) ==
-		   0xFEC59) {
-				//printf("Entered F000:EC59, returning to ");
-				cpu.ip = pop();
-				cpu.segregs[regcs] = pop();
-				decodeflagsword(pop());
-				//printf("%04X:%04X\n", cpu.segregs[regcs], cpu.ip);
-				diskhandler();
-			}*/
 
-		int reptype = 0;
-		cpu.segoverride = 0;
-		cpu.useseg = cpu.segregs[regds];
-		docontinue = 0;
-		firstip = cpu.ip;
+#ifdef USE_PREFETCH_QUEUE
+#define FETCH_OPCODE() do { \
+	machine_cpu.savecs = machine_cpu.segregs[regcs]; \
+	machine_cpu.saveip = machine_cpu.ip; \
+	ea = segbase(machine_cpu.savecs) + (uint32_t)machine_cpu.saveip; \
+	if ((ea < prefetch_base) || (ea > (prefetch_base + 5))) { \
+		memcpy(&prefetch[0], &machine_ram[ea], 6); \
+		prefetch_base = ea; \
+	} \
+	opcode = prefetch[ea - prefetch_base]; \
+	StepIP(1); \
+} while (0)
+#else
+#define FETCH_OPCODE() do { \
+	machine_cpu.savecs = machine_cpu.segregs[regcs]; \
+	machine_cpu.saveip = machine_cpu.ip; \
+	opcode = getcode8(); \
+	StepIP(1); \
+} while (0)
+#endif
 
-		if ((cpu.segregs[regcs] == 0xF000) && (cpu.ip == 0xE066))
-			didbootstrap =
-			    0; // detect if we hit the BIOS entry point to clear
-			       // didbootstrap because we've rebooted
+// With the flow cache, prefixes are decoded together with the opcode, the
+// prefix handlers (in case of threaded dispatch) are never reached then.
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+#define DECODE_OPCODE()	opcode = flowcache_decode(&reptype)
+#else
+#define DECODE_OPCODE()	FETCH_OPCODE()
+#endif
 
-		uint8_t opcode;
-		while (!docontinue) {
-			cpu.segregs[regcs] = cpu.segregs[regcs] & 0xFFFF;
-			cpu.ip = cpu.ip & 0xFFFF;
-			cpu.savecs = cpu.segregs[regcs];
-			cpu.saveip = cpu.ip;
-#ifdef USE_PREFETCH_QUEUE
-			ea = segbase(cpu.savecs) + (uint32_t)cpu.saveip;
-			if ((ea < prefetch_base) ||
-			    (ea > (prefetch_base + 5))) {
-				memcpy(&prefetch[0], &RAM[ea], 6);
-				prefetch_base = ea;
-			}
-			opcode = prefetch[ea - prefetch_base];
+// Charges the opcode fetched by DECODE_OPCODE() to totalcycles. Without the
+// flow cache, the prefixes are charged by their own handlers as fetched.
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+#define CHARGE_OPCODE()	totalcycles += cycles_base[opcode] + 2U * (uint16_t)(machine_cpu.saveip - firstip)
 #else
-			//printf("EXEC @ %04X:%04X cpu.saveip=%04X\n", cpu.segregs[regcs], cpu.ip, cpu.saveip);
-			opcode = getmem8(cpu.segregs[regcs], cpu.ip);
+#define CHARGE_OPCODE()	totalcycles += cycles_base[opcode]
 #endif
-			StepIP(1);
+
+#ifdef CPU_PROFILER
+#define PROFILE_OPCODE()	prof_insn(opcode, reptype, machine_cpu.segoverride, machine_cpu.savecs, machine_cpu.saveip)
+#else
+#define PROFILE_OPCODE()	do { } while (0)
+#endif
+
+#ifdef CPU_THREADED_DISPATCH
+// Threaded dispatch: every opcode handler is a label, and the table below
+// holds their addresses. At the end of a handler, NEXT_OPCODE checks if the
+// instruction prologue has any work to do (see machine_attention()), or CS:IP
+// is a JIT entry or the BIOS entry point. If not, it resets the per-instruction
+// state, fetches the next opcode and jumps to its handler directly, without
+// going through the for() loop and switch() again.
+#define OPCODE(n)	op_##n
+#define OPCODE_ILLEGAL	op_illegal
+#define NEXT_OPCODE do { \
+	machine->attention--; \
+	if (UNLIKELY(++loopcount >= execloops) || \
+	    UNLIKELY(totalcycles >= machine->cycle_limit)) \
+		return; \
+	if (UNLIKELY(machine->attention < 0) || JIT_ENTRY() || BIOS_ENTRY_POINT()) \
+		goto instruction_prologue; \
+	reptype = 0; \
+	machine_cpu.segoverride = 0; \
+	machine_cpu.useseg = machine_cpu.segregs[regds]; \
+	firstip = machine_cpu.ip; \
+	DECODE_OPCODE(); \
+	totalexec++; \
+	CHARGE_OPCODE(); \
+	PROFILE_OPCODE(); \
+	goto *opcode_table[opcode]; \
+} while (0)
+#else
+#define OPCODE(n)	case n
+#define OPCODE_ILLEGAL	default
+#define NEXT_OPCODE	break
+#endif
+
+// A string instruction counts as two, itself and its re-dispatch (see
+// rep_bulk_limit()), except if it's the last one of the exec86() budget,
+// so the budget is never exceeded
+#define COUNT_STRING_OP() do { \
+	if (loopcount + 1 < execloops) { \
+		totalexec++; \
+		loopcount++; \
+	} \
+} while (0)
+
+#ifdef CPU_BULK_STRING_OPS
+// Fast forwards REP iterations by a rep_* helper, which are accounted as if
+// they were executed one by one
+#define REP_BULK(helper, ...) do { \
+	const unsigned int cycles = cycles_base[opcode] + 2U * (uint16_t)(machine_cpu.saveip - firstip); \
+	const uint32_t bulk = helper(rep_bulk_limit(loopcount, execloops, firstip, cycles), __VA_ARGS__); \
+	totalexec += 2 * bulk; \
+	machine->attention -= bulk; \
+	totalcycles += (uint64_t)bulk * cycles; \
+	loopcount += 2 * bulk; \
+} while (0)
+#else
+#define REP_BULK(helper, ...)	do { } while (0)
+#endif
+
+#ifdef CPU_SUPERINSTRUCTIONS
+const char *const cpu_fusion_names[FUSE_KINDS] = { "CMP+Jcc", "TEST+Jcc", "DEC+Jcc", "LODSB+STOSB" };
+
+// Condition of the Jcc opcode (70-7F) from the flags
+static INLINE int jcc_taken(uint8_t opcode) {
+	switch (opcode & 0xF) {
+		case 0x0: return FLAG_OF();
+		case 0x1: return !FLAG_OF();
+		case 0x2: return machine_cpu.cf;
+		case 0x3: return !machine_cpu.cf;
+		case 0x4: return FLAG_ZF();
+		case 0x5: return !FLAG_ZF();
+		case 0x6: return machine_cpu.cf || FLAG_ZF();
+		case 0x7: return !machine_cpu.cf && !FLAG_ZF();
+		case 0x8: return FLAG_SF();
+		case 0x9: return !FLAG_SF();
+		case 0xA: return FLAG_PF();
+		case 0xB: return !FLAG_PF();
+		case 0xC: return FLAG_SF() != FLAG_OF();
+		case 0xD: return FLAG_SF() == FLAG_OF();
+		case 0xE: return FLAG_ZF() || (FLAG_SF() != FLAG_OF());
+		default:  return !FLAG_ZF() && (FLAG_SF() == FLAG_OF());
+	}
+}
+
+// Condition of the Jcc opcode after CMP dst,src, straight from the operands
+// (signbit is 0x80 or 0x8000). Flipping the sign bits makes the signed order
+// the same as the unsigned one.
+static INLINE int jcc_cmp(uint8_t opcode, uint16_t dst, uint16_t src, uint16_t signbit) {
+	const uint16_t res = dst - src;
+	switch (opcode & 0xF) {
+		case 0x0: return ((dst ^ src) & (dst ^ res) & signbit) != 0;
+		case 0x1: return ((dst ^ src) & (dst ^ res) & signbit) == 0;
+		case 0x2: return dst < src;
+		case 0x3: return dst >= src;
+		case 0x4: return dst == src;
+		case 0x5: return dst != src;
+		case 0x6: return dst <= src;
+		case 0x7: return dst > src;
+		case 0x8: return (res & signbit) != 0;
+		case 0x9: return (res & signbit) == 0;
+		case 0xA: return parity[res & 0xFF];
+		case 0xB: return !parity[res & 0xFF];
+		case 0xC: return (dst ^ signbit) < (src ^ signbit);
+		case 0xD: return (dst ^ signbit) >= (src ^ signbit);
+		case 0xE: return (dst ^ signbit) <= (src ^ signbit);
+		default:  return (dst ^ signbit) > (src ^ signbit);
+	}
+}
+
+// Superinstructions: the handler of the first instruction of a pair runs the
+// second one as well, if it follows in the same flow cache block (decoded,
+// without prefixes), and NEXT_OPCODE would go to it directly anyway: not at
+// the end of the time slice, no prologue work due, not a JIT entry. So if an
+// interrupt or single step would come between them, they are not fused.
+#define FUSABLE(next, mask, op, length) ( \
+	fc_block && (next) < fc_block->insn + fc_block->count && \
+	(next)->ip == machine_cpu.ip && ((next)->flags & FC_DECODED) && \
+	((next)->opcode & (mask)) == (op) && !(next)->prefixes && (next)->len == (length) && \
+	machine->attention > 0 && loopcount + 1 < execloops && \
+	totalcycles < machine->cycle_limit && fc_epoch == flowcache_epoch && !JIT_ENTRY())
+
+// The dispatch part of NEXT_OPCODE for the second instruction
+#define FUSE_DISPATCH(next, kind) do { \
+	machine->attention--; \
+	loopcount++; \
+	reptype = 0; \
+	machine_cpu.segoverride = 0; \
+	machine_cpu.useseg = machine_cpu.segregs[regds]; \
+	firstip = machine_cpu.ip; \
+	fc_insn = (next); \
+	machine_cpu.savecs = machine_cpu.segregs[regcs]; \
+	machine_cpu.saveip = machine_cpu.ip++; \
+	opcode = (next)->opcode; \
+	totalexec++; \
+	CHARGE_OPCODE(); \
+	PROFILE_OPCODE(); \
+	machine->flowcache.fused[kind]++; \
+} while (0)
+
+// CMP/TEST/DEC + Jcc, the jump is taken if "taken" is true (opcode is the
+// one of the Jcc already when it's evaluated)
+#define FUSE_JCC(kind, taken) do { \
+	struct flowcache_insn *const next = fc_insn + 1; \
+	machine->flowcache.pairs[kind]++; \
+	if (FUSABLE(next, 0xF0, 0x70, 2)) { \
+		FUSE_DISPATCH(next, kind); \
+		const uint16_t rel = signext(getcode8()); \
+		StepIP(1); \
+		if (taken) \
+			JUMP_SHORT(rel); \
+	} \
+	NEXT_OPCODE; \
+} while (0)
+
+// LODSB + STOSB, the loop body of copying strings with a check or a
+// translation of each byte
+#define FUSE_STOSB() do { \
+	struct flowcache_insn *const next = fc_insn + 1; \
+	machine->flowcache.pairs[FUSE_LODSB_STOSB]++; \
+	if (FUSABLE(next, 0xFF, 0xAA, 1)) { \
+		FUSE_DISPATCH(next, FUSE_LODSB_STOSB); \
+		putmem8(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi], machine_cpu.regs.byteregs[regal]); \
+		if (machine_cpu.df) \
+			machine_cpu.regs.wordregs[regdi]--; \
+		else \
+			machine_cpu.regs.wordregs[regdi]++; \
+		COUNT_STRING_OP(); \
+	} \
+	NEXT_OPCODE; \
+} while (0)
+#else
+#define FUSE_JCC(kind, taken)	NEXT_OPCODE
+#define FUSE_STOSB()		NEXT_OPCODE
+#endif
+
+#define trap_toggle	(machine->trap_toggle)
+
+static void exec86_run(uint32_t execloops) {
+
+	static _Thread_local uint16_t firstip;
+#ifdef CPU_THREADED_DISPATCH
+	static const void *const opcode_table[0x100] = {
+		&&op_0x0, &&op_0x1, &&op_0x2, &&op_0x3, &&op_0x4, &&op_0x5, &&op_0x6, &&op_0x7,
+		&&op_0x8, &&op_0x9, &&op_0xA, &&op_0xB, &&op_0xC, &&op_0xD, &&op_0xE,
+#ifdef CPU_ALLOW_POP_CS
+		&&op_0xF,
+#else
+		&&op_illegal,
+#endif
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+		&&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+		&&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+		&&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+		&&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+		&&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+#ifndef CPU_8086
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+		&&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+#else
+		&&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+		&&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+#endif
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+		&&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+		&&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+		&&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+		&&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+		&&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+		&&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+		&&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+		&&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+		&&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+		&&op_0xF0, &&op_illegal, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+		&&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF,	};
+#elif !defined(CPU_INSTRUCTION_FLOW_CACHE)
+	uint8_t docontinue;
+#endif
+
+	// This seems not to be used anywhere, so commented out for now.
+	//counterticks = (uint64_t)((double)timerfreq / (double)65536.0);
+
+	for (uint32_t loopcount = 0; loopcount < execloops && totalcycles < machine->cycle_limit; loopcount++) {
+#ifdef CPU_THREADED_DISPATCH
+	instruction_prologue:
+#endif
+
+#ifdef CPU_THREADED_DISPATCH
+		// NEXT_OPCODE has already counted this instruction
+		if (UNLIKELY(machine->attention < 0)) {
+#else
+		if (UNLIKELY(--machine->attention < 0)) {
+#endif
+			if (!machine_running)
+				return;
+
+			timing();
+
+			if (trap_toggle) {
+				intcall86(1);
+			}
+
+			if (machine_cpu.tf) {
+				trap_toggle = 1;
+			} else {
+				trap_toggle = 0;
+			}
+
+			if (!trap_toggle && (machine_cpu.ifl && i8259.deliverable)) {
+				machine_cpu.hltstate = 0;
+				intcall86(nextintr()); /* get next interrupt from the
+							  i8259, if any */
+			}
+
+			if (machine_cpu.hltstate) {
+				// wait for the next interrupt, and give the
+				// rest of the time slice back to the caller
+				timing_halt(machine->cycle_limit - totalcycles);
+				totalcycles += CYCLES_HALTED;
+				machine->attention = -1;
+				return;
+			}
+
+			// the single step trap needs the prologue after every
+			// instruction, otherwise it comes back at the next multiple
+			// of TIMING_INTERVAL+1 instructions (or earlier, as string
+			// instructions count as two). This depends on totalexec
+			// only, so the JIT does not move these points either.
+			machine->attention = trap_toggle ? 0 : TIMING_INTERVAL - (totalexec & TIMING_INTERVAL);
+		}
+
+#ifdef USE_JIT
+		// Offer the rest of the budget to the translated code, if there is any for CS:IP.
+		// It stops before the end of the time slice and the next device event itself.
+		if (machine->jit && !trap_toggle) {
+			const uint32_t budget = execloops - loopcount;
+#ifdef CPU_PROFILER
+			prof_jit_begin();
+#endif
+			const uint32_t done = jit_exec(budget);
+#ifdef CPU_PROFILER
+			prof_jit_end(done);
+#endif
+			if (done) {
+				// no event was due at the timing() calls skipped meanwhile
+				totalexec += done;
+				loopcount += done - 1;
+				machine->attention = -1;
+				goto skipexecution;
+			}
+		}
+#endif
+
+		/*if ((((uint32_t)cpu.segregs[regcs] << 4) + (uint32_t)cpu.ip) ==
+		   0xFEC59) {
+				//printf("Entered F000:EC59, returning to ");
+				cpu.ip = pop();
+				cpu.segregs[regcs] = pop();
+				decodeflagsword(pop());
+				//printf("%04X:%04X\n", cpu.segregs[regcs], cpu.ip);
+				diskhandler();
+			}*/
+
+		int reptype = 0;
+		machine_cpu.segoverride = 0;
+		machine_cpu.useseg = machine_cpu.segregs[regds];
+		firstip = machine_cpu.ip;
+
+		if (BIOS_ENTRY_POINT())
+			set_didbootstrap(0);	// detect if we hit the BIOS entry point to clear
+						// didbootstrap because we've rebooted
+
+		uint8_t opcode;
+#ifdef CPU_THREADED_DISPATCH
+		// Prefixes are ordinary handlers here, which modify the state
+		// then dispatch the following byte of the same instruction.
+		DECODE_OPCODE();
+		totalexec++;
+		CHARGE_OPCODE();
+		PROFILE_OPCODE();
+		goto *opcode_table[opcode];
+		{
+		OPCODE(0x2E): /* segment cpu.segregs[regcs] */
+			machine_cpu.useseg = machine_cpu.segregs[regcs];
+			machine_cpu.segoverride = 1;
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
+			PROFILE_OPCODE();
+			goto *opcode_table[opcode];
+
+		OPCODE(0x3E): /* segment cpu.segregs[regds] */
+			machine_cpu.useseg = machine_cpu.segregs[regds];
+			machine_cpu.segoverride = 1;
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
+			PROFILE_OPCODE();
+			goto *opcode_table[opcode];
+
+		OPCODE(0x26): /* segment cpu.segregs[reges] */
+			machine_cpu.useseg = machine_cpu.segregs[reges];
+			machine_cpu.segoverride = 1;
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
+			PROFILE_OPCODE();
+			goto *opcode_table[opcode];
+
+		OPCODE(0x36): /* segment cpu.segregs[regss] */
+			machine_cpu.useseg = machine_cpu.segregs[regss];
+			machine_cpu.segoverride = 1;
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
+			PROFILE_OPCODE();
+			goto *opcode_table[opcode];
+
+		OPCODE(0xF3): /* REP/REPE/REPZ */
+			reptype = 1;
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
+			PROFILE_OPCODE();
+			goto *opcode_table[opcode];
+
+		OPCODE(0xF2): /* REPNE/REPNZ */
+			reptype = 2;
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
+			PROFILE_OPCODE();
+			goto *opcode_table[opcode];
+
+#elif defined(CPU_INSTRUCTION_FLOW_CACHE)
+		DECODE_OPCODE();
+		totalexec++;
+		CHARGE_OPCODE();
+		PROFILE_OPCODE();
+
+		switch (opcode) {
+#else
+		docontinue = 0;
+		while (!docontinue) {
+			FETCH_OPCODE();
+			totalcycles += cycles_base[opcode];
 
 			switch (opcode) {
 				/* segment prefix check */
 			case 0x2E: /* segment cpu.segregs[regcs] */
-				cpu.useseg = cpu.segregs[regcs];
-				cpu.segoverride = 1;
+				machine_cpu.useseg = machine_cpu.segregs[regcs];
+				machine_cpu.segoverride = 1;
 				break;
 
 			case 0x3E: /* segment cpu.segregs[regds] */
-				cpu.useseg = cpu.segregs[regds];
-				cpu.segoverride = 1;
+				machine_cpu.useseg = machine_cpu.segregs[regds];
+				machine_cpu.segoverride = 1;
 				break;
 
 			case 0x26: /* segment cpu.segregs[reges] */
-				cpu.useseg = cpu.segregs[reges];
-				cpu.segoverride = 1;
+				machine_cpu.useseg = machine_cpu.segregs[reges];
+				machine_cpu.segoverride = 1;
 				break;
 
 			case 0x36: /* segment cpu.segregs[regss] */
-				cpu.useseg = cpu.segregs[regss];
-				cpu.segoverride = 1;
+				machine_cpu.useseg = machine_cpu.segregs[regss];
+				machine_cpu.segoverride = 1;
 				break;
 
 				/* repetition prefix check */
@@ -1547,778 +2820,785 @@ void exec86(uint32_t execloops) {
 		}
 
 		totalexec++;
+		PROFILE_OPCODE();
 
 		switch (opcode) {
-		case 0x0: /* 00 ADD Eb Gb */
-			modregrm();
+#endif
+		OPCODE(0x0): /* 00 ADD Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_add8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x1: /* 01 ADD Ev Gv */
-			modregrm();
+		OPCODE(0x1): /* 01 ADD Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_add16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x2: /* 02 ADD Gb Eb */
-			modregrm();
+		OPCODE(0x2): /* 02 ADD Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_add8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x3: /* 03 ADD Gv Ev */
-			modregrm();
+		OPCODE(0x3): /* 03 ADD Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_add16();
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x4: /* 04 ADD cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x4): /* 04 ADD cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_add8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0x5: /* 05 ADD eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x5): /* 05 ADD eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_add16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
 
-		case 0x6: /* 06 PUSH cpu.segregs[reges] */
-			push(cpu.segregs[reges]);
-			break;
+		OPCODE(0x6): /* 06 PUSH cpu.segregs[reges] */
+			push(machine_cpu.segregs[reges]);
+			NEXT_OPCODE;
 
-		case 0x7: /* 07 POP cpu.segregs[reges] */
-			cpu.segregs[reges] = pop();
-			break;
+		OPCODE(0x7): /* 07 POP cpu.segregs[reges] */
+			machine_cpu.segregs[reges] = pop();
+			NEXT_OPCODE;
 
-		case 0x8: /* 08 OR Eb Gb */
-			modregrm();
+		OPCODE(0x8): /* 08 OR Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_or8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x9: /* 09 OR Ev Gv */
-			modregrm();
+		OPCODE(0x9): /* 09 OR Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_or16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0xA: /* 0A OR Gb Eb */
-			modregrm();
+		OPCODE(0xA): /* 0A OR Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_or8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB: /* 0B OR Gv Ev */
-			modregrm();
+		OPCODE(0xB): /* 0B OR Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_or16();
 			if ((oper1 == 0xF802) && (oper2 == 0xF802)) {
-				cpu.sf = 0; /* cheap hack to make Wolf 3D think
+				CPU_SYNC_FLAGS();
+				machine_cpu.sf = 0; /* cheap hack to make Wolf 3D think
 					   we're a 286 so it plays */
 			}
 
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0xC: /* 0C OR cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xC): /* 0C OR cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_or8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0xD: /* 0D OR eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xD): /* 0D OR eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_or16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
 
-		case 0xE: /* 0E PUSH cpu.segregs[regcs] */
-			push(cpu.segregs[regcs]);
-			break;
+		OPCODE(0xE): /* 0E PUSH cpu.segregs[regcs] */
+			push(machine_cpu.segregs[regcs]);
+			NEXT_OPCODE;
 
 #ifdef CPU_ALLOW_POP_CS	  // only the 8086/8088 does this.
-		case 0xF: // 0F POP CS
-			cpu.segregs[regcs] = pop();
-			break;
+		OPCODE(0xF): // 0F POP CS
+			machine_cpu.segregs[regcs] = pop();
+			NEXT_OPCODE;
 #endif
 
-		case 0x10: /* 10 ADC Eb Gb */
-			modregrm();
+		OPCODE(0x10): /* 10 ADC Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_adc8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x11: /* 11 ADC Ev Gv */
-			modregrm();
+		OPCODE(0x11): /* 11 ADC Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_adc16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x12: /* 12 ADC Gb Eb */
-			modregrm();
+		OPCODE(0x12): /* 12 ADC Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_adc8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x13: /* 13 ADC Gv Ev */
-			modregrm();
+		OPCODE(0x13): /* 13 ADC Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_adc16();
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x14: /* 14 ADC cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x14): /* 14 ADC cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_adc8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0x15: /* 15 ADC eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x15): /* 15 ADC eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_adc16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
 
-		case 0x16: /* 16 PUSH cpu.segregs[regss] */
-			push(cpu.segregs[regss]);
-			break;
+		OPCODE(0x16): /* 16 PUSH cpu.segregs[regss] */
+			push(machine_cpu.segregs[regss]);
+			NEXT_OPCODE;
 
-		case 0x17: /* 17 POP cpu.segregs[regss] */
-			cpu.segregs[regss] = pop();
-			break;
+		OPCODE(0x17): /* 17 POP cpu.segregs[regss] */
+			machine_cpu.segregs[regss] = pop();
+			NEXT_OPCODE;
 
-		case 0x18: /* 18 SBB Eb Gb */
-			modregrm();
+		OPCODE(0x18): /* 18 SBB Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_sbb8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x19: /* 19 SBB Ev Gv */
-			modregrm();
+		OPCODE(0x19): /* 19 SBB Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_sbb16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x1A: /* 1A SBB Gb Eb */
-			modregrm();
+		OPCODE(0x1A): /* 1A SBB Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_sbb8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x1B: /* 1B SBB Gv Ev */
-			modregrm();
+		OPCODE(0x1B): /* 1B SBB Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_sbb16();
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x1C: /* 1C SBB cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x1C): /* 1C SBB cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_sbb8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0x1D: /* 1D SBB eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x1D): /* 1D SBB eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_sbb16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
 
-		case 0x1E: /* 1E PUSH cpu.segregs[regds] */
-			push(cpu.segregs[regds]);
-			break;
+		OPCODE(0x1E): /* 1E PUSH cpu.segregs[regds] */
+			push(machine_cpu.segregs[regds]);
+			NEXT_OPCODE;
 
-		case 0x1F: /* 1F POP cpu.segregs[regds] */
-			cpu.segregs[regds] = pop();
-			break;
+		OPCODE(0x1F): /* 1F POP cpu.segregs[regds] */
+			machine_cpu.segregs[regds] = pop();
+			NEXT_OPCODE;
 
-		case 0x20: /* 20 AND Eb Gb */
-			modregrm();
+		OPCODE(0x20): /* 20 AND Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_and8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x21: /* 21 AND Ev Gv */
-			modregrm();
+		OPCODE(0x21): /* 21 AND Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_and16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x22: /* 22 AND Gb Eb */
-			modregrm();
+		OPCODE(0x22): /* 22 AND Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_and8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x23: /* 23 AND Gv Ev */
-			modregrm();
+		OPCODE(0x23): /* 23 AND Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_and16();
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x24: /* 24 AND cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x24): /* 24 AND cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_and8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0x25: /* 25 AND eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x25): /* 25 AND eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_and16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
-
-		case 0x27: /* 27 DAA */
-			if (((cpu.regs.byteregs[regal] & 0xF) > 9) || (cpu.af == 1)) {
-				oper1 = cpu.regs.byteregs[regal] + 6;
-				cpu.regs.byteregs[regal] = oper1 & 255;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
+
+		OPCODE(0x27): /* 27 DAA */
+			CPU_SYNC_FLAGS();
+			if (((machine_cpu.regs.byteregs[regal] & 0xF) > 9) || (machine_cpu.af == 1)) {
+				oper1 = machine_cpu.regs.byteregs[regal] + 6;
+				machine_cpu.regs.byteregs[regal] = oper1 & 255;
 				if (oper1 & 0xFF00) {
-					cpu.cf = 1;
+					machine_cpu.cf = 1;
 				} else {
-					cpu.cf = 0;
+					machine_cpu.cf = 0;
 				}
 
-				cpu.af = 1;
+				machine_cpu.af = 1;
 			} else {
 				// cpu.af = 0;
 			}
 
-			if ((cpu.regs.byteregs[regal] > 0x9F) || (cpu.cf == 1)) {
-				cpu.regs.byteregs[regal] =
-				    cpu.regs.byteregs[regal] + 0x60;
-				cpu.cf = 1;
+			if ((machine_cpu.regs.byteregs[regal] > 0x9F) || (machine_cpu.cf == 1)) {
+				machine_cpu.regs.byteregs[regal] =
+				    machine_cpu.regs.byteregs[regal] + 0x60;
+				machine_cpu.cf = 1;
 			} else {
 				// cpu.cf = 0;
 			}
 
-			cpu.regs.byteregs[regal] = cpu.regs.byteregs[regal] & 255;
-			flag_szp8(cpu.regs.byteregs[regal]);
-			break;
+			machine_cpu.regs.byteregs[regal] = machine_cpu.regs.byteregs[regal] & 255;
+			flag_szp8(machine_cpu.regs.byteregs[regal]);
+			NEXT_OPCODE;
 
-		case 0x28: /* 28 SUB Eb Gb */
-			modregrm();
+		OPCODE(0x28): /* 28 SUB Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_sub8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x29: /* 29 SUB Ev Gv */
-			modregrm();
+		OPCODE(0x29): /* 29 SUB Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_sub16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x2A: /* 2A SUB Gb Eb */
-			modregrm();
+		OPCODE(0x2A): /* 2A SUB Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_sub8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x2B: /* 2B SUB Gv Ev */
-			modregrm();
+		OPCODE(0x2B): /* 2B SUB Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_sub16();
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x2C: /* 2C SUB cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x2C): /* 2C SUB cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_sub8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0x2D: /* 2D SUB eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x2D): /* 2D SUB eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_sub16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
-
-		case 0x2F: /* 2F DAS */
-			if (((cpu.regs.byteregs[regal] & 15) > 9) || (cpu.af == 1)) {
-				oper1 = cpu.regs.byteregs[regal] - 6;
-				cpu.regs.byteregs[regal] = oper1 & 255;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
+
+		OPCODE(0x2F): /* 2F DAS */
+			CPU_SYNC_FLAGS();
+			if (((machine_cpu.regs.byteregs[regal] & 15) > 9) || (machine_cpu.af == 1)) {
+				oper1 = machine_cpu.regs.byteregs[regal] - 6;
+				machine_cpu.regs.byteregs[regal] = oper1 & 255;
 				if (oper1 & 0xFF00) {
-					cpu.cf = 1;
+					machine_cpu.cf = 1;
 				} else {
-					cpu.cf = 0;
+					machine_cpu.cf = 0;
 				}
 
-				cpu.af = 1;
+				machine_cpu.af = 1;
 			} else {
-				cpu.af = 0;
+				machine_cpu.af = 0;
 			}
 
-			if (((cpu.regs.byteregs[regal] & 0xF0) > 0x90) ||
-			    (cpu.cf == 1)) {
-				cpu.regs.byteregs[regal] = cpu.regs.byteregs[regal] - 0x60;
-				cpu.cf = 1;
+			if (((machine_cpu.regs.byteregs[regal] & 0xF0) > 0x90) ||
+			    (machine_cpu.cf == 1)) {
+				machine_cpu.regs.byteregs[regal] = machine_cpu.regs.byteregs[regal] - 0x60;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
 
-			flag_szp8(cpu.regs.byteregs[regal]);
-			break;
+			flag_szp8(machine_cpu.regs.byteregs[regal]);
+			NEXT_OPCODE;
 
-		case 0x30: /* 30 XOR Eb Gb */
-			modregrm();
+		OPCODE(0x30): /* 30 XOR Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			op_xor8();
 			writerm8(rm, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x31: /* 31 XOR Ev Gv */
-			modregrm();
+		OPCODE(0x31): /* 31 XOR Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			op_xor16();
 			writerm16(rm, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x32: /* 32 XOR Gb Eb */
-			modregrm();
+		OPCODE(0x32): /* 32 XOR Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			op_xor8();
 			setreg8(reg, res8);
-			break;
+			NEXT_OPCODE;
 
-		case 0x33: /* 33 XOR Gv Ev */
-			modregrm();
+		OPCODE(0x33): /* 33 XOR Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			op_xor16();
 			setreg16(reg, res16);
-			break;
+			NEXT_OPCODE;
 
-		case 0x34: /* 34 XOR cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x34): /* 34 XOR cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			op_xor8();
-			cpu.regs.byteregs[regal] = res8;
-			break;
+			machine_cpu.regs.byteregs[regal] = res8;
+			NEXT_OPCODE;
 
-		case 0x35: /* 35 XOR eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x35): /* 35 XOR eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			op_xor16();
-			cpu.regs.wordregs[regax] = res16;
-			break;
-
-		case 0x37: /* 37 AAA ASCII */
-			if (((cpu.regs.byteregs[regal] & 0xF) > 9) || (cpu.af == 1)) {
-				cpu.regs.byteregs[regal] = cpu.regs.byteregs[regal] + 6;
-				cpu.regs.byteregs[regah] = cpu.regs.byteregs[regah] + 1;
-				cpu.af = 1;
-				cpu.cf = 1;
+			machine_cpu.regs.wordregs[regax] = res16;
+			NEXT_OPCODE;
+
+		OPCODE(0x37): /* 37 AAA ASCII */
+			CPU_SYNC_FLAGS();
+			if (((machine_cpu.regs.byteregs[regal] & 0xF) > 9) || (machine_cpu.af == 1)) {
+				machine_cpu.regs.byteregs[regal] = machine_cpu.regs.byteregs[regal] + 6;
+				machine_cpu.regs.byteregs[regah] = machine_cpu.regs.byteregs[regah] + 1;
+				machine_cpu.af = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.af = 0;
-				cpu.cf = 0;
+				machine_cpu.af = 0;
+				machine_cpu.cf = 0;
 			}
 
-			cpu.regs.byteregs[regal] = cpu.regs.byteregs[regal] & 0xF;
-			break;
+			machine_cpu.regs.byteregs[regal] = machine_cpu.regs.byteregs[regal] & 0xF;
+			NEXT_OPCODE;
 
-		case 0x38: /* 38 CMP Eb Gb */
-			modregrm();
+		OPCODE(0x38): /* 38 CMP Eb Gb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = getreg8(reg);
 			flag_sub8(oper1b, oper2b);
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1b, oper2b, 0x80));
 
-		case 0x39: /* 39 CMP Ev Gv */
-			modregrm();
+		OPCODE(0x39): /* 39 CMP Ev Gv */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			oper2 = getreg16(reg);
 			flag_sub16(oper1, oper2);
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1, oper2, 0x8000));
 
-		case 0x3A: /* 3A CMP Gb Eb */
-			modregrm();
+		OPCODE(0x3A): /* 3A CMP Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			flag_sub8(oper1b, oper2b);
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1b, oper2b, 0x80));
 
-		case 0x3B: /* 3B CMP Gv Ev */
-			modregrm();
+		OPCODE(0x3B): /* 3B CMP Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			flag_sub16(oper1, oper2);
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1, oper2, 0x8000));
 
-		case 0x3C: /* 3C CMP cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x3C): /* 3C CMP cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			flag_sub8(oper1b, oper2b);
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1b, oper2b, 0x80));
 
-		case 0x3D: /* 3D CMP eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x3D): /* 3D CMP eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			flag_sub16(oper1, oper2);
-			break;
-
-		case 0x3F: /* 3F AAS ASCII */
-			if (((cpu.regs.byteregs[regal] & 0xF) > 9) || (cpu.af == 1)) {
-				cpu.regs.byteregs[regal] = cpu.regs.byteregs[regal] - 6;
-				cpu.regs.byteregs[regah] = cpu.regs.byteregs[regah] - 1;
-				cpu.af = 1;
-				cpu.cf = 1;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1, oper2, 0x8000));
+
+		OPCODE(0x3F): /* 3F AAS ASCII */
+			CPU_SYNC_FLAGS();
+			if (((machine_cpu.regs.byteregs[regal] & 0xF) > 9) || (machine_cpu.af == 1)) {
+				machine_cpu.regs.byteregs[regal] = machine_cpu.regs.byteregs[regal] - 6;
+				machine_cpu.regs.byteregs[regah] = machine_cpu.regs.byteregs[regah] - 1;
+				machine_cpu.af = 1;
+				machine_cpu.cf = 1;
 			} else {
-				cpu.af = 0;
-				cpu.cf = 0;
+				machine_cpu.af = 0;
+				machine_cpu.cf = 0;
 			}
 
-			cpu.regs.byteregs[regal] = cpu.regs.byteregs[regal] & 0xF;
-			break;
+			machine_cpu.regs.byteregs[regal] = machine_cpu.regs.byteregs[regal] & 0xF;
+			NEXT_OPCODE;
 
-		case 0x40: /* 40 INC eAX */
+		OPCODE(0x40): /* 40 INC eAX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regax];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regax];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regax] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regax] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x41: /* 41 INC eCX */
+		OPCODE(0x41): /* 41 INC eCX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regcx];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regcx];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regcx] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regcx] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x42: /* 42 INC eDX */
+		OPCODE(0x42): /* 42 INC eDX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regdx];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regdx];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regdx] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regdx] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x43: /* 43 INC eBX */
+		OPCODE(0x43): /* 43 INC eBX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regbx];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regbx];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regbx] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regbx] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x44: /* 44 INC eSP */
+		OPCODE(0x44): /* 44 INC eSP */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regsp];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regsp];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regsp] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regsp] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x45: /* 45 INC eBP */
+		OPCODE(0x45): /* 45 INC eBP */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regbp];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regbp];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regbp] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regbp] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x46: /* 46 INC eSI */
+		OPCODE(0x46): /* 46 INC eSI */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regsi];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regsi];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regsi] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regsi] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x47: /* 47 INC eDI */
+		OPCODE(0x47): /* 47 INC eDI */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regdi];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regdi];
 				oper2 = 1;
 				op_add16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regdi] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regdi] = res16;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x48: /* 48 DEC eAX */
+		OPCODE(0x48): /* 48 DEC eAX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regax];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regax];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regax] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regax] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x49: /* 49 DEC eCX */
+		OPCODE(0x49): /* 49 DEC eCX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regcx];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regcx];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regcx] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regcx] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x4A: /* 4A DEC eDX */
+		OPCODE(0x4A): /* 4A DEC eDX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regdx];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regdx];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regdx] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regdx] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x4B: /* 4B DEC eBX */
+		OPCODE(0x4B): /* 4B DEC eBX */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regbx];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regbx];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regbx] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regbx] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x4C: /* 4C DEC eSP */
+		OPCODE(0x4C): /* 4C DEC eSP */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regsp];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regsp];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regsp] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regsp] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x4D: /* 4D DEC eBP */
+		OPCODE(0x4D): /* 4D DEC eBP */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regbp];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regbp];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regbp] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regbp] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x4E: /* 4E DEC eSI */
+		OPCODE(0x4E): /* 4E DEC eSI */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regsi];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regsi];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regsi] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regsi] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x4F: /* 4F DEC eDI */
+		OPCODE(0x4F): /* 4F DEC eDI */
 			{
-				int oldcf = cpu.cf;
-				oper1 = cpu.regs.wordregs[regdi];
+				int oldcf = machine_cpu.cf;
+				oper1 = machine_cpu.regs.wordregs[regdi];
 				oper2 = 1;
 				op_sub16();
-				cpu.cf = oldcf;
-				cpu.regs.wordregs[regdi] = res16;
+				machine_cpu.cf = oldcf;
+				machine_cpu.regs.wordregs[regdi] = res16;
 			}
-			break;
+			FUSE_JCC(FUSE_DEC_JCC, jcc_taken(opcode));
 
-		case 0x50: /* 50 PUSH eAX */
-			push(cpu.regs.wordregs[regax]);
-			break;
+		OPCODE(0x50): /* 50 PUSH eAX */
+			push(machine_cpu.regs.wordregs[regax]);
+			NEXT_OPCODE;
 
-		case 0x51: /* 51 PUSH eCX */
-			push(cpu.regs.wordregs[regcx]);
-			break;
+		OPCODE(0x51): /* 51 PUSH eCX */
+			push(machine_cpu.regs.wordregs[regcx]);
+			NEXT_OPCODE;
 
-		case 0x52: /* 52 PUSH eDX */
-			push(cpu.regs.wordregs[regdx]);
-			break;
+		OPCODE(0x52): /* 52 PUSH eDX */
+			push(machine_cpu.regs.wordregs[regdx]);
+			NEXT_OPCODE;
 
-		case 0x53: /* 53 PUSH eBX */
-			push(cpu.regs.wordregs[regbx]);
-			break;
+		OPCODE(0x53): /* 53 PUSH eBX */
+			push(machine_cpu.regs.wordregs[regbx]);
+			NEXT_OPCODE;
 
-		case 0x54: /* 54 PUSH eSP */
+		OPCODE(0x54): /* 54 PUSH eSP */
 #ifdef USE_286_STYLE_PUSH_SP
-			push(cpu.regs.wordregs[regsp]);
+			push(machine_cpu.regs.wordregs[regsp]);
 #else
-			push(cpu.regs.wordregs[regsp] - 2);
+			push(machine_cpu.regs.wordregs[regsp] - 2);
 #endif
-			break;
+			NEXT_OPCODE;
 
-		case 0x55: /* 55 PUSH eBP */
-			push(cpu.regs.wordregs[regbp]);
-			break;
+		OPCODE(0x55): /* 55 PUSH eBP */
+			push(machine_cpu.regs.wordregs[regbp]);
+			NEXT_OPCODE;
 
-		case 0x56: /* 56 PUSH eSI */
-			push(cpu.regs.wordregs[regsi]);
-			break;
+		OPCODE(0x56): /* 56 PUSH eSI */
+			push(machine_cpu.regs.wordregs[regsi]);
+			NEXT_OPCODE;
 
-		case 0x57: /* 57 PUSH eDI */
-			push(cpu.regs.wordregs[regdi]);
-			break;
+		OPCODE(0x57): /* 57 PUSH eDI */
+			push(machine_cpu.regs.wordregs[regdi]);
+			NEXT_OPCODE;
 
-		case 0x58: /* 58 POP eAX */
-			cpu.regs.wordregs[regax] = pop();
-			break;
+		OPCODE(0x58): /* 58 POP eAX */
+			machine_cpu.regs.wordregs[regax] = pop();
+			NEXT_OPCODE;
 
-		case 0x59: /* 59 POP eCX */
-			cpu.regs.wordregs[regcx] = pop();
-			break;
+		OPCODE(0x59): /* 59 POP eCX */
+			machine_cpu.regs.wordregs[regcx] = pop();
+			NEXT_OPCODE;
 
-		case 0x5A: /* 5A POP eDX */
-			cpu.regs.wordregs[regdx] = pop();
-			break;
+		OPCODE(0x5A): /* 5A POP eDX */
+			machine_cpu.regs.wordregs[regdx] = pop();
+			NEXT_OPCODE;
 
-		case 0x5B: /* 5B POP eBX */
-			cpu.regs.wordregs[regbx] = pop();
-			break;
+		OPCODE(0x5B): /* 5B POP eBX */
+			machine_cpu.regs.wordregs[regbx] = pop();
+			NEXT_OPCODE;
 
-		case 0x5C: /* 5C POP eSP */
-			cpu.regs.wordregs[regsp] = pop();
-			break;
+		OPCODE(0x5C): /* 5C POP eSP */
+			machine_cpu.regs.wordregs[regsp] = pop();
+			NEXT_OPCODE;
 
-		case 0x5D: /* 5D POP eBP */
-			cpu.regs.wordregs[regbp] = pop();
-			break;
+		OPCODE(0x5D): /* 5D POP eBP */
+			machine_cpu.regs.wordregs[regbp] = pop();
+			NEXT_OPCODE;
 
-		case 0x5E: /* 5E POP eSI */
-			cpu.regs.wordregs[regsi] = pop();
-			break;
+		OPCODE(0x5E): /* 5E POP eSI */
+			machine_cpu.regs.wordregs[regsi] = pop();
+			NEXT_OPCODE;
 
-		case 0x5F: /* 5F POP eDI */
-			cpu.regs.wordregs[regdi] = pop();
-			break;
+		OPCODE(0x5F): /* 5F POP eDI */
+			machine_cpu.regs.wordregs[regdi] = pop();
+			NEXT_OPCODE;
 
 #ifndef CPU_8086
-		case 0x60: /* 60 PUSHA (80186+) */
+		OPCODE(0x60): /* 60 PUSHA (80186+) */
 			{
-			uint16_t oldsp = cpu.regs.wordregs[regsp];
-			push(cpu.regs.wordregs[regax]);
-			push(cpu.regs.wordregs[regcx]);
-			push(cpu.regs.wordregs[regdx]);
-			push(cpu.regs.wordregs[regbx]);
+			uint16_t oldsp = machine_cpu.regs.wordregs[regsp];
+			push(machine_cpu.regs.wordregs[regax]);
+			push(machine_cpu.regs.wordregs[regcx]);
+			push(machine_cpu.regs.wordregs[regdx]);
+			push(machine_cpu.regs.wordregs[regbx]);
 			push(oldsp);
-			push(cpu.regs.wordregs[regbp]);
-			push(cpu.regs.wordregs[regsi]);
-			push(cpu.regs.wordregs[regdi]);
+			push(machine_cpu.regs.wordregs[regbp]);
+			push(machine_cpu.regs.wordregs[regsi]);
+			push(machine_cpu.regs.wordregs[regdi]);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x61: /* 61 POPA (80186+) */
-			cpu.regs.wordregs[regdi] = pop();
-			cpu.regs.wordregs[regsi] = pop();
-			cpu.regs.wordregs[regbp] = pop();
+		OPCODE(0x61): /* 61 POPA (80186+) */
+			machine_cpu.regs.wordregs[regdi] = pop();
+			machine_cpu.regs.wordregs[regsi] = pop();
+			machine_cpu.regs.wordregs[regbp] = pop();
 			pop();	// result is not used
-			cpu.regs.wordregs[regbx] = pop();
-			cpu.regs.wordregs[regdx] = pop();
-			cpu.regs.wordregs[regcx] = pop();
-			cpu.regs.wordregs[regax] = pop();
-			break;
-
-		case 0x62: /* 62 BOUND Gv, Ev (80186+) */
-			modregrm();
+			machine_cpu.regs.wordregs[regbx] = pop();
+			machine_cpu.regs.wordregs[regdx] = pop();
+			machine_cpu.regs.wordregs[regcx] = pop();
+			machine_cpu.regs.wordregs[regax] = pop();
+			NEXT_OPCODE;
+
+		OPCODE(0x62): /* 62 BOUND Gv, Ev (80186+) */
+			modregrm(opcode);
 			getea(rm);
 			if (signext32(getreg16(reg)) <
 			    signext32(getmem16(ea >> 4, ea & 15))) {
@@ -2330,18 +3610,19 @@ void exec86(uint32_t execloops) {
 					intcall86(5); // bounds check exception
 				}
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x68: /* 68 PUSH Iv (80186+) */
-			push(getmem16(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0x68): /* 68 PUSH Iv (80186+) */
+			push(getcode16());
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0x69: /* 69 IMUL Gv Ev Iv (80186+) */
+		OPCODE(0x69): /* 69 IMUL Gv Ev Iv (80186+) */
+			CPU_SYNC_FLAGS();
 			{
-				modregrm();
+				modregrm(opcode);
 				uint32_t temp1 = readrm16(rm);
-				uint32_t temp2 = getmem16(cpu.segregs[regcs], cpu.ip);
+				uint32_t temp2 = getcode16();
 				StepIP(2);
 				if ((temp1 & 0x8000L) == 0x8000L) {
 					temp1 = temp1 | 0xFFFF0000L;
@@ -2352,25 +3633,26 @@ void exec86(uint32_t execloops) {
 				uint32_t temp3 = temp1 * temp2;
 				setreg16(reg, temp3 & 0xFFFFL);
 				if (temp3 & 0xFFFF0000L) {
-					cpu.cf = 1;
-					cpu.of = 1;
+					machine_cpu.cf = 1;
+					machine_cpu.of = 1;
 				} else {
-					cpu.cf = 0;
-					cpu.of = 0;
+					machine_cpu.cf = 0;
+					machine_cpu.of = 0;
 				}
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x6A: /* 6A PUSH Ib (80186+) */
-			push(getmem8(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0x6A): /* 6A PUSH Ib (80186+) */
+			push(getcode8());
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0x6B: /* 6B IMUL Gv Eb Ib (80186+) */
+		OPCODE(0x6B): /* 6B IMUL Gv Eb Ib (80186+) */
+			CPU_SYNC_FLAGS();
 			{
-				modregrm();
+				modregrm(opcode);
 				uint32_t temp1 = readrm16(rm);
-				uint32_t temp2 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint32_t temp2 = signext(getcode8());
 				StepIP(1);
 				if ((temp1 & 0x8000L) == 0x8000L) {
 					temp1 = temp1 | 0xFFFF0000L;
@@ -2381,277 +3663,273 @@ void exec86(uint32_t execloops) {
 				uint32_t temp3 = temp1 * temp2;
 				setreg16(reg, temp3 & 0xFFFFL);
 				if (temp3 & 0xFFFF0000L) {
-					cpu.cf = 1;
-					cpu.of = 1;
+					machine_cpu.cf = 1;
+					machine_cpu.of = 1;
 				} else {
-					cpu.cf = 0;
-					cpu.of = 0;
+					machine_cpu.cf = 0;
+					machine_cpu.of = 0;
 				}
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x6C: /* 6E INSB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0x6C): /* 6E INSB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
 
-			putmem8(cpu.useseg, cpu.regs.wordregs[regsi],
-				portin(cpu.regs.wordregs[regdx]));
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 1;
+			putmem8(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi],
+				portin(machine_cpu.regs.wordregs[regdx]));
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 1;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 1;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 1;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0x6D: /* 6F INSW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0x6D): /* 6F INSW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
 
-			putmem16(cpu.useseg, cpu.regs.wordregs[regsi],
-				 portin16(cpu.regs.wordregs[regdx]));
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 2;
+			putmem16(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi],
+				 portin16(machine_cpu.regs.wordregs[regdx]));
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 2;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 2;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 2;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0x6E: /* 6E OUTSB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0x6E): /* 6E OUTSB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
 
-			portout(cpu.regs.wordregs[regdx],
-				getmem8(cpu.useseg, cpu.regs.wordregs[regsi]));
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 1;
+			portout(machine_cpu.regs.wordregs[regdx],
+				getmem8(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]));
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 1;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 1;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 1;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0x6F: /* 6F OUTSW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0x6F): /* 6F OUTSW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
 
-			portout16(cpu.regs.wordregs[regdx],
-				  getmem16(cpu.useseg, cpu.regs.wordregs[regsi]));
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 2;
+			portout16(machine_cpu.regs.wordregs[regdx],
+				  getmem16(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]));
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 2;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 2;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 2;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 #endif
 
-		case 0x70: /* 70 JO Jb */
+		OPCODE(0x70): /* 70 JO Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.of)
-					cpu.ip = cpu.ip + temp16;
+				if (FLAG_OF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x71: /* 71 JNO Jb */
+		OPCODE(0x71): /* 71 JNO Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.of)
-					cpu.ip = cpu.ip + temp16;
+				if (!FLAG_OF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x72: /* 72 JB Jb */
+		OPCODE(0x72): /* 72 JB Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.cf)
-					cpu.ip = cpu.ip + temp16;
+				if (machine_cpu.cf)
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x73: /* 73 JNB Jb */
+		OPCODE(0x73): /* 73 JNB Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.cf)
-					cpu.ip = cpu.ip + temp16;
+				if (!machine_cpu.cf)
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x74: /* 74 JZ Jb */
+		OPCODE(0x74): /* 74 JZ Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.zf)
-					cpu.ip = cpu.ip + temp16;
+				if (FLAG_ZF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x75: /* 75 JNZ Jb */
+		OPCODE(0x75): /* 75 JNZ Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.zf)
-					cpu.ip = cpu.ip + temp16;
+				if (!FLAG_ZF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x76: /* 76 JBE Jb */
+		OPCODE(0x76): /* 76 JBE Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.cf || cpu.zf)
-					cpu.ip = cpu.ip + temp16;
+				if (machine_cpu.cf || FLAG_ZF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x77: /* 77 JA Jb */
+		OPCODE(0x77): /* 77 JA Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.cf && !cpu.zf)
-					cpu.ip = cpu.ip + temp16;
+				if (!machine_cpu.cf && !FLAG_ZF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x78: /* 78 JS Jb */
+		OPCODE(0x78): /* 78 JS Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.sf)
-					cpu.ip = cpu.ip + temp16;
+				if (FLAG_SF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x79: /* 79 JNS Jb */
+		OPCODE(0x79): /* 79 JNS Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.sf)
-					cpu.ip = cpu.ip + temp16;
+				if (!FLAG_SF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x7A: /* 7A JPE Jb */
+		OPCODE(0x7A): /* 7A JPE Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.pf)
-					cpu.ip = cpu.ip + temp16;
+				if (FLAG_PF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x7B: /* 7B JPO Jb */
+		OPCODE(0x7B): /* 7B JPO Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.pf)
-					cpu.ip = cpu.ip + temp16;
+				if (!FLAG_PF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x7C: /* 7C JL Jb */
+		OPCODE(0x7C): /* 7C JL Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.sf != cpu.of)
-					cpu.ip = cpu.ip + temp16;
+				if (FLAG_SF() != FLAG_OF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x7D: /* 7D JGE Jb */
+		OPCODE(0x7D): /* 7D JGE Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (cpu.sf == cpu.of)
-					cpu.ip = cpu.ip + temp16;
+				if (FLAG_SF() == FLAG_OF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x7E: /* 7E JLE Jb */
+		OPCODE(0x7E): /* 7E JLE Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if ((cpu.sf != cpu.of) || cpu.zf)
-					cpu.ip = cpu.ip + temp16;
+				if ((FLAG_SF() != FLAG_OF()) || FLAG_ZF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x7F: /* 7F JG Jb */
+		OPCODE(0x7F): /* 7F JG Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.zf && (cpu.sf == cpu.of))
-					cpu.ip = cpu.ip + temp16;
+				if (!FLAG_ZF() && (FLAG_SF() == FLAG_OF()))
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x80:
-		case 0x82: /* 80/82 GRP1 Eb Ib */
-			modregrm();
+		OPCODE(0x80):
+		OPCODE(0x82): /* 80/82 GRP1 Eb Ib */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+			oper2b = getcode8();
 			StepIP(1);
 			switch (reg) {
 			case 0:
@@ -2684,18 +3962,19 @@ void exec86(uint32_t execloops) {
 
 			if (reg < 7) {
 				writerm8(rm, res8);
+				NEXT_OPCODE;
 			}
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1b, oper2b, 0x80));
 
-		case 0x81: /* 81 GRP1 Ev Iv */
-		case 0x83: /* 83 GRP1 Ev Ib */
-			modregrm();
+		OPCODE(0x81): /* 81 GRP1 Ev Iv */
+		OPCODE(0x83): /* 83 GRP1 Ev Ib */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			if (opcode == 0x81) {
-				oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+				oper2 = getcode16();
 				StepIP(2);
 			} else {
-				oper2 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				oper2 = signext(getcode8());
 				StepIP(1);
 			}
 
@@ -2730,706 +4009,717 @@ void exec86(uint32_t execloops) {
 
 			if (reg < 7) {
 				writerm16(rm, res16);
+				NEXT_OPCODE;
 			}
-			break;
+			FUSE_JCC(FUSE_CMP_JCC, jcc_cmp(opcode, oper1, oper2, 0x8000));
 
-		case 0x84: /* 84 TEST Gb Eb */
-			modregrm();
+		OPCODE(0x84): /* 84 TEST Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			oper2b = readrm8(rm);
 			flag_log8(oper1b & oper2b);
-			break;
+			FUSE_JCC(FUSE_TEST_JCC, jcc_taken(opcode));
 
-		case 0x85: /* 85 TEST Gv Ev */
-			modregrm();
+		OPCODE(0x85): /* 85 TEST Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			oper2 = readrm16(rm);
 			flag_log16(oper1 & oper2);
-			break;
+			FUSE_JCC(FUSE_TEST_JCC, jcc_taken(opcode));
 
-		case 0x86: /* 86 XCHG Gb Eb */
-			modregrm();
+		OPCODE(0x86): /* 86 XCHG Gb Eb */
+			modregrm(opcode);
 			oper1b = getreg8(reg);
 			setreg8(reg, readrm8(rm));
 			writerm8(rm, oper1b);
-			break;
+			NEXT_OPCODE;
 
-		case 0x87: /* 87 XCHG Gv Ev */
-			modregrm();
+		OPCODE(0x87): /* 87 XCHG Gv Ev */
+			modregrm(opcode);
 			oper1 = getreg16(reg);
 			setreg16(reg, readrm16(rm));
 			writerm16(rm, oper1);
-			break;
+			NEXT_OPCODE;
 
-		case 0x88: /* 88 MOV Eb Gb */
-			modregrm();
+		OPCODE(0x88): /* 88 MOV Eb Gb */
+			modregrm(opcode);
 			writerm8(rm, getreg8(reg));
-			break;
+			NEXT_OPCODE;
 
-		case 0x89: /* 89 MOV Ev Gv */
-			modregrm();
+		OPCODE(0x89): /* 89 MOV Ev Gv */
+			modregrm(opcode);
 			writerm16(rm, getreg16(reg));
-			break;
+			NEXT_OPCODE;
 
-		case 0x8A: /* 8A MOV Gb Eb */
-			modregrm();
+		OPCODE(0x8A): /* 8A MOV Gb Eb */
+			modregrm(opcode);
 			setreg8(reg, readrm8(rm));
-			break;
+			NEXT_OPCODE;
 
-		case 0x8B: /* 8B MOV Gv Ev */
-			modregrm();
+		OPCODE(0x8B): /* 8B MOV Gv Ev */
+			modregrm(opcode);
 			setreg16(reg, readrm16(rm));
-			break;
+			NEXT_OPCODE;
 
-		case 0x8C: /* 8C MOV Ew Sw */
-			modregrm();
+		OPCODE(0x8C): /* 8C MOV Ew Sw */
+			modregrm(opcode);
 			writerm16(rm, getsegreg(reg));
-			break;
+			NEXT_OPCODE;
 
-		case 0x8D: /* 8D LEA Gv M */
-			modregrm();
+		OPCODE(0x8D): /* 8D LEA Gv M */
+			modregrm(opcode);
 			getea(rm);
-			setreg16(reg, ea - segbase(cpu.useseg));
-			break;
+			setreg16(reg, ea - segbase(machine_cpu.useseg));
+			NEXT_OPCODE;
 
-		case 0x8E: /* 8E MOV Sw Ew */
-			modregrm();
+		OPCODE(0x8E): /* 8E MOV Sw Ew */
+			modregrm(opcode);
 			putsegreg(reg, readrm16(rm));
-			break;
+			NEXT_OPCODE;
 
-		case 0x8F: /* 8F POP Ev */
-			modregrm();
+		OPCODE(0x8F): /* 8F POP Ev */
+			modregrm(opcode);
 			writerm16(rm, pop());
-			break;
-
-		case 0x90: /* 90 NOP */
-			break;
-
-		case 0x91: /* 91 XCHG eCX eAX */
-			oper1 = cpu.regs.wordregs[regcx];
-			cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x92: /* 92 XCHG eDX eAX */
-			oper1 = cpu.regs.wordregs[regdx];
-			cpu.regs.wordregs[regdx] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x93: /* 93 XCHG eBX eAX */
-			oper1 = cpu.regs.wordregs[regbx];
-			cpu.regs.wordregs[regbx] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x94: /* 94 XCHG eSP eAX */
-			oper1 = cpu.regs.wordregs[regsp];
-			cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x95: /* 95 XCHG eBP eAX */
-			oper1 = cpu.regs.wordregs[regbp];
-			cpu.regs.wordregs[regbp] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x96: /* 96 XCHG eSI eAX */
-			oper1 = cpu.regs.wordregs[regsi];
-			cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x97: /* 97 XCHG eDI eAX */
-			oper1 = cpu.regs.wordregs[regdi];
-			cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regax];
-			cpu.regs.wordregs[regax] = oper1;
-			break;
-
-		case 0x98: /* 98 CBW */
-			if ((cpu.regs.byteregs[regal] & 0x80) == 0x80) {
-				cpu.regs.byteregs[regah] = 0xFF;
+			NEXT_OPCODE;
+
+		OPCODE(0x90): /* 90 NOP */
+			NEXT_OPCODE;
+
+		OPCODE(0x91): /* 91 XCHG eCX eAX */
+			oper1 = machine_cpu.regs.wordregs[regcx];
+			machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x92): /* 92 XCHG eDX eAX */
+			oper1 = machine_cpu.regs.wordregs[regdx];
+			machine_cpu.regs.wordregs[regdx] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x93): /* 93 XCHG eBX eAX */
+			oper1 = machine_cpu.regs.wordregs[regbx];
+			machine_cpu.regs.wordregs[regbx] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x94): /* 94 XCHG eSP eAX */
+			oper1 = machine_cpu.regs.wordregs[regsp];
+			machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x95): /* 95 XCHG eBP eAX */
+			oper1 = machine_cpu.regs.wordregs[regbp];
+			machine_cpu.regs.wordregs[regbp] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x96): /* 96 XCHG eSI eAX */
+			oper1 = machine_cpu.regs.wordregs[regsi];
+			machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x97): /* 97 XCHG eDI eAX */
+			oper1 = machine_cpu.regs.wordregs[regdi];
+			machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regax];
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
+
+		OPCODE(0x98): /* 98 CBW */
+			if ((machine_cpu.regs.byteregs[regal] & 0x80) == 0x80) {
+				machine_cpu.regs.byteregs[regah] = 0xFF;
 			} else {
-				cpu.regs.byteregs[regah] = 0;
+				machine_cpu.regs.byteregs[regah] = 0;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x99: /* 99 CWD */
-			if ((cpu.regs.byteregs[regah] & 0x80) == 0x80) {
-				cpu.regs.wordregs[regdx] = 0xFFFF;
+		OPCODE(0x99): /* 99 CWD */
+			if ((machine_cpu.regs.byteregs[regah] & 0x80) == 0x80) {
+				machine_cpu.regs.wordregs[regdx] = 0xFFFF;
 			} else {
-				cpu.regs.wordregs[regdx] = 0;
+				machine_cpu.regs.wordregs[regdx] = 0;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x9A: /* 9A CALL Ap */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0x9A): /* 9A CALL Ap */
+			oper1 = getcode16();
 			StepIP(2);
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+			oper2 = getcode16();
 			StepIP(2);
-			push(cpu.segregs[regcs]);
-			push(cpu.ip);
-			cpu.ip = oper1;
-			cpu.segregs[regcs] = oper2;
-			break;
+			push(machine_cpu.segregs[regcs]);
+			push(machine_cpu.ip);
+			machine_cpu.ip = oper1;
+			machine_cpu.segregs[regcs] = oper2;
+			NEXT_OPCODE;
 
-		case 0x9B: /* 9B WAIT */
-			break;
+		OPCODE(0x9B): /* 9B WAIT */
+			NEXT_OPCODE;
 
-		case 0x9C: /* 9C PUSHF */
+		OPCODE(0x9C): /* 9C PUSHF */
 #ifdef CPU_SET_HIGH_FLAGS
 			push(makeflagsword() | 0xF800);
 #else
 			push(makeflagsword() | 0x0800);
 #endif
-			break;
+			NEXT_OPCODE;
 
-		case 0x9D: /* 9D POPF */
+		OPCODE(0x9D): /* 9D POPF */
 			{
 				uint16_t temp16 = pop();
 				decodeflagsword(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0x9E: /* 9E SAHF */
+		OPCODE(0x9E): /* 9E SAHF */
 			decodeflagsword((makeflagsword() & 0xFF00) |
-					cpu.regs.byteregs[regah]);
-			break;
+					machine_cpu.regs.byteregs[regah]);
+			NEXT_OPCODE;
 
-		case 0x9F: /* 9F LAHF */
-			cpu.regs.byteregs[regah] = makeflagsword() & 0xFF;
-			break;
+		OPCODE(0x9F): /* 9F LAHF */
+			machine_cpu.regs.byteregs[regah] = makeflagsword() & 0xFF;
+			NEXT_OPCODE;
 
-		case 0xA0: /* A0 MOV cpu.regs.byteregs[regal] Ob */
-			cpu.regs.byteregs[regal] =
-			    getmem8(cpu.useseg, getmem16(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0xA0): /* A0 MOV cpu.regs.byteregs[regal] Ob */
+			machine_cpu.regs.byteregs[regal] =
+			    getmem8(machine_cpu.useseg, getcode16());
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xA1: /* A1 MOV eAX Ov */
-			oper1 = getmem16(cpu.useseg, getmem16(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0xA1): /* A1 MOV eAX Ov */
+			oper1 = getmem16(machine_cpu.useseg, getcode16());
 			StepIP(2);
-			cpu.regs.wordregs[regax] = oper1;
-			break;
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
 
-		case 0xA2: /* A2 MOV Ob cpu.regs.byteregs[regal] */
-			putmem8(cpu.useseg, getmem16(cpu.segregs[regcs], cpu.ip),
-				cpu.regs.byteregs[regal]);
+		OPCODE(0xA2): /* A2 MOV Ob cpu.regs.byteregs[regal] */
+			putmem8(machine_cpu.useseg, getcode16(),
+				machine_cpu.regs.byteregs[regal]);
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xA3: /* A3 MOV Ov eAX */
-			putmem16(cpu.useseg, getmem16(cpu.segregs[regcs], cpu.ip),
-				 cpu.regs.wordregs[regax]);
+		OPCODE(0xA3): /* A3 MOV Ov eAX */
+			putmem16(machine_cpu.useseg, getcode16(),
+				 machine_cpu.regs.wordregs[regax]);
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xA4: /* A4 MOVSB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xA4): /* A4 MOVSB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_movs, 1);
 
-			putmem8(cpu.segregs[reges], cpu.regs.wordregs[regdi],
-				getmem8(cpu.useseg, cpu.regs.wordregs[regsi]));
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 1;
+			putmem8(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi],
+				getmem8(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]));
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 1;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 1;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 1;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xA5: /* A5 MOVSW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xA5): /* A5 MOVSW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_movs, 2);
 
-			putmem16(cpu.segregs[reges], cpu.regs.wordregs[regdi],
-				 getmem16(cpu.useseg, cpu.regs.wordregs[regsi]));
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 2;
+			putmem16(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi],
+				 getmem16(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]));
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 2;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 2;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 2;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xA6: /* A6 CMPSB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xA6): /* A6 CMPSB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_cmps, 1, reptype);
 
-			oper1b = getmem8(cpu.useseg, cpu.regs.wordregs[regsi]);
-			oper2b = getmem8(cpu.segregs[reges], cpu.regs.wordregs[regdi]);
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 1;
+			oper1b = getmem8(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]);
+			oper2b = getmem8(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi]);
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 1;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 1;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 1;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 1;
 			}
 
 			flag_sub8(oper1b, oper2b);
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			if ((reptype == 1) && !cpu.zf) {
-				break;
-			} else if ((reptype == 2) && (cpu.zf == 1)) {
-				break;
+			if ((reptype == 1) && !FLAG_ZF()) {
+				NEXT_OPCODE;
+			} else if ((reptype == 2) && (FLAG_ZF() == 1)) {
+				NEXT_OPCODE;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xA7: /* A7 CMPSW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xA7): /* A7 CMPSW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_cmps, 2, reptype);
 
-			oper1 = getmem16(cpu.useseg, cpu.regs.wordregs[regsi]);
-			oper2 = getmem16(cpu.segregs[reges], cpu.regs.wordregs[regdi]);
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 2;
+			oper1 = getmem16(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]);
+			oper2 = getmem16(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi]);
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 2;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 2;
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 2;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 2;
 			}
 
 			flag_sub16(oper1, oper2);
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			if ((reptype == 1) && !cpu.zf) {
-				break;
+			if ((reptype == 1) && !FLAG_ZF()) {
+				NEXT_OPCODE;
 			}
 
-			if ((reptype == 2) && (cpu.zf == 1)) {
-				break;
+			if ((reptype == 2) && (FLAG_ZF() == 1)) {
+				NEXT_OPCODE;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xA8: /* A8 TEST cpu.regs.byteregs[regal] Ib */
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xA8): /* A8 TEST cpu.regs.byteregs[regal] Ib */
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getcode8();
 			StepIP(1);
 			flag_log8(oper1b & oper2b);
-			break;
+			FUSE_JCC(FUSE_TEST_JCC, jcc_taken(opcode));
 
-		case 0xA9: /* A9 TEST eAX Iv */
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xA9): /* A9 TEST eAX Iv */
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getcode16();
 			StepIP(2);
 			flag_log16(oper1 & oper2);
-			break;
+			FUSE_JCC(FUSE_TEST_JCC, jcc_taken(opcode));
 
-		case 0xAA: /* AA STOSB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xAA): /* AA STOSB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_stos, 1);
 
-			putmem8(cpu.segregs[reges], cpu.regs.wordregs[regdi],
-				cpu.regs.byteregs[regal]);
-			if (cpu.df) {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 1;
+			putmem8(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi],
+				machine_cpu.regs.byteregs[regal]);
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 1;
 			} else {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 1;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xAB: /* AB STOSW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xAB): /* AB STOSW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_stos, 2);
 
-			putmem16(cpu.segregs[reges], cpu.regs.wordregs[regdi],
-				 cpu.regs.wordregs[regax]);
-			if (cpu.df) {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 2;
+			putmem16(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi],
+				 machine_cpu.regs.wordregs[regax]);
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 2;
 			} else {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 2;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xAC: /* AC LODSB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xAC): /* AC LODSB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_lods, 1);
 
-			cpu.regs.byteregs[regal] =
-			    getmem8(cpu.useseg, cpu.regs.wordregs[regsi]);
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 1;
+			machine_cpu.regs.byteregs[regal] =
+			    getmem8(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]);
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 1;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 1;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 1;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				FUSE_STOSB();
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xAD: /* AD LODSW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xAD): /* AD LODSW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_lods, 2);
 
-			oper1 = getmem16(cpu.useseg, cpu.regs.wordregs[regsi]);
-			cpu.regs.wordregs[regax] = oper1;
-			if (cpu.df) {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] - 2;
+			oper1 = getmem16(machine_cpu.useseg, machine_cpu.regs.wordregs[regsi]);
+			machine_cpu.regs.wordregs[regax] = oper1;
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] - 2;
 			} else {
-				cpu.regs.wordregs[regsi] = cpu.regs.wordregs[regsi] + 2;
+				machine_cpu.regs.wordregs[regsi] = machine_cpu.regs.wordregs[regsi] + 2;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xAE: /* AE SCASB */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xAE): /* AE SCASB */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_scas, 1, reptype);
 
-			oper1b = cpu.regs.byteregs[regal];
-			oper2b = getmem8(cpu.segregs[reges], cpu.regs.wordregs[regdi]);
+			oper1b = machine_cpu.regs.byteregs[regal];
+			oper2b = getmem8(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi]);
 			flag_sub8(oper1b, oper2b);
-			if (cpu.df) {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 1;
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 1;
 			} else {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 1;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 1;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			if ((reptype == 1) && !cpu.zf) {
-				break;
-			} else if ((reptype == 2) && (cpu.zf == 1)) {
-				break;
+			if ((reptype == 1) && !FLAG_ZF()) {
+				NEXT_OPCODE;
+			} else if ((reptype == 2) && (FLAG_ZF() == 1)) {
+				NEXT_OPCODE;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xAF: /* AF SCASW */
-			if (reptype && (cpu.regs.wordregs[regcx] == 0)) {
-				break;
+		OPCODE(0xAF): /* AF SCASW */
+			if (reptype && (machine_cpu.regs.wordregs[regcx] == 0)) {
+				NEXT_OPCODE;
 			}
+			if (reptype)
+				REP_BULK(rep_scas, 2, reptype);
 
-			oper1 = cpu.regs.wordregs[regax];
-			oper2 = getmem16(cpu.segregs[reges], cpu.regs.wordregs[regdi]);
+			oper1 = machine_cpu.regs.wordregs[regax];
+			oper2 = getmem16(machine_cpu.segregs[reges], machine_cpu.regs.wordregs[regdi]);
 			flag_sub16(oper1, oper2);
-			if (cpu.df) {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] - 2;
+			if (machine_cpu.df) {
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] - 2;
 			} else {
-				cpu.regs.wordregs[regdi] = cpu.regs.wordregs[regdi] + 2;
+				machine_cpu.regs.wordregs[regdi] = machine_cpu.regs.wordregs[regdi] + 2;
 			}
 
 			if (reptype) {
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
 			}
 
-			if ((reptype == 1) && !cpu.zf) {
-				break;
-			} else if ((reptype == 2) & (cpu.zf == 1)) {
-				break;
+			if ((reptype == 1) && !FLAG_ZF()) {
+				NEXT_OPCODE;
+			} else if ((reptype == 2) & (FLAG_ZF() == 1)) {
+				NEXT_OPCODE;
 			}
 
-			totalexec++;
-			loopcount++;
+			COUNT_STRING_OP();
 			if (!reptype) {
-				break;
+				NEXT_OPCODE;
 			}
 
-			cpu.ip = firstip;
-			break;
+			machine_cpu.ip = firstip;
+			NEXT_OPCODE;
 
-		case 0xB0: /* B0 MOV cpu.regs.byteregs[regal] Ib */
-			cpu.regs.byteregs[regal] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB0): /* B0 MOV cpu.regs.byteregs[regal] Ib */
+			machine_cpu.regs.byteregs[regal] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB1: /* B1 MOV cpu.regs.byteregs[regcl] Ib */
-			cpu.regs.byteregs[regcl] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB1): /* B1 MOV cpu.regs.byteregs[regcl] Ib */
+			machine_cpu.regs.byteregs[regcl] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB2: /* B2 MOV cpu.regs.byteregs[regdl] Ib */
-			cpu.regs.byteregs[regdl] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB2): /* B2 MOV cpu.regs.byteregs[regdl] Ib */
+			machine_cpu.regs.byteregs[regdl] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB3: /* B3 MOV cpu.regs.byteregs[regbl] Ib */
-			cpu.regs.byteregs[regbl] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB3): /* B3 MOV cpu.regs.byteregs[regbl] Ib */
+			machine_cpu.regs.byteregs[regbl] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB4: /* B4 MOV cpu.regs.byteregs[regah] Ib */
-			cpu.regs.byteregs[regah] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB4): /* B4 MOV cpu.regs.byteregs[regah] Ib */
+			machine_cpu.regs.byteregs[regah] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB5: /* B5 MOV cpu.regs.byteregs[regch] Ib */
-			cpu.regs.byteregs[regch] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB5): /* B5 MOV cpu.regs.byteregs[regch] Ib */
+			machine_cpu.regs.byteregs[regch] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB6: /* B6 MOV cpu.regs.byteregs[regdh] Ib */
-			cpu.regs.byteregs[regdh] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB6): /* B6 MOV cpu.regs.byteregs[regdh] Ib */
+			machine_cpu.regs.byteregs[regdh] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB7: /* B7 MOV cpu.regs.byteregs[regbh] Ib */
-			cpu.regs.byteregs[regbh] = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB7): /* B7 MOV cpu.regs.byteregs[regbh] Ib */
+			machine_cpu.regs.byteregs[regbh] = getcode8();
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xB8: /* B8 MOV eAX Iv */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB8): /* B8 MOV eAX Iv */
+			oper1 = getcode16();
 			StepIP(2);
-			cpu.regs.wordregs[regax] = oper1;
-			break;
+			machine_cpu.regs.wordregs[regax] = oper1;
+			NEXT_OPCODE;
 
-		case 0xB9: /* B9 MOV eCX Iv */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xB9): /* B9 MOV eCX Iv */
+			oper1 = getcode16();
 			StepIP(2);
-			cpu.regs.wordregs[regcx] = oper1;
-			break;
+			machine_cpu.regs.wordregs[regcx] = oper1;
+			NEXT_OPCODE;
 
-		case 0xBA: /* BA MOV eDX Iv */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xBA): /* BA MOV eDX Iv */
+			oper1 = getcode16();
 			StepIP(2);
-			cpu.regs.wordregs[regdx] = oper1;
-			break;
+			machine_cpu.regs.wordregs[regdx] = oper1;
+			NEXT_OPCODE;
 
-		case 0xBB: /* BB MOV eBX Iv */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xBB): /* BB MOV eBX Iv */
+			oper1 = getcode16();
 			StepIP(2);
-			cpu.regs.wordregs[regbx] = oper1;
-			break;
+			machine_cpu.regs.wordregs[regbx] = oper1;
+			NEXT_OPCODE;
 
-		case 0xBC: /* BC MOV eSP Iv */
-			cpu.regs.wordregs[regsp] = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xBC): /* BC MOV eSP Iv */
+			machine_cpu.regs.wordregs[regsp] = getcode16();
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xBD: /* BD MOV eBP Iv */
-			cpu.regs.wordregs[regbp] = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xBD): /* BD MOV eBP Iv */
+			machine_cpu.regs.wordregs[regbp] = getcode16();
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xBE: /* BE MOV eSI Iv */
-			cpu.regs.wordregs[regsi] = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xBE): /* BE MOV eSI Iv */
+			machine_cpu.regs.wordregs[regsi] = getcode16();
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xBF: /* BF MOV eDI Iv */
-			cpu.regs.wordregs[regdi] = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xBF): /* BF MOV eDI Iv */
+			machine_cpu.regs.wordregs[regdi] = getcode16();
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xC0: /* C0 GRP2 byte imm8 (80186+) */
-			modregrm();
+		OPCODE(0xC0): /* C0 GRP2 byte imm8 (80186+) */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
-			oper2b = getmem8(cpu.segregs[regcs], cpu.ip);
+			oper2b = getcode8();
 			StepIP(1);
 			writerm8(rm, op_grp2_8(oper2b));
-			break;
+			NEXT_OPCODE;
 
-		case 0xC1: /* C1 GRP2 word imm8 (80186+) */
-			modregrm();
+		OPCODE(0xC1): /* C1 GRP2 word imm8 (80186+) */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
-			oper2 = getmem8(cpu.segregs[regcs], cpu.ip);
+			oper2 = getcode8();
 			StepIP(1);
 			writerm16(rm, op_grp2_16((uint8_t)oper2));
-			break;
+			NEXT_OPCODE;
 
-		case 0xC2: /* C2 RET Iw */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
-			cpu.ip = pop();
-			cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regsp] + oper1;
-			break;
+		OPCODE(0xC2): /* C2 RET Iw */
+			oper1 = getcode16();
+			machine_cpu.ip = pop();
+			machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regsp] + oper1;
+			NEXT_OPCODE;
 
-		case 0xC3: /* C3 RET */
-			cpu.ip = pop();
-			break;
+		OPCODE(0xC3): /* C3 RET */
+			machine_cpu.ip = pop();
+			NEXT_OPCODE;
 
-		case 0xC4: /* C4 LES Gv Mp */
-			modregrm();
+		OPCODE(0xC4): /* C4 LES Gv Mp */
+			modregrm(opcode);
 			getea(rm);
 			setreg16(reg, read86(ea) + read86(ea + 1) * 256);
-			cpu.segregs[reges] = read86(ea + 2) + read86(ea + 3) * 256;
-			break;
+			machine_cpu.segregs[reges] = read86(ea + 2) + read86(ea + 3) * 256;
+			NEXT_OPCODE;
 
-		case 0xC5: /* C5 LDS Gv Mp */
-			modregrm();
+		OPCODE(0xC5): /* C5 LDS Gv Mp */
+			modregrm(opcode);
 			getea(rm);
 			setreg16(reg, read86(ea) + read86(ea + 1) * 256);
-			cpu.segregs[regds] = read86(ea + 2) + read86(ea + 3) * 256;
-			break;
+			machine_cpu.segregs[regds] = read86(ea + 2) + read86(ea + 3) * 256;
+			NEXT_OPCODE;
 
-		case 0xC6: /* C6 MOV Eb Ib */
-			modregrm();
-			writerm8(rm, getmem8(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0xC6): /* C6 MOV Eb Ib */
+			modregrm(opcode);
+			writerm8(rm, getcode8());
 			StepIP(1);
-			break;
+			NEXT_OPCODE;
 
-		case 0xC7: /* C7 MOV Ev Iv */
-			modregrm();
-			writerm16(rm, getmem16(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0xC7): /* C7 MOV Ev Iv */
+			modregrm(opcode);
+			writerm16(rm, getcode16());
 			StepIP(2);
-			break;
+			NEXT_OPCODE;
 
-		case 0xC8: /* C8 ENTER (80186+) */
-			stacksize = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xC8): /* C8 ENTER (80186+) */
+			stacksize = getcode16();
 			StepIP(2);
-			nestlev = getmem8(cpu.segregs[regcs], cpu.ip);
+			nestlev = getcode8();
 			StepIP(1);
-			push(cpu.regs.wordregs[regbp]);
-			frametemp = cpu.regs.wordregs[regsp];
+			push(machine_cpu.regs.wordregs[regbp]);
+			frametemp = machine_cpu.regs.wordregs[regsp];
 			if (nestlev) {
 				for (int a = 1; a < nestlev; a++) {
-					cpu.regs.wordregs[regbp] =
-					    cpu.regs.wordregs[regbp] - 2;
-					push(cpu.regs.wordregs[regbp]);
+					machine_cpu.regs.wordregs[regbp] =
+					    machine_cpu.regs.wordregs[regbp] - 2;
+					push(machine_cpu.regs.wordregs[regbp]);
 				}
 
-				push(cpu.regs.wordregs[regsp]);
+				push(machine_cpu.regs.wordregs[regsp]);
 			}
 
-			cpu.regs.wordregs[regbp] = frametemp;
-			cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regbp] - stacksize;
+			machine_cpu.regs.wordregs[regbp] = frametemp;
+			machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regbp] - stacksize;
 
-			break;
+			NEXT_OPCODE;
 
-		case 0xC9: /* C9 LEAVE (80186+) */
-			cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regbp];
-			cpu.regs.wordregs[regbp] = pop();
-			break;
+		OPCODE(0xC9): /* C9 LEAVE (80186+) */
+			machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regbp];
+			machine_cpu.regs.wordregs[regbp] = pop();
+			NEXT_OPCODE;
 
-		case 0xCA: /* CA RETF Iw */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
-			cpu.ip = pop();
-			cpu.segregs[regcs] = pop();
-			cpu.regs.wordregs[regsp] = cpu.regs.wordregs[regsp] + oper1;
-			break;
+		OPCODE(0xCA): /* CA RETF Iw */
+			oper1 = getcode16();
+			machine_cpu.ip = pop();
+			machine_cpu.segregs[regcs] = pop();
+			machine_cpu.regs.wordregs[regsp] = machine_cpu.regs.wordregs[regsp] + oper1;
+			NEXT_OPCODE;
 
-		case 0xCB: /* CB RETF */
-			cpu.ip = pop();
+		OPCODE(0xCB): /* CB RETF */
+			machine_cpu.ip = pop();
 			;
-			cpu.segregs[regcs] = pop();
-			break;
+			machine_cpu.segregs[regcs] = pop();
+			NEXT_OPCODE;
 
-		case 0xCC: /* CC INT 3 */
+		OPCODE(0xCC): /* CC INT 3 */
 			intcall86(3);
-			break;
+			NEXT_OPCODE;
 
-		case 0xCD: /* CD INT Ib */
-			oper1b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xCD): /* CD INT Ib */
+			oper1b = getcode8();
 			StepIP(1);
 			intcall86(oper1b);
-			break;
+			NEXT_OPCODE;
 
-		case 0xCE: /* CE INTO */
-			if (cpu.of) {
+		OPCODE(0xCE): /* CE INTO */
+			if (FLAG_OF()) {
 				intcall86(4);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xCF: /* CF IRET */
+		OPCODE(0xCF): /* CF IRET */
 			cpu_IRET();
 			/*cpu.ip = pop();
 			cpu.segregs[regcs] = pop();
@@ -3438,277 +4728,282 @@ void exec86(uint32_t execloops) {
 			/*
 			 * if (net.enabled) net.canrecv = 1;
 			 */
-			break;
+			NEXT_OPCODE;
 
-		case 0xD0: /* D0 GRP2 Eb 1 */
-			modregrm();
+		OPCODE(0xD0): /* D0 GRP2 Eb 1 */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			writerm8(rm, op_grp2_8(1));
-			break;
+			NEXT_OPCODE;
 
-		case 0xD1: /* D1 GRP2 Ev 1 */
-			modregrm();
+		OPCODE(0xD1): /* D1 GRP2 Ev 1 */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			writerm16(rm, op_grp2_16(1));
-			break;
+			NEXT_OPCODE;
 
-		case 0xD2: /* D2 GRP2 Eb cpu.regs.byteregs[regcl] */
-			modregrm();
+		OPCODE(0xD2): /* D2 GRP2 Eb cpu.regs.byteregs[regcl] */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
-			writerm8(rm, op_grp2_8(cpu.regs.byteregs[regcl]));
-			break;
+			writerm8(rm, op_grp2_8(machine_cpu.regs.byteregs[regcl]));
+			NEXT_OPCODE;
 
-		case 0xD3: /* D3 GRP2 Ev cpu.regs.byteregs[regcl] */
-			modregrm();
+		OPCODE(0xD3): /* D3 GRP2 Ev cpu.regs.byteregs[regcl] */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
-			writerm16(rm, op_grp2_16(cpu.regs.byteregs[regcl]));
-			break;
+			writerm16(rm, op_grp2_16(machine_cpu.regs.byteregs[regcl]));
+			NEXT_OPCODE;
 
-		case 0xD4: /* D4 AAM I0 */
-			oper1 = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xD4): /* D4 AAM I0 */
+			oper1 = getcode8();
 			StepIP(1);
 			if (!oper1) {
 				intcall86(0);
-				break;
+				NEXT_OPCODE;
 			} /* division by zero */
 
-			cpu.regs.byteregs[regah] =
-			    (cpu.regs.byteregs[regal] / oper1) & 255;
-			cpu.regs.byteregs[regal] =
-			    (cpu.regs.byteregs[regal] % oper1) & 255;
-			flag_szp16(cpu.regs.wordregs[regax]);
-			break;
-
-		case 0xD5: /* D5 AAD I0 */
-			oper1 = getmem8(cpu.segregs[regcs], cpu.ip);
+			CPU_SYNC_FLAGS();
+			machine_cpu.regs.byteregs[regah] =
+			    (machine_cpu.regs.byteregs[regal] / oper1) & 255;
+			machine_cpu.regs.byteregs[regal] =
+			    (machine_cpu.regs.byteregs[regal] % oper1) & 255;
+			flag_szp16(machine_cpu.regs.wordregs[regax]);
+			NEXT_OPCODE;
+
+		OPCODE(0xD5): /* D5 AAD I0 */
+			CPU_SYNC_FLAGS();
+			oper1 = getcode8();
 			StepIP(1);
-			cpu.regs.byteregs[regal] = (cpu.regs.byteregs[regah] * oper1 +
-						cpu.regs.byteregs[regal]) &
+			machine_cpu.regs.byteregs[regal] = (machine_cpu.regs.byteregs[regah] * oper1 +
+						machine_cpu.regs.byteregs[regal]) &
 					       255;
-			cpu.regs.byteregs[regah] = 0;
-			flag_szp16(cpu.regs.byteregs[regah] * oper1 +
-				   cpu.regs.byteregs[regal]);
-			cpu.sf = 0;
-			break;
+			machine_cpu.regs.byteregs[regah] = 0;
+			flag_szp16(machine_cpu.regs.byteregs[regah] * oper1 +
+				   machine_cpu.regs.byteregs[regal]);
+			machine_cpu.sf = 0;
+			NEXT_OPCODE;
 
-		case 0xD6: /* D6 XLAT on V20/V30, SALC on 8086/8088 */
+		OPCODE(0xD6): /* D6 XLAT on V20/V30, SALC on 8086/8088 */
 #ifndef CPU_NO_SALC
-			cpu.regs.byteregs[regal] = cpu.cf ? 0xFF : 0x00;
-			break;
+			machine_cpu.regs.byteregs[regal] = machine_cpu.cf ? 0xFF : 0x00;
+			NEXT_OPCODE;
 #endif
 
-		case 0xD7: /* D7 XLAT */
-			cpu.regs.byteregs[regal] =
-			    read86(cpu.useseg * 16 + (cpu.regs.wordregs[regbx]) +
-				   cpu.regs.byteregs[regal]);
-			break;
-
-		case 0xD8:
-		case 0xD9:
-		case 0xDA:
-		case 0xDB:
-		case 0xDC:
-		case 0xDE:
-		case 0xDD:
-		case 0xDF: /* escape to x87 FPU (unsupported) */
-			modregrm();
-			break;
-
-		case 0xE0: /* E0 LOOPNZ Jb */
+		OPCODE(0xD7): /* D7 XLAT */
+			machine_cpu.regs.byteregs[regal] =
+			    read86(machine_cpu.useseg * 16 + (machine_cpu.regs.wordregs[regbx]) +
+				   machine_cpu.regs.byteregs[regal]);
+			NEXT_OPCODE;
+
+		OPCODE(0xD8):
+		OPCODE(0xD9):
+		OPCODE(0xDA):
+		OPCODE(0xDB):
+		OPCODE(0xDC):
+		OPCODE(0xDE):
+		OPCODE(0xDD):
+		OPCODE(0xDF): /* escape to x87 FPU (unsupported) */
+			modregrm(opcode);
+			NEXT_OPCODE;
+
+		OPCODE(0xE0): /* E0 LOOPNZ Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
-				if ((cpu.regs.wordregs[regcx]) && !cpu.zf)
-					cpu.ip = cpu.ip + temp16;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
+				if ((machine_cpu.regs.wordregs[regcx]) && !FLAG_ZF())
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xE1: /* E1 LOOPZ Jb */
+		OPCODE(0xE1): /* E1 LOOPZ Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
-				if (cpu.regs.wordregs[regcx] && (cpu.zf == 1))
-					cpu.ip = cpu.ip + temp16;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
+				if (machine_cpu.regs.wordregs[regcx] && (FLAG_ZF() == 1))
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xE2: /* E2 LOOP Jb */
+		OPCODE(0xE2): /* E2 LOOP Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				cpu.regs.wordregs[regcx] = cpu.regs.wordregs[regcx] - 1;
-				if (cpu.regs.wordregs[regcx])
-					cpu.ip = cpu.ip + temp16;
+				machine_cpu.regs.wordregs[regcx] = machine_cpu.regs.wordregs[regcx] - 1;
+				if (machine_cpu.regs.wordregs[regcx])
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xE3: /* E3 JCXZ Jb */
+		OPCODE(0xE3): /* E3 JCXZ Jb */
 			{
-				uint16_t temp16 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+				uint16_t temp16 = signext(getcode8());
 				StepIP(1);
-				if (!cpu.regs.wordregs[regcx])
-					cpu.ip = cpu.ip + temp16;
+				if (!machine_cpu.regs.wordregs[regcx])
+					JUMP_SHORT(temp16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xE4: /* E4 IN cpu.regs.byteregs[regal] Ib */
-			oper1b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xE4): /* E4 IN cpu.regs.byteregs[regal] Ib */
+			oper1b = getcode8();
 			StepIP(1);
-			cpu.regs.byteregs[regal] = (uint8_t)portin(oper1b);
-			break;
+			machine_cpu.regs.byteregs[regal] = (uint8_t)portin(oper1b);
+			NEXT_OPCODE;
 
-		case 0xE5: /* E5 IN eAX Ib */
-			oper1b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xE5): /* E5 IN eAX Ib */
+			oper1b = getcode8();
 			StepIP(1);
-			cpu.regs.wordregs[regax] = portin16(oper1b);
-			break;
+			machine_cpu.regs.wordregs[regax] = portin16(oper1b);
+			NEXT_OPCODE;
 
-		case 0xE6: /* E6 OUT Ib cpu.regs.byteregs[regal] */
-			oper1b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xE6): /* E6 OUT Ib cpu.regs.byteregs[regal] */
+			oper1b = getcode8();
 			StepIP(1);
-			portout(oper1b, cpu.regs.byteregs[regal]);
-			break;
+			portout(oper1b, machine_cpu.regs.byteregs[regal]);
+			NEXT_OPCODE;
 
-		case 0xE7: /* E7 OUT Ib eAX */
-			oper1b = getmem8(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xE7): /* E7 OUT Ib eAX */
+			oper1b = getcode8();
 			StepIP(1);
-			portout16(oper1b, cpu.regs.wordregs[regax]);
-			break;
+			portout16(oper1b, machine_cpu.regs.wordregs[regax]);
+			NEXT_OPCODE;
 
-		case 0xE8: /* E8 CALL Jv */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xE8): /* E8 CALL Jv */
+			oper1 = getcode16();
 			StepIP(2);
-			push(cpu.ip);
-			cpu.ip = cpu.ip + oper1;
-			break;
+			push(machine_cpu.ip);
+			machine_cpu.ip = machine_cpu.ip + oper1;
+			NEXT_OPCODE;
 
-		case 0xE9: /* E9 JMP Jv */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xE9): /* E9 JMP Jv */
+			oper1 = getcode16();
 			StepIP(2);
-			cpu.ip = cpu.ip + oper1;
-			break;
+			machine_cpu.ip = machine_cpu.ip + oper1;
+			NEXT_OPCODE;
 
-		case 0xEA: /* EA JMP Ap */
-			oper1 = getmem16(cpu.segregs[regcs], cpu.ip);
+		OPCODE(0xEA): /* EA JMP Ap */
+			oper1 = getcode16();
 			StepIP(2);
-			oper2 = getmem16(cpu.segregs[regcs], cpu.ip);
-			cpu.ip = oper1;
-			cpu.segregs[regcs] = oper2;
-			break;
+			oper2 = getcode16();
+			machine_cpu.ip = oper1;
+			machine_cpu.segregs[regcs] = oper2;
+			NEXT_OPCODE;
 
-		case 0xEB: /* EB JMP Jb */
-			oper1 = signext(getmem8(cpu.segregs[regcs], cpu.ip));
+		OPCODE(0xEB): /* EB JMP Jb */
+			oper1 = signext(getcode8());
 			StepIP(1);
-			cpu.ip = cpu.ip + oper1;
-			break;
+			machine_cpu.ip = machine_cpu.ip + oper1;
+			NEXT_OPCODE;
 
-		case 0xEC: /* EC IN cpu.regs.byteregs[regal] regdx */
-			oper1 = cpu.regs.wordregs[regdx];
-			cpu.regs.byteregs[regal] = (uint8_t)portin(oper1);
-			break;
+		OPCODE(0xEC): /* EC IN cpu.regs.byteregs[regal] regdx */
+			oper1 = machine_cpu.regs.wordregs[regdx];
+			machine_cpu.regs.byteregs[regal] = (uint8_t)portin(oper1);
+			NEXT_OPCODE;
 
-		case 0xED: /* ED IN eAX regdx */
-			oper1 = cpu.regs.wordregs[regdx];
-			cpu.regs.wordregs[regax] = portin16(oper1);
-			break;
+		OPCODE(0xED): /* ED IN eAX regdx */
+			oper1 = machine_cpu.regs.wordregs[regdx];
+			machine_cpu.regs.wordregs[regax] = portin16(oper1);
+			NEXT_OPCODE;
 
-		case 0xEE: /* EE OUT regdx cpu.regs.byteregs[regal] */
-			oper1 = cpu.regs.wordregs[regdx];
-			portout(oper1, cpu.regs.byteregs[regal]);
-			break;
+		OPCODE(0xEE): /* EE OUT regdx cpu.regs.byteregs[regal] */
+			oper1 = machine_cpu.regs.wordregs[regdx];
+			portout(oper1, machine_cpu.regs.byteregs[regal]);
+			NEXT_OPCODE;
 
-		case 0xEF: /* EF OUT regdx eAX */
-			oper1 = cpu.regs.wordregs[regdx];
-			portout16(oper1, cpu.regs.wordregs[regax]);
-			break;
+		OPCODE(0xEF): /* EF OUT regdx eAX */
+			oper1 = machine_cpu.regs.wordregs[regdx];
+			portout16(oper1, machine_cpu.regs.wordregs[regax]);
+			NEXT_OPCODE;
 
-		case 0xF0: /* F0 LOCK */
-			break;
+		OPCODE(0xF0): /* F0 LOCK */
+			NEXT_OPCODE;
 
-		case 0xF4: /* F4 HLT */
+		OPCODE(0xF4): /* F4 HLT */
 			// HLT can be used as trap. We call this implementation to tell, if it's really a halt or just a trap
-			if (cpu_hlt_handler())
-				cpu.hltstate = 1;
-			break;
+			if (cpu_hlt_handler()) {
+				machine_cpu.hltstate = 1;
+				machine_attention();
+			}
+			NEXT_OPCODE;
 
-		case 0xF5: /* F5 CMC */
-			if (!cpu.cf) {
-				cpu.cf = 1;
+		OPCODE(0xF5): /* F5 CMC */
+			if (!machine_cpu.cf) {
+				machine_cpu.cf = 1;
 			} else {
-				cpu.cf = 0;
+				machine_cpu.cf = 0;
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xF6: /* F6 GRP3a Eb */
-			modregrm();
+		OPCODE(0xF6): /* F6 GRP3a Eb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			op_grp3_8();
 			if ((reg > 1) && (reg < 4)) {
 				writerm8(rm, res8);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xF7: /* F7 GRP3b Ev */
-			modregrm();
+		OPCODE(0xF7): /* F7 GRP3b Ev */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			op_grp3_16();
 			if ((reg > 1) && (reg < 4)) {
 				writerm16(rm, res16);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xF8: /* F8 CLC */
-			cpu.cf = 0;
-			break;
+		OPCODE(0xF8): /* F8 CLC */
+			machine_cpu.cf = 0;
+			NEXT_OPCODE;
 
-		case 0xF9: /* F9 STC */
-			cpu.cf = 1;
-			break;
+		OPCODE(0xF9): /* F9 STC */
+			machine_cpu.cf = 1;
+			NEXT_OPCODE;
 
-		case 0xFA: /* FA CLI */
-			cpu.ifl = 0;
-			break;
+		OPCODE(0xFA): /* FA CLI */
+			machine_cpu.ifl = 0;
+			NEXT_OPCODE;
 
-		case 0xFB: /* FB STI */
-			cpu.ifl = 1;
-			break;
+		OPCODE(0xFB): /* FB STI */
+			machine_cpu.ifl = 1;
+			machine_attention();
+			NEXT_OPCODE;
 
-		case 0xFC: /* FC CLD */
-			cpu.df = 0;
-			break;
+		OPCODE(0xFC): /* FC CLD */
+			machine_cpu.df = 0;
+			NEXT_OPCODE;
 
-		case 0xFD: /* FD STD */
-			cpu.df = 1;
-			break;
+		OPCODE(0xFD): /* FD STD */
+			machine_cpu.df = 1;
+			NEXT_OPCODE;
 
-		case 0xFE: /* FE GRP4 Eb */
-			modregrm();
+		OPCODE(0xFE): /* FE GRP4 Eb */
+			modregrm(opcode);
 			oper1b = readrm8(rm);
 			oper2b = 1;
 			if (!reg) {
-				int tempcf = cpu.cf;
+				int tempcf = machine_cpu.cf;
 				res8 = oper1b + oper2b;
 				flag_add8(oper1b, oper2b);
-				cpu.cf = tempcf;
+				machine_cpu.cf = tempcf;
 				writerm8(rm, res8);
 			} else {
-				int tempcf = cpu.cf;
+				int tempcf = machine_cpu.cf;
 				res8 = oper1b - oper2b;
 				flag_sub8(oper1b, oper2b);
-				cpu.cf = tempcf;
+				machine_cpu.cf = tempcf;
 				writerm8(rm, res8);
 			}
-			break;
+			NEXT_OPCODE;
 
-		case 0xFF: /* FF GRP5 Ev */
-			modregrm();
+		OPCODE(0xFF): /* FF GRP5 Ev */
+			modregrm(opcode);
 			oper1 = readrm16(rm);
 			op_grp5();
-			break;
+			NEXT_OPCODE;
 
-		default:
+		OPCODE_ILLEGAL:
 #ifdef CPU_ALLOW_ILLEGAL_OP_EXCEPTION
 			intcall86(6); /* trip invalid opcode exception (this
 					 occurs on the 80186+, 8086/8088 CPUs
@@ -3720,18 +5015,50 @@ void exec86(uint32_t execloops) {
 			if (verbose) {
 				printf("Illegal opcode: %02X %02X /%X @ "
 				       "%04X:%04X\n",
-				       getmem8(cpu.savecs, cpu.saveip),
-				       getmem8(cpu.savecs, cpu.saveip + 1),
-				       (getmem8(cpu.savecs, cpu.saveip + 2) >> 3) & 7,
-				       cpu.savecs, cpu.saveip);
+				       getmem8(machine_cpu.savecs, machine_cpu.saveip),
+				       getmem8(machine_cpu.savecs, machine_cpu.saveip + 1),
+				       (getmem8(machine_cpu.savecs, machine_cpu.saveip + 2) >> 3) & 7,
+				       machine_cpu.savecs, machine_cpu.saveip);
 			}
-			break;
+			NEXT_OPCODE;
 		}
 
+#ifdef USE_JIT
 	skipexecution:
-		if (!running) {
+#endif
+		if (!machine_running) {
 			return;
 		}
 	}
 }
+
+void exec86(uint32_t execloops) {
+	machine->cycle_limit = UINT64_MAX;
+#ifdef CPU_PROFILER
+	prof_enter();
+	exec86_run(execloops);
+	prof_leave();
+#else
+	exec86_run(execloops);
+#endif
+}
+
+/* Executes instructions for (at least) the given number of 8088 clock
+   cycles, as estimated by the cycle tables above, and returns the number
+   of cycles actually executed. It can be a bit more than the budget, as
+   the last instruction (or a translated block with the JIT) is always
+   executed as a whole. The caller should subtract the excess from the
+   next budget to keep the average clock exact. */
+uint32_t exec86_cycles(uint32_t budget) {
+	const uint64_t start = totalcycles;
+	machine->cycle_limit = start + budget;
+#ifdef CPU_PROFILER
+	prof_enter();
+	exec86_run(UINT32_MAX);
+	prof_leave();
+#else
+	exec86_run(UINT32_MAX);
 #endif
+	machine->cycle_limit = UINT64_MAX;
+	return (uint32_t)(totalcycles - start);
+}
@@ -85,90 +85,179 @@ struct addrmodecache_s {
 
 #define RAM_SIZE 0x100000
 
-#ifdef USE_KVM
-extern uint8_t *RAM;
-#else
-extern uint8_t RAM[RAM_SIZE];
+
+// Descriptor of a 4K page of the 1Mbyte address space, see cpu_mem_remap()
+#define MEM_PAGE_READONLY	1	// ROM, writes are ignored
+#define MEM_PAGE_CHECKED	2	// writes always go to write_handler
+#define MEM_PAGE_VIDEO		4	// write_handler only stores to RAM and sets updatedscreen
+#define MEM_CODE_FLOWCACHE	1	// owners of code on the page, in mem_page.code
+#define MEM_CODE_JIT		2
+
+struct mem_page {
+	uint8_t	*read;		// memory for direct reads (indexed by the linear address), or NULL to use read_handler
+	uint8_t	*write;		// the same for writes, or NULL to use write_handler (unless MEM_PAGE_READONLY)
+	uint8_t	(*read_handler)  ( uint32_t addr32 );
+	void	(*write_handler) ( uint32_t addr32, uint8_t value );
+	uint8_t	flags;
+	uint8_t	code;
+};
+
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+/* Instruction flow cache of a machine, see cpu.c for the details. */
+#define FLOWCACHE_BLOCKS_BITS	12
+#define FLOWCACHE_BLOCKS	(1 << FLOWCACHE_BLOCKS_BITS)
+#define FLOWCACHE_BLOCK_INSNS	32
+#define FLOWCACHE_INSN_BYTES	16
+
+struct flowcache_block;
+
+struct flowcache_insn {
+	struct flowcache_block *link;	// block where the execution went last time, if not sequentially
+	uint8_t  len;			// number of bytes recorded in bytes[]
+	uint16_t ip;			// IP of the first byte (prefix or opcode)
+	uint8_t  flags;
+	uint8_t  opcode, prefixes, reptype, segov;
+	uint8_t  mode, reg, rm, modrmlen;
+	uint16_t disp16;
+	uint8_t  bytes[FLOWCACHE_INSN_BYTES];
+};
+
+struct flowcache_block {
+	uint16_t cs;
+	uint8_t  page;
+	uint8_t  count;		// number of valid entries in insn[], 0 = unused block
+	uint32_t gen0, gen1;	// generation of the page of the block, and the next one
+	struct flowcache_insn insn[FLOWCACHE_BLOCK_INSNS];
+};
+
+#ifdef CPU_SUPERINSTRUCTIONS
+/* Instruction pairs run as one step, see FUSE_JCC() in cpu.c */
+enum { FUSE_CMP_JCC, FUSE_TEST_JCC, FUSE_DEC_JCC, FUSE_LODSB_STOSB, FUSE_KINDS };
+extern const char *const cpu_fusion_names[FUSE_KINDS];
 #endif
-extern uint8_t readonly[RAM_SIZE];
-extern uint8_t running;
-extern uint32_t makeupticks;
-extern uint64_t totalexec;
 
-extern uint16_t cpu_last_int_seg, cpu_last_int_ip;
+struct flowcache {
+	struct flowcache_block	blocks[FLOWCACHE_BLOCKS];
+	uint8_t			codemap[RAM_SIZE >> 3];
+	uint32_t		pagegen[RAM_SIZE >> 12];
+	uint32_t		epoch;
+	struct flowcache_insn	dummy;		// used for code which is not cached (VGA memory window), never recorded into
+	struct flowcache_block	*block;		// block being executed or recorded
+	struct flowcache_insn	*insn;		// entry of the current instruction in it
+	uint32_t		block_epoch;
+	uint64_t		hits, misses, invalidations;
+#ifdef CPU_SUPERINSTRUCTIONS
+	uint64_t		pairs[FUSE_KINDS];	// first instructions of the pair executed
+	uint64_t		fused[FUSE_KINDS];	// ... and run together with the second one
+#endif
+};
+#endif
 
-struct cpu {
+struct cpu_state {
         uint8_t         cf, zf, pf, af, sf, tf, ifl, df, of;
 	uint16_t	savecs, saveip, ip, useseg;
         int             hltstate;
         uint16_t        segregs[4];
 	uint8_t		segoverride;
         union           _bytewordregs_ regs;
+#ifdef CPU_LAZY_FLAGS
+	uint8_t		lazyflags;	// pending operation for ZF/SF/PF/OF/AF, zero if those are valid
+	uint16_t	lazydst, lazysrc, lazyres;
+#endif
 };
 
-extern struct cpu cpu;
+/* All the state above belongs to a machine, see machine.h */
+#include "machine.h"
+
+#ifdef CPU_LAZY_FLAGS
+extern void cpu_flags_materialize ( void );
+#define CPU_SYNC_FLAGS()	do { if (machine_cpu.lazyflags) cpu_flags_materialize(); } while (0)
+#else
+#define CPU_SYNC_FLAGS()	do { } while (0)
+#endif
 
 static inline uint16_t makeflagsword ( void )
 {
-	return 2 | (uint16_t) cpu.cf | ((uint16_t) cpu.pf << 2) | ((uint16_t) cpu.af << 4) | ((uint16_t) cpu.zf << 6) | ((uint16_t) cpu.sf << 7) |
-		((uint16_t) cpu.tf << 8) | ((uint16_t) cpu.ifl << 9) | ((uint16_t) cpu.df << 10) | ((uint16_t) cpu.of << 11)
+	CPU_SYNC_FLAGS();
+	return 2 | (uint16_t) machine_cpu.cf | ((uint16_t) machine_cpu.pf << 2) | ((uint16_t) machine_cpu.af << 4) | ((uint16_t) machine_cpu.zf << 6) | ((uint16_t) machine_cpu.sf << 7) |
+		((uint16_t) machine_cpu.tf << 8) | ((uint16_t) machine_cpu.ifl << 9) | ((uint16_t) machine_cpu.df << 10) | ((uint16_t) machine_cpu.of << 11)
 	;
 }
 
 static inline void decodeflagsword ( uint16_t x )
 {
-	cpu.cf  =  x        & 1;
-	cpu.pf  = (x >>  2) & 1;
-	cpu.af  = (x >>  4) & 1;
-	cpu.zf  = (x >>  6) & 1;
-	cpu.sf  = (x >>  7) & 1;
-	cpu.tf  = (x >>  8) & 1;
-	cpu.ifl = (x >>  9) & 1;
-	cpu.df  = (x >> 10) & 1;
-	cpu.of  = (x >> 11) & 1;
+	machine_cpu.cf  =  x        & 1;
+	machine_cpu.pf  = (x >>  2) & 1;
+	machine_cpu.af  = (x >>  4) & 1;
+	machine_cpu.zf  = (x >>  6) & 1;
+	machine_cpu.sf  = (x >>  7) & 1;
+	machine_cpu.tf  = (x >>  8) & 1;
+	machine_cpu.ifl = (x >>  9) & 1;
+	machine_cpu.df  = (x >> 10) & 1;
+	machine_cpu.of  = (x >> 11) & 1;
+#ifdef CPU_LAZY_FLAGS
+	machine_cpu.lazyflags = 0;
+#endif
+	if (x & 0x300)		// TF or IF set
+		machine_attention();
 }
 
-#define CPU_FL_CF	cpu.cf
-#define CPU_FL_PF	cpu.pf
-#define CPU_FL_AF	cpu.af
-#define CPU_FL_ZF	cpu.zf
-#define CPU_FL_SF	cpu.sf
-#define CPU_FL_TF	cpu.tf
-#define CPU_FL_IFL	cpu.ifl
-#define CPU_FL_DF	cpu.df
-#define CPU_FL_OF	cpu.of
-
-#define CPU_CS		cpu.segregs[regcs]
-#define CPU_DS		cpu.segregs[regds]
-#define CPU_ES		cpu.segregs[reges]
-#define CPU_SS		cpu.segregs[regss]
-
-#define CPU_AX  	cpu.regs.wordregs[regax]
-#define CPU_BX  	cpu.regs.wordregs[regbx]
-#define CPU_CX  	cpu.regs.wordregs[regcx]
-#define CPU_DX  	cpu.regs.wordregs[regdx]
-#define CPU_SI  	cpu.regs.wordregs[regsi]
-#define CPU_DI  	cpu.regs.wordregs[regdi]
-#define CPU_BP  	cpu.regs.wordregs[regbp]
-#define CPU_SP  	cpu.regs.wordregs[regsp]
-#define CPU_IP		cpu.ip
-
-#define CPU_AL  	cpu.regs.byteregs[regal]
-#define CPU_BL  	cpu.regs.byteregs[regbl]
-#define CPU_CL  	cpu.regs.byteregs[regcl]
-#define CPU_DL  	cpu.regs.byteregs[regdl]
-#define CPU_AH  	cpu.regs.byteregs[regah]
-#define CPU_BH  	cpu.regs.byteregs[regbh]
-#define CPU_CH  	cpu.regs.byteregs[regch]
-#define CPU_DH  	cpu.regs.byteregs[regdh]
+#define CPU_FL_CF	machine_cpu.cf
+#define CPU_FL_PF	machine_cpu.pf
+#define CPU_FL_AF	machine_cpu.af
+#define CPU_FL_ZF	machine_cpu.zf
+#define CPU_FL_SF	machine_cpu.sf
+#define CPU_FL_TF	machine_cpu.tf
+#define CPU_FL_IFL	machine_cpu.ifl
+#define CPU_FL_DF	machine_cpu.df
+#define CPU_FL_OF	machine_cpu.of
+
+#define CPU_CS		machine_cpu.segregs[regcs]
+#define CPU_DS		machine_cpu.segregs[regds]
+#define CPU_ES		machine_cpu.segregs[reges]
+#define CPU_SS		machine_cpu.segregs[regss]
+
+#define CPU_AX  	machine_cpu.regs.wordregs[regax]
+#define CPU_BX  	machine_cpu.regs.wordregs[regbx]
+#define CPU_CX  	machine_cpu.regs.wordregs[regcx]
+#define CPU_DX  	machine_cpu.regs.wordregs[regdx]
+#define CPU_SI  	machine_cpu.regs.wordregs[regsi]
+#define CPU_DI  	machine_cpu.regs.wordregs[regdi]
+#define CPU_BP  	machine_cpu.regs.wordregs[regbp]
+#define CPU_SP  	machine_cpu.regs.wordregs[regsp]
+#define CPU_IP		machine_cpu.ip
+
+#define CPU_AL  	machine_cpu.regs.byteregs[regal]
+#define CPU_BL  	machine_cpu.regs.byteregs[regbl]
+#define CPU_CL  	machine_cpu.regs.byteregs[regcl]
+#define CPU_DL  	machine_cpu.regs.byteregs[regdl]
+#define CPU_AH  	machine_cpu.regs.byteregs[regah]
+#define CPU_BH  	machine_cpu.regs.byteregs[regbh]
+#define CPU_CH  	machine_cpu.regs.byteregs[regch]
+#define CPU_DH  	machine_cpu.regs.byteregs[regdh]
+
+#define CYCLES_SHORT_JUMP_TAKEN	12	// extra cycles of the taken Jcc, LOOPcc and JCXZ, see cpu_insn_cycles()
 
 extern void     write86  ( uint32_t addr32, uint8_t value );
+extern void     writew86 ( uint32_t addr32, uint16_t value );
 extern void     reset86  ( void );
+extern void     cpu_mem_reload ( void );
 extern void     exec86   ( uint32_t execloops );
+extern uint32_t exec86_cycles   ( uint32_t budget );
+extern unsigned int cpu_insn_cycles ( uint8_t opcode, uint8_t mode, uint8_t reg, uint8_t rm );
 extern uint8_t  read86   ( uint32_t addr32 );
+extern uint16_t readw86  ( uint32_t addr32 );
+extern void     cpu_mem_write_block ( uint32_t addr32, const uint8_t *src, uint32_t len );
+extern void     cpu_mem_read_block  ( uint32_t addr32, uint8_t *dst, uint32_t len );
 extern void     cpu_push ( uint16_t pushval );
 extern uint16_t cpu_pop  ( void );
 extern void     cpu_IRET ( void );
 extern int      cpu_hlt_handler ( void );
+extern void     cpu_mem_remap       ( void );
+extern void     cpu_mem_code_page   ( unsigned int page, uint8_t owner );
+extern void     cpu_mem_uncode_page ( unsigned int page, uint8_t owner );
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+extern void     cpu_flowcache_invalidate ( uint32_t addr32, uint32_t len );
+#endif
 
 #endif
@@ -22,30 +22,66 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "disk.h"
 
 #include "cpu.h"
+#include "diskcache.h"
+#include "diskoverlay.h"
+#include "diskpack.h"
 #include "hostfs.h"
+#include "timing.h"
 
 
-struct struct_drive disk[256];
+static _Thread_local uint8_t sectorbuffer[512];
 
-uint8_t bootdrive = 0, hdcount = 0, fdcount = 0;
+#define lastdiskah	(machine->lastdiskah)
+#define lastdiskcf	(machine->lastdiskcf)
 
 
-static uint8_t sectorbuffer[512];
+// Maps the image file into the memory, so the transfers are simple copies
+// between the mapping and the guest memory. The file stays open with hostfs
+// as well, the transfers fall back to it if the mapping is not possible.
+static uint8_t *map_image ( const char *filename, size_t size, int writeprotected )
+{
+#ifdef _WIN32
+	return NULL;
+#else
+	const int fd = open(filename, writeprotected ? O_RDONLY : O_RDWR);
+	if (fd < 0)
+		return NULL;
+	void *map = mmap(NULL, size, writeprotected ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return map == MAP_FAILED ? NULL : map;
+#endif
+}
 
 
-uint8_t insertdisk ( uint8_t drivenum, const char *filename )
+// Opens and checks a disk image for the drive, without attaching it yet:
+// 'd' gets everything disk_attach() needs. Returns non-zero on error.
+uint8_t disk_open ( uint8_t drivenum, const char *filename, struct struct_drive *d )
 {
 	const char *err = "?";
+	struct diskoverlay *delta = NULL;
+	struct diskpack *pack = NULL;
 	HOSTFS_FILE *file = hostfs_open(filename, "?r+b");	// ? -> signal hostfs to use fallback mode "rb" (read-only) if the given mode (r/w here "r+b") fails
+	const int ro = hostfs_was_fallback_mode;
 	if (!file) {
 		err = SDL_GetError();
 		goto error;
 	}
-	size_t size = hostfs_size(file);
+	if (diskoverlay_check(file) && !(delta = diskoverlay_open(file, &err)))
+		goto error;
+	if (diskpack_check(file) && !(pack = diskpack_open(file, &err)))
+		goto error;
+	size_t size = delta ? diskoverlay_size(delta) : pack ? diskpack_size(pack) : hostfs_size(file);
 	if (size < 0) {
 		err = SDL_GetError();
 		goto error;
@@ -90,43 +126,112 @@ uint8_t insertdisk ( uint8_t drivenum, const char *filename )
 		//goto error;
 		// FIXME!!!!
 	}
-	// Seems to be OK. Let's validate (store params) and print message.
+	// Seems to be OK. Let's validate (store params).
+	memset(d, 0, sizeof(*d));
+	d->diskfile = file;
+	d->filesize = size;
+	d->inserted = 1;
+	d->writeprotected = ro || pack;
+	d->cyls = cyls;
+	d->heads = heads;
+	d->sects = sects;
+	d->filename = SDL_strdup(filename);	// for the snapshots, to attach the same image again
+	d->delta = delta;
+	d->pack = pack;
+	return 0;
+error:
+	if (delta)
+		diskoverlay_close(delta);
+	if (pack)
+		diskpack_close(pack);
+	if (file)
+		hostfs_close(file);
+	fprintf(stderr, "DISK: ERROR: cannot insert disk 0%02Xh as %s because: %s\n", drivenum, filename, err);
+	return 1;
+}
+
+
+// Closes an image opened by disk_open() which has not been attached
+void disk_close ( struct struct_drive *d )
+{
+	if (!d->inserted)
+		return;
+	if (d->delta)
+		diskoverlay_close(d->delta);
+	if (d->pack)
+		diskpack_close(d->pack);
+	hostfs_close(d->diskfile);
+	SDL_free(d->filename);
+	memset(d, 0, sizeof(*d));
+}
+
+
+// Attaches an image opened by disk_open() to the drive, instead of the
+// current one, if there is any. 'd' is emptied, the drive owns the image.
+void disk_attach ( uint8_t drivenum, struct struct_drive *d )
+{
 	ejectdisk(drivenum);	// close previous disk image for this drive if there is any
-	disk[drivenum].diskfile = file;
-	disk[drivenum].filesize = size;
-	disk[drivenum].inserted = 1;
-	disk[drivenum].readonly = hostfs_was_fallback_mode;
-	disk[drivenum].cyls = cyls;
-	disk[drivenum].heads = heads;
-	disk[drivenum].sects = sects;
+	machine_disk[drivenum] = *d;
+	memset(d, 0, sizeof(*d));
+	d = &machine_disk[drivenum];
+	// the overlays and the packed images do their own I/O, not on the raw file
+	d->map = d->delta || d->pack ? NULL : map_image(d->filename, d->filesize, d->writeprotected);
+	d->cache = d->delta || d->pack ? NULL : diskcache_create(d);
 	if (drivenum >= 0x80)
 		hdcount++;
 	else
 		fdcount++;
 	printf(
-		"DISK: Disk 0%02Xh has been attached %s from file %s size=%luK, CHS=%d,%d,%d\n",
+		"DISK: Disk 0%02Xh has been attached %s%s from file %s size=%luK, CHS=%d,%d,%d\n",
 		drivenum,
-		hostfs_was_fallback_mode ? "R/O" : "R/W",
-		filename,
-		(unsigned long)(size >> 10),
-		cyls,
-		heads,
-		sects
+		d->writeprotected ? "R/O" : "R/W",
+		d->delta ? " (overlay)" : d->pack ? " (packed)" : d->map ? " (mapped)" : "",
+		d->filename,
+		(unsigned long)(d->filesize >> 10),
+		d->cyls,
+		d->heads,
+		d->sects
 	);
+}
+
+
+uint8_t insertdisk ( uint8_t drivenum, const char *filename )
+{
+	struct struct_drive d;
+	if (disk_open(drivenum, filename, &d))
+		return 1;
+	disk_attach(drivenum, &d);
 	return 0;
-error:
-	if (file)
-		hostfs_close(file);
-	fprintf(stderr, "DISK: ERROR: cannot insert disk 0%02Xh as %s because: %s\n", drivenum, filename, err);
-	return 1;
 }
 
 
 void ejectdisk ( uint8_t drivenum )
 {
-	if (disk[drivenum].inserted) {
-		hostfs_close(disk[drivenum].diskfile);
-		disk[drivenum].inserted = 0;
+	if (machine_disk[drivenum].inserted) {
+		if (machine_disk[drivenum].cache)
+			diskcache_destroy(machine_disk[drivenum].cache);	// writes out the dirty sectors
+		machine_disk[drivenum].cache = NULL;
+		if (machine_disk[drivenum].delta)
+			diskoverlay_close(machine_disk[drivenum].delta);
+		machine_disk[drivenum].delta = NULL;
+		if (machine_disk[drivenum].pack)
+			diskpack_close(machine_disk[drivenum].pack);
+		machine_disk[drivenum].pack = NULL;
+		hostfs_close(machine_disk[drivenum].diskfile);
+#ifndef _WIN32
+		if (machine_disk[drivenum].map)
+			munmap(machine_disk[drivenum].map, machine_disk[drivenum].filesize);
+#endif
+		machine_disk[drivenum].map = NULL;
+		machine_disk[drivenum].inserted = 0;
+		SDL_free(machine_disk[drivenum].filename);
+		machine_disk[drivenum].filename = NULL;
+		if (machine_disk[drivenum].overlay) {
+			for (size_t lba = 0; lba < machine_disk[drivenum].filesize / 512; lba++)
+				free(machine_disk[drivenum].overlay[lba]);
+			free(machine_disk[drivenum].overlay);
+			machine_disk[drivenum].overlay = NULL;
+		}
 		if (drivenum >= 0x80)
 			hdcount--;
 		else
@@ -135,59 +240,140 @@ void ejectdisk ( uint8_t drivenum )
 }
 
 
+// The process has been forked (see fanout.c): the disk image files are
+// reopened to have their own file positions, read-only, and the sectors
+// written from now on are kept in the memory of this process only.
+void disk_make_private ( void )
+{
+	for (int drivenum = 0; drivenum < 256; drivenum++) {
+		struct struct_drive *d = &machine_disk[drivenum];
+		if (!d->inserted || d->overlay)
+			continue;
+		HOSTFS_FILE *file = hostfs_open(d->filename, "rb");
+		d->overlay = calloc(d->filesize / 512, sizeof(uint8_t*));
+		if (!file || !d->overlay) {
+			fprintf(stderr, "DISK: FATAL: cannot reopen disk 0%02Xh from file %s\n", drivenum, d->filename);
+			exit(1);
+		}
+		hostfs_close(d->diskfile);
+		d->diskfile = file;
+		if (d->delta)
+			diskoverlay_reopen(d->delta, file);
+		if (d->pack)
+			diskpack_reopen(d->pack, file);
+	}
+}
+
+
 // Call this ONLY if all parameters are valid! There is no check here!
 static size_t chs2ofs ( int drivenum, int cyl, int head, int sect )
 {
-	return (((size_t)cyl * (size_t)disk[drivenum].heads + (size_t)head) * (size_t)disk[drivenum].sects + (size_t)sect - 1) * 512UL;
+	return (((size_t)cyl * (size_t)machine_disk[drivenum].heads + (size_t)head) * (size_t)machine_disk[drivenum].sects + (size_t)sect - 1) * 512UL;
+}
+
+
+// The transfers use the file of the image directly, at its current position
+static inline int direct_file ( uint8_t drivenum )
+{
+	return !machine_disk[drivenum].map && !machine_disk[drivenum].cache && !machine_disk[drivenum].delta && !machine_disk[drivenum].pack;
+}
+
+
+// Number of sectors from 'lba' (at most 'count') which can be copied from/to
+// the mapping of the image at once: the ones in the image, up to the first
+// one with a private copy in the overlay
+static uint32_t mapped_run ( uint8_t drivenum, size_t lba, uint32_t count )
+{
+	const size_t sectors = machine_disk[drivenum].filesize / 512;
+	if (lba >= sectors)
+		return 0;
+	if (count > sectors - lba)
+		count = sectors - lba;
+	if (machine_disk[drivenum].overlay)
+		for (uint32_t n = 0; n < count; n++)
+			if (machine_disk[drivenum].overlay[lba + n])
+				return n;
+	return count;
 }
 
 
 static void bios_readdisk ( uint8_t drivenum, uint16_t dstseg, uint16_t dstoff, uint16_t cyl, uint16_t sect, uint16_t head, uint16_t sectcount, int is_verify )
 {
-	if (!disk[drivenum].inserted) {
+	if (!machine_disk[drivenum].inserted) {
 		CPU_AH = 0x31;	// no media in drive
 		goto error;
 	}
-	if (!sect || sect > disk[drivenum].sects || cyl >= disk[drivenum].cyls || head >= disk[drivenum].heads) {
+	if (!sect || sect > machine_disk[drivenum].sects || cyl >= machine_disk[drivenum].cyls || head >= machine_disk[drivenum].heads) {
 		CPU_AH = 0x04;	// sector not found
 		goto error;
 	}
 	//uint32_t lba = ((uint32_t)cyl * (uint32_t)disk[drivenum].heads + (uint32_t)head) * (uint32_t)disk[drivenum].sects + (uint32_t)sect - 1;
 	//size_t fileoffset = lba * 512;
 	size_t fileoffset = chs2ofs(drivenum, cyl, head, sect);
-	if (fileoffset > disk[drivenum].filesize) {
+	if (fileoffset > machine_disk[drivenum].filesize) {
 		CPU_AH = 0x04;	// sector not found
 		goto error;
 	}
-	if (hostfs_seek_set(disk[drivenum].diskfile, fileoffset) != fileoffset) {
+	if (direct_file(drivenum) && hostfs_seek_set(machine_disk[drivenum].diskfile, fileoffset) != fileoffset) {
 		CPU_AH = 0x04;	// sector not found
 		goto error;
 	}
+	if (machine_disk[drivenum].cache && !machine_disk[drivenum].overlay)
+		diskcache_readahead(machine_disk[drivenum].cache, fileoffset / 512, sectcount);
 	uint32_t memdest = ((uint32_t)dstseg << 4) + (uint32_t)dstoff;
-	// for the readdisk function, we need to use write86 instead of directly fread'ing into
-	// the RAM array, so that read-only flags are honored. otherwise, a program could load
-	// data from a disk over BIOS or other ROM code that it shouldn't be able to.
+	// the data goes through cpu_mem_write_block(), so that read-only flags are honored.
+	// otherwise, a program could load data from a disk over BIOS or other ROM code that
+	// it shouldn't be able to.
 	uint32_t cursect;
-	for (cursect = 0; cursect < sectcount; cursect++) {
-		if (hostfs_read(disk[drivenum].diskfile, sectorbuffer, 512, 1) != 1)
-			break;
+	for (cursect = 0; cursect < sectcount; ) {
+		const size_t lba = fileoffset / 512 + cursect;
+		const uint8_t *data;
+		uint32_t n = 1;
+		if (machine_disk[drivenum].overlay && lba < machine_disk[drivenum].filesize / 512 && machine_disk[drivenum].overlay[lba]) {
+			data = machine_disk[drivenum].overlay[lba];
+			if (direct_file(drivenum))
+				hostfs_seek_cur(machine_disk[drivenum].diskfile, 512);
+		} else if (machine_disk[drivenum].delta) {
+			if (diskoverlay_read(machine_disk[drivenum].delta, lba, sectorbuffer))
+				break;
+			data = sectorbuffer;
+		} else if (machine_disk[drivenum].pack) {
+			// the rest of the block at once, it is read-only, so no private copies in the overlay
+			n = sectcount - cursect;
+			if (!(data = diskpack_sectors(machine_disk[drivenum].pack, lba, &n)))
+				break;
+		} else if (machine_disk[drivenum].map) {
+			// as many sectors at once as there are in the image (and not in the overlay)
+			n = mapped_run(drivenum, lba, sectcount - cursect);
+			if (!n)
+				break;
+			data = machine_disk[drivenum].map + lba * 512;
+		} else if (machine_disk[drivenum].cache) {
+			if (diskcache_read(machine_disk[drivenum].cache, lba, sectorbuffer))
+				break;
+			data = sectorbuffer;
+		} else {
+			if (hostfs_read(machine_disk[drivenum].diskfile, sectorbuffer, 512, 1) != 1)
+				break;
+			data = sectorbuffer;
+		}
 		if (is_verify) {
-			for (int sectoffset = 0; sectoffset < 512; sectoffset++) {
+			for (uint32_t sectoffset = 0; sectoffset < n * 512; sectoffset++) {
 				// FIXME: segment overflow condition?
-				if (read86(memdest++) != sectorbuffer[sectoffset]) {
+				if (read86(memdest++) != data[sectoffset]) {
 					// sector verify failed!
-					CPU_AL = cursect;
+					CPU_AL = cursect + sectoffset / 512;
 					CPU_FL_CF = 1;
 					CPU_AH = 0xBB;	// error code?? what we should say in this case????
 					return;
 				}
 			}
 		} else {
-			for (int sectoffset = 0; sectoffset < 512; sectoffset++) {
-				// FIXME: segment overflow condition?
-				write86(memdest++, sectorbuffer[sectoffset]);
-			}
+			// FIXME: segment overflow condition?
+			cpu_mem_write_block(memdest, data, n * 512);
+			memdest += n * 512;
 		}
+		cursect += n;
 	}
 	if (sectcount && !cursect) {
 		CPU_AH = 0x04;	// sector not found
@@ -212,38 +398,63 @@ void bios_read_boot_sector ( int drive, uint16_t dstseg, uint16_t dstoff )
 
 static void bios_writedisk ( uint8_t drivenum, uint16_t dstseg, uint16_t dstoff, uint16_t cyl, uint16_t sect, uint16_t head, uint16_t sectcount )
 {
-	if (!disk[drivenum].inserted) {
+	if (!machine_disk[drivenum].inserted) {
 		CPU_AH = 0x31;	// no media in drive
 		goto error;
 	}
-	if (!sect || sect > disk[drivenum].sects || cyl >= disk[drivenum].cyls || head >= disk[drivenum].heads) {
+	if (!sect || sect > machine_disk[drivenum].sects || cyl >= machine_disk[drivenum].cyls || head >= machine_disk[drivenum].heads) {
 		CPU_AH = 0x04;	// sector not found
 		goto error;
 	}
 	//uint32_t lba = ((uint32_t)cyl * (uint32_t)disk[drivenum].heads + (uint32_t)head) * (uint32_t)disk[drivenum].sects + (uint32_t)sect - 1;
 	//size_t fileoffset = lba * 512;
 	size_t fileoffset = chs2ofs(drivenum, cyl, head, sect);
-	if (fileoffset > disk[drivenum].filesize) {
+	if (fileoffset > machine_disk[drivenum].filesize) {
 		CPU_AH = 0x04;	// sector not found
 		goto error;
 	}
-	if (disk[drivenum].readonly) {
+	if (machine_disk[drivenum].writeprotected) {
 		CPU_AH = 0x03;	// drive is read-only
 		goto error;
 	}
-	if (hostfs_seek_set(disk[drivenum].diskfile, fileoffset) != fileoffset) {
+	if (direct_file(drivenum) && hostfs_seek_set(machine_disk[drivenum].diskfile, fileoffset) != fileoffset) {
 		CPU_AH = 0x04;	// sector not found
 		goto error;
 	}
 	uint32_t memdest = ((uint32_t)dstseg << 4) + (uint32_t)dstoff;
 	uint32_t cursect;
-	for (cursect = 0; cursect < sectcount; cursect++) {
-		for (int sectoffset = 0; sectoffset < 512; sectoffset++) {
-			// FIXME: segment overflow condition?
-			sectorbuffer[sectoffset] = read86(memdest++);
+	for (cursect = 0; cursect < sectcount; ) {
+		const size_t lba = fileoffset / 512 + cursect;
+		uint32_t n = 1;
+		// FIXME: segment overflow condition?
+		if (machine_disk[drivenum].overlay) {
+			if (lba >= machine_disk[drivenum].filesize / 512)
+				break;
+			if (!machine_disk[drivenum].overlay[lba] && !(machine_disk[drivenum].overlay[lba] = malloc(512)))
+				break;
+			cpu_mem_read_block(memdest, machine_disk[drivenum].overlay[lba], 512);
+		} else if (machine_disk[drivenum].delta) {
+			cpu_mem_read_block(memdest, sectorbuffer, 512);
+			if (diskoverlay_write(machine_disk[drivenum].delta, lba, sectorbuffer))
+				break;
+		} else if (machine_disk[drivenum].map) {
+			n = mapped_run(drivenum, lba, sectcount - cursect);
+			if (!n)
+				break;
+			cpu_mem_read_block(memdest, machine_disk[drivenum].map + lba * 512, n * 512);
+			if (machine_disk[drivenum].cache)
+				diskcache_mapped(machine_disk[drivenum].cache, lba, n);
+		} else if (machine_disk[drivenum].cache) {
+			cpu_mem_read_block(memdest, sectorbuffer, 512);
+			if (diskcache_write(machine_disk[drivenum].cache, lba, sectorbuffer))
+				break;
+		} else {
+			cpu_mem_read_block(memdest, sectorbuffer, 512);
+			if (hostfs_write(machine_disk[drivenum].diskfile, sectorbuffer, 512, 1) != 1)
+				break;
 		}
-		if (hostfs_write(disk[drivenum].diskfile, sectorbuffer, 512, 1) != 1)
-			break;
+		memdest += n * 512;
+		cursect += n;
 	}
 	if (sectcount && !cursect) {
 		CPU_AH = 0x04;	// sector not found
@@ -267,9 +478,8 @@ static void formattrack ( uint8_t drivenum, int track )
 #endif
 
 
-void diskhandler ( void )
+static void diskservice ( void )
 {
-	static uint8_t lastdiskah[256], lastdiskcf[256];
 	//printf("DISK interrupt function %02Xh\n", CPU_AH);
 	switch (CPU_AH) {
 		case 0: //reset disk system
@@ -319,13 +529,13 @@ void diskhandler ( void )
 			CPU_AH = 0;
 			break;
 		case 8: //get drive parameters
-			if (disk[CPU_DL].inserted) {
+			if (machine_disk[CPU_DL].inserted) {
 				CPU_FL_CF = 0;
 				CPU_AH = 0;
-				CPU_CH = disk[CPU_DL].cyls - 1;
-				CPU_CL = disk[CPU_DL].sects & 63;
-				CPU_CL = CPU_CL + (disk[CPU_DL].cyls/256) *64;
-				CPU_DH = disk[CPU_DL].heads - 1;
+				CPU_CH = machine_disk[CPU_DL].cyls - 1;
+				CPU_CL = machine_disk[CPU_DL].sects & 63;
+				CPU_CL = CPU_CL + (machine_disk[CPU_DL].cyls/256) *64;
+				CPU_DH = machine_disk[CPU_DL].heads - 1;
 				if (CPU_DL<0x80) {
 					CPU_BL = 4; //else CPU_BL = 0;
 					CPU_DL = 2;
@@ -338,12 +548,12 @@ void diskhandler ( void )
 			break;
 #if 0
 		case 0x15:	// get disk type
-			if (disk[CPU_DL].inserted) {
+			if (machine_disk[CPU_DL].inserted) {
 				int drivenum = CPU_DL;
 				printf("Requesting int 13h / function 15h for drive %02Xh\n", drivenum);
 				CPU_AH = (drivenum & 0x80) ? 3 : 1;		// either "floppy without change line support" (1) or "harddisk" (3)
-				CPU_CX = (disk[drivenum].filesize >> 9) >> 16;	// number of blocks, high word
-				CPU_DX = (disk[drivenum].filesize >> 9) & 0xFFFF;	// number of blocks, low word
+				CPU_CX = (machine_disk[drivenum].filesize >> 9) >> 16;	// number of blocks, high word
+				CPU_DX = (machine_disk[drivenum].filesize >> 9) & 0xFFFF;	// number of blocks, low word
 				CPU_AL = CPU_AH;
 				CPU_FL_CF = 0;
 			} else {
@@ -366,5 +576,13 @@ void diskhandler ( void )
 	lastdiskah[CPU_DL] = CPU_AH;
 	lastdiskcf[CPU_DL] = CPU_FL_CF;
 	if (CPU_DL & 0x80)
-		RAM[0x474] = CPU_AH;
+		machine_ram[0x474] = CPU_AH;
+}
+
+
+void diskhandler ( void )
+{
+	const uint64_t start = TIMING_ACCOUNT_START();
+	diskservice();
+	TIMING_ACCOUNT_STOP(TIMING_ACCOUNT_DISK, start);
 }
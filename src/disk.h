@@ -31,18 +31,25 @@ struct struct_drive {
 	uint16_t	sects;
 	uint16_t	heads;
 	uint8_t		inserted;
-	uint8_t		readonly;
+	uint8_t		writeprotected;
 	char 		*filename;
+	uint8_t		*map;		// the image mapped into the memory, or NULL to use diskfile
+	struct diskcache *cache;	// write-back cache, see diskcache.c
+	struct diskoverlay *delta;	// copy-on-write overlay image, see diskoverlay.c
+	struct diskpack	*pack;		// packed (compressed) image, see diskpack.c
+	uint8_t		**overlay;	// private copies of the written sectors, see disk_make_private()
 };
 
-extern struct struct_drive disk[256];
-
-extern uint8_t bootdrive, hdcount, fdcount;
-
 extern uint8_t	insertdisk  ( uint8_t drivenum, const char *filename );
+extern uint8_t	disk_open   ( uint8_t drivenum, const char *filename, struct struct_drive *d );
+extern void	disk_attach ( uint8_t drivenum, struct struct_drive *d );
+extern void	disk_close  ( struct struct_drive *d );
 extern void	diskhandler ( void );
 extern void	ejectdisk   ( uint8_t drivenum );
+extern void	disk_make_private ( void );
 
 extern void	bios_read_boot_sector ( int drive, uint16_t dstseg, uint16_t dstofs );
 
+#include "machine.h"
+
 #endif
@@ -0,0 +1,638 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* diskcache.c: write-back cache of the disk images. The INT 13h writes only
+   go into the memory, and a background thread writes the dirty sectors into
+   the image files, merging the adjacent ones into a single write. It also
+   flushes at eject and exit, and on the "flush" console command.
+
+   For images read with hostfs, the cache keeps the last used sectors (in LRU
+   order) up to its size (-diskcache), the clean ones are thrown away when a
+   new one is needed. For the mapped images (see disk.c) the mapping itself
+   is the cache, only the dirty sectors are tracked, and flushed by msync().
+   With -diskwritethrough every write goes to the file immediately, the
+   cache is still used for the reads.
+
+   Readahead: if an INT 13h read continues where the previous one of the
+   drive ended, the following cylinder(s) (-diskreadahead) are requested,
+   and the flush thread reads them into the cache, while the emulation goes
+   on. For the mapped images the kernel is asked to read the pages ahead.
+
+   The emulation thread writes the sectors, the flush thread writes out the
+   dirty ones, and inserts the clean sectors read ahead. A sector is clean
+   again only if it was not written again while being flushed, and a dirty
+   sector never leaves the cache, so a cache miss never reads a stale
+   sector from the file. The sectors read ahead are thrown away if there
+   was any write meanwhile, as they may be stale. */
+
+#include "config.h"
+#include <SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "diskcache.h"
+
+#include "disk.h"
+#include "parsecl.h"
+
+#define DISKCACHE_FLUSH_MSECS	500	// the flush thread runs at least this often
+#define DISKCACHE_RUN_SECTORS	128	// longest merged write
+#define NONE			(-1)
+
+struct diskcache_slot {
+	uint32_t	lba;
+	uint32_t	gen;		// incremented by every write of the sector
+	int32_t		prev, next;	// LRU list, the most recently used first
+	int32_t		hnext;		// chain of the hash bucket
+	uint8_t		valid, dirty;
+	uint8_t		prefetched;	// read ahead, and not used yet
+	uint8_t		data[512];
+};
+
+struct diskcache {
+	struct struct_drive	*drive;
+	SDL_mutex		*lock;		// the slots and the dirty bitmap
+	SDL_mutex		*io;		// the position of the hostfs file
+	SDL_mutex		*flushing;	// one flush at a time, so the writes stay in order
+	uint32_t		sectors;	// of the image
+	uint32_t		nslots;		// 0 for mapped images
+	struct diskcache_slot	*slot;
+	int32_t			*hash;		// first slot of the buckets, by lba % nslots
+	int32_t			lru_head, lru_tail;
+	uint32_t		*dirtymap;	// by lba
+	uint32_t		dirty;		// number of dirty sectors
+	uint32_t		writes;		// incremented by every write, see cache_prefetch()
+	uint32_t		seq_next;	// the sector after the last read
+	uint32_t		ra_next;	// first sector after the ones requested to read ahead
+	uint32_t		ra_start, ra_count;	// request for the flush thread
+	struct diskcache_stats	stats;
+	struct diskcache	*next;		// list of the flush thread
+	int			users;		// flushed without list_lock, under list_lock
+	int			detached;	// removed from the list while in use, under list_lock
+	uint8_t			runbuf[DISKCACHE_RUN_SECTORS * 512];
+	uint8_t			rabuf[DISKCACHE_RUN_SECTORS * 512];
+};
+
+static SDL_mutex *list_lock = NULL;
+static SDL_cond *list_kick = NULL;
+static SDL_cond *list_idle = NULL;	// a cache is not used any more, see diskcache_destroy()
+static SDL_Thread *flush_thread = NULL;
+static struct diskcache *caches = NULL;
+static volatile int flush_thread_quit = 0;
+static int kick_pending = 0;		// under list_lock, a kick while the thread was not waiting is not lost
+
+
+static inline int is_dirty ( const struct diskcache *c, uint32_t lba )
+{
+	return (c->dirtymap[lba >> 5] >> (lba & 31)) & 1;
+}
+
+static inline void set_dirty ( struct diskcache *c, uint32_t lba )
+{
+	if (!is_dirty(c, lba)) {
+		c->dirtymap[lba >> 5] |= 1U << (lba & 31);
+		c->dirty++;
+	}
+}
+
+static inline void clear_dirty ( struct diskcache *c, uint32_t lba )
+{
+	if (is_dirty(c, lba)) {
+		c->dirtymap[lba >> 5] &= ~(1U << (lba & 31));
+		c->dirty--;
+	}
+}
+
+
+static int32_t cache_lookup ( const struct diskcache *c, uint32_t lba )
+{
+	for (int32_t i = c->hash[lba % c->nslots]; i != NONE; i = c->slot[i].hnext)
+		if (c->slot[i].lba == lba)
+			return i;
+	return NONE;
+}
+
+
+static void lru_unlink ( struct diskcache *c, int32_t i )
+{
+	struct diskcache_slot *s = &c->slot[i];
+	if (s->prev != NONE)
+		c->slot[s->prev].next = s->next;
+	else
+		c->lru_head = s->next;
+	if (s->next != NONE)
+		c->slot[s->next].prev = s->prev;
+	else
+		c->lru_tail = s->prev;
+}
+
+
+static void lru_touch ( struct diskcache *c, int32_t i )
+{
+	if (c->lru_head == i)
+		return;
+	lru_unlink(c, i);
+	c->slot[i].prev = NONE;
+	c->slot[i].next = c->lru_head;
+	c->slot[c->lru_head].prev = i;
+	c->lru_head = i;
+}
+
+
+static void hash_unlink ( struct diskcache *c, int32_t i )
+{
+	int32_t *p = &c->hash[c->slot[i].lba % c->nslots];
+	while (*p != i)
+		p = &c->slot[*p].hnext;
+	*p = c->slot[i].hnext;
+}
+
+
+// A slot for a new sector: the least recently used clean one, or NONE if all of them are dirty
+static int32_t cache_victim ( struct diskcache *c )
+{
+	for (int32_t i = c->lru_tail; i != NONE; i = c->slot[i].prev) {
+		if (c->slot[i].dirty)
+			continue;
+		if (c->slot[i].valid)
+			hash_unlink(c, i);
+		c->slot[i].valid = 0;
+		return i;
+	}
+	return NONE;
+}
+
+
+static int32_t cache_insert ( struct diskcache *c, uint32_t lba, const uint8_t *data )
+{
+	const int32_t i = cache_victim(c);
+	if (i == NONE)
+		return NONE;
+	struct diskcache_slot *s = &c->slot[i];
+	s->lba = lba;
+	s->valid = 1;
+	s->dirty = 0;
+	s->prefetched = 0;	// set by cache_prefetch() after the insert
+	memcpy(s->data, data, 512);
+	s->hnext = c->hash[lba % c->nslots];
+	c->hash[lba % c->nslots] = i;
+	lru_touch(c, i);
+	return i;
+}
+
+
+static int file_io ( struct diskcache *c, uint32_t lba, void *buf, uint32_t count, int is_write )
+{
+	HOSTFS_FILE *file = c->drive->diskfile;
+	const size_t ofs = (size_t)lba * 512;
+	SDL_LockMutex(c->io);
+	int ok = hostfs_seek_set(file, ofs) == ofs;
+	if (ok)
+		ok = is_write ? hostfs_write(file, buf, 512, count) == count : hostfs_read(file, buf, 512, count) == count;
+	SDL_UnlockMutex(c->io);
+	return !ok;
+}
+
+
+static void kick_flush_thread ( void )
+{
+	if (!list_lock)
+		return;
+	SDL_LockMutex(list_lock);
+	kick_pending = 1;
+	SDL_CondSignal(list_kick);
+	SDL_UnlockMutex(list_lock);
+}
+
+
+// Writes out the dirty sectors, in runs of adjacent ones
+void diskcache_flush ( struct diskcache *c )
+{
+	uint32_t gens[DISKCACHE_RUN_SECTORS];
+	int32_t slots[DISKCACHE_RUN_SECTORS];
+	SDL_LockMutex(c->flushing);
+	SDL_LockMutex(c->lock);
+	uint32_t lba = 0;
+	while (c->dirty && lba < c->sectors) {
+		if (!c->dirtymap[lba >> 5]) {
+			lba = (lba | 31) + 1;
+			continue;
+		}
+		if (!is_dirty(c, lba)) {
+			lba++;
+			continue;
+		}
+		uint32_t n = 0;
+		while (n < DISKCACHE_RUN_SECTORS && lba + n < c->sectors && is_dirty(c, lba + n))
+			n++;
+		int error;
+		if (!c->nslots) {
+#ifndef _WIN32
+			// the mapping holds the data, the dirty state can go before the write
+			for (uint32_t i = 0; i < n; i++)
+				clear_dirty(c, lba + i);
+			SDL_UnlockMutex(c->lock);
+			static long pagesize = 0;
+			if (!pagesize)
+				pagesize = sysconf(_SC_PAGESIZE);
+			const size_t start = ((size_t)lba * 512) & ~(size_t)(pagesize - 1);
+			error = msync(c->drive->map + start, (size_t)(lba + n) * 512 - start, MS_SYNC) != 0;
+			SDL_LockMutex(c->lock);
+#else
+			error = 1;
+#endif
+		} else {
+			for (uint32_t i = 0; i < n; i++) {
+				slots[i] = cache_lookup(c, lba + i);
+				gens[i] = c->slot[slots[i]].gen;
+				memcpy(c->runbuf + i * 512, c->slot[slots[i]].data, 512);
+			}
+			SDL_UnlockMutex(c->lock);
+			error = file_io(c, lba, c->runbuf, n, 1);
+			SDL_LockMutex(c->lock);
+			for (uint32_t i = 0; !error && i < n; i++) {
+				// not written again meanwhile (the slot cannot go while it's dirty)
+				if (c->slot[slots[i]].gen == gens[i]) {
+					c->slot[slots[i]].dirty = 0;
+					clear_dirty(c, lba + i);
+				}
+			}
+		}
+		if (error) {
+			fprintf(stderr, "DISK: ERROR: cannot write sectors %u-%u of %s\n", lba, lba + n - 1, c->drive->filename);
+			break;
+		}
+		lba += n;
+	}
+	SDL_UnlockMutex(c->lock);
+	SDL_UnlockMutex(c->flushing);
+}
+
+
+int diskcache_read ( struct diskcache *c, uint32_t lba, uint8_t *buf )
+{
+	SDL_LockMutex(c->lock);
+	const int32_t i = cache_lookup(c, lba);
+	c->stats.reads++;
+	if (i != NONE) {
+		memcpy(buf, c->slot[i].data, 512);
+		lru_touch(c, i);
+		c->stats.hits++;
+		if (c->slot[i].prefetched) {
+			c->slot[i].prefetched = 0;
+			c->stats.readahead_hits++;
+		}
+		SDL_UnlockMutex(c->lock);
+		return 0;
+	}
+	SDL_UnlockMutex(c->lock);
+	// a miss: the sector cannot be dirty, only this thread writes
+	if (file_io(c, lba, buf, 1, 0))
+		return 1;
+	SDL_LockMutex(c->lock);
+	if (cache_lookup(c, lba) == NONE)	// it may have been read ahead meanwhile, the same data
+		cache_insert(c, lba, buf);	// not cached if all of the slots are dirty, no problem
+	SDL_UnlockMutex(c->lock);
+	return 0;
+}
+
+
+int diskcache_write ( struct diskcache *c, uint32_t lba, const uint8_t *buf )
+{
+	if (diskwritethrough && file_io(c, lba, (void*)buf, 1, 1))
+		return 1;
+	SDL_LockMutex(c->lock);
+	c->writes++;
+	int32_t i = cache_lookup(c, lba);
+	if (i == NONE) {
+		i = cache_insert(c, lba, buf);
+		if (i == NONE) {
+			// every slot is dirty, the flush thread cannot keep up
+			SDL_UnlockMutex(c->lock);
+			diskcache_flush(c);
+			SDL_LockMutex(c->lock);
+			i = cache_insert(c, lba, buf);
+			if (i == NONE) {
+				SDL_UnlockMutex(c->lock);
+				return diskwritethrough ? 0 : file_io(c, lba, (void*)buf, 1, 1);
+			}
+		}
+	} else {
+		memcpy(c->slot[i].data, buf, 512);
+		lru_touch(c, i);
+	}
+	c->slot[i].prefetched = 0;
+	c->slot[i].gen++;
+	if (!diskwritethrough) {
+		c->slot[i].dirty = 1;
+		set_dirty(c, lba);
+	}
+	const int kick = c->dirty >= c->nslots / 2;
+	SDL_UnlockMutex(c->lock);
+	if (kick)
+		kick_flush_thread();
+	return 0;
+}
+
+
+// A read of 'count' sectors from 'lba' is about to be done: if it continues
+// the previous one, the sectors following it are read ahead, to be always
+// at least half of the window ahead of the reads
+void diskcache_readahead ( struct diskcache *c, uint32_t lba, uint32_t count )
+{
+	const int sequential = lba == c->seq_next;
+	const uint32_t from = lba + count;
+	c->seq_next = from;
+	if (!diskreadahead || !sequential || from >= c->sectors)
+		return;
+	uint32_t window = diskreadahead * c->drive->heads * c->drive->sects;
+	if (c->nslots && window > c->nslots / 2)
+		window = c->nslots / 2;	// not to throw out the sectors read ahead before they are used
+	if (c->ra_next < from || c->ra_next > from + window)
+		c->ra_next = from;
+	if (c->ra_next - from >= window / 2)
+		return;
+	uint32_t to = from + window;
+	if (to > c->sectors)
+		to = c->sectors;
+	if (to <= c->ra_next)
+		return;
+	if (!c->nslots) {
+#ifndef _WIN32
+		static long pagesize = 0;
+		if (!pagesize)
+			pagesize = sysconf(_SC_PAGESIZE);
+		const size_t start = ((size_t)c->ra_next * 512) & ~(size_t)(pagesize - 1);
+		madvise(c->drive->map + start, (size_t)to * 512 - start, MADV_WILLNEED);
+#endif
+		c->stats.readahead_sectors += to - c->ra_next;
+		c->ra_next = to;
+		return;
+	}
+	SDL_LockMutex(c->lock);
+	if (c->ra_count && c->ra_start + c->ra_count == c->ra_next)
+		c->ra_count += to - c->ra_next;	// the previous request is not done yet, it is extended
+	else {
+		c->ra_start = c->ra_next;
+		c->ra_count = to - c->ra_next;
+	}
+	SDL_UnlockMutex(c->lock);
+	c->ra_next = to;
+	kick_flush_thread();
+}
+
+
+// In the flush thread: reads the requested sectors ahead, into the cache.
+// The flush lock is held, so no dirty sector can become clean, and leave
+// the cache meanwhile: a sector read from the file is either up to date,
+// or it is still in the cache (dirty), or there was a write since.
+static void cache_prefetch ( struct diskcache *c )
+{
+	SDL_LockMutex(c->flushing);
+	SDL_LockMutex(c->lock);
+	while (c->ra_count) {
+		const uint32_t lba = c->ra_start;
+		const uint32_t n = c->ra_count < DISKCACHE_RUN_SECTORS ? c->ra_count : DISKCACHE_RUN_SECTORS;
+		const uint32_t writes = c->writes;
+		c->ra_start += n;
+		c->ra_count -= n;
+		SDL_UnlockMutex(c->lock);
+		const int error = file_io(c, lba, c->rabuf, n, 0);
+		SDL_LockMutex(c->lock);
+		if (error || writes != c->writes)
+			continue;
+		for (uint32_t i = 0; i < n; i++) {
+			if (cache_lookup(c, lba + i) != NONE)
+				continue;
+			const int32_t s = cache_insert(c, lba + i, c->rabuf + i * 512);
+			if (s == NONE)
+				break;
+			c->slot[s].prefetched = 1;
+			c->stats.readahead_sectors++;
+		}
+	}
+	SDL_UnlockMutex(c->lock);
+	SDL_UnlockMutex(c->flushing);
+}
+
+
+// Sectors were written into the mapping of the image
+void diskcache_mapped ( struct diskcache *c, uint32_t lba, uint32_t count )
+{
+	SDL_LockMutex(c->lock);
+	for (uint32_t i = 0; i < count && lba + i < c->sectors; i++)
+		set_dirty(c, lba + i);
+	SDL_UnlockMutex(c->lock);
+	if (diskwritethrough)
+		diskcache_flush(c);
+}
+
+
+// Flushes (and reads ahead for) the caches in the list. It is called with
+// list_lock held, but the lock is released during the disk I/O, so the
+// emulation thread never waits for it longer than walking the list. A cache
+// is not freed while it is used, but it may be detached: then the pass ends
+// early, and returns nonzero for another one.
+static int flush_caches ( int prefetch )
+{
+	for (struct diskcache *c = caches; c; ) {
+		c->users++;
+		SDL_UnlockMutex(list_lock);
+		diskcache_flush(c);
+		if (prefetch && c->nslots)
+			cache_prefetch(c);
+		SDL_LockMutex(list_lock);
+		struct diskcache *next = c->detached ? NULL : c->next;
+		const int detached = c->detached;
+		if (!--c->users)
+			SDL_CondBroadcast(list_idle);
+		if (detached)
+			return 1;
+		c = next;
+	}
+	return 0;
+}
+
+
+static int flush_thread_main ( void *unused )
+{
+	SDL_LockMutex(list_lock);
+	while (!flush_thread_quit) {
+		if (!kick_pending)
+			SDL_CondWaitTimeout(list_kick, list_lock, DISKCACHE_FLUSH_MSECS);
+		kick_pending = 0;
+		if (flush_caches(1))
+			kick_pending = 1;
+	}
+	SDL_UnlockMutex(list_lock);
+	return 0;
+}
+
+
+void diskcache_flush_all ( void )
+{
+	if (!list_lock)
+		return;
+	SDL_LockMutex(list_lock);
+	while (flush_caches(0))
+		;
+	SDL_UnlockMutex(list_lock);
+}
+
+
+// Writes the statistics of the attached images, at exit or on the "diskstat" console command
+void diskcache_report ( void (*print)(const char *line) )
+{
+	char line[160];
+	if (!list_lock)
+		return;
+	SDL_LockMutex(list_lock);
+	for (struct diskcache *c = caches; c; c = c->next) {
+		SDL_LockMutex(c->lock);
+		const struct diskcache_stats s = c->stats;
+		SDL_UnlockMutex(c->lock);
+		if (c->nslots)
+			snprintf(line, sizeof(line), "Disk %s: %llu sector reads, cache hits: %llu (%.1f%%), misses: %llu, readahead: %llu sectors, %llu hits\n",
+				c->drive->filename, (unsigned long long)s.reads, (unsigned long long)s.hits, s.reads ? 100.0 * s.hits / s.reads : 0.0,
+				(unsigned long long)(s.reads - s.hits), (unsigned long long)s.readahead_sectors, (unsigned long long)s.readahead_hits);
+		else
+			snprintf(line, sizeof(line), "Disk %s: mapped, readahead: %llu sectors\n",
+				c->drive->filename, (unsigned long long)s.readahead_sectors);
+		print(line);
+	}
+	SDL_UnlockMutex(list_lock);
+}
+
+
+// Flushes everything and stops the flush thread (at exit, or before fork())
+void diskcache_stop ( void )
+{
+	if (flush_thread) {
+		SDL_LockMutex(list_lock);
+		flush_thread_quit = 1;
+		SDL_CondSignal(list_kick);
+		SDL_UnlockMutex(list_lock);
+		SDL_WaitThread(flush_thread, NULL);
+		flush_thread = NULL;
+	}
+	diskcache_flush_all();
+}
+
+
+// The cache of an attached image, NULL if there is none (-diskcache 0)
+struct diskcache *diskcache_create ( struct struct_drive *drive )
+{
+	if (!diskcachesize)
+		return NULL;
+	if (!list_lock) {
+		list_lock = SDL_CreateMutex();
+		list_kick = SDL_CreateCond();
+		list_idle = SDL_CreateCond();
+		if (!list_lock || !list_kick || !list_idle) {
+			fprintf(stderr, "DISK: cannot create the cache locks: %s\n", SDL_GetError());
+			return NULL;
+		}
+		atexit(diskcache_stop);
+	}
+	if (!flush_thread && (!diskwritethrough || diskreadahead) && !flush_thread_quit) {
+		flush_thread = SDL_CreateThread(flush_thread_main, "Fake86DiskFlush", NULL);
+		if (!flush_thread) {
+			fprintf(stderr, "DISK: cannot create the flush thread, writing through, no readahead: %s\n", SDL_GetError());
+			diskwritethrough = 1;
+			diskreadahead = 0;
+		}
+	}
+	struct diskcache *c = calloc(1, sizeof(struct diskcache));
+	if (!c)
+		return NULL;
+	c->drive = drive;
+	c->sectors = drive->filesize / 512;
+	c->nslots = drive->map ? 0 : diskcachesize * 2;
+	if (c->nslots > c->sectors)
+		c->nslots = c->sectors;
+	c->lock = SDL_CreateMutex();
+	c->io = SDL_CreateMutex();
+	c->flushing = SDL_CreateMutex();
+	c->dirtymap = calloc((c->sectors + 31) / 32, sizeof(uint32_t));
+	if (c->nslots) {
+		c->slot = malloc(c->nslots * sizeof(struct diskcache_slot));
+		c->hash = malloc(c->nslots * sizeof(int32_t));
+	}
+	if (!c->lock || !c->io || !c->flushing || !c->dirtymap || (c->nslots && (!c->slot || !c->hash))) {
+		fprintf(stderr, "DISK: cannot create the cache of %s\n", drive->filename);
+		diskcache_destroy(c);
+		return NULL;
+	}
+	c->lru_head = c->lru_tail = NONE;
+	c->seq_next = UINT32_MAX;
+	for (int32_t i = 0; i < (int32_t)c->nslots; i++) {
+		c->hash[i] = NONE;
+		c->slot[i].valid = c->slot[i].dirty = c->slot[i].prefetched = 0;
+		c->slot[i].gen = 0;
+		// all of them are in the LRU list, the invalid ones are simply reused first
+		c->slot[i].next = NONE;
+		c->slot[i].prev = c->lru_tail;
+		if (c->lru_tail != NONE)
+			c->slot[c->lru_tail].next = i;
+		else
+			c->lru_head = i;
+		c->lru_tail = i;
+	}
+	SDL_LockMutex(list_lock);
+	c->next = caches;
+	caches = c;
+	SDL_UnlockMutex(list_lock);
+	return c;
+}
+
+
+// Flushes and frees the cache, before the image is detached
+void diskcache_destroy ( struct diskcache *c )
+{
+	if (c->lock && c->io && c->flushing && c->dirtymap) {
+		SDL_LockMutex(list_lock);
+		for (struct diskcache **p = &caches; *p; p = &(*p)->next)
+			if (*p == c) {
+				*p = c->next;
+				break;
+			}
+		c->detached = 1;
+		while (c->users)
+			SDL_CondWait(list_idle, list_lock);
+		SDL_UnlockMutex(list_lock);
+		diskcache_flush(c);
+	}
+	if (c->lock)
+		SDL_DestroyMutex(c->lock);
+	if (c->io)
+		SDL_DestroyMutex(c->io);
+	if (c->flushing)
+		SDL_DestroyMutex(c->flushing);
+	free(c->dirtymap);
+	free(c->slot);
+	free(c->hash);
+	free(c);
+}
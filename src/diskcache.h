@@ -0,0 +1,53 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_DISKCACHE_H_INCLUDED
+#define FAKE86_DISKCACHE_H_INCLUDED
+
+#include <stdint.h>
+
+// Default size of the cache of a disk image, in Kbytes (-diskcache)
+#define DISKCACHE_DEFAULT_KB	1024
+
+// Default number of the cylinders read ahead of sequential reads (-diskreadahead)
+#define DISKCACHE_DEFAULT_READAHEAD	1
+
+struct struct_drive;
+struct diskcache;
+
+struct diskcache_stats {
+	uint64_t	reads;			// sectors read through the cache
+	uint64_t	hits;			// of them found in the cache
+	uint64_t	readahead_sectors;	// read ahead by the flush thread
+	uint64_t	readahead_hits;		// of them used by a read
+};
+
+extern struct diskcache *diskcache_create    ( struct struct_drive *drive );
+extern void              diskcache_destroy   ( struct diskcache *c );
+extern int               diskcache_read      ( struct diskcache *c, uint32_t lba, uint8_t *buf );
+extern int               diskcache_write     ( struct diskcache *c, uint32_t lba, const uint8_t *buf );
+extern void              diskcache_mapped    ( struct diskcache *c, uint32_t lba, uint32_t count );
+extern void              diskcache_readahead ( struct diskcache *c, uint32_t lba, uint32_t count );
+extern void              diskcache_report    ( void (*print)(const char *line) );
+extern void              diskcache_flush     ( struct diskcache *c );
+extern void              diskcache_flush_all ( void );
+extern void              diskcache_stop      ( void );
+
+#endif
@@ -0,0 +1,180 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* diskoverlay.c: copy-on-write overlay images (see diskoverlay.h for the
+   format). The reads of the sectors which are not in the overlay go to the
+   base image, the writes always go to the overlay: the first write of a
+   sector appends a copy of it. The allocation table is kept in the memory
+   as well. */
+
+#include "config.h"
+#include <SDL.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskoverlay.h"
+#include "diskpack.h"
+
+struct diskoverlay {
+	HOSTFS_FILE			*file;		// the overlay, the same as diskfile of the drive
+	HOSTFS_FILE			*base;
+	struct diskpack			*pack;		// if the base image is a packed one
+	struct diskoverlay_header	header;
+	uint32_t			*table;
+};
+
+
+static int file_at ( HOSTFS_FILE *file, uint64_t ofs, void *buf, size_t size, int is_write )
+{
+	if (hostfs_seek_set(file, ofs) != (Sint64)ofs)
+		return 1;
+	return (is_write ? hostfs_write(file, buf, size, 1) : hostfs_read(file, buf, size, 1)) != 1;
+}
+
+
+// Is the open file an overlay image?
+int diskoverlay_check ( HOSTFS_FILE *file )
+{
+	char magic[8];
+	const int ok = !file_at(file, 0, magic, sizeof(magic), 0) && !memcmp(magic, DISKOVERLAY_MAGIC, sizeof(magic));
+	hostfs_seek_set(file, 0);
+	return ok;
+}
+
+
+struct diskoverlay *diskoverlay_open ( HOSTFS_FILE *file, const char **err )
+{
+	struct diskoverlay *o = calloc(1, sizeof(struct diskoverlay));
+	if (!o) {
+		*err = "Out of memory";
+		return NULL;
+	}
+	o->file = file;
+	if (file_at(file, 0, &o->header, sizeof(o->header), 0) || memcmp(o->header.magic, DISKOVERLAY_MAGIC, sizeof(o->header.magic))) {
+		*err = "Cannot read the overlay header";
+		goto error;
+	}
+	diskoverlay_header_byteorder(&o->header);
+	if (o->header.version != DISKOVERLAY_VERSION) {
+		*err = "Unsupported overlay version";
+		goto error;
+	}
+	o->header.base[DISKOVERLAY_BASE_MAX - 1] = '\0';
+	o->base = hostfs_open(o->header.base, "rb");
+	if (!o->base) {
+		*err = "Cannot open the base image of the overlay";
+		goto error;
+	}
+	if (diskpack_check(o->base) && !(o->pack = diskpack_open(o->base, err)))
+		goto error;
+	if ((uint64_t)(o->pack ? diskpack_size(o->pack) : hostfs_size(o->base)) != o->header.basesize || o->header.basesize != (uint64_t)o->header.sectors * 512) {
+		*err = "The base image of the overlay has been changed";
+		goto error;
+	}
+	o->table = malloc((size_t)o->header.sectors * 4);
+	if (!o->table || file_at(file, DISKOVERLAY_HEADER_SIZE, o->table, (size_t)o->header.sectors * 4, 0)) {
+		*err = "Cannot read the allocation table of the overlay";
+		goto error;
+	}
+	for (uint32_t i = 0; i < o->header.sectors; i++)
+		o->table[i] = le32(o->table[i]);
+	printf("DISK: overlay with %u written sectors of %u, on base image %s\n", o->header.used, o->header.sectors, o->header.base);
+	return o;
+error:
+	diskoverlay_close(o);
+	return NULL;
+}
+
+
+// Closes the base image, the overlay file is closed by the caller
+void diskoverlay_close ( struct diskoverlay *o )
+{
+	if (o->pack)
+		diskpack_close(o->pack);
+	if (o->base)
+		hostfs_close(o->base);
+	free(o->table);
+	free(o);
+}
+
+
+// After fork(), see disk_make_private(): the files are reopened, not to share their positions
+void diskoverlay_reopen ( struct diskoverlay *o, HOSTFS_FILE *file )
+{
+	HOSTFS_FILE *base = hostfs_open(o->header.base, "rb");
+	if (!base) {
+		fprintf(stderr, "DISK: FATAL: cannot reopen the base image %s\n", o->header.base);
+		exit(1);
+	}
+	hostfs_close(o->base);
+	o->base = base;
+	if (o->pack)
+		diskpack_reopen(o->pack, base);
+	o->file = file;
+}
+
+
+size_t diskoverlay_size ( const struct diskoverlay *o )
+{
+	return o->header.basesize;
+}
+
+
+int diskoverlay_read ( struct diskoverlay *o, uint32_t lba, uint8_t *buf )
+{
+	if (lba >= o->header.sectors)
+		return 1;
+	if (o->table[lba])
+		return file_at(o->file, DISKOVERLAY_DATA_START(o->header.sectors) + (uint64_t)(o->table[lba] - 1) * 512, buf, 512, 0);
+	if (o->pack) {
+		uint32_t n = 1;
+		const uint8_t *data = diskpack_sectors(o->pack, lba, &n);
+		if (!data)
+			return 1;
+		memcpy(buf, data, 512);
+		return 0;
+	}
+	return file_at(o->base, (uint64_t)lba * 512, buf, 512, 0);
+}
+
+
+int diskoverlay_write ( struct diskoverlay *o, uint32_t lba, const uint8_t *buf )
+{
+	if (lba >= o->header.sectors)
+		return 1;
+	if (!o->table[lba]) {
+		// the count goes first: if the rest does not make it to the file,
+		// only an unused sector is left there
+		const uint32_t n = o->header.used + 1;
+		const uint32_t n_le = le32(n);
+		if (file_at(o->file, offsetof(struct diskoverlay_header, used), (void*)&n_le, 4, 1))
+			return 1;
+		o->header.used = n;
+		if (file_at(o->file, DISKOVERLAY_DATA_START(o->header.sectors) + (uint64_t)(n - 1) * 512, (void*)buf, 512, 1) ||
+		    file_at(o->file, DISKOVERLAY_HEADER_SIZE + (uint64_t)lba * 4, (void*)&n_le, 4, 1))
+			return 1;
+		o->table[lba] = n;
+		return 0;
+	}
+	return file_at(o->file, DISKOVERLAY_DATA_START(o->header.sectors) + (uint64_t)(o->table[lba] - 1) * 512, (void*)buf, 512, 1);
+}
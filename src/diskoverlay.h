@@ -0,0 +1,80 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_DISKOVERLAY_H_INCLUDED
+#define FAKE86_DISKOVERLAY_H_INCLUDED
+
+#include <stdint.h>
+
+#include "byteorder.h"
+
+/* Copy-on-write overlay images: only the sectors written since the overlay
+   was created are stored, the others are read from a read-only base image.
+   The file is a header, the allocation table (a 32 bit word for every
+   sector of the base image, 0 if the sector is not in the overlay, or the
+   number of its copy in the overlay, counting from 1), then the copies of
+   the written sectors, in the order of their allocation. The numbers are
+   little-endian. The base image may be a packed one (see diskpack.h). The
+   imagegen tool creates the overlays, and commits them into their (raw)
+   base images. */
+
+#define DISKOVERLAY_MAGIC	"FAKE86OV"
+#define DISKOVERLAY_VERSION	1
+#define DISKOVERLAY_HEADER_SIZE	4096
+#define DISKOVERLAY_BASE_MAX	(DISKOVERLAY_HEADER_SIZE - 32)
+
+struct diskoverlay_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	sectors;	// of the base image
+	uint64_t	basesize;	// in bytes, to notice a different base image
+	uint32_t	used;		// number of the sectors stored in the overlay
+	uint32_t	reserved;
+	char		base[DISKOVERLAY_BASE_MAX];	// path of the base image, zero terminated
+};
+
+// Offset of the stored sectors in the file, after the allocation table
+#define DISKOVERLAY_DATA_START(sectors)	(DISKOVERLAY_HEADER_SIZE + (((uint64_t)(sectors) * 4 + DISKOVERLAY_HEADER_SIZE - 1) & ~(uint64_t)(DISKOVERLAY_HEADER_SIZE - 1)))
+
+// Converts the numbers of a header between the file and the host byte order (either way)
+static inline void diskoverlay_header_byteorder ( struct diskoverlay_header *h )
+{
+	h->version  = le32(h->version);
+	h->sectors  = le32(h->sectors);
+	h->basesize = le64(h->basesize);
+	h->used     = le32(h->used);
+	h->reserved = le32(h->reserved);
+}
+
+#ifndef FAKE86_IMAGEGEN
+#include "hostfs.h"
+
+struct diskoverlay;
+
+extern int                 diskoverlay_check  ( HOSTFS_FILE *file );
+extern struct diskoverlay *diskoverlay_open   ( HOSTFS_FILE *file, const char **err );
+extern void                diskoverlay_close  ( struct diskoverlay *o );
+extern void                diskoverlay_reopen ( struct diskoverlay *o, HOSTFS_FILE *file );
+extern size_t              diskoverlay_size   ( const struct diskoverlay *o );
+extern int                 diskoverlay_read   ( struct diskoverlay *o, uint32_t lba, uint8_t *buf );
+extern int                 diskoverlay_write  ( struct diskoverlay *o, uint32_t lba, const uint8_t *buf );
+#endif
+
+#endif
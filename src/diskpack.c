@@ -0,0 +1,212 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* diskpack.c: reading the packed disk images (see diskpack.h for the
+   format). The blocks are decompressed into a small cache of the drive,
+   and the sectors are copied from there, a whole run of them within the
+   block at once. */
+
+#include "config.h"
+#include <SDL.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskpack.h"
+#include "lzblock.h"
+
+struct diskpack_slot {
+	int64_t		block;		// -1 if the slot is empty
+	uint32_t	lastuse;
+	uint8_t		*data;
+};
+
+struct diskpack {
+	HOSTFS_FILE		*file;		// the same as diskfile of the drive
+	struct diskpack_header	header;
+	struct diskpack_entry	*index;
+	uint8_t			*packed;	// buffer for the compressed data read from the file
+	uint8_t			*zero;		// a block of zeros, for the blocks not stored
+	uint32_t		usecounter;
+	struct diskpack_slot	slots[DISKPACK_CACHE_BLOCKS];
+};
+
+
+static int file_at ( HOSTFS_FILE *file, uint64_t ofs, void *buf, size_t size )
+{
+	if (hostfs_seek_set(file, ofs) != (Sint64)ofs)
+		return 1;
+	return hostfs_read(file, buf, size, 1) != 1;
+}
+
+
+// Size of a block unpacked: the last one may be shorter
+static inline uint32_t block_bytes ( const struct diskpack *p, uint32_t block )
+{
+	const uint64_t left = p->header.size - (uint64_t)block * p->header.blocksize;
+	return left < p->header.blocksize ? left : p->header.blocksize;
+}
+
+
+// Is the open file a packed image?
+int diskpack_check ( HOSTFS_FILE *file )
+{
+	char magic[8];
+	const int ok = !file_at(file, 0, magic, sizeof(magic)) && !memcmp(magic, DISKPACK_MAGIC, sizeof(magic));
+	hostfs_seek_set(file, 0);
+	return ok;
+}
+
+
+struct diskpack *diskpack_open ( HOSTFS_FILE *file, const char **err )
+{
+	struct diskpack *p = calloc(1, sizeof(struct diskpack));
+	if (!p) {
+		*err = "Out of memory";
+		return NULL;
+	}
+	p->file = file;
+	if (file_at(file, 0, &p->header, sizeof(p->header)) || memcmp(p->header.magic, DISKPACK_MAGIC, sizeof(p->header.magic))) {
+		*err = "Cannot read the header of the packed image";
+		goto error;
+	}
+	diskpack_header_byteorder(&p->header);
+	if (p->header.version != DISKPACK_VERSION) {
+		*err = "Unsupported packed image version";
+		goto error;
+	}
+	const uint32_t bs = p->header.blocksize;
+	if (bs < DISKPACK_BLOCK_MIN || bs > DISKPACK_BLOCK_MAX || (bs & (bs - 1)) || (p->header.size & 511) ||
+	    p->header.blocks != (p->header.size + bs - 1) / bs) {
+		*err = "Invalid header of the packed image";
+		goto error;
+	}
+	const uint64_t filesize = hostfs_size(file);
+	p->index = malloc((size_t)p->header.blocks * sizeof(struct diskpack_entry));
+	if (!p->index || file_at(file, sizeof(p->header), p->index, (size_t)p->header.blocks * sizeof(struct diskpack_entry))) {
+		*err = "Cannot read the index of the packed image";
+		goto error;
+	}
+	uint32_t stored = 0;
+	for (uint32_t block = 0; block < p->header.blocks; block++) {
+		struct diskpack_entry *e = &p->index[block];
+		diskpack_entry_byteorder(e);
+		if (e->size > block_bytes(p, block) || e->offset > filesize || e->size > filesize - e->offset) {
+			*err = "Invalid index of the packed image";
+			goto error;
+		}
+		stored += !!e->size;
+	}
+	p->packed = malloc(bs);
+	p->zero = calloc(1, bs);
+	if (!p->packed || !p->zero) {
+		*err = "Out of memory";
+		goto error;
+	}
+	for (int i = 0; i < DISKPACK_CACHE_BLOCKS; i++) {
+		p->slots[i].block = -1;
+		if (!(p->slots[i].data = malloc(bs))) {
+			*err = "Out of memory";
+			goto error;
+		}
+	}
+	printf("DISK: packed image, %u blocks of %uK, %u stored, %luK in the file\n",
+		p->header.blocks, bs >> 10, stored, (unsigned long)(filesize >> 10));
+	return p;
+error:
+	diskpack_close(p);
+	return NULL;
+}
+
+
+// The file is closed by the caller
+void diskpack_close ( struct diskpack *p )
+{
+	for (int i = 0; i < DISKPACK_CACHE_BLOCKS; i++)
+		free(p->slots[i].data);
+	free(p->zero);
+	free(p->packed);
+	free(p->index);
+	free(p);
+}
+
+
+// After fork(), see disk_make_private()
+void diskpack_reopen ( struct diskpack *p, HOSTFS_FILE *file )
+{
+	p->file = file;
+}
+
+
+size_t diskpack_size ( const struct diskpack *p )
+{
+	return p->header.size;
+}
+
+
+// The block in the cache, decompressed if it is not there yet
+static const uint8_t *get_block ( struct diskpack *p, uint32_t block )
+{
+	const struct diskpack_entry *e = &p->index[block];
+	if (!e->size)
+		return p->zero;
+	struct diskpack_slot *slot = &p->slots[0];
+	for (int i = 0; i < DISKPACK_CACHE_BLOCKS; i++) {
+		if (p->slots[i].block == block) {
+			slot = &p->slots[i];
+			slot->lastuse = ++p->usecounter;
+			return slot->data;
+		}
+		if (p->slots[i].lastuse < slot->lastuse)
+			slot = &p->slots[i];	// the least recently used one, if the block is not found
+	}
+	const uint32_t bytes = block_bytes(p, block);
+	slot->block = -1;
+	if (e->size == bytes) {
+		if (file_at(p->file, e->offset, slot->data, bytes))
+			return NULL;
+	} else if (file_at(p->file, e->offset, p->packed, e->size) || lzblock_decompress(p->packed, e->size, slot->data, bytes)) {
+		fprintf(stderr, "DISK: corrupt block #%u in the packed image\n", block);
+		return NULL;
+	}
+	slot->block = block;
+	slot->lastuse = ++p->usecounter;
+	return slot->data;
+}
+
+
+// Returns the data of the sector 'lba', and of the next ones in the same
+// block. '*count' is the number of the sectors wanted on entry, and the
+// number of them available on return.
+const uint8_t *diskpack_sectors ( struct diskpack *p, uint32_t lba, uint32_t *count )
+{
+	const uint64_t ofs = (uint64_t)lba * 512;
+	if (ofs >= p->header.size)
+		return NULL;
+	const uint32_t block = ofs / p->header.blocksize;
+	const uint32_t inblock = ofs % p->header.blocksize;
+	const uint32_t left = (block_bytes(p, block) - inblock) / 512;
+	if (*count > left)
+		*count = left;
+	const uint8_t *data = get_block(p, block);
+	return data ? data + inblock : NULL;
+}
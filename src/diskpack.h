@@ -0,0 +1,89 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_DISKPACK_H_INCLUDED
+#define FAKE86_DISKPACK_H_INCLUDED
+
+#include <stdint.h>
+
+#include "byteorder.h"
+
+/* Packed disk images: the image is split into blocks of the same size,
+   which are compressed one by one (see lzblock.h), and the blocks of zero
+   bytes are not stored at all. The file is a header, the index (an entry
+   for every block), then the stored blocks. The numbers are little-endian.
+   The imagegen tool packs and unpacks the images. The packed images are
+   read-only, an overlay image (see diskoverlay.h) can be created on them to
+   write. */
+
+#define DISKPACK_MAGIC		"FAKE86PK"
+#define DISKPACK_VERSION	1
+#define DISKPACK_BLOCK_MIN	512
+#define DISKPACK_BLOCK_MAX	(1024 * 1024)
+#define DISKPACK_BLOCK_DEFAULT	(32 * 1024)
+// Number of the decompressed blocks kept in the memory for every packed drive
+#define DISKPACK_CACHE_BLOCKS	8
+
+struct diskpack_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	blocksize;	// power of 2, DISKPACK_BLOCK_MIN ... DISKPACK_BLOCK_MAX
+	uint64_t	size;		// of the unpacked image, in bytes
+	uint32_t	blocks;		// number of the index entries
+	uint32_t	reserved;
+};
+
+struct diskpack_entry {
+	uint64_t	offset;		// of the stored block in the file
+	uint32_t	size;		// 0: all zero (not stored), blocksize: stored uncompressed, otherwise compressed
+	uint32_t	reserved;
+};
+
+// Convert the numbers of a header/an index entry between the file and the host byte order (either way)
+static inline void diskpack_header_byteorder ( struct diskpack_header *h )
+{
+	h->version   = le32(h->version);
+	h->blocksize = le32(h->blocksize);
+	h->size      = le64(h->size);
+	h->blocks    = le32(h->blocks);
+	h->reserved  = le32(h->reserved);
+}
+
+static inline void diskpack_entry_byteorder ( struct diskpack_entry *e )
+{
+	e->offset   = le64(e->offset);
+	e->size     = le32(e->size);
+	e->reserved = le32(e->reserved);
+}
+
+#ifndef FAKE86_IMAGEGEN
+#include "hostfs.h"
+
+struct diskpack;
+
+extern int                diskpack_check   ( HOSTFS_FILE *file );
+extern struct diskpack   *diskpack_open    ( HOSTFS_FILE *file, const char **err );
+extern void               diskpack_close   ( struct diskpack *p );
+extern void               diskpack_reopen  ( struct diskpack *p, HOSTFS_FILE *file );
+extern size_t             diskpack_size    ( const struct diskpack *p );
+extern const uint8_t     *diskpack_sectors ( struct diskpack *p, uint32_t lba, uint32_t *count );
+#endif
+
+#endif
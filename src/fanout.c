@@ -0,0 +1,175 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* fanout.c: running many jobs from one booted machine (-fanout). When the
+   guest reaches its ready point (it calls the emulation gateway, or right
+   after -loadstate), the process forks a child for every job, sharing the
+   memory of the machine copy-on-write, with no more of them running at the
+   same time than the number of host CPUs. Every child writes its output
+   into its own log file, and gets private copies of the disks, so the
+   writes of a job are not seen by the others (or the image files). The
+   parent only waits for the children and exits.
+
+   The emulation gateway can be called both with a far call to the
+   BIOS_TRAP_EMUGW trap of the internal BIOS, and with INT E6h:
+
+     AH=10h  ready point: fans out (once), returns the job number in AX
+             (1...N in the children, 0 without -fanout)
+     AH=11h  returns the job number in AX
+     AH=12h  writes CX bytes from DS:SI into the output of the job
+     AH=13h  ends the job with the exit status in AL */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "fanout.h"
+
+#include "cpu.h"
+#include "disk.h"
+#include "diskcache.h"
+#include "parsecl.h"
+
+unsigned int fanout_job = 0;	// the number of the job of this process, 0 in the parent
+int fanout_status = 0;		// exit status of the job, see AH=13h
+static int fanout_done = 0;
+
+
+#ifndef _WIN32
+// The child of a job: own output channel and disks
+static void fanout_child ( void )
+{
+	char logname[1024];
+	snprintf(logname, sizeof(logname), "%s%u.log", fanoutlog, fanout_job);
+	if (!freopen(logname, "w", stdout)) {
+		fprintf(stderr, "FANOUT: job %u cannot create its log file %s\n", fanout_job, logname);
+		exit(1);
+	}
+	dup2(fileno(stdout), fileno(stderr));
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	printf("FANOUT: job %u of %u (pid %ld)\n", fanout_job, fanoutjobs, (long)getpid());
+	disk_make_private();
+}
+#endif
+
+
+// Forks the children for the jobs. Returns the job number in the children,
+// the parent does not return from here, but exits when all of them ended.
+unsigned int fanout_start ( void )
+{
+	if (fanout_done || !fanoutjobs)
+		return fanout_job;
+	fanout_done = 1;
+#ifdef _WIN32
+	fprintf(stderr, "FANOUT: not supported on Windows, running a single job\n");
+	return fanout_job;
+#else
+	long maxchildren = sysconf(_SC_NPROCESSORS_ONLN);
+	if (maxchildren < 1)
+		maxchildren = 1;
+	pid_t *pids = calloc(fanoutjobs, sizeof(pid_t));
+	if (!pids) {
+		fprintf(stderr, "FANOUT: out of memory\n");
+		exit(1);
+	}
+	printf("FANOUT: starting %u jobs, %ld at a time, logs are %s*.log\n", fanoutjobs, maxchildren, fanoutlog);
+	diskcache_stop();	// fork() would not copy the flush thread, and the children must not write the images
+	fflush(NULL);	// or the children would write out the buffered data of the parent again
+	unsigned int started = 0, children = 0, failed = 0;
+	while (started < fanoutjobs || children) {
+		if (started < fanoutjobs && children < maxchildren) {
+			const pid_t pid = fork();
+			if (!pid) {
+				fanout_job = started + 1;
+				free(pids);
+				fanout_child();
+				return fanout_job;
+			}
+			if (pid > 0) {
+				pids[started++] = pid;
+				children++;
+				continue;
+			}
+			perror("FANOUT: cannot fork");
+			failed += fanoutjobs - started;
+			started = fanoutjobs;
+			if (!children)
+				break;
+		}
+		int status;
+		const pid_t pid = wait(&status);
+		if (pid < 0) {
+			perror("FANOUT: wait");
+			break;
+		}
+		unsigned int job = 0;
+		while (job < started && pids[job] != pid)
+			job++;
+		if (job == started)
+			continue;	// not one of ours
+		children--;
+		if (WIFEXITED(status) && !WEXITSTATUS(status))
+			continue;
+		failed++;
+		if (WIFEXITED(status))
+			printf("FANOUT: job %u exited with status %d\n", job + 1, WEXITSTATUS(status));
+		else
+			printf("FANOUT: job %u was killed by signal %d\n", job + 1, WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+		fflush(stdout);	// before the next fork()
+	}
+	free(pids);
+	printf("FANOUT: %u jobs finished, %u failed\n", fanoutjobs, failed);
+	exit(failed ? 1 : 0);
+#endif
+}
+
+
+// The emulation gateway functions, returns non-zero if AH is not one of them
+int fanout_gateway ( void )
+{
+	switch (CPU_AH) {
+		case 0x10:
+			CPU_AX = fanout_start();
+			break;
+		case 0x11:
+			CPU_AX = fanout_job;
+			break;
+		case 0x12:
+			for (uint16_t i = 0; i < CPU_CX; i++)
+				putchar(read86(((uint32_t)CPU_DS << 4) + (uint16_t)(CPU_SI + i)));
+			fflush(stdout);
+			break;
+		case 0x13:
+			fanout_status = CPU_AL;
+			machine_running = 0;
+			machine_attention();
+			break;
+		default:
+			return 1;
+	}
+	CPU_FL_CF = 0;
+	return 0;
+}
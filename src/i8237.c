@@ -18,8 +18,9 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
-/* i8237.c: functions to emulate the Intel 8237 DMA controller.
-   the Sound Blaster emulation functions rely on this! */
+/* i8237.c: functions to emulate the Intel 8237 DMA controller, with its
+   four channels and the page registers of the PC. The devices move whole
+   blocks through it, the Sound Blaster emulation functions rely on this! */
 
 #include "config.h"
 #include <stdint.h>
@@ -28,107 +29,224 @@
 
 #include "i8237.h"
 
-#include "blaster.h"
 #include "ports.h"
 #include "cpu.h"
 
 
-static struct dmachan_s dmachan[4];
-static uint8_t flipflop = 0;
+#define dmachan		(machine->i8237.chan)
+#define flipflop	(machine->i8237.flipflop)
+#define dmacommand	(machine->i8237.command)
+#define dmastatus	(machine->i8237.status)
+#define dmarequest	(machine->i8237.request)
+#define dmapages	(machine->i8237.pages)
 
-uint8_t read8237 (uint8_t channel) {
-	uint8_t ret;
-	if (dmachan[channel].masked) return 128;
-	if (dmachan[channel].autoinit && (dmachan[channel].count > dmachan[channel].reload) ) dmachan[channel].count = 0;
-	if (dmachan[channel].count > dmachan[channel].reload) return 128;
-	//if (dmachan[channel].direction) ret = RAM[dmachan[channel].page + dmachan[channel].addr + dmachan[channel].count];
-	//	else ret = RAM[dmachan[channel].page + dmachan[channel].addr - dmachan[channel].count];
-	if (dmachan[channel].direction == 0) ret = RAM[dmachan[channel].page + dmachan[channel].addr + dmachan[channel].count];
-	else ret = RAM[dmachan[channel].page + dmachan[channel].addr - dmachan[channel].count];
-	dmachan[channel].count++;
-	return ret;
+// the page register of each channel, from port 80h
+static const uint8_t pageport[4] = { 7, 3, 1, 2 };
+
+
+// Moves at most 'len' bytes on the channel, in spans which are contiguous
+// in the memory and stay before the terminal count. Without 'buf' only the
+// registers are stepped, with 'peek' only the memory is accessed.
+static uint32_t transfer ( uint8_t channel, uint8_t *buf, uint32_t len, int tomemory, int peek )
+{
+	struct dmachan_s copy = dmachan[channel & 3];
+	struct dmachan_s *c = peek ? &copy : &dmachan[channel & 3];
+	uint32_t done = 0;
+	if (c->masked || (dmacommand & 4))	// or the whole controller is disabled
+		return 0;
+	while (done < len) {
+		uint32_t n = (uint32_t)c->count + 1;
+		if (n > len - done)
+			n = len - done;
+		// the address wraps within the 64K of the page
+		const uint32_t room = c->direction ? (uint32_t)c->addr + 1 : 0x10000 - c->addr;
+		if (n > room)
+			n = room;
+		const uint32_t linear = ((uint32_t)dmapages[pageport[channel & 3]] << 16) | c->addr;
+		if (!buf) {
+			if (c->direction)
+				c->addr -= n;
+			else
+				c->addr += n;
+		} else if (!c->direction) {
+			if (tomemory)
+				cpu_mem_write_block(linear, buf + done, n);
+			else
+				cpu_mem_read_block(linear, buf + done, n);
+			c->addr += n;
+		} else {
+			for (uint32_t i = 0; i < n; i++) {
+				if (tomemory)
+					write86(linear - i, buf[done + i]);
+				else
+					buf[done + i] = read86(linear - i);
+			}
+			c->addr -= n;
+		}
+		done += n;
+		c->count -= n;
+		if (c->count == 0xFFFF) {
+			// terminal count
+			if (!peek)
+				dmastatus |= 1 << (channel & 3);
+			if (!c->autoinit) {
+				c->masked = 1;
+				break;
+			}
+			c->addr = c->baseaddr;
+			c->count = c->basecount;
+		}
+	}
+	return done;
+}
+
+
+uint32_t i8237_read_block ( uint8_t channel, uint8_t *buf, uint32_t len )
+{
+	return transfer(channel, buf, len, 0, 0);
+}
+
+
+uint32_t i8237_write_block ( uint8_t channel, const uint8_t *buf, uint32_t len )
+{
+	return transfer(channel, (uint8_t *)buf, len, 1, 0);
 }
 
-static void out8237 (uint16_t addr, uint8_t value) {
-	uint8_t channel;
+
+uint32_t i8237_peek_block ( uint8_t channel, uint8_t *buf, uint32_t len )
+{
+	return transfer(channel, buf, len, 0, 1);
+}
+
+
+uint32_t i8237_advance ( uint8_t channel, uint32_t len )
+{
+	return transfer(channel, NULL, len, 0, 0);
+}
+
+
+// A byte of the address or count registers, through the flip-flop
+static void write_word ( uint16_t *reg, uint16_t *base, uint8_t value )
+{
+	if (flipflop)
+		*reg = (*reg & 0x00FF) | ((uint16_t)value << 8);
+	else
+		*reg = (*reg & 0xFF00) | value;
+	*base = *reg;
+	flipflop ^= 1;
+}
+
+
+static void out8237 ( uint16_t addr, uint8_t value )
+{
+	const uint8_t channel = value & 3;
 #ifdef DEBUG_DMA
-	printf ("out8237(0x%X, %X);\n", addr, value);
+	printf("out8237(0x%X, %X);\n", addr, value);
 #endif
+	if (addr >= 0x80) {
+		dmapages[addr & 0xF] = value;
+		return;
+	}
 	switch (addr) {
-			case 0x2: //channel 1 address register
-				if (flipflop == 1) dmachan[1].addr = (dmachan[1].addr & 0x00FF) | ( (uint32_t) value << 8);
-				else dmachan[1].addr = (dmachan[1].addr & 0xFF00) | value;
-#ifdef DEBUG_DMA
-				if (flipflop == 1) printf ("[NOTICE] DMA channel 1 address register = %04X\n", dmachan[1].addr);
-#endif
-				flipflop = ~flipflop & 1;
-				break;
-			case 0x3: //channel 1 count register
-				if (flipflop == 1) dmachan[1].reload = (dmachan[1].reload & 0x00FF) | ( (uint32_t) value << 8);
-				else dmachan[1].reload = (dmachan[1].reload & 0xFF00) | value;
-				if (flipflop == 1) {
-						if (dmachan[1].reload == 0) dmachan[1].reload = 65536;
-						dmachan[1].count = 0;
-#ifdef DEBUG_DMA
-						printf ("[NOTICE] DMA channel 1 reload register = %04X\n", dmachan[1].reload);
-#endif
-					}
-				flipflop = ~flipflop & 1;
-				break;
-			case 0xA: //write single mask register
-				channel = value & 3;
-				dmachan[channel].masked = (value >> 2) & 1;
-#ifdef DEBUG_DMA
-				printf ("[NOTICE] DMA channel %u masking = %u\n", channel, dmachan[channel].masked);
-#endif
-				break;
-			case 0xB: //write mode register
-				channel = value & 3;
-				dmachan[channel].direction = (value >> 5) & 1;
-				dmachan[channel].autoinit = (value >> 4) & 1;
-				dmachan[channel].writemode = (value >> 2) & 1; //not quite accurate
-#ifdef DEBUG_DMA
-				printf ("[NOTICE] DMA channel %u write mode reg: direction = %u, autoinit = %u, write mode = %u\n",
-				        channel, dmachan[channel].direction, dmachan[channel].autoinit, dmachan[channel].writemode);
-#endif
-				break;
-			case 0xC: //clear byte pointer flip-flop
+		case 0x0:
+		case 0x2:
+		case 0x4:
+		case 0x6:	// address registers
+			write_word(&dmachan[addr >> 1].addr, &dmachan[addr >> 1].baseaddr, value);
+			break;
+		case 0x1:
+		case 0x3:
+		case 0x5:
+		case 0x7:	// count registers
+			write_word(&dmachan[addr >> 1].count, &dmachan[addr >> 1].basecount, value);
+			break;
+		case 0x8:	// command register
+			dmacommand = value;
+			break;
+		case 0x9:	// request register
+			if (value & 4)
+				dmarequest |= 1 << channel;
+			else
+				dmarequest &= ~(1 << channel);
+			break;
+		case 0xA:	// write single mask register
+			dmachan[channel].masked = (value >> 2) & 1;
 #ifdef DEBUG_DMA
-				printf ("[NOTICE] DMA cleared byte pointer flip-flop\n");
+			printf("[NOTICE] DMA channel %u masking = %u\n", channel, dmachan[channel].masked);
 #endif
-				flipflop = 0;
-				break;
-			case 0x83: //DMA channel 1 page register
-				dmachan[1].page = (uint32_t) value << 16;
+			break;
+		case 0xB:	// write mode register
+			dmachan[channel].mode = value >> 6;
+			dmachan[channel].direction = (value >> 5) & 1;
+			dmachan[channel].autoinit = (value >> 4) & 1;
+			dmachan[channel].transfer = (value >> 2) & 3;
 #ifdef DEBUG_DMA
-				printf ("[NOTICE] DMA channel 1 page base = %05X\n", dmachan[1].page);
+			printf("[NOTICE] DMA channel %u mode: direction = %u, autoinit = %u, transfer = %u\n",
+				channel, dmachan[channel].direction, dmachan[channel].autoinit, dmachan[channel].transfer);
 #endif
-				break;
-		}
+			break;
+		case 0xC:	// clear byte pointer flip-flop
+			flipflop = 0;
+			break;
+		case 0xD:	// master clear
+			dmacommand = dmastatus = dmarequest = 0;
+			flipflop = 0;
+			for (int i = 0; i < 4; i++)
+				dmachan[i].masked = 1;
+			break;
+		case 0xE:	// clear mask register
+			for (int i = 0; i < 4; i++)
+				dmachan[i].masked = 0;
+			break;
+		case 0xF:	// write all mask register bits
+			for (int i = 0; i < 4; i++)
+				dmachan[i].masked = (value >> i) & 1;
+			break;
+	}
 }
 
-static uint8_t in8237 (uint16_t addr) {
+
+static uint8_t in8237 ( uint16_t addr )
+{
 #ifdef DEBUG_DMA
-	printf ("in8237(0x%X);\n", addr);
+	printf("in8237(0x%X);\n", addr);
 #endif
+	if (addr >= 0x80)
+		return dmapages[addr & 0xF];
+	uint8_t ret = 0;
 	switch (addr) {
-		case 3:
-			if (flipflop == 1)
-				return dmachan[1].reload >> 8;
-			else
-				return dmachan[1].reload;
-			flipflop = ~flipflop & 1;	// this seems to be invalid, control never gets here ... :-O
+		case 0x0:
+		case 0x2:
+		case 0x4:
+		case 0x6:	// current address
+		case 0x1:
+		case 0x3:
+		case 0x5:
+		case 0x7: {	// current count
+			const uint16_t reg = (addr & 1) ? dmachan[addr >> 1].count : dmachan[addr >> 1].addr;
+			ret = flipflop ? (uint8_t)(reg >> 8) : (uint8_t)reg;
+			flipflop ^= 1;
+			break;
+		}
+		case 0x8:	// status register, the terminal count bits are cleared by reading
+			ret = dmastatus | (dmarequest << 4);
+			dmastatus = 0;
+			break;
+		case 0xF:	// mask register
+			for (int i = 0; i < 4; i++)
+				ret |= dmachan[i].masked << i;
+			ret |= 0xF0;
 			break;
 	}
-	return 0;
+	return ret;
 }
 
-void init8237(void) {
-	memset (dmachan, 0, sizeof (dmachan) );
-
-	set_port_write_redirector (0x00, 0x0F, &out8237);
-	set_port_read_redirector (0x00, 0x0F, &in8237);
 
-	set_port_write_redirector (0x80, 0x8F, &out8237);
-	set_port_read_redirector (0x80, 0x8F, &in8237);
+void init8237 ( void )
+{
+	memset(&machine->i8237, 0, sizeof(machine->i8237));
+	set_port_write_redirector(0x00, 0x0F, &out8237);
+	set_port_read_redirector(0x00, 0x0F, &in8237);
+	set_port_write_redirector(0x80, 0x8F, &out8237);
+	set_port_read_redirector(0x80, 0x8F, &in8237);
 }
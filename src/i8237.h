@@ -24,17 +24,39 @@
 #include <stdint.h>
 
 struct dmachan_s {
-	uint32_t page;
-	uint32_t addr;
-	uint32_t reload;
-	uint32_t count;
-	uint8_t direction;
+	uint16_t baseaddr;	// written by the CPU, reloaded in autoinit mode
+	uint16_t basecount;
+	uint16_t addr;		// current
+	uint16_t count;		// current, bytes left minus one, FFFFh after the terminal count
+	uint8_t direction;	// address decrement
 	uint8_t autoinit;
-	uint8_t writemode;
+	uint8_t transfer;	// mode bits 3-2: 0 verify, 1 write to memory, 2 read from memory
+	uint8_t mode;		// mode bits 7-6: demand, single, block, cascade
 	uint8_t masked;
 };
 
-extern void init8237(void);
-extern uint8_t read8237 (uint8_t channel);
+struct i8237_s {
+	struct dmachan_s chan[4];
+	uint8_t flipflop;
+	uint8_t command;
+	uint8_t status;		// terminal count reached (bits 0-3) and requests (bits 4-7)
+	uint8_t request;
+	uint8_t pages[16];	// ports 80h-8Fh, the page registers are 81h-83h and 87h
+};
+
+extern void     init8237 ( void );
+/* Block transfers on a channel for the devices: 'len' bytes at most, from
+   the memory to 'buf' (the memory read transfers of a sound card), or from
+   'buf' to the memory (a disk controller reading a sector). They stop at
+   the terminal count unless the channel is in autoinit mode, and return the
+   bytes moved, 0 if the channel is masked. */
+extern uint32_t i8237_read_block  ( uint8_t channel, uint8_t *buf, uint32_t len );
+extern uint32_t i8237_write_block ( uint8_t channel, const uint8_t *buf, uint32_t len );
+/* A device reading ahead of its actual DMA cycles (the FIFO of a sound
+   card) peeks at what i8237_read_block() would give, without moving the
+   channel, then moves it as it consumes the bytes, so the address, count
+   and terminal count seen by the CPU follow the device. */
+extern uint32_t i8237_peek_block  ( uint8_t channel, uint8_t *buf, uint32_t len );
+extern uint32_t i8237_advance     ( uint8_t channel, uint32_t len );
 
 #endif
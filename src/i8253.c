@@ -30,88 +30,397 @@
 
 #include "i8253.h"
 
+#include "i8259.h"
 #include "mutex.h"
 #include "ports.h"
 #include "timing.h"
 
 
-struct i8253_s i8253;
+// The PIT clocks since the start of the machine time
+static uint64_t pit_now ( void )
+{
+	const uint64_t now = timing_now(), clock = timing_clock();
+	return now / clock * PIT_CLOCK + now % clock * PIT_CLOCK / clock;
+}
 
 
-static void out8253 ( uint16_t portnum, uint8_t value )
+// The machine time of a PIT clock, rounded up
+static uint64_t pit_time ( uint64_t pit )
 {
-	uint8_t curbyte = 0; // make gcc happy to have initialized variable :)
-	portnum &= 3;
-	switch (portnum) {
+	const uint64_t clock = timing_clock();
+	return pit / PIT_CLOCK * clock + (pit % PIT_CLOCK * clock + PIT_CLOCK - 1) / PIT_CLOCK;
+}
+
+
+static inline uint32_t modulus ( int ch )
+{
+	return i8253.bcd[ch] ? 10000 : 65536;
+}
+
+
+static uint32_t from_bcd ( uint16_t value )
+{
+	return (value >> 12) * 1000 + ((value >> 8) & 15) * 100 + ((value >> 4) & 15) * 10 + (value & 15);
+}
+
+
+static uint16_t to_bcd ( uint32_t value )
+{
+	return ((value / 1000 % 10) << 12) | ((value / 100 % 10) << 8) | ((value / 10 % 10) << 4) | (value % 10);
+}
+
+
+// The reload of modes 2 and 3, once the current period is over
+static void update ( int ch, uint64_t now )
+{
+	if (i8253.pending[ch] && now >= i8253.switchat[ch]) {
+		i8253.pending[ch] = 0;
+		i8253.effectivedata[ch] = i8253.start[ch] = i8253.nextdata[ch];
+		i8253.loaded[ch] = i8253.switchat[ch];
+		i8253.chanfreq[ch] = (float)PIT_CLOCK / (float)i8253.effectivedata[ch];
+	}
+}
+
+
+// The count of the counting element, in binary, 'modulus' for zero
+static uint32_t count ( int ch, uint64_t now )
+{
+	if (!i8253.active[ch])
+		return i8253.start[ch];
+	const uint64_t elapsed = now - i8253.loaded[ch];
+	const uint32_t n = i8253.effectivedata[ch];
+	switch (i8253.mode[ch]) {
+		case 2:
+			return n - (uint32_t)(elapsed % n);
+		case 3: {
+			// by two, with the OUT high in the first half (one more for odd counts)
+			const uint32_t pos = (uint32_t)(elapsed % n), high = (n + 1) / 2;
+			const uint32_t even = n & ~1U;
+			return pos < high ? even - 2 * pos : even - 2 * (pos - high);
+		}
+		default: {
+			// modes 0, 1, 4, 5 wrap around after the terminal count
+			const uint32_t m = modulus(ch);
+			const uint32_t pos = (uint32_t)(elapsed % m);
+			const uint32_t c = i8253.start[ch] > pos ? i8253.start[ch] - pos : i8253.start[ch] + m - pos;
+			return c;
+		}
+	}
+}
+
+
+static uint8_t out ( int ch, uint64_t now )
+{
+	if (!i8253.active[ch])
+		return i8253.mode[ch] == 0 ? i8253.tc[ch] : 1;
+	const uint64_t elapsed = now - i8253.loaded[ch];
+	const uint32_t n = i8253.effectivedata[ch];
+	switch (i8253.mode[ch]) {
 		case 0:
 		case 1:
-		case 2: //channel data
-			if ((i8253.accessmode[portnum] == PIT_MODE_LOBYTE) || ((i8253.accessmode[portnum] == PIT_MODE_TOGGLE) && (i8253.bytetoggle[portnum] == 0)))
-				curbyte = 0;
-			else if ((i8253.accessmode[portnum] == PIT_MODE_HIBYTE) || ((i8253.accessmode[portnum] == PIT_MODE_TOGGLE) && (i8253.bytetoggle[portnum] == 1)))
-				curbyte = 1;
-			if (curbyte == 0)  //low byte
-				i8253.chandata[portnum] = (i8253.chandata[portnum] & 0xFF00) | value;
-			else    //high byte
-				i8253.chandata[portnum] = (i8253.chandata[portnum] & 0x00FF) | ( (uint16_t) value << 8);
-			if (i8253.chandata[portnum] == 0)
-				i8253.effectivedata[portnum] = 65536;
-			else
-				i8253.effectivedata[portnum] = i8253.chandata[portnum];
-			i8253.active[portnum] = 1;
-			tickgap = (uint64_t) ( (float) hostfreq / (float) ( (float) 1193182 / (float) i8253.effectivedata[0]) );
-			if (i8253.accessmode[portnum] == PIT_MODE_TOGGLE)
-				i8253.bytetoggle[portnum] = (~i8253.bytetoggle[portnum]) & 1;
-			i8253.chanfreq[portnum] = (float) ( (uint32_t) ( ( (float) 1193182.0 / (float) i8253.effectivedata[portnum]) * (float) 1000.0) ) / (float) 1000.0;
-			//printf("[DEBUG] PIT channel %u counter changed to %u (%f Hz)\n", portnum, i8253.chandata[portnum], i8253.chanfreq[portnum]);
+			return i8253.tc[ch] || elapsed >= i8253.start[ch];
+		case 2:
+			return n == 1 || elapsed % n != n - 1;
+		case 3:
+			return elapsed % n < (n + 1) / 2;
+		default:	// modes 4 and 5: low for the clock of the terminal count
+			return elapsed != i8253.start[ch];
+	}
+}
+
+
+// The PIT clock of the next rising edge of OUT0 after 'now', 0 if none
+static uint64_t next_edge ( uint64_t now )
+{
+	if (!i8253.active[0])
+		return 0;
+	const uint64_t loaded = i8253.loaded[0];
+	const uint32_t n = i8253.effectivedata[0];
+	switch (i8253.mode[0]) {
+		case 0:
+		case 1:
+			if (i8253.tc[0] || loaded + i8253.start[0] <= now)
+				return 0;
+			return loaded + i8253.start[0];
+		case 2:
+		case 3:
+			// at the reloads, the pending one is at the end of the period anyway
+			return loaded + ((now - loaded) / n + 1) * n;
+		default:
+			if (loaded + i8253.start[0] + 1 <= now)
+				return 0;
+			return loaded + i8253.start[0] + 1;
+	}
+}
+
+
+// Schedules IRQ0 to the next rising edge of OUT0
+static void schedule_irq0 ( uint64_t now )
+{
+	const uint64_t edge = next_edge(now);
+	if (edge)
+		timing_at(TIMING_PIT, pit_time(edge));
+	else
+		timing_stop(TIMING_PIT);
+}
+
+
+static void pit_irq ( void )
+{
+	const uint64_t now = pit_now();
+	update(0, now);
+	doirq(0);
+	schedule_irq0(now);
+}
+
+
+// Starts counting from 'value' now
+static void start ( int ch, uint32_t value, uint64_t now )
+{
+	i8253.start[ch] = value;
+	i8253.loaded[ch] = now;
+	i8253.tc[ch] = 0;
+	i8253.active[ch] = 1;
+}
+
+
+// Stops counting, the count is kept
+static void stop ( int ch, uint64_t now )
+{
+	if (!i8253.active[ch])
+		return;
+	if (i8253.mode[ch] <= 1)
+		i8253.tc[ch] = out(ch, now);
+	i8253.start[ch] = count(ch, now);
+	i8253.active[ch] = 0;
+}
+
+
+// A new count was written
+static void load ( int ch, uint64_t now )
+{
+	uint32_t n = i8253.bcd[ch] ? from_bcd(i8253.chandata[ch]) : i8253.chandata[ch];
+	if (!n)
+		n = modulus(ch);
+	const int wasarmed = i8253.armed[ch];
+	i8253.armed[ch] = 1;
+	switch (i8253.mode[ch]) {
+		case 2:
+		case 3:
+			if (i8253.active[ch] && wasarmed) {
+				// the current period is finished first
+				const uint64_t elapsed = now - i8253.loaded[ch];
+				const uint32_t cur = i8253.effectivedata[ch];
+				i8253.pending[ch] = 1;
+				i8253.nextdata[ch] = n;
+				i8253.switchat[ch] = i8253.loaded[ch] + (elapsed + cur - 1) / cur * cur;
+				if (i8253.switchat[ch] <= now)
+					update(ch, now);
+				return;
+			}
+			break;
+		case 1:
+		case 5:
+			// used at the next trigger by the gate
+			i8253.effectivedata[ch] = n;
+			i8253.chanfreq[ch] = (float)PIT_CLOCK / (float)n;
+			return;
+	}
+	i8253.effectivedata[ch] = n;
+	i8253.chanfreq[ch] = (float)PIT_CLOCK / (float)n;
+	i8253.start[ch] = n;
+	i8253.tc[ch] = 0;
+	if (i8253.gate[ch])
+		start(ch, n, now);
+}
+
+
+static uint8_t status ( int ch, uint64_t now )
+{
+	return (out(ch, now) << 7) | ((!i8253.armed[ch] || i8253.pending[ch]) << 6) |
+		(i8253.accessmode[ch] << 4) | (i8253.mode[ch] << 1) | i8253.bcd[ch];
+}
+
+
+static uint16_t read_count ( int ch, uint64_t now )
+{
+	const uint32_t c = count(ch, now) % modulus(ch);
+	return i8253.bcd[ch] ? to_bcd(c) : (uint16_t)c;
+}
+
+
+static void latch_count ( int ch, uint64_t now )
+{
+	if (i8253.latched[ch])
+		return;
+	i8253.latch[ch] = read_count(ch, now);
+	i8253.latched[ch] = i8253.accessmode[ch] == PIT_MODE_TOGGLE ? 2 : 1;
+}
+
+
+// The gate input of a counter, only the one of channel 2 is not tied high
+void i8253_gate ( int ch, int level )
+{
+	level = !!level;
+	if (level == i8253.gate[ch])
+		return;
+	const uint64_t now = pit_now();
+	update(ch, now);
+	i8253.gate[ch] = level;
+	switch (i8253.mode[ch]) {
+		case 0:
+		case 4:
+			// the counting is suspended while the gate is low
+			if (!level)
+				stop(ch, now);
+			else if (i8253.armed[ch]) {
+				const uint8_t tc = i8253.tc[ch];
+				start(ch, i8253.start[ch], now);
+				i8253.tc[ch] = tc;
+			}
 			break;
-		case 3: //mode/command
-			i8253.accessmode[value>>6] = (value >> 4) & 3;
-			if (i8253.accessmode[value>>6] == PIT_MODE_TOGGLE)
-				i8253.bytetoggle[value>>6] = 0;
+		case 2:
+		case 3:
+			// the OUT is high while the gate is low, the count is reloaded on the rising edge
+			if (!level) {
+				stop(ch, now);
+				if (i8253.pending[ch]) {
+					i8253.pending[ch] = 0;
+					i8253.effectivedata[ch] = i8253.nextdata[ch];
+				}
+			} else if (i8253.armed[ch])
+				start(ch, i8253.effectivedata[ch], now);
 			break;
 		default:
-			UNREACHABLE();
+			// modes 1 and 5 are triggered by the rising edge
+			if (level && i8253.armed[ch])
+				start(ch, i8253.effectivedata[ch], now);
+			break;
 	}
+	if (ch == 0)
+		schedule_irq0(now);
 }
 
 
-static uint8_t in8253 ( uint16_t portnum )
+uint8_t i8253_out ( int ch )
+{
+	const uint64_t now = pit_now();
+	update(ch, now);
+	return out(ch, now);
+}
+
+
+static void out8253 ( uint16_t portnum, uint8_t value )
 {
-	uint8_t curbyte;
+	const uint64_t now = pit_now();
 	portnum &= 3;
 	switch (portnum) {
 		case 0:
 		case 1:
 		case 2: //channel data
-			if ((i8253.accessmode[portnum] == 0) || (i8253.accessmode[portnum] == PIT_MODE_LOBYTE) || ((i8253.accessmode[portnum] == PIT_MODE_TOGGLE) && (i8253.bytetoggle[portnum] == 0)))
-				curbyte = 0;
-			else if ((i8253.accessmode[portnum] == PIT_MODE_HIBYTE) || ((i8253.accessmode[portnum] == PIT_MODE_TOGGLE) && (i8253.bytetoggle[portnum] == 1)))
-				curbyte = 1;
-			if ((i8253.accessmode[portnum] == 0) || (i8253.accessmode[portnum] == PIT_MODE_LOBYTE) || ((i8253.accessmode[portnum] == PIT_MODE_TOGGLE) && (i8253.bytetoggle[portnum] == 0)))
-				curbyte = 0;
-			else if ( (i8253.accessmode[portnum] == PIT_MODE_HIBYTE) || ((i8253.accessmode[portnum] == PIT_MODE_TOGGLE) && (i8253.bytetoggle[portnum] == 1)))
-				curbyte = 1;
-			if ((i8253.accessmode[portnum] == 0) || (i8253.accessmode[portnum] == PIT_MODE_TOGGLE))
-				i8253.bytetoggle[portnum] = (~i8253.bytetoggle[portnum]) & 1;
-			if (curbyte == 0) {	// low byte
-				return (uint8_t)i8253.counter[portnum];
-			} else {		// high byte
-				return (uint8_t)(i8253.counter[portnum] >> 8);
+			update(portnum, now);
+			switch (i8253.accessmode[portnum]) {
+				case PIT_MODE_LOBYTE:
+					i8253.chandata[portnum] = value;
+					break;
+				case PIT_MODE_HIBYTE:
+					i8253.chandata[portnum] = (uint16_t)value << 8;
+					break;
+				case PIT_MODE_TOGGLE:
+					i8253.bytetoggle[portnum] ^= 1;
+					if (i8253.bytetoggle[portnum]) {
+						i8253.chandata[portnum] = (i8253.chandata[portnum] & 0xFF00) | value;
+						// mode 0 stops counting after the first byte
+						if (i8253.mode[portnum] == 0)
+							stop(portnum, now);
+						return;
+					}
+					i8253.chandata[portnum] = (i8253.chandata[portnum] & 0x00FF) | ((uint16_t)value << 8);
+					break;
+				default:
+					return;
 			}
+			load(portnum, now);
+			//printf("[DEBUG] PIT channel %u counter changed to %u (%f Hz)\n", portnum, i8253.chandata[portnum], i8253.chanfreq[portnum]);
+			if (portnum == 0)
+				schedule_irq0(now);
 			break;
-		case 3:
+		case 3: { //mode/command
+			const int ch = value >> 6;
+			if (ch == 3) {
+				// read-back: latch the count and/or the status of the selected counters
+				for (int i = 0; i < 3; i++) {
+					if (!(value & (2 << i)))
+						continue;
+					update(i, now);
+					if (!(value & 0x20))
+						latch_count(i, now);
+					if (!(value & 0x10) && !i8253.statuslatched[i]) {
+						i8253.status[i] = status(i, now);
+						i8253.statuslatched[i] = 1;
+					}
+				}
+				break;
+			}
+			update(ch, now);
+			if (!(value & 0x30)) {
+				latch_count(ch, now);
+				break;
+			}
+			i8253.accessmode[ch] = (value >> 4) & 3;
+			i8253.mode[ch] = (value >> 1) & 7;
+			if (i8253.mode[ch] > 5)
+				i8253.mode[ch] -= 4;
+			i8253.bcd[ch] = value & 1;
+			i8253.bytetoggle[ch] = i8253.readtoggle[ch] = 0;
+			i8253.latched[ch] = i8253.statuslatched[ch] = 0;
+			i8253.active[ch] = i8253.armed[ch] = i8253.pending[ch] = 0;
+			i8253.tc[ch] = 0;
+			if (ch == 0)
+				schedule_irq0(now);
 			break;
+		}
 		default:
 			UNREACHABLE();
 	}
-	return 0;
+}
+
+
+static uint8_t in8253 ( uint16_t portnum )
+{
+	portnum &= 3;
+	if (portnum == 3)
+		return 0;
+	const uint64_t now = pit_now();
+	update(portnum, now);
+	if (i8253.statuslatched[portnum]) {
+		i8253.statuslatched[portnum] = 0;
+		return i8253.status[portnum];
+	}
+	uint16_t value;
+	if (i8253.latched[portnum]) {
+		value = i8253.latch[portnum];
+		i8253.latched[portnum]--;
+	} else
+		value = read_count(portnum, now);
+	switch (i8253.accessmode[portnum]) {
+		case PIT_MODE_HIBYTE:
+			return (uint8_t)(value >> 8);
+		case PIT_MODE_TOGGLE:
+			// low byte first, a latched count is held until both are read
+			i8253.readtoggle[portnum] ^= 1;
+			return i8253.readtoggle[portnum] ? (uint8_t)value : (uint8_t)(value >> 8);
+		default:
+			return (uint8_t)value;
+	}
 }
 
 
 void init8253 ( void )
 {
 	memset(&i8253, 0, sizeof(i8253));
+	i8253.gate[0] = i8253.gate[1] = 1;
+	timing_register(TIMING_PIT, pit_irq);
 	set_port_write_redirector(0x40, 0x43, &out8253);
 	set_port_read_redirector(0x40, 0x43, &in8253);
 }
@@ -28,17 +28,41 @@
 #define PIT_MODE_HIBYTE		2
 #define PIT_MODE_TOGGLE		3
 
+// the input clock of the counters
+#define PIT_CLOCK		1193182
+
+/* The counters are not decremented clock by clock. Each one remembers the
+   count it started from and the PIT clock when it did, and the current
+   count, the OUT pin and the next IRQ0 are computed from the machine time
+   on demand. */
 struct i8253_s {
-	uint16_t chandata[3];
+	uint16_t chandata[3];		// the count written, 0 is the maximum
 	uint8_t accessmode[3];
-	uint8_t bytetoggle[3];
-	uint32_t effectivedata[3];
+	uint8_t mode[3];		// 0-5
+	uint8_t bcd[3];
+	uint8_t bytetoggle[3];		// the next byte to write in PIT_MODE_TOGGLE is the high one
+	uint8_t readtoggle[3];		// and to read
+	uint32_t effectivedata[3];	// the count in clocks, 1-65536
 	float chanfreq[3];
-	uint8_t active[3];
-	uint16_t counter[3];
+	uint8_t active[3];		// counting
+	uint8_t armed[3];		// a count was written since the mode
+	uint8_t gate[3];
+	uint8_t tc[3];			// mode 0 and 1: the terminal count was reached before 'loaded'
+	uint32_t start[3];		// the count at 'loaded'
+	uint64_t loaded[3];		// PIT clock when the counting started from 'start'
+	uint8_t pending[3];		// mode 2 and 3: 'nextdata' is loaded at PIT clock 'switchat'
+	uint32_t nextdata[3];
+	uint64_t switchat[3];
+	uint8_t latched[3];		// bytes of 'latch' left to read
+	uint16_t latch[3];
+	uint8_t statuslatched[3];
+	uint8_t status[3];
 };
 
-extern struct i8253_s i8253;
-extern void init8253(void);
+extern void    init8253 ( void );
+extern void    i8253_gate ( int ch, int level );
+extern uint8_t i8253_out ( int ch );
+
+#include "machine.h"
 
 #endif
@@ -18,9 +18,10 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
-/* i8259.c: functions to emulate the Intel 8259 prioritized interrupt controller.
-   note: this is not a very complete 8259 implementation, but for the purposes
-   of a PC, it's all we need. */
+/* i8259.c: functions to emulate the Intel 8259 prioritized interrupt controller,
+   the master at 20h, and optionally the slave at A0h, cascaded on IRQ2.
+   note: the level triggered and the buffered modes are not emulated, for the
+   purposes of a PC, it's all we need. */
 
 #include <stdint.h>
 #include <string.h>
@@ -30,73 +31,233 @@
 #include "ports.h"
 #include "cpu.h"
 #include "input.h"
+#include "parsecl.h"
 
-struct structpic i8259;
-
-static uint8_t in8259(uint16_t portnum) {
-	switch (portnum & 1) {
-		   case 0:
-			if (i8259.readmode == 0)
-				return i8259.irr;
-			else
-				return i8259.isr;
-		   case 1: //read mask register
-			return i8259.imr;
+
+// rotates the bits, so that the IRQ with the highest priority is bit 0
+static inline uint8_t by_priority ( const struct structpic *pic, uint8_t bits )
+{
+	return (uint8_t)((bits >> pic->priority) | (bits << (8 - pic->priority)));
+}
+
+
+static inline uint8_t from_priority ( const struct structpic *pic, uint8_t bits )
+{
+	return (uint8_t)((bits << pic->priority) | (bits >> (8 - pic->priority)));
+}
+
+
+// The requests which are not masked, and have higher priority than the
+// IRQs in service (only the IRQ itself in the special mask mode)
+static uint8_t deliverable ( const struct structpic *pic )
+{
+	const uint8_t req = pic->irr & ~pic->imr;
+	if (!req || !pic->isr)
+		return req;
+	if (pic->specialmask)
+		return req & ~pic->isr;
+	const int inservice = CTZ(by_priority(pic, pic->isr));
+	return req & from_priority(pic, (uint8_t)((1U << inservice) - 1));
+}
+
+
+// After any change of irr, imr or isr: the slave requests IRQ2 of the
+// master while it has a deliverable one
+static void update ( void )
+{
+	if (i8259slave.enabled) {
+		i8259slave.deliverable = deliverable(&i8259slave);
+		if (i8259slave.deliverable)
+			i8259.irr |= 4;
+		else
+			i8259.irr &= ~4;
 	}
-	return 0;
+	i8259.deliverable = deliverable(&i8259);
+	if (i8259.deliverable)
+		machine_attention();
 }
 
-static void out8259(uint16_t portnum, uint8_t value) {
-	 uint8_t i;
-	 switch (portnum & 1) {
-		case 0:
-		 if (value & 0x10) { //begin initialization sequence
-			i8259.icwstep = 1;
-			i8259.imr = 0; //clear interrupt mask register
-			i8259.icw[i8259.icwstep++] = value;
+
+// The IRQ with the highest priority in 'bits', which must not be zero
+static inline int highest ( const struct structpic *pic, uint8_t bits )
+{
+	return (CTZ(by_priority(pic, bits)) + pic->priority) & 7;
+}
+
+
+static void eoi ( struct structpic *pic, int irq )
+{
+	pic->isr &= ~(1 << irq);
+	if (pic == &i8259 && irq == 0 && makeupticks > 0) {
+		makeupticks = 0;
+		i8259.irr |= 1;
+	}
+}
+
+
+// INTA on a single chip, returns the IRQ, or -1 if nothing is deliverable
+static int acknowledge ( struct structpic *pic )
+{
+	const uint8_t bits = deliverable(pic);
+	if (!bits)
+		return -1;
+	const int irq = highest(pic, bits);
+	pic->irr &= ~(1 << irq);
+	if (!pic->autoeoi)
+		pic->isr |= 1 << irq;
+	else if (pic->rotateaeoi)
+		pic->priority = (irq + 1) & 7;
+	return irq;
+}
+
+
+static uint8_t in8259 ( struct structpic *pic, uint16_t portnum )
+{
+	if (pic->poll) {
+		// the poll command: the highest IRQ, acknowledged
+		pic->poll = 0;
+		const int irq = acknowledge(pic);
+		update();
+		return irq < 0 ? 0 : 0x80 | irq;
+	}
+	if (portnum & 1)	// read mask register
+		return pic->imr;
+	return pic->readmode ? pic->isr : pic->irr;
+}
+
+
+static void out8259 ( struct structpic *pic, uint16_t portnum, uint8_t value )
+{
+	if (portnum & 1) {
+		if (pic->icwstep == 3 && (pic->icw[1] & 2))
+			pic->icwstep = 4;	// single mode, so don't read ICW3
+		if (pic->icwstep == 4 && !(pic->icw[1] & 1))
+			pic->icwstep = 5;	// no ICW4
+		if (pic->icwstep < 5) {
+			pic->icw[pic->icwstep++] = value;
+			if (pic->icwstep == 5)
+				pic->autoeoi = (pic->icw[4] >> 1) & 1;
 			return;
-		 }
-		 if ((value & 0x98)==8) { //it's an OCW3
-			if (value & 2) i8259.readmode = value & 2;
-		 }
-		 if (value & 0x20) { //EOI command
-	keyboardwaitack = 0;
-			for (i=0; i<8; i++)
-			if ((i8259.isr >> i) & 1) {
-			   i8259.isr ^= (1 << i);
-			   if ((i==0) && (makeupticks>0)) { makeupticks = 0; i8259.irr |= 1; }
-			   return;
-			}
-		 }
-		 break;
-		case 1:
-		 if ((i8259.icwstep==3) && (i8259.icw[1] & 2)) i8259.icwstep = 4; //single mode, so don't read ICW3
-		 if (i8259.icwstep<5) { i8259.icw[i8259.icwstep++] = value; return; }
-		 //if we get to this point, this is just a new IMR value
-		 i8259.imr = value;
-		 break;
-	 }
-}
-
-uint8_t nextintr(void) {
-	uint8_t i, tmpirr;
-	tmpirr = i8259.irr & (~i8259.imr); //XOR request register with inverted mask register
-	for (i=0; i<8; i++)
-		if ((tmpirr >> i) & 1) {
-		   i8259.irr ^= (1 << i);
-		   i8259.isr |= (1 << i);
-		   return i8259.icw[2] + i;
 		}
-	return 0; //this won't be reached, but without it the compiler gives a warning
+		// if we get to this point, this is just a new IMR value
+		pic->imr = value;
+		update();
+		return;
+	}
+	if (value & 0x10) {	// ICW1, begin initialization sequence
+		pic->icwstep = 1;
+		pic->imr = pic->isr = 0;
+		pic->icw[4] = 0;
+		pic->priority = pic->autoeoi = pic->rotateaeoi = pic->specialmask = 0;
+		pic->readmode = pic->poll = 0;
+		pic->icw[pic->icwstep++] = value;
+		update();
+		return;
+	}
+	if (value & 0x08) {	// OCW3
+		if (value & 0x02)
+			pic->readmode = value & 0x01;
+		if (value & 0x40)
+			pic->specialmask = (value >> 5) & 1;
+		pic->poll = (value >> 2) & 1;
+		update();
+		return;
+	}
+	// OCW2
+	const int level = value & 7;
+	switch (value >> 5) {
+		case 1:	// non-specific EOI
+		case 5:	// and rotate
+			if (pic->isr) {
+				const int irq = highest(pic, pic->isr);
+				eoi(pic, irq);
+				if (value & 0x80)
+					pic->priority = (irq + 1) & 7;
+			}
+			break;
+		case 3:	// specific EOI
+		case 7:	// and rotate
+			eoi(pic, level);
+			if (value & 0x80)
+				pic->priority = (level + 1) & 7;
+			break;
+		case 4:	// rotate in automatic EOI mode
+		case 0:
+			pic->rotateaeoi = value >> 7;
+			break;
+		case 6:	// set priority, the IRQ is the lowest one
+			pic->priority = (level + 1) & 7;
+			break;
+	}
+	update();
 }
 
-void doirq(uint8_t irqnum) {
-	 i8259.irr |= (1 << irqnum);
-	 if (irqnum == 1) keyboardwaitack = 1;
+
+static uint8_t in8259master ( uint16_t portnum )
+{
+	return in8259(&i8259, portnum);
+}
+
+
+static void out8259master ( uint16_t portnum, uint8_t value )
+{
+	out8259(&i8259, portnum, value);
 }
 
-void init8259(void) {
-	 memset((void *)&i8259, 0, sizeof(i8259));
-	 set_port_write_redirector(0x20, 0x21, &out8259);
-	 set_port_read_redirector(0x20, 0x21, &in8259);
+
+static uint8_t in8259slave ( uint16_t portnum )
+{
+	return in8259(&i8259slave, portnum);
+}
+
+
+static void out8259slave ( uint16_t portnum, uint8_t value )
+{
+	out8259(&i8259slave, portnum, value);
+}
+
+
+// INTA: the vector of the IRQ the CPU takes, from the slave on IRQ2
+uint8_t nextintr ( void )
+{
+	const int irq = acknowledge(&i8259);
+	uint8_t vector;
+	if (irq < 0)	// spurious
+		vector = (i8259.icw[2] & 0xF8) | 7;
+	else if (irq == 2 && i8259slave.enabled) {
+		const int slaveirq = acknowledge(&i8259slave);
+		vector = (i8259slave.icw[2] & 0xF8) | (slaveirq < 0 ? 7 : slaveirq);
+	} else
+		vector = (i8259.icw[2] & 0xF8) | irq;
+	update();
+	return vector;
+}
+
+
+void doirq ( uint8_t irqnum )
+{
+	if (irqnum < 8)
+		i8259.irr |= 1 << irqnum;
+	else if (i8259slave.enabled)
+		i8259slave.irr |= 1 << (irqnum - 8);
+	else
+		return;
+	update();
+}
+
+
+void init8259 ( void )
+{
+	memset((void *)&i8259, 0, sizeof(i8259));
+	memset((void *)&i8259slave, 0, sizeof(i8259slave));
+	set_port_write_redirector(0x20, 0x21, &out8259master);
+	set_port_read_redirector(0x20, 0x21, &in8259master);
+	if (slavepic) {
+		// the vectors of an AT, the BIOS does not initialize it
+		i8259slave.enabled = 1;
+		i8259slave.icw[2] = 0x70;
+		i8259slave.icwstep = 5;
+		set_port_write_redirector(0xA0, 0xA1, &out8259slave);
+		set_port_read_redirector(0xA0, 0xA1, &in8259slave);
+	}
 }
@@ -27,18 +27,25 @@ struct structpic {
 	uint8_t imr; //mask register
 	uint8_t irr; //request register
 	uint8_t isr; //service register
+	uint8_t deliverable; //requests which would be acknowledged now, updated with the three above
 	uint8_t icwstep; //used during initialization to keep track of which ICW we're at
 	uint8_t icw[5];
-	uint8_t intoffset; //interrupt vector offset
 	uint8_t priority; //which IRQ has highest priority
 	uint8_t autoeoi; //automatic EOI mode
+	uint8_t rotateaeoi; //rotate the priorities in automatic EOI mode
+	uint8_t specialmask; //special mask mode: only the in-service IRQ itself is blocked
 	uint8_t readmode; //remember what to return on read register from OCW3
-	uint8_t enabled;
+	uint8_t poll; //the next read is the poll command
+	uint8_t enabled; //the slave exists
 };
 
-extern struct structpic i8259;
+/* The CPU only has to test i8259.deliverable of the master, which covers
+   the slave on IRQ2. The slave at A0h is optional (-slavepic), without it
+   IRQ 8-15 are ignored. */
 extern void init8259(void);
 extern uint8_t nextintr(void);
 extern void doirq (uint8_t irqnum);
 
+#include "machine.h"
+
 #endif
@@ -17,10 +17,315 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
-const char *build = "Imagegen v1.1";
+#define FAKE86_IMAGEGEN
+#include "../diskoverlay.h"
+#include "../diskpack.h"
+#include "../lzblock.h"
+
+const char *build = "Imagegen v1.3";
+
+/* Size of an image: the unpacked size if it is a packed one */
+static long image_size(FILE *f, int *packed) {
+	struct diskpack_header	header;
+
+	*packed = 0;
+	if((fread(&header, sizeof(header), 1, f) == 1) && !memcmp(header.magic, DISKPACK_MAGIC, sizeof(header.magic))) {
+		*packed = 1;
+		return (long)le64(header.size);
+	}
+	fseek(f, 0, SEEK_END);
+	return ftell(f);
+}
+
+/* Compresses a raw image into a packed one, block by block */
+static int pack_image(const char *rawfile, const char *packfile, unsigned long blocksize) {
+	struct diskpack_header	header;
+	struct diskpack_entry	*index;
+	FILE			*raw, *pack;
+	uint8_t			*block, *packed;
+	uint64_t		offset;
+	uint32_t		i, bytes, stored = 0;
+	long			size;
+
+	if((blocksize < DISKPACK_BLOCK_MIN) || (blocksize > DISKPACK_BLOCK_MAX) || (blocksize & (blocksize - 1))) {
+		printf("Invalid block size! It must be a power of 2, 1 to %u Kbytes.\n", DISKPACK_BLOCK_MAX >> 10);
+		return(1);
+	}
+	raw = fopen(rawfile, "rb");
+	if(raw == NULL) {
+		printf("Unable to open image: %s\n", rawfile);
+		return(1);
+	}
+	fseek(raw, 0, SEEK_END);
+	size = ftell(raw);
+	fseek(raw, 0, SEEK_SET);
+	if((size <= 0) || (size & 511)) {
+		printf("Invalid image, its size is not a multiple of 512 bytes: %s\n", rawfile);
+		return(1);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DISKPACK_MAGIC, sizeof(header.magic));
+	header.version = DISKPACK_VERSION;
+	header.blocksize = blocksize;
+	header.size = size;
+	header.blocks = (size + blocksize - 1) / blocksize;
+	index = (struct diskpack_entry *)calloc(header.blocks, sizeof(struct diskpack_entry));
+	block = (uint8_t *)malloc(blocksize);
+	packed = (uint8_t *)malloc(blocksize);
+	if((index == NULL) || (block == NULL) || (packed == NULL)) {
+		printf("Unable to allocate enough memory!\n");
+		return(1);
+	}
+	pack = fopen(packfile, "wb");
+	if(pack == NULL) {
+		printf("Unable to create new file: %s\n", packfile);
+		return(1);
+	}
+
+	printf("Please wait, packing image...\n");
+	offset = sizeof(header) + (uint64_t)header.blocks * sizeof(struct diskpack_entry);
+	fseek(pack, (long)offset, SEEK_SET);	/* the index is written at the end */
+	for(i = 0; i < header.blocks; i++) {
+		bytes = (size - (long)i * blocksize) < (long)blocksize ? size - (long)i * blocksize : blocksize;
+		if(fread(block, bytes, 1, raw) != 1) {
+			printf("Unable to read image: %s\n", rawfile);
+			return(1);
+		}
+		if(!block[0] && !memcmp(block, block + 1, bytes - 1))
+			continue;	/* all zero, not stored */
+		index[i].offset = offset;
+		/* compressed only if it is smaller, otherwise stored as it is */
+		index[i].size = lzblock_compress(block, bytes, packed, bytes - 1);
+		if(!index[i].size)
+			index[i].size = bytes;
+		if(fwrite(index[i].size == bytes ? block : packed, index[i].size, 1, pack) != 1) {
+			printf("Unable to write file: %s\n", packfile);
+			return(1);
+		}
+		offset += index[i].size;
+		stored++;
+		printf("\rPacking block: %u of %u", i + 1, header.blocks);
+	}
+	fclose(raw);
+	/* in the file byte order from here */
+	for(i = 0; i < header.blocks; i++)
+		diskpack_entry_byteorder(&index[i]);
+	diskpack_header_byteorder(&header);
+	if(fseek(pack, 0, SEEK_SET) || (fwrite(&header, sizeof(header), 1, pack) != 1) ||
+	   (fwrite(index, sizeof(struct diskpack_entry), le32(header.blocks), pack) != le32(header.blocks)) || fclose(pack)) {
+		printf("Unable to write file: %s\n", packfile);
+		return(1);
+	}
+	printf("\nPacked %ld Kbytes into %lu Kbytes, %u blocks of %u stored.\n", size >> 10, (unsigned long)(offset >> 10), stored, le32(header.blocks));
+	return(0);
+}
+
+/* Decompresses a packed image into a raw one */
+static int unpack_image(const char *packfile, const char *rawfile) {
+	struct diskpack_header	header;
+	struct diskpack_entry	*index;
+	FILE			*raw, *pack;
+	uint8_t			*block, *packed;
+	uint32_t		i, bytes;
+
+	pack = fopen(packfile, "rb");
+	if((pack == NULL) || (fread(&header, sizeof(header), 1, pack) != 1)) {
+		printf("Not a packed image: %s\n", packfile);
+		return(1);
+	}
+	diskpack_header_byteorder(&header);
+	if(memcmp(header.magic, DISKPACK_MAGIC, sizeof(header.magic)) || (header.version != DISKPACK_VERSION) ||
+	   (header.blocksize < DISKPACK_BLOCK_MIN) || (header.blocksize > DISKPACK_BLOCK_MAX) ||
+	   (header.blocks != (header.size + header.blocksize - 1) / header.blocksize)) {
+		printf("Not a packed image: %s\n", packfile);
+		return(1);
+	}
+	index = (struct diskpack_entry *)calloc(header.blocks, sizeof(struct diskpack_entry));
+	block = (uint8_t *)malloc(header.blocksize);
+	packed = (uint8_t *)malloc(header.blocksize);
+	if((index == NULL) || (block == NULL) || (packed == NULL)) {
+		printf("Unable to allocate enough memory!\n");
+		return(1);
+	}
+	if(fread(index, sizeof(struct diskpack_entry), header.blocks, pack) != header.blocks) {
+		printf("Unable to read the index of the packed image!\n");
+		return(1);
+	}
+	for(i = 0; i < header.blocks; i++)
+		diskpack_entry_byteorder(&index[i]);
+	raw = fopen(rawfile, "wb");
+	if(raw == NULL) {
+		printf("Unable to create new file: %s\n", rawfile);
+		return(1);
+	}
+
+	printf("Please wait, unpacking image...\n");
+	for(i = 0; i < header.blocks; i++) {
+		bytes = (header.size - (uint64_t)i * header.blocksize) < header.blocksize ? header.size - (uint64_t)i * header.blocksize : header.blocksize;
+		if(!index[i].size)
+			memset(block, 0, bytes);
+		else if((index[i].size > bytes) || fseek(pack, (long)index[i].offset, SEEK_SET) ||
+			(fread(index[i].size == bytes ? block : packed, index[i].size, 1, pack) != 1) ||
+			((index[i].size != bytes) && lzblock_decompress(packed, index[i].size, block, bytes))) {
+			printf("\nCorrupt block #%u in the packed image!\n", i);
+			return(1);
+		}
+		if(fwrite(block, bytes, 1, raw) != 1) {
+			printf("\nUnable to write file: %s\n", rawfile);
+			return(1);
+		}
+		printf("\rUnpacking block: %u of %u", i + 1, header.blocks);
+	}
+	if(fclose(raw)) {
+		printf("\nUnable to write file: %s\n", rawfile);
+		return(1);
+	}
+	fclose(pack);
+	printf("\nUnpacked %lu Kbytes.\n", (unsigned long)(header.size >> 10));
+	return(0);
+}
+
+/* Writes an overlay header at the current position, in the file byte order */
+static int overlay_write_header(FILE *f, const struct diskoverlay_header *header) {
+	static struct diskoverlay_header	file;
+
+	file = *header;
+	diskoverlay_header_byteorder(&file);
+	return(fwrite(&file, sizeof(file), 1, f) != 1);
+}
+
+/* Creates an empty copy-on-write overlay on a base image */
+static int overlay_create(const char *overlayfile, const char *basefile) {
+	static struct diskoverlay_header	header;
+	FILE			*base, *overlay;
+	char			*path;
+	long			size;
+	int			packed;
+
+#ifdef _WIN32
+	path = _fullpath(NULL, basefile, 0);
+#else
+	path = realpath(basefile, NULL);
+#endif
+	base = fopen(basefile, "rb");
+	if(base == NULL || path == NULL) {
+		printf("Unable to open base image: %s\n", basefile);
+		return(1);
+	}
+	size = image_size(base, &packed);
+	fclose(base);
+	if((size <= 0) || (size & 511) || (strlen(path) >= DISKOVERLAY_BASE_MAX)) {
+		printf("Invalid base image: %s\n", basefile);
+		return(1);
+	}
+
+	memcpy(header.magic, DISKOVERLAY_MAGIC, sizeof(header.magic));
+	header.version = DISKOVERLAY_VERSION;
+	header.sectors = size / 512;
+	header.basesize = size;
+	strcpy(header.base, path);	/* absolute, the overlay can be used from anywhere */
+
+	overlay = fopen(overlayfile, "wb");
+	if(overlay == NULL) {
+		printf("Unable to create new file: %s\n", overlayfile);
+		return(1);
+	}
+	/* the header, then the allocation table: all zero, as the file is extended */
+	if(overlay_write_header(overlay, &header) ||
+	   fseek(overlay, DISKOVERLAY_DATA_START(header.sectors) - 1, SEEK_SET) ||
+	   (fputc(0, overlay) == EOF) || fclose(overlay)) {
+		printf("Unable to write file: %s\n", overlayfile);
+		return(1);
+	}
+	printf("Overlay %s created on base image %s (%u sectors).\n", overlayfile, path, header.sectors);
+	free(path);
+	return(0);
+}
+
+/* Writes the sectors of an overlay into its base image, then empties the overlay */
+static int overlay_commit(const char *overlayfile) {
+	static struct diskoverlay_header	header;
+	FILE			*base, *overlay;
+	uint32_t		*table, lba, done = 0;
+	uint8_t			sector[512];
+	int			packed;
+
+	overlay = fopen(overlayfile, "r+b");
+	if((overlay == NULL) || (fread(&header, sizeof(header), 1, overlay) != 1) ||
+	   memcmp(header.magic, DISKOVERLAY_MAGIC, sizeof(header.magic)) || (le32(header.version) != DISKOVERLAY_VERSION)) {
+		printf("Not an overlay image: %s\n", overlayfile);
+		return(1);
+	}
+	diskoverlay_header_byteorder(&header);
+	header.base[DISKOVERLAY_BASE_MAX - 1] = 0;
+	table = (uint32_t *)calloc(header.sectors, 4);
+	if((table == NULL) || (fread(table, 4, header.sectors, overlay) != header.sectors)) {
+		printf("Unable to read the allocation table of the overlay!\n");
+		return(1);
+	}
+	for(lba = 0; lba < header.sectors; lba++)
+		table[lba] = le32(table[lba]);
+	base = fopen(header.base, "r+b");
+	if(base == NULL) {
+		printf("Unable to open base image for writing: %s\n", header.base);
+		return(1);
+	}
+	if(((uint64_t)image_size(base, &packed) != header.basesize) || packed) {
+		if(packed)
+			printf("The base image is a packed one, unpack it first: %s\n", header.base);
+		else
+			printf("The base image has been changed since the overlay was created: %s\n", header.base);
+		return(1);
+	}
+
+	printf("Committing %u sectors into %s...\n", header.used, header.base);
+	for(lba = 0; lba < header.sectors; lba++) {
+		if(!table[lba])
+			continue;
+		if(fseek(overlay, DISKOVERLAY_DATA_START(header.sectors) + (uint64_t)(table[lba] - 1) * 512, SEEK_SET) ||
+		   (fread(sector, 512, 1, overlay) != 1) ||
+		   fseek(base, (long)lba * 512, SEEK_SET) ||
+		   (fwrite(sector, 512, 1, base) != 1)) {
+			printf("I/O error at sector %u!\n", lba);
+			return(1);
+		}
+		done++;
+	}
+	if(fclose(base)) {
+		printf("Unable to write the base image!\n");
+		return(1);
+	}
+
+	/* the base has everything now, the overlay starts again empty */
+	memset(table, 0, (size_t)header.sectors * 4);
+	header.used = 0;
+	if(fseek(overlay, 0, SEEK_SET) || overlay_write_header(overlay, &header) ||
+	   (fwrite(table, 4, header.sectors, overlay) != header.sectors) || fflush(overlay)) {
+		printf("Unable to reset the overlay!\n");
+		return(1);
+	}
+#ifdef _WIN32
+	_chsize_s(_fileno(overlay), DISKOVERLAY_DATA_START(header.sectors));
+#else
+	if(ftruncate(fileno(overlay), DISKOVERLAY_DATA_START(header.sectors)))
+		printf("Unable to truncate the overlay, it is still valid.\n");
+#endif
+	fclose(overlay);
+	printf("%u sectors committed, the overlay is empty now.\n", done);
+	printf("Other overlays on the same base image are no longer consistent!\n");
+	return(0);
+}
 
 int main(int argc, char *argv[]) {
 	FILE			*image;
@@ -30,11 +335,30 @@ int main(int argc, char *argv[]) {
 	printf("%s (c)2010-2012 Mike Chambers\n", build);
 	printf("[Blank disk image generator for Fake86]\n\n");
 
+	if((argc == 4) && !strcmp(argv[1], "-overlay"))
+		return overlay_create(argv[2], argv[3]);
+	if((argc == 3) && !strcmp(argv[1], "-commit"))
+		return overlay_commit(argv[2]);
+	if(((argc == 4) || (argc == 5)) && !strcmp(argv[1], "-pack"))
+		return pack_image(argv[2], argv[3], argc == 5 ? strtoul(argv[4], NULL, 10) * 1024 : DISKPACK_BLOCK_DEFAULT);
+	if((argc == 4) && !strcmp(argv[1], "-unpack"))
+		return unpack_image(argv[2], argv[3]);
+
 	if(argc < 3) {
 		printf("Usage syntax:\n");
-		printf("    imagegen imagefile size\n\n");
+		printf("    imagegen imagefile size\n");
+		printf("    imagegen -overlay overlayfile baseimage\n");
+		printf("    imagegen -commit overlayfile\n");
+		printf("    imagegen -pack imagefile packedfile [blocksize]\n");
+		printf("    imagegen -unpack packedfile imagefile\n\n");
 		printf("imagefile denotes the filename of the new disk image to create.\n");
 		printf("size denotes the size in megabytes that it should be.\n");
+		printf("-overlay creates a copy-on-write overlay on a (read-only) base image,\n");
+		printf("Fake86 can use it as a disk image, which stores only the written sectors.\n");
+		printf("-commit writes the sectors of the overlay into its base image.\n");
+		printf("-pack compresses an image into a (read-only) packed image, which Fake86\n");
+		printf("can use as a disk image, blocksize is in Kbytes (default %u).\n", DISKPACK_BLOCK_DEFAULT >> 10);
+		printf("-unpack converts a packed image back into a raw one.\n");
 		return(1);
 	}
 
@@ -34,7 +34,6 @@
 #include "i8259.h"
 #include "render.h"
 
-uint8_t keyboardwaitack = 0;
 int hijacked_input = 0;
 static uint8_t keydown[0x100];
 
@@ -260,7 +259,7 @@ void handleinput ( void )
 				}
 				break;
 			case SDL_QUIT:
-				running = 0;
+				machine_running = 0;
 				break;
 			default:
 				break;
@@ -21,7 +21,6 @@
 #ifndef FAKE86_INPUT_H_INCLUDED
 #define FAKE86_INPUT_H_INCLUDED
 
-extern uint8_t keyboardwaitack;
 extern int     hijacked_input;
 
 extern void handleinput ( void );
@@ -0,0 +1,1193 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* A simple x86-64 translator for hot basic blocks of 8086 code.
+
+   exec86() offers the instruction boundaries it handles in its prologue (where
+   no IRQ, trap or HLT is pending) to jit_exec(), which counts how many times a
+   given CS:IP was seen. With threaded dispatch the prologue runs only every
+   TIMING_INTERVAL+1 instructions or so, which is a cheap sampling profiler, and
+   the fast path leaves to the prologue only at CS:IPs marked in jit_entrymap.
+   Once it is hot, the basic block starting there is translated into host code
+   which works directly on "struct cpu_state", calling read86()/write86() and the
+   port handlers for anything else than registers, so the semantic is exactly
+   the same as the one of the interpreter. Only a common subset of the
+   instruction set is handled, translation stops at the first instruction
+   which is not supported, the interpreter will execute that one then.
+
+   Host register usage inside translated code:
+	rbx  = &cpu
+	r12d = remaining instruction budget
+	r13d = linear address of the memory operand
+	r14d = memory operand value
+   Everything else is scratch, and can be destroyed by the called C functions.
+
+   Translated blocks are validated by per-4K page generation counters, exactly
+   the way as the instruction flow cache in cpu.c does it, a write86() into a
+   page which has translated code on it increments the generation counter of
+   the page, so all the translations involving that page become stale.
+
+   The 8088 clock cycles of the whole block are added to totalcycles at its
+   entry, a mid-block exit (self modifying code) gives back the ones of the
+   instructions not executed, and a taken conditional jump adds its extra
+   cycles, so the clock is the same as the one of the interpreter. A block
+   is only entered if it ends before jit_cycle_limit: the next device event
+   or the end of the time slice, otherwise the interpreter runs it. So the
+   timing() calls and interrupts of exec86() come at the same instructions
+   as without the JIT. */
+
+#include "config.h"
+
+#ifdef USE_JIT
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "cpu.h"
+#include "i8259.h"
+#include "ports.h"
+
+
+#define JIT_CACHE_SIZE		(16 * 1024 * 1024)
+#define JIT_BLOCKS_BITS		14
+#define JIT_BLOCKS		(1 << JIT_BLOCKS_BITS)
+#define JIT_BLOCK_INSNS		64
+// Worst case host code size of a block, if less space is left, the whole cache is flushed
+#define JIT_BLOCK_MAX_CODE	(JIT_BLOCK_INSNS * 256 + 512)
+#define JIT_MAX_PATCHES		4096
+#define JIT_MAX_RUN		256
+#ifndef JIT_HOT_THRESHOLD
+#define JIT_HOT_THRESHOLD	16
+#endif
+
+#define JIT_PROFILING		0
+#define JIT_TRANSLATED		1
+#define JIT_UNSUPPORTED		2
+
+struct jit_block {
+	uint8_t  *code;		// host code entry point, only valid in JIT_TRANSLATED state
+	uint32_t gen0, gen1;	// page generations at the time of (re)initialization of the block
+	uint16_t cs, ip;
+	uint16_t hits;		// times seen by jit_exec() in JIT_PROFILING state
+	uint8_t  page;		// 4K page of the first instruction
+	uint8_t  state;
+};
+
+struct jit_patch {
+	uint8_t  *site;		// rel32 of a "jmp" to be redirected to the translation of cs:ip
+	uint16_t cs, ip;
+};
+
+struct jit_insn {
+	uint16_t ip, next;
+	uint16_t disp16, imm;
+	uint8_t  opcode, seg, mode, reg, rm;
+	uint8_t  cycles;	// 8088 clock cycles, see cpu_insn_cycles()
+};
+
+uint8_t  jit_codemap[RAM_SIZE >> 3];
+uint8_t  jit_entrymap[RAM_SIZE >> 3];
+uint64_t jit_translations = 0, jit_executed = 0;
+
+static uint32_t jit_pagegen[RAM_SIZE >> 12];
+static struct jit_block jit_blocks[JIT_BLOCKS];
+static struct jit_patch jit_patches[JIT_MAX_PATCHES];
+static int jit_npatches = 0;
+
+static uint8_t *jit_cache = MAP_FAILED;
+static uint8_t *jit_code_start, *jit_ptr;
+static const uint8_t *jit_epilogue;
+static uint64_t jit_cycle_limit;	// totalcycles must stay below it in the translated code
+static uint32_t (*jit_trampoline)(const uint8_t *code, uint32_t budget, struct cpu_state *cpuptr);
+
+// All offsets into "struct cpu_state" are used as 8 bit signed displacements for [rbx+disp8]
+_Static_assert(sizeof(struct cpu_state) < 0x80, "struct cpu_state is too large for disp8 addressing of the JIT");
+
+#define OFS(field)	((uint8_t)offsetof(struct cpu_state, field))
+#define OFS_WREG(r)	((uint8_t)(offsetof(struct cpu_state, regs) + 2 * (r)))
+#define OFS_BREG(r)	((uint8_t)(offsetof(struct cpu_state, regs) + byteregofs[r]))
+#define OFS_SREG(r)	((uint8_t)(offsetof(struct cpu_state, segregs) + 2 * (r)))
+#define OFS_AL		((uint8_t)(offsetof(struct cpu_state, regs) + regal))
+
+#define signext(value)	((uint16_t)(int16_t)(int8_t)(value))
+
+// Host register numbers
+#define H_EAX	0
+#define H_ECX	1
+#define H_EDX	2
+#define H_R13	13
+#define H_R14	14
+
+static const uint8_t byteregofs[8] = { regal, regcl, regdl, regbl, regah, regch, regdh, regbh };
+static const int8_t  ea_base[8]    = { regbx, regbx, regbp, regbp, regsi, regdi, regbp, regbx };
+static const int8_t  ea_index[8]   = { regsi, regdi, regsi, regdi, -1,    -1,    -1,    -1    };
+// Host "op r/m16, r16" opcodes for the 8086 ALU operations. SBB is not translated, as
+// the interpreter computes its flags slightly differently (source + CF is truncated first)
+static const uint8_t host_alu16[8] = { 0x01, 0x09, 0x11, 0x00, 0x21, 0x29, 0x31, 0x39 };
+
+
+/* ---- host code emitter ---- */
+
+#define EMIT(...) do { \
+	static const uint8_t _bytes[] = { __VA_ARGS__ }; \
+	memcpy(jit_ptr, _bytes, sizeof _bytes); \
+	jit_ptr += sizeof _bytes; \
+} while (0)
+
+static INLINE void emit8 ( uint8_t v )
+{
+	*jit_ptr++ = v;
+}
+
+static INLINE void emit16 ( uint16_t v )
+{
+	memcpy(jit_ptr, &v, 2);
+	jit_ptr += 2;
+}
+
+static INLINE void emit32 ( uint32_t v )
+{
+	memcpy(jit_ptr, &v, 4);
+	jit_ptr += 4;
+}
+
+static INLINE void emit64 ( uint64_t v )
+{
+	memcpy(jit_ptr, &v, 8);
+	jit_ptr += 8;
+}
+
+static INLINE void patch_rel32 ( uint8_t *rel, const uint8_t *target )
+{
+	const int32_t v = (int32_t)(target - (rel + 4));
+	memcpy(rel, &v, 4);
+}
+
+// Emits a jump (given by the opcode bytes) with rel32, returns the address of the rel32 field
+static uint8_t *emit_jump ( uint8_t op1, uint8_t op2, const uint8_t *target )
+{
+	emit8(op1);
+	if (op2)
+		emit8(op2);
+	uint8_t *rel = jit_ptr;
+	emit32(0);
+	if (target)
+		patch_rel32(rel, target);
+	return rel;
+}
+
+#define JMP(target)	emit_jump(0xE9, 0, target)
+#define JCC(cc, target)	emit_jump(0x0F, 0x80 | (cc), target)
+#define CC_Z	0x4
+#define CC_NZ	0x5
+#define CC_L	0xC
+#define CC_AE	0x3
+
+// movzx reg32, word/byte [rbx + disp]
+static void emit_load16 ( int reg, uint8_t disp )
+{
+	if (reg >= 8)
+		emit8(0x44);
+	emit8(0x0F); emit8(0xB7); emit8(0x43 | ((reg & 7) << 3)); emit8(disp);
+}
+
+static void emit_load8 ( int reg, uint8_t disp )
+{
+	if (reg >= 8)
+		emit8(0x44);
+	emit8(0x0F); emit8(0xB6); emit8(0x43 | ((reg & 7) << 3)); emit8(disp);
+}
+
+// mov word/byte [rbx + disp], reg (only al/cl/dl and r8-r15 for the byte form!)
+static void emit_store16 ( int reg, uint8_t disp )
+{
+	emit8(0x66);
+	if (reg >= 8)
+		emit8(0x44);
+	emit8(0x89); emit8(0x43 | ((reg & 7) << 3)); emit8(disp);
+}
+
+static void emit_store8 ( int reg, uint8_t disp )
+{
+	if (reg >= 8)
+		emit8(0x44);
+	emit8(0x88); emit8(0x43 | ((reg & 7) << 3)); emit8(disp);
+}
+
+static void emit_store_imm16 ( uint8_t disp, uint16_t v )
+{
+	EMIT(0x66, 0xC7, 0x43); emit8(disp); emit16(v);
+}
+
+static void emit_store_imm8 ( uint8_t disp, uint8_t v )
+{
+	EMIT(0xC6, 0x43); emit8(disp); emit8(v);
+}
+
+static void emit_call ( const void *func )
+{
+	EMIT(0x48, 0xB8); emit64((uintptr_t)func);	// movabs rax, func
+	EMIT(0xFF, 0xD0);				// call rax
+}
+
+// Stores the guest flags from the host flags of the last ALU instruction
+#define FL_CF		1
+#define FL_OF		2
+#define FL_SZP		4
+#define FL_AF		8
+#define FL_CLEAR_CO	16	// CF = OF = 0, as bitwise logic operations do
+#define FL_ARITH	(FL_CF | FL_OF | FL_SZP | FL_AF)
+#define FL_INCDEC	(FL_OF | FL_SZP | FL_AF)
+#define FL_LOGIC	(FL_SZP | FL_CLEAR_CO)
+#define FL_SHIFT	(FL_CF | FL_OF | FL_SZP)
+#define FL_ROTATE	(FL_CF | FL_OF)
+
+static void emit_flags ( int which )
+{
+	if (which & FL_CF)
+		EMIT(0x0F, 0x92, 0x43, OFS(cf));	// setc [rbx+cf]
+	if (which & FL_OF)
+		EMIT(0x0F, 0x90, 0x43, OFS(of));	// seto [rbx+of]
+	if (which & FL_SZP) {
+		EMIT(0x0F, 0x94, 0x43, OFS(zf));	// setz [rbx+zf]
+		EMIT(0x0F, 0x98, 0x43, OFS(sf));	// sets [rbx+sf]
+		EMIT(0x0F, 0x9A, 0x43, OFS(pf));	// setp [rbx+pf]
+	}
+	if (which & FL_CLEAR_CO) {
+		emit_store_imm8(OFS(cf), 0);
+		emit_store_imm8(OFS(of), 0);
+	}
+	if (which & FL_AF) {
+		EMIT(
+			0x9C,			// pushfq
+			0x58,			// pop rax
+			0xC1, 0xE8, 0x04,	// shr eax, 4
+			0x83, 0xE0, 0x01,	// and eax, 1
+			0x88, 0x43, OFS(af)	// mov [rbx+af], al
+		);
+	}
+}
+
+// host CF = guest CF
+static void emit_load_cf ( void )
+{
+	EMIT(0x8A, 0x43, OFS(cf), 0xD0, 0xE8);		// mov al, [rbx+cf]; shr al, 1
+}
+
+// r13d = linear address of the ModR/M memory operand, the same way as getea() does
+static void emit_ea ( const struct jit_insn *in, int with_segment )
+{
+	if (in->mode == 0 && in->rm == 6) {
+		EMIT(0x41, 0xBD); emit32(in->disp16);		// mov r13d, disp16
+	} else {
+		emit_load16(H_R13, OFS_WREG(ea_base[in->rm]));
+		if (ea_index[in->rm] >= 0) {
+			emit_load16(H_EAX, OFS_WREG(ea_index[in->rm]));
+			EMIT(0x41, 0x01, 0xC5);			// add r13d, eax
+		}
+		if (in->mode) {
+			EMIT(0x41, 0x81, 0xC5); emit32(in->disp16);	// add r13d, disp16
+		}
+		if (in->mode || ea_index[in->rm] >= 0) {
+			EMIT(0x41, 0x81, 0xE5); emit32(0xFFFF);	// and r13d, 0xFFFF
+		}
+	}
+	if (with_segment) {
+		emit_load16(H_EAX, OFS_SREG(in->seg));
+		EMIT(
+			0xC1, 0xE0, 0x04,	// shl eax, 4
+			0x41, 0x01, 0xC5	// add r13d, eax
+		);
+	}
+}
+
+// r13d = linear address of SS:SP
+static void emit_stack_ea ( void )
+{
+	emit_load16(H_R13, OFS_WREG(regsp));
+	emit_load16(H_EAX, OFS_SREG(regss));
+	EMIT(
+		0xC1, 0xE0, 0x04,	// shl eax, 4
+		0x41, 0x01, 0xC5	// add r13d, eax
+	);
+}
+
+// r14d = byte/word at r13d, by read86()/readw86()
+static void emit_read ( int word )
+{
+	EMIT(0x44, 0x89, 0xEF);			// mov edi, r13d
+	if (word) {
+		emit_call(readw86);
+		EMIT(0x44, 0x0F, 0xB7, 0xF0);	// movzx r14d, ax
+	} else {
+		emit_call(read86);
+		EMIT(0x44, 0x0F, 0xB6, 0xF0);	// movzx r14d, al
+	}
+}
+
+// byte/word r14d to r13d, by write86()/writew86()
+static void emit_write ( int word )
+{
+	EMIT(0x44, 0x89, 0xEF);			// mov edi, r13d
+	if (word) {
+		EMIT(0x41, 0x0F, 0xB7, 0xF6);	// movzx esi, r14w
+		emit_call(writew86);
+	} else {
+		EMIT(0x41, 0x0F, 0xB6, 0xF6);	// movzx esi, r14b
+		emit_call(write86);
+	}
+}
+
+
+/* ---- block management ---- */
+
+static INLINE uint32_t jit_linear ( uint16_t cs, uint16_t ip )
+{
+	return (((uint32_t)cs << 4) + ip) & 0xFFFFF;
+}
+
+static INLINE int jit_block_valid ( const struct jit_block *b )
+{
+	return b->gen0 == jit_pagegen[b->page] && b->gen1 == jit_pagegen[(b->page + 1) & 0xFF];
+}
+
+static INLINE struct jit_block *jit_slot ( uint16_t cs, uint16_t ip )
+{
+	const uint32_t linear = jit_linear(cs, ip);
+	return &jit_blocks[(linear ^ (linear >> JIT_BLOCKS_BITS) ^ ((uint32_t)cs << 3)) & (JIT_BLOCKS - 1)];
+}
+
+// Returns with the translated block of cs:ip if there is a valid one, without touching the profiling data
+static struct jit_block *jit_peek ( uint16_t cs, uint16_t ip )
+{
+	struct jit_block *b = jit_slot(cs, ip);
+	if (b->state == JIT_TRANSLATED && b->cs == cs && b->ip == ip && jit_block_valid(b))
+		return b;
+	return NULL;
+}
+
+static struct jit_block *jit_lookup ( uint16_t cs, uint16_t ip )
+{
+	const uint32_t linear = jit_linear(cs, ip);
+	if (linear >= 0xA0000 && linear < 0xC0000)
+		return NULL;	// video memory is never translated
+	if (cs == 0xF000 && ip == 0xE066)
+		return NULL;	// bootstrap hook, see exec86()
+	struct jit_block *b = jit_slot(cs, ip);
+	if (b->cs != cs || b->ip != ip || !jit_block_valid(b)) {
+		b->cs = cs;
+		b->ip = ip;
+		b->page = linear >> 12;
+		b->gen0 = jit_pagegen[b->page];
+		b->gen1 = jit_pagegen[(b->page + 1) & 0xFF];
+		b->hits = 0;
+		b->code = NULL;
+		b->state = JIT_PROFILING;
+	}
+	return b;
+}
+
+void jit_invalidate_page ( unsigned int page )
+{
+	jit_pagegen[page]++;
+	memset(jit_codemap + (page << 9), 0, 1 << 9);
+	memset(jit_entrymap + (page << 9), 0, 1 << 9);
+	cpu_mem_uncode_page(page, MEM_CODE_JIT);
+}
+
+// Drops all translations but keeps the page generations (no guest memory changed)
+static void jit_flush_code ( void )
+{
+	jit_ptr = jit_code_start;
+	jit_npatches = 0;
+	memset(jit_entrymap, 0, sizeof jit_entrymap);
+	for (int i = 0; i < JIT_BLOCKS; i++) {
+		jit_blocks[i].code = NULL;
+		jit_blocks[i].hits = 0;
+		jit_blocks[i].state = JIT_PROFILING;
+	}
+}
+
+void jit_flush ( void )
+{
+	if (jit_cache == MAP_FAILED)
+		return;
+	for (unsigned int page = 0; page < (RAM_SIZE >> 12); page++)
+		jit_invalidate_page(page);
+	jit_flush_code();
+}
+
+
+/* ---- decoder ---- */
+
+static int jit_code8 ( uint16_t cs, uint32_t ip, uint8_t *v )
+{
+	if (ip > 0xFFFF)
+		return 0;	// do not bother with IP wrapping around inside a block
+	const uint32_t linear = jit_linear(cs, ip);
+	if (linear >= 0xA0000 && linear < 0xC0000)
+		return 0;
+	*v = machine_ram[linear];
+	return 1;
+}
+
+// Control transfers, I/O and STI (a pending IRQ must be serviced after it) end the block
+static int jit_is_block_end ( const struct jit_insn *in )
+{
+	const uint8_t op = in->opcode;
+	return (op >= 0x70 && op <= 0x7F) || op == 0xC2 || op == 0xC3 || op == 0xCA || op == 0xCB ||
+		(op >= 0xE2 && op <= 0xEF) || op == 0xFB || (op == 0xFF && (in->reg == 2 || in->reg == 4));
+}
+
+// Decodes a supported instruction at cs:ip, returns with zero for anything the translator does not know
+static int jit_decode ( uint16_t cs, uint16_t ip, struct jit_insn *in )
+{
+	uint32_t p = ip;
+	int segov = -1, modrm = 0, immsize = 0, prefixes;
+	uint8_t op, b;
+	for (prefixes = 0;; prefixes++) {
+		if (prefixes > 4 || !jit_code8(cs, p++, &op))
+			return 0;
+		if (op == 0x26 || op == 0x2E || op == 0x36 || op == 0x3E)
+			segov = (op >> 3) & 3;	// 26 -> ES, 2E -> CS, 36 -> SS, 3E -> DS
+		else
+			break;
+	}
+	switch (op) {
+		case 0x00: case 0x01: case 0x02: case 0x03:	// ADD
+		case 0x08: case 0x09: case 0x0A: case 0x0B:	// OR
+		case 0x10: case 0x11: case 0x12: case 0x13:	// ADC
+		case 0x20: case 0x21: case 0x22: case 0x23:	// AND
+		case 0x28: case 0x29: case 0x2A: case 0x2B:	// SUB
+		case 0x30: case 0x31: case 0x32: case 0x33:	// XOR
+		case 0x38: case 0x39: case 0x3A: case 0x3B:	// CMP
+		case 0x84: case 0x85:				// TEST
+		case 0x88: case 0x89: case 0x8A: case 0x8B:	// MOV
+		case 0x8C: case 0x8D: case 0x8E:		// MOV Ew Sw, LEA, MOV Sw Ew
+		case 0xD0: case 0xD1:				// shifts and rotates by one
+		case 0xFE: case 0xFF:				// INC, DEC, CALL, JMP, PUSH Ev
+			modrm = 1;
+			break;
+		case 0x04: case 0x0C: case 0x14: case 0x24: case 0x2C: case 0x34: case 0x3C: case 0xA8:
+		case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+		case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+		case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
+		case 0xE2: case 0xE3: case 0xE4: case 0xE5: case 0xE6: case 0xE7: case 0xEB:
+			immsize = 1;
+			break;
+		case 0x05: case 0x0D: case 0x15: case 0x25: case 0x2D: case 0x35: case 0x3D: case 0xA9:
+		case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+		case 0xA0: case 0xA1: case 0xA2: case 0xA3:
+		case 0xC2: case 0xCA:
+		case 0xE8: case 0xE9:
+			immsize = 2;
+			break;
+		case 0x80: case 0x82: case 0x83: case 0xC6:
+			modrm = 1;
+			immsize = 1;
+			break;
+		case 0x81: case 0xC7:
+			modrm = 1;
+			immsize = 2;
+			break;
+		case 0x54:	// PUSH SP has model specific behaviour, leave it to the interpreter
+			return 0;
+		case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+		case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
+		case 0x50: case 0x51: case 0x52: case 0x53:            case 0x55: case 0x56: case 0x57:
+		case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+		case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+		case 0x06: case 0x07: case 0x0E: case 0x16: case 0x17: case 0x1E: case 0x1F:
+		case 0xC3: case 0xCB: case 0xEC: case 0xED: case 0xEE: case 0xEF:
+		case 0xF5: case 0xF8: case 0xF9: case 0xFA: case 0xFB: case 0xFC: case 0xFD:
+			break;
+		default:
+			return 0;
+	}
+	in->ip = ip;
+	in->opcode = op;
+	in->disp16 = 0;
+	in->mode = in->reg = in->rm = 0;
+	if (modrm) {
+		if (!jit_code8(cs, p++, &b))
+			return 0;
+		in->mode = b >> 6;
+		in->reg = (b >> 3) & 7;
+		in->rm = b & 7;
+		if (in->mode == 1) {
+			if (!jit_code8(cs, p++, &b))
+				return 0;
+			in->disp16 = signext(b);
+		} else if (in->mode == 2 || (in->mode == 0 && in->rm == 6)) {
+			uint8_t hi;
+			if (!jit_code8(cs, p++, &b) || !jit_code8(cs, p++, &hi))
+				return 0;
+			in->disp16 = b | (hi << 8);
+		}
+		if (segov >= 0)
+			in->seg = segov;
+		else if (in->rm == 2 || in->rm == 3 || (in->rm == 6 && in->mode != 0))
+			in->seg = regss;
+		else
+			in->seg = regds;
+		if (op >= 0x80 && op <= 0x83 && in->reg == 3)
+			return 0;	// SBB
+		if (op == 0xD0 && in->reg == 0)
+			return 0;	// 8 bit ROL sets OF differently in the interpreter
+		if (op == 0x8D && in->mode == 3)
+			return 0;
+		if ((op == 0x8C && in->reg > 3) || (op == 0x8E && (in->reg > 3 || in->reg == regcs)))
+			return 0;
+		if ((op == 0xFE && in->reg > 1) || (op == 0xFF && in->reg != 0 && in->reg != 1 && in->reg != 2 && in->reg != 4 && in->reg != 6))
+			return 0;
+	}
+	in->cycles = cpu_insn_cycles(op, modrm ? in->mode : 3, in->reg, in->rm) + 2 * prefixes;
+	in->imm = 0;
+	if (immsize) {
+		uint8_t hi = 0;
+		if (!jit_code8(cs, p++, &b) || (immsize == 2 && !jit_code8(cs, p++, &hi)))
+			return 0;
+		in->imm = b | (hi << 8);
+	}
+	if (op >= 0xA0 && op <= 0xA3) {
+		// MOV between the accumulator and a direct address is the same as 88-8B with [disp16]
+		in->opcode = op == 0xA0 ? 0x8A : op == 0xA1 ? 0x8B : op == 0xA2 ? 0x88 : 0x89;
+		in->mode = 0;
+		in->rm = 6;
+		in->reg = 0;
+		in->disp16 = in->imm;
+		in->seg = segov >= 0 ? segov : regds;
+	}
+	if (p > 0xFFFF)
+		return 0;
+	in->next = p;
+	return 1;
+}
+
+
+/* ---- translator ---- */
+
+// Jumps to the translation of cs:ip, or exits to jit_exec() with the given IP if there is none (yet)
+static void emit_exit ( uint16_t cs, uint16_t ip )
+{
+	const struct jit_block *t = jit_peek(cs, ip);
+	if (t) {
+		JMP(t->code);
+		return;
+	}
+	uint8_t *site = JMP(jit_ptr + 5);	// patched to the translation later, until then it falls through
+	emit_store_imm16(OFS(ip), ip);
+	JMP(jit_epilogue);
+	if (jit_npatches < JIT_MAX_PATCHES) {
+		jit_patches[jit_npatches].site = site;
+		jit_patches[jit_npatches].cs = cs;
+		jit_patches[jit_npatches].ip = ip;
+		jit_npatches++;
+	}
+}
+
+// Exits from the middle of a block if a write86() modified the code of the current block,
+// the budget and the cycles of the instructions not executed are given back
+static void emit_smc_check ( const struct jit_block *b, uint16_t next_ip, uint32_t unused_budget, uint32_t unused_cycles )
+{
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&jit_pagegen[b->page]);			// movabs rax, &pagegen[page]
+	EMIT(0x81, 0x38); emit32(b->gen0);						// cmp dword [rax], gen0
+	EMIT(0x75, 18);									// jne exit
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&jit_pagegen[(b->page + 1) & 0xFF]);	// movabs rax, &pagegen[page + 1]
+	EMIT(0x81, 0x38); emit32(b->gen1);						// cmp dword [rax], gen1
+	EMIT(0x74, 35);									// je continue
+	emit_store_imm16(OFS(ip), next_ip);						// exit:
+	EMIT(0x41, 0x81, 0xC4); emit32(unused_budget);					// add r12d, unused_budget
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&totalcycles);				// movabs rax, &totalcycles
+	EMIT(0x48, 0x81, 0x28); emit32(unused_cycles);					// sub qword [rax], unused_cycles
+	JMP(jit_epilogue);								// continue:
+}
+
+// A memory write of the k-th instruction (in) of the block of n ones
+static void emit_write_checked ( const struct jit_block *b, const struct jit_insn *in, int word, int k, int n )
+{
+	emit_write(word);
+	if (k < n - 1) {
+		uint32_t unused_cycles = 0;
+		for (int i = 1; i < n - k; i++)
+			unused_cycles += in[i].cycles;
+		emit_smc_check(b, in->next, n - k - 1, unused_cycles);
+	}
+}
+
+// ALU operation between dl/dx (destination) and cl/cx (source), result is in dl/dx
+static void emit_alu ( int aluop, int word )
+{
+	if (aluop == 2)
+		emit_load_cf();
+	if (word)
+		emit8(0x66);
+	emit8(host_alu16[aluop] - (word ? 0 : 1));
+	emit8(0xCA);
+	emit_flags(aluop == 1 || aluop == 4 || aluop == 6 ? FL_LOGIC : FL_ARITH);
+}
+
+// Condition test of the 8086 Jcc, leaves host ZF clear if the jump is to be taken
+static void emit_condition ( uint8_t opcode )
+{
+	switch ((opcode >> 1) & 7) {
+		case 0: EMIT(0x80, 0x7B, OFS(of), 0x00); break;			// cmp byte [rbx+of], 0
+		case 1: EMIT(0x80, 0x7B, OFS(cf), 0x00); break;
+		case 2: EMIT(0x80, 0x7B, OFS(zf), 0x00); break;
+		case 3: EMIT(0x8A, 0x43, OFS(cf), 0x0A, 0x43, OFS(zf), 0x84, 0xC0); break;	// mov al, cf; or al, zf; test al, al
+		case 4: EMIT(0x80, 0x7B, OFS(sf), 0x00); break;
+		case 5: EMIT(0x80, 0x7B, OFS(pf), 0x00); break;
+		case 6: EMIT(0x8A, 0x43, OFS(sf), 0x3A, 0x43, OFS(of)); break;		// mov al, sf; cmp al, of
+		case 7: EMIT(0x8A, 0x43, OFS(sf), 0x32, 0x43, OFS(of), 0x0A, 0x43, OFS(zf), 0x84, 0xC0); break;	// (sf ^ of) | zf
+	}
+}
+
+// Conditional block end: taken -> target, otherwise -> next instruction
+static void emit_branch ( uint16_t cs, uint8_t cc, uint16_t next, uint16_t target )
+{
+	uint8_t *taken = JCC(cc, NULL);
+	emit_exit(cs, next);
+	patch_rel32(taken, jit_ptr);
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&totalcycles);				// movabs rax, &totalcycles
+	EMIT(0x48, 0x83, 0x00, CYCLES_SHORT_JUMP_TAKEN);				// add qword [rax], taken jump cycles
+	emit_exit(cs, target);
+}
+
+static void emit_insn ( const struct jit_block *b, const struct jit_insn *in, int k, int n )
+{
+	const uint8_t op = in->opcode;
+	const int word = op & 1;
+	switch (op) {
+		case 0x00: case 0x01: case 0x02: case 0x03: case 0x08: case 0x09: case 0x0A: case 0x0B:
+		case 0x10: case 0x11: case 0x12: case 0x13:
+		case 0x20: case 0x21: case 0x22: case 0x23: case 0x28: case 0x29: case 0x2A: case 0x2B:
+		case 0x30: case 0x31: case 0x32: case 0x33: case 0x38: case 0x39: case 0x3A: case 0x3B:
+		case 0x84: case 0x85:
+		{
+			const int aluop = (op >> 3) & 7;
+			const int to_reg = (op & 2) && op < 0x80;
+			const uint8_t regofs = word ? OFS_WREG(in->reg) : OFS_BREG(in->reg);
+			const int writeback = op < 0x80 && aluop != 7;
+			if (in->mode == 3) {
+				const uint8_t rmofs = word ? OFS_WREG(in->rm) : OFS_BREG(in->rm);
+				if (word) {
+					emit_load16(H_EDX, to_reg ? regofs : rmofs);
+					emit_load16(H_ECX, to_reg ? rmofs : regofs);
+				} else {
+					emit_load8(H_EDX, to_reg ? regofs : rmofs);
+					emit_load8(H_ECX, to_reg ? rmofs : regofs);
+				}
+			} else {
+				emit_ea(in, 1);
+				emit_read(word);
+				if (to_reg) {
+					(word ? emit_load16 : emit_load8)(H_EDX, regofs);
+					EMIT(0x44, 0x89, 0xF1);		// mov ecx, r14d
+				} else {
+					EMIT(0x44, 0x89, 0xF2);		// mov edx, r14d
+					(word ? emit_load16 : emit_load8)(H_ECX, regofs);
+				}
+			}
+			if (op >= 0x80) {
+				if (word)
+					EMIT(0x66, 0x85, 0xCA);		// test dx, cx
+				else
+					EMIT(0x84, 0xCA);		// test dl, cl
+				emit_flags(FL_LOGIC);
+				break;
+			}
+			emit_alu(aluop, word);
+			if (!writeback)
+				break;
+			if (to_reg || in->mode == 3) {
+				const uint8_t dstofs = to_reg ? regofs : (word ? OFS_WREG(in->rm) : OFS_BREG(in->rm));
+				(word ? emit_store16 : emit_store8)(H_EDX, dstofs);
+			} else {
+				EMIT(0x41, 0x89, 0xD6);			// mov r14d, edx
+				emit_write_checked(b, in, word, k, n);
+			}
+			break;
+		}
+		case 0x04: case 0x05: case 0x0C: case 0x0D: case 0x14: case 0x15: case 0x24: case 0x25:
+		case 0x2C: case 0x2D: case 0x34: case 0x35: case 0x3C: case 0x3D:
+		case 0xA8: case 0xA9:
+		{
+			const uint8_t accofs = word ? OFS_WREG(regax) : OFS_AL;
+			(word ? emit_load16 : emit_load8)(H_EDX, accofs);
+			emit8(0xB9); emit32(in->imm);			// mov ecx, imm
+			if (op >= 0xA8) {
+				if (word)
+					EMIT(0x66, 0x85, 0xCA);
+				else
+					EMIT(0x84, 0xCA);
+				emit_flags(FL_LOGIC);
+				break;
+			}
+			emit_alu((op >> 3) & 7, word);
+			if (((op >> 3) & 7) != 7)
+				(word ? emit_store16 : emit_store8)(H_EDX, accofs);
+			break;
+		}
+		case 0x80: case 0x81: case 0x82: case 0x83:
+		{
+			const int w = op != 0x80 && op != 0x82;
+			const uint16_t imm = op == 0x83 ? (uint16_t)signext(in->imm) : in->imm;
+			const uint8_t rmofs = w ? OFS_WREG(in->rm) : OFS_BREG(in->rm);
+			if (in->mode == 3) {
+				(w ? emit_load16 : emit_load8)(H_EDX, rmofs);
+			} else {
+				emit_ea(in, 1);
+				emit_read(w);
+				EMIT(0x44, 0x89, 0xF2);			// mov edx, r14d
+			}
+			emit8(0xB9); emit32(imm);			// mov ecx, imm
+			emit_alu(in->reg, w);
+			if (in->reg == 7)
+				break;
+			if (in->mode == 3) {
+				(w ? emit_store16 : emit_store8)(H_EDX, rmofs);
+			} else {
+				EMIT(0x41, 0x89, 0xD6);			// mov r14d, edx
+				emit_write_checked(b, in, w, k, n);
+			}
+			break;
+		}
+		case 0xD0: case 0xD1:
+		{
+			const uint8_t rmofs = word ? OFS_WREG(in->rm) : OFS_BREG(in->rm);
+			if (in->mode == 3) {
+				(word ? emit_load16 : emit_load8)(H_EDX, rmofs);
+			} else {
+				emit_ea(in, 1);
+				emit_read(word);
+				EMIT(0x44, 0x89, 0xF2);			// mov edx, r14d
+			}
+			if (in->reg == 2 || in->reg == 3)
+				emit_load_cf();
+			if (word)
+				emit8(0x66);
+			emit8(op);
+			emit8(0xC2 | ((in->reg == 6 ? 4 : in->reg) << 3));	// rol/ror/rcl/rcr/shl/shr/shl/sar dx, 1
+			emit_flags(in->reg < 4 ? FL_ROTATE : FL_SHIFT);
+			if (in->mode == 3) {
+				(word ? emit_store16 : emit_store8)(H_EDX, rmofs);
+			} else {
+				EMIT(0x41, 0x89, 0xD6);			// mov r14d, edx
+				emit_write_checked(b, in, word, k, n);
+			}
+			break;
+		}
+		case 0xFE: case 0xFF:
+			if (in->reg > 1) {
+				// PUSH, CALL or JMP near Ev, operand to r14d first
+				if (in->mode == 3)
+					emit_load16(H_R14, OFS_WREG(in->rm));
+				else {
+					emit_ea(in, 1);
+					emit_read(1);
+				}
+				if (in->reg != 6)
+					emit_store16(H_R14, OFS(ip));
+				if (in->reg == 4) {
+					JMP(jit_epilogue);
+					break;
+				}
+				EMIT(0x66, 0x83, 0x6B, OFS_WREG(regsp), 0x02);	// sub word [rbx+sp], 2
+				emit_stack_ea();
+				if (in->reg == 2) {
+					EMIT(0x41, 0xBE); emit32(in->next);	// mov r14d, return address
+					emit_write(1);
+					JMP(jit_epilogue);
+				} else
+					emit_write_checked(b, in, 1, k, n);
+				break;
+			}
+			if (in->mode == 3) {
+				(word ? emit_load16 : emit_load8)(H_EDX, word ? OFS_WREG(in->rm) : OFS_BREG(in->rm));
+			} else {
+				emit_ea(in, 1);
+				emit_read(word);
+				EMIT(0x44, 0x89, 0xF2);				// mov edx, r14d
+			}
+			if (word)
+				emit8(0x66);
+			emit8(op);
+			emit8(in->reg ? 0xCA : 0xC2);				// inc/dec dl/dx
+			emit_flags(FL_INCDEC);
+			if (in->mode == 3) {
+				(word ? emit_store16 : emit_store8)(H_EDX, word ? OFS_WREG(in->rm) : OFS_BREG(in->rm));
+			} else {
+				EMIT(0x41, 0x89, 0xD6);				// mov r14d, edx
+				emit_write_checked(b, in, word, k, n);
+			}
+			break;
+		case 0x8C:
+			if (in->mode == 3) {
+				emit_load16(H_EAX, OFS_SREG(in->reg));
+				emit_store16(H_EAX, OFS_WREG(in->rm));
+			} else {
+				emit_ea(in, 1);
+				emit_load16(H_R14, OFS_SREG(in->reg));
+				emit_write_checked(b, in, 1, k, n);
+			}
+			break;
+		case 0x8E:
+			if (in->mode == 3) {
+				emit_load16(H_EAX, OFS_WREG(in->rm));
+				emit_store16(H_EAX, OFS_SREG(in->reg));
+			} else {
+				emit_ea(in, 1);
+				emit_read(1);
+				emit_store16(H_R14, OFS_SREG(in->reg));
+			}
+			break;
+		case 0x06: case 0x0E: case 0x16: case 0x1E:
+			emit_load16(H_R14, OFS_SREG(op >> 3));
+			EMIT(0x66, 0x83, 0x6B, OFS_WREG(regsp), 0x02);	// sub word [rbx+sp], 2
+			emit_stack_ea();
+			emit_write_checked(b, in, 1, k, n);
+			break;
+		case 0x07: case 0x17: case 0x1F:
+			emit_stack_ea();
+			emit_read(1);
+			EMIT(0x66, 0x83, 0x43, OFS_WREG(regsp), 0x02);	// add word [rbx+sp], 2
+			emit_store16(H_R14, OFS_SREG(op >> 3));
+			break;
+		case 0xFA:
+			emit_store_imm8(OFS(ifl), 0);
+			break;
+		case 0xFB:
+			emit_store_imm8(OFS(ifl), 1);
+			emit_exit(b->cs, in->next);
+			break;
+		case 0x88: case 0x89:
+			if (in->mode == 3) {
+				if (word) {
+					emit_load16(H_EAX, OFS_WREG(in->reg));
+					emit_store16(H_EAX, OFS_WREG(in->rm));
+				} else {
+					emit_load8(H_EAX, OFS_BREG(in->reg));
+					emit_store8(H_EAX, OFS_BREG(in->rm));
+				}
+			} else {
+				emit_ea(in, 1);
+				(word ? emit_load16 : emit_load8)(H_R14, word ? OFS_WREG(in->reg) : OFS_BREG(in->reg));
+				emit_write_checked(b, in, word, k, n);
+			}
+			break;
+		case 0x8A: case 0x8B:
+			if (in->mode == 3) {
+				if (word) {
+					emit_load16(H_EAX, OFS_WREG(in->rm));
+					emit_store16(H_EAX, OFS_WREG(in->reg));
+				} else {
+					emit_load8(H_EAX, OFS_BREG(in->rm));
+					emit_store8(H_EAX, OFS_BREG(in->reg));
+				}
+			} else {
+				emit_ea(in, 1);
+				emit_read(word);
+				(word ? emit_store16 : emit_store8)(H_R14, word ? OFS_WREG(in->reg) : OFS_BREG(in->reg));
+			}
+			break;
+		case 0x8D:
+			emit_ea(in, 0);
+			emit_store16(H_R13, OFS_WREG(in->reg));
+			break;
+		case 0xC6: case 0xC7:
+			if (in->mode == 3) {
+				if (word)
+					emit_store_imm16(OFS_WREG(in->rm), in->imm);
+				else
+					emit_store_imm8(OFS_BREG(in->rm), in->imm);
+			} else {
+				emit_ea(in, 1);
+				EMIT(0x41, 0xBE); emit32(in->imm);	// mov r14d, imm
+				emit_write_checked(b, in, word, k, n);
+			}
+			break;
+		case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+		case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
+			emit_load16(H_EDX, OFS_WREG(op & 7));
+			EMIT(0x66, 0xFF);
+			emit8(op < 0x48 ? 0xC2 : 0xCA);			// inc/dec dx
+			emit_flags(FL_INCDEC);
+			emit_store16(H_EDX, OFS_WREG(op & 7));
+			break;
+		case 0x50: case 0x51: case 0x52: case 0x53: case 0x55: case 0x56: case 0x57:
+			emit_load16(H_R14, OFS_WREG(op & 7));
+			EMIT(0x66, 0x83, 0x6B, OFS_WREG(regsp), 0x02);	// sub word [rbx+sp], 2
+			emit_stack_ea();
+			emit_write_checked(b, in, 1, k, n);
+			break;
+		case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+			emit_stack_ea();
+			emit_read(1);
+			EMIT(0x66, 0x83, 0x43, OFS_WREG(regsp), 0x02);	// add word [rbx+sp], 2
+			emit_store16(H_R14, OFS_WREG(op & 7));
+			break;
+		case 0x90:
+			break;
+		case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+			emit_load16(H_EAX, OFS_WREG(regax));
+			emit_load16(H_ECX, OFS_WREG(op & 7));
+			emit_store16(H_ECX, OFS_WREG(regax));
+			emit_store16(H_EAX, OFS_WREG(op & 7));
+			break;
+		case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
+			emit_store_imm8(OFS_BREG(op & 7), in->imm);
+			break;
+		case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+			emit_store_imm16(OFS_WREG(op & 7), in->imm);
+			break;
+		case 0xF5:
+			EMIT(0x80, 0x73, OFS(cf), 0x01);		// xor byte [rbx+cf], 1
+			break;
+		case 0xF8: case 0xF9:
+			emit_store_imm8(OFS(cf), op & 1);
+			break;
+		case 0xFC: case 0xFD:
+			emit_store_imm8(OFS(df), op & 1);
+			break;
+		/* Block enders */
+		case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+		case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+			emit_condition(op);
+			emit_branch(b->cs, CC_NZ ^ (op & 1), in->next, in->next + signext(in->imm));
+			break;
+		case 0xE2:
+			EMIT(0x66, 0x83, 0x6B, OFS_WREG(regcx), 0x01);	// sub word [rbx+cx], 1
+			emit_branch(b->cs, CC_NZ, in->next, in->next + signext(in->imm));
+			break;
+		case 0xE3:
+			EMIT(0x66, 0x83, 0x7B, OFS_WREG(regcx), 0x00);	// cmp word [rbx+cx], 0
+			emit_branch(b->cs, CC_Z, in->next, in->next + signext(in->imm));
+			break;
+		case 0xEB:
+			emit_exit(b->cs, in->next + signext(in->imm));
+			break;
+		case 0xE9:
+			emit_exit(b->cs, in->next + in->imm);
+			break;
+		case 0xE8:
+			EMIT(0x66, 0x83, 0x6B, OFS_WREG(regsp), 0x02);	// sub word [rbx+sp], 2
+			emit_stack_ea();
+			EMIT(0x41, 0xBE); emit32(in->next);		// mov r14d, return address
+			emit_write(1);
+			emit_exit(b->cs, in->next + in->imm);
+			break;
+		case 0xC2: case 0xC3: case 0xCA: case 0xCB:
+			emit_stack_ea();
+			emit_read(1);
+			EMIT(0x66, 0x83, 0x43, OFS_WREG(regsp), 0x02);	// add word [rbx+sp], 2
+			emit_store16(H_R14, OFS(ip));
+			if (op & 8) {
+				emit_stack_ea();
+				emit_read(1);
+				EMIT(0x66, 0x83, 0x43, OFS_WREG(regsp), 0x02);
+				emit_store16(H_R14, OFS_SREG(regcs));
+			}
+			if (!(op & 1)) {
+				EMIT(0x66, 0x81, 0x43, OFS_WREG(regsp)); emit16(in->imm);	// add word [rbx+sp], imm16
+			}
+			JMP(jit_epilogue);
+			break;
+		case 0xE4: case 0xE5: case 0xE6: case 0xE7:
+		case 0xEC: case 0xED: case 0xEE: case 0xEF:
+			// Port handlers can do anything, so IP is stored before, and the block exits to C after
+			emit_store_imm16(OFS(ip), in->next);
+			if (op & 8)
+				EMIT(0x0F, 0xB7, 0x7B, OFS_WREG(regdx));	// movzx edi, word [rbx+dx]
+			else {
+				emit8(0xBF); emit32(in->imm);		// mov edi, imm8
+			}
+			if (op & 2) {
+				if (word)
+					EMIT(0x0F, 0xB7, 0x73, OFS_WREG(regax));	// movzx esi, word [rbx+ax]
+				else
+					EMIT(0x0F, 0xB6, 0x73, OFS_AL);	// movzx esi, byte [rbx+al]
+				emit_call(word ? (const void*)portout16 : (const void*)portout);
+			} else {
+				emit_call(word ? (const void*)portin16 : (const void*)portin);
+				(word ? emit_store16 : emit_store8)(H_EAX, word ? OFS_WREG(regax) : OFS_AL);
+			}
+			JMP(jit_epilogue);
+			break;
+		default:
+			UNREACHABLE();
+	}
+}
+
+static void jit_translate ( struct jit_block *b )
+{
+	struct jit_insn insn[JIT_BLOCK_INSNS];
+	int n = 0;
+	uint16_t ip = b->ip;
+	while (n < JIT_BLOCK_INSNS) {
+		if (n && b->cs == 0xF000 && ip == 0xE066)
+			break;
+		if ((jit_linear(b->cs, ip) >> 12) != b->page)
+			break;
+		if (!jit_decode(b->cs, ip, &insn[n]))
+			break;
+		ip = insn[n].next;
+		if (jit_is_block_end(&insn[n++]))
+			break;
+	}
+	if (!n) {
+		b->state = JIT_UNSUPPORTED;
+		return;
+	}
+	if (jit_cache + JIT_CACHE_SIZE - jit_ptr < JIT_BLOCK_MAX_CODE) {
+		const uint16_t cs = b->cs, ip0 = b->ip;
+		jit_flush_code();
+		b = jit_lookup(cs, ip0);
+	}
+	for (int i = 0; i < n; i++)
+		for (uint32_t a = insn[i].ip; a < insn[i].next; a++) {
+			const uint32_t linear = jit_linear(b->cs, a);
+			jit_codemap[linear >> 3] |= 1 << (linear & 7);
+			cpu_mem_code_page(linear >> 12, MEM_CODE_JIT);
+		}
+	// Exit stub for the block entry checks: nothing is executed
+	uint8_t *exit_start = jit_ptr;
+	emit_store_imm16(OFS(ip), b->ip);
+	JMP(jit_epilogue);
+	uint8_t *entry = jit_ptr;
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&jit_pagegen[b->page]);			// movabs rax, &pagegen[page]
+	EMIT(0x81, 0x38); emit32(b->gen0);						// cmp dword [rax], gen0
+	JCC(CC_NZ, exit_start);
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&jit_pagegen[(b->page + 1) & 0xFF]);	// movabs rax, &pagegen[page + 1]
+	EMIT(0x81, 0x38); emit32(b->gen1);						// cmp dword [rax], gen1
+	JCC(CC_NZ, exit_start);
+	EMIT(0x41, 0x81, 0xFC); emit32(n);						// cmp r12d, n
+	JCC(CC_L, exit_start);
+	uint32_t cycles = 0;
+	for (int i = 0; i < n; i++)
+		cycles += insn[i].cycles;
+	const uint8_t last = insn[n - 1].opcode;
+	const uint32_t maxcycles = cycles + ((last >= 0x70 && last <= 0x7F) || last == 0xE2 || last == 0xE3 ? CYCLES_SHORT_JUMP_TAKEN : 0);
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&totalcycles);				// movabs rax, &totalcycles
+	EMIT(0x48, 0x8B, 0x00);								// mov rax, [rax]
+	EMIT(0x48, 0x05); emit32(maxcycles);						// add rax, maxcycles
+	EMIT(0x48, 0xB9); emit64((uintptr_t)&jit_cycle_limit);				// movabs rcx, &jit_cycle_limit
+	EMIT(0x48, 0x3B, 0x01);								// cmp rax, [rcx]
+	JCC(CC_AE, exit_start);
+	// Pending IRQ must be serviced by exec86() before the block
+	EMIT(0x80, 0x7B, OFS(ifl), 0x00, 0x74, 19);					// cmp byte [rbx+ifl], 0; je +19
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&i8259.deliverable);			// movabs rax, &i8259.deliverable
+	EMIT(0x80, 0x38, 0x00);								// cmp byte [rax], 0
+	JCC(CC_NZ, exit_start);
+	EMIT(0x41, 0x81, 0xEC); emit32(n);						// sub r12d, n
+	EMIT(0x48, 0xB8); emit64((uintptr_t)&totalcycles);				// movabs rax, &totalcycles
+	EMIT(0x48, 0x81, 0x00); emit32(cycles);						// add qword [rax], cycles
+	for (int i = 0; i < n; i++)
+		emit_insn(b, &insn[i], i, n);
+	if (!jit_is_block_end(&insn[n - 1]))
+		emit_exit(b->cs, ip);
+	b->code = entry;
+	b->state = JIT_TRANSLATED;
+	const uint32_t linear = jit_linear(b->cs, b->ip);
+	jit_entrymap[linear >> 3] |= 1 << (linear & 7);
+	jit_translations++;
+	// Link the already existing exits to this new block
+	for (int i = 0; i < jit_npatches;) {
+		if (jit_patches[i].cs == b->cs && jit_patches[i].ip == b->ip) {
+			patch_rel32(jit_patches[i].site, entry);
+			jit_patches[i] = jit_patches[--jit_npatches];
+		} else
+			i++;
+	}
+}
+
+uint32_t jit_exec ( uint32_t budget )
+{
+	uint32_t done = 0;
+	if (budget > JIT_MAX_RUN)
+		budget = JIT_MAX_RUN;
+	while (done < budget) {
+		struct jit_block *b = jit_lookup(machine_cpu.segregs[regcs], machine_cpu.ip);
+		if (!b)
+			break;
+		if (b->state == JIT_PROFILING) {
+			if (++b->hits < JIT_HOT_THRESHOLD)
+				break;
+			jit_translate(b);
+			b = jit_lookup(machine_cpu.segregs[regcs], machine_cpu.ip);
+		}
+		if (b->state != JIT_TRANSLATED)
+			break;
+		CPU_SYNC_FLAGS();	// translated code works on the real flag bytes only
+		// a port access of the previous block may have rescheduled an event
+		jit_cycle_limit = machine->timing.next < machine->cycle_limit ? machine->timing.next : machine->cycle_limit;
+		const uint32_t ran = budget - done - jit_trampoline(b->code, budget - done, &machine_cpu);
+		if (!ran)
+			break;
+		done += ran;
+	}
+	jit_executed += done;
+	return done;
+}
+
+int jit_init ( void )
+{
+	jit_cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit_cache == MAP_FAILED) {
+		perror("JIT: cannot allocate executable memory");
+		return -1;
+	}
+	jit_ptr = jit_cache;
+	// uint32_t trampoline(code = rdi, budget = esi, cpu = rdx), returns with the unused budget
+	jit_trampoline = (void*)jit_ptr;
+	EMIT(
+		0x55,				// push rbp
+		0x53,				// push rbx
+		0x41, 0x54,			// push r12
+		0x41, 0x55,			// push r13
+		0x41, 0x56,			// push r14
+		0x41, 0x57,			// push r15
+		0x48, 0x83, 0xEC, 0x08,		// sub rsp, 8
+		0x48, 0x89, 0xD3,		// mov rbx, rdx
+		0x41, 0x89, 0xF4,		// mov r12d, esi
+		0xFF, 0xE7			// jmp rdi
+	);
+	jit_epilogue = jit_ptr;
+	EMIT(
+		0x44, 0x89, 0xE0,		// mov eax, r12d
+		0x48, 0x83, 0xC4, 0x08,		// add rsp, 8
+		0x41, 0x5F,			// pop r15
+		0x41, 0x5E,			// pop r14
+		0x41, 0x5D,			// pop r13
+		0x41, 0x5C,			// pop r12
+		0x5B,				// pop rbx
+		0x5D,				// pop rbp
+		0xC3				// ret
+	);
+	jit_code_start = jit_ptr;
+	jit_flush();
+	printf("JIT: %d Mbytes of translation cache at %p\n", JIT_CACHE_SIZE >> 20, jit_cache);
+	return 0;
+}
+
+#endif
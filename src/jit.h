@@ -0,0 +1,47 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_JIT_H_INCLUDED
+#define FAKE86_JIT_H_INCLUDED
+#include "config.h"
+#ifdef USE_JIT
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+extern uint8_t  jit_codemap[RAM_SIZE >> 3];
+extern uint8_t  jit_entrymap[RAM_SIZE >> 3];
+extern uint64_t jit_translations, jit_executed;
+
+extern int      jit_init            ( void );
+extern void     jit_flush           ( void );
+extern void     jit_invalidate_page ( unsigned int page );
+extern uint32_t jit_exec            ( uint32_t budget );
+
+// Is there (or was there) a translated block starting at cs:ip?
+static inline int jit_is_entry ( uint16_t cs, uint16_t ip )
+{
+	const uint32_t linear = (((uint32_t)cs << 4) + ip) & 0xFFFFF;
+	return jit_entrymap[linear >> 3] & (1 << (linear & 7));
+}
+
+#endif
+#endif
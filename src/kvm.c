@@ -265,37 +265,37 @@ int kvm_run ( void )
 
 void cpu_regs_from_kvm ( void )
 {
-	cpu.regs.wordregs[regax] = KVM_GET_AX();
-	cpu.regs.wordregs[regbx] = KVM_GET_BX();
-	cpu.regs.wordregs[regcx] = KVM_GET_CX();
-	cpu.regs.wordregs[regdx] = KVM_GET_DX();
-	cpu.regs.wordregs[regsi] = KVM_GET_SI();
-	cpu.regs.wordregs[regdi] = KVM_GET_DI();
-	cpu.regs.wordregs[regbp] = KVM_GET_BP();
-	cpu.regs.wordregs[regsp] = KVM_GET_SP();
-	cpu.ip = KVM_GET_IP();
+	machine_cpu.regs.wordregs[regax] = KVM_GET_AX();
+	machine_cpu.regs.wordregs[regbx] = KVM_GET_BX();
+	machine_cpu.regs.wordregs[regcx] = KVM_GET_CX();
+	machine_cpu.regs.wordregs[regdx] = KVM_GET_DX();
+	machine_cpu.regs.wordregs[regsi] = KVM_GET_SI();
+	machine_cpu.regs.wordregs[regdi] = KVM_GET_DI();
+	machine_cpu.regs.wordregs[regbp] = KVM_GET_BP();
+	machine_cpu.regs.wordregs[regsp] = KVM_GET_SP();
+	machine_cpu.ip = KVM_GET_IP();
 	decodeflagsword(KVM_GET_FL());
-	cpu.segregs[regcs] = KVM_GET_CS();
-	cpu.segregs[regds] = KVM_GET_DS();
-	cpu.segregs[reges] = KVM_GET_ES();
-	cpu.segregs[regss] = KVM_GET_SS();
+	machine_cpu.segregs[regcs] = KVM_GET_CS();
+	machine_cpu.segregs[regds] = KVM_GET_DS();
+	machine_cpu.segregs[reges] = KVM_GET_ES();
+	machine_cpu.segregs[regss] = KVM_GET_SS();
 }
 void cpu_regs_to_kvm ( void )
 {
-	KVM_SET_AX(cpu.regs.wordregs[regax]);
-	KVM_SET_BX(cpu.regs.wordregs[regbx]);
-	KVM_SET_CX(cpu.regs.wordregs[regcx]);
-	KVM_SET_DX(cpu.regs.wordregs[regdx]);
-	KVM_SET_SI(cpu.regs.wordregs[regsi]);
-	KVM_SET_DI(cpu.regs.wordregs[regdi]);
-	KVM_SET_BP(cpu.regs.wordregs[regbp]);
-	KVM_SET_SP(cpu.regs.wordregs[regsp]);
-	KVM_SET_IP(cpu.ip);
+	KVM_SET_AX(machine_cpu.regs.wordregs[regax]);
+	KVM_SET_BX(machine_cpu.regs.wordregs[regbx]);
+	KVM_SET_CX(machine_cpu.regs.wordregs[regcx]);
+	KVM_SET_DX(machine_cpu.regs.wordregs[regdx]);
+	KVM_SET_SI(machine_cpu.regs.wordregs[regsi]);
+	KVM_SET_DI(machine_cpu.regs.wordregs[regdi]);
+	KVM_SET_BP(machine_cpu.regs.wordregs[regbp]);
+	KVM_SET_SP(machine_cpu.regs.wordregs[regsp]);
+	KVM_SET_IP(machine_cpu.ip);
 	KVM_SET_FL(makeflagsword());
-	KVM_SET_CS(cpu.segregs[regcs]);
-	KVM_SET_DS(cpu.segregs[regds]);
-	KVM_SET_ES(cpu.segregs[reges]);
-	KVM_SET_SS(cpu.segregs[regss]);
+	KVM_SET_CS(machine_cpu.segregs[regcs]);
+	KVM_SET_DS(machine_cpu.segregs[regds]);
+	KVM_SET_ES(machine_cpu.segregs[reges]);
+	KVM_SET_SS(machine_cpu.segregs[regss]);
 }
 
 #endif
@@ -0,0 +1,164 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* lzblock.c: the compressor of the packed disk images, see lzblock.h for
+   the format. This file must not depend on SDL or anything of the emulator,
+   the imagegen tool is built with it as well. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lzblock.h"
+
+#define LZ_MINMATCH	4
+#define LZ_MAXOFFSET	0xFFFF
+#define LZ_HASH_BITS	13
+
+
+static inline uint32_t lz_hash ( const uint8_t *p )
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+
+static uint8_t *lz_put_length ( uint8_t *op, const uint8_t *oend, size_t len )
+{
+	for (; len >= 255; len -= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+	}
+	if (op >= oend)
+		return NULL;
+	*op++ = len;
+	return op;
+}
+
+
+static int lz_get_length ( const uint8_t **ip, const uint8_t *iend, size_t *len )
+{
+	unsigned int b;
+	do {
+		if (*ip >= iend)
+			return 1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+
+// Emits a sequence, 'matchlen' is zero for the last one. Returns NULL if there is no room for it.
+static uint8_t *lz_sequence ( uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t litlen, size_t offset, size_t matchlen )
+{
+	if (op >= oend)
+		return NULL;
+	uint8_t *token = op++;
+	*token = (litlen >= 15 ? 15 : litlen) << 4;
+	if (litlen >= 15 && !(op = lz_put_length(op, oend, litlen - 15)))
+		return NULL;
+	if ((size_t)(oend - op) < litlen)
+		return NULL;
+	memcpy(op, lit, litlen);
+	op += litlen;
+	if (!matchlen)
+		return op;
+	if (oend - op < 2)
+		return NULL;
+	*op++ = offset;
+	*op++ = offset >> 8;
+	matchlen -= LZ_MINMATCH;
+	*token |= matchlen >= 15 ? 15 : matchlen;
+	if (matchlen >= 15 && !(op = lz_put_length(op, oend, matchlen - 15)))
+		return NULL;
+	return op;
+}
+
+
+// Returns the size of the compressed data, or zero if it would not fit into 'max' bytes
+size_t lzblock_compress ( const uint8_t *src, size_t len, uint8_t *dst, size_t max )
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+	const uint8_t *ip = src, *anchor = src, *const iend = src + len;
+	const uint8_t *const mlimit = len > LZ_MINMATCH ? iend - LZ_MINMATCH : src;
+	uint8_t *op = dst, *const oend = dst + max;
+	while (ip < mlimit) {
+		const uint32_t h = lz_hash(ip);
+		const uint8_t *ref = src + table[h];
+		table[h] = ip - src;
+		if (ref < ip && ip - ref <= LZ_MAXOFFSET && !memcmp(ref, ip, LZ_MINMATCH)) {
+			size_t matchlen = LZ_MINMATCH;
+			while (ip + matchlen < iend && ref[matchlen] == ip[matchlen])
+				matchlen++;
+			if (!(op = lz_sequence(op, oend, anchor, ip - anchor, ip - ref, matchlen)))
+				return 0;
+			ip += matchlen;
+			anchor = ip;
+		} else
+			ip++;
+	}
+	if (!(op = lz_sequence(op, oend, anchor, iend - anchor, 0, 0)))
+		return 0;
+	return op - dst;
+}
+
+
+// Returns non-zero if the data is corrupt, or it does not decompress to exactly 'size' bytes
+int lzblock_decompress ( const uint8_t *src, size_t len, uint8_t *dst, size_t size )
+{
+	const uint8_t *ip = src, *const iend = src + len;
+	uint8_t *op = dst, *const oend = dst + size;
+	while (ip < iend) {
+		const unsigned int token = *ip++;
+		size_t n = token >> 4;
+		if (n == 15 && lz_get_length(&ip, iend, &n))
+			return 1;
+		if ((size_t)(iend - ip) < n || (size_t)(oend - op) < n)
+			return 1;
+		memcpy(op, ip, n);
+		op += n;
+		ip += n;
+		if (ip == iend)
+			break;	// the last sequence
+		if (iend - ip < 2)
+			return 1;
+		const size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		n = token & 15;
+		if (n == 15 && lz_get_length(&ip, iend, &n))
+			return 1;
+		n += LZ_MINMATCH;
+		if (!offset || offset > (size_t)(op - dst) || (size_t)(oend - op) < n)
+			return 1;
+		const uint8_t *ref = op - offset;
+		if (offset >= n) {
+			memcpy(op, ref, n);
+			op += n;
+		} else {
+			while (n--)	// overlapping, a repeated pattern
+				*op++ = *ref++;
+		}
+	}
+	return op != oend;
+}
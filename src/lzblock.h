@@ -0,0 +1,39 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_LZBLOCK_H_INCLUDED
+#define FAKE86_LZBLOCK_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A simple and fast LZ77 compressor for blocks of the packed disk images,
+   without any dependency, as it is used by the imagegen tool as well. The
+   compressed data is a series of sequences, every one is a token byte (the
+   number of literals in the high, the length of the match minus 4 in the low
+   nibble, 15 means extra length bytes follow, added up to the first one
+   which is not 255), the literals, then the 16 bit little-endian offset of
+   the match, and its extra length bytes. The last sequence has literals
+   only. */
+
+extern size_t lzblock_compress   ( const uint8_t *src, size_t len, uint8_t *dst, size_t max );
+extern int    lzblock_decompress ( const uint8_t *src, size_t len, uint8_t *dst, size_t size );
+
+#endif
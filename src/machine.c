@@ -0,0 +1,137 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* machine.c: the machine context, which holds all the state of an emulated
+   PC, so more of them can run in the same process on different threads. */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+
+#include "ports.h"
+#include "i8253.h"
+#include "i8259.h"
+#include "i8237.h"
+#include "video.h"
+#include "timing.h"
+
+// The traditional names of machine.h would clash with the field names here.
+#undef videobase
+#undef textbase
+
+#define ROM_START	0xC0000
+
+struct machine machine_main = {
+	.video = {
+		.cols = 80, .rows = 25,
+		.videobase = 0xB8000, .textbase = 0xB8000
+	},
+	.timing = {
+		.rate = TIMING_RATE_ONE
+	},
+	.bios_color = 7,
+	.attention = -1,
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	.flowcache = {
+		.insn = &machine_main.flowcache.dummy
+	},
+#endif
+};
+
+_Thread_local struct machine *machine = &machine_main;
+
+
+// Makes 'm' the machine of the calling thread, which all the emulation
+// functions (exec86(), the port handlers, timing(), ...) work on.
+void machine_bind ( struct machine *m )
+{
+	machine = m;
+}
+
+
+// Creates a new headless machine, with the ports, PIT, PIC, DMA controller
+// and the video adapter initialized. If 'rom' is not NULL, the ROM area
+// (the BIOS and the option ROMs) is copied from that machine, so it does not
+// need to be loaded again. The machine is still to be reset by reset86()
+// after binding it to a thread and inserting its disks.
+struct machine *machine_create ( const struct machine *rom )
+{
+	struct machine *m = calloc(1, sizeof(struct machine));
+	if (!m)
+		return NULL;
+#ifdef USE_KVM
+	m->RAM = calloc(1, RAM_SIZE);
+	if (!m->RAM) {
+		free(m);
+		return NULL;
+	}
+#endif
+	m->video.cols = 80;
+	m->video.rows = 25;
+	m->video.videobase = 0xB8000;
+	m->video.textbase = 0xB8000;
+	m->timing.rate = TIMING_RATE_ONE;
+	m->bios_color = 7;
+	m->attention = -1;
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	m->flowcache.insn = &m->flowcache.dummy;
+#endif
+	m->headless = 1;
+	m->running = 1;
+	if (rom) {
+		memcpy(m->RAM + ROM_START, rom->RAM + ROM_START, RAM_SIZE - ROM_START);
+		memcpy(m->readonly + ROM_START, rom->readonly + ROM_START, RAM_SIZE - ROM_START);
+	}
+	struct machine *old = machine;
+	machine = m;
+	ports_init();
+	init8253();
+	init8259();
+	init8237();
+	initVideoPorts();
+	resettiming();
+	machine = old;
+	return m;
+}
+
+
+void machine_destroy ( struct machine *m )
+{
+	if (!m || m == &machine_main)
+		return;
+	if (machine == m)
+		machine = &machine_main;
+#ifdef USE_KVM
+	free(m->RAM);
+#endif
+	free(m);
+}
+
+
+// Runs 'execloops' instructions on 'm', which also becomes the current
+// machine of the calling thread.
+void machine_exec ( struct machine *m, uint32_t execloops )
+{
+	machine = m;
+	exec86(execloops);
+}
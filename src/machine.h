@@ -0,0 +1,165 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* cpu.h includes this file in its middle, after its own types are defined,
+   so that its inline functions can already use the per-machine state below.
+   Pulling cpu.h in first (outside of the include guard) gives that order
+   even if some source includes this file before cpu.h. */
+#include "cpu.h"
+
+#ifndef FAKE86_MACHINE_H_INCLUDED
+#define FAKE86_MACHINE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "config.h"
+#include "ports.h"
+#include "i8253.h"
+#include "i8259.h"
+#include "i8237.h"
+#include "disk.h"
+#include "timing.h"
+#include "video.h"
+
+/* A complete emulated PC: CPU, memory and the core devices which are
+   reachable from the CPU (I/O ports, PIT, PIC, DMA, video adapter, disks).
+   Every host thread has a current machine, which all the emulation code
+   works on (see machine_bind()). It is the main machine by default, which
+   is also the only one with a screen, input, audio and networking, and
+   the only one the JIT and KVM can run. Further machines are headless
+   and can be created by machine_create(), typically to run one of them
+   on each host thread, as -benchmachines does. What is not in here is
+   still single-instance and must only be used by the main machine: the
+   JIT (its translations address totalcycles and the PICs of the main
+   machine directly) and KVM state, the CPU profiler, the renderer and
+   the video palette/page state it works from, the sound devices (Sound
+   Blaster, Adlib, Disney Sound Source, speaker), the SDL front-end, the
+   network card and the disk cache flusher thread. */
+struct machine {
+	struct cpu_state	cpu;
+	uint64_t		totalexec;
+	uint64_t		totalcycles;	// 8088 clock cycles executed, see exec86_cycles()
+	uint64_t		cycle_limit;	// exec86() stops at this totalcycles value
+	int32_t			attention;	// instructions until exec86() must take its slow path, see machine_attention()
+	uint32_t		makeupticks;
+	uint16_t		last_int_seg, last_int_ip, last_int10ax;
+	uint16_t		trap_toggle;
+	uint8_t			running;
+	uint8_t			didbootstrap;
+	uint8_t			headless;	// no screen/input/audio, the sound devices schedule no events
+#ifdef USE_JIT
+	uint8_t			jit;		// executed with the help of the JIT translator
+#endif
+#ifdef USE_KVM
+	uint8_t			*RAM;
+#else
+	uint8_t			RAM[RAM_SIZE];
+#endif
+	uint8_t			readonly[RAM_SIZE];
+	struct mem_page		mem_pages[RAM_SIZE >> 12];
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	struct flowcache	flowcache;
+#endif
+	uint8_t			portram[0x10000];
+	io_write8_cb_t		port_write_callback  [0x10000];
+	io_read8_cb_t		port_read_callback   [0x10000];
+	io_write16_cb_t		port_write_callback16[0x10000];
+	io_read16_cb_t		port_read_callback16 [0x10000];
+	uint8_t			speakerenabled;
+	struct i8253_s		i8253;
+	struct structpic	i8259;
+	struct structpic	i8259slave;
+	struct i8237_s		i8237;
+	struct timing_s		timing;
+	struct video_s		video;
+	struct struct_drive	disk[256];
+	uint8_t			bootdrive, hdcount, fdcount;
+	uint8_t			lastdiskah[256], lastdiskcf[256];
+	int			bios_color, bios_x, bios_y;	// internal BIOS teletype output
+};
+
+extern struct machine machine_main;
+extern _Thread_local struct machine *machine;
+
+/* exec86() only does the work of its instruction prologue (timing, single
+   step trap, interrupt, halt) when the attention counter of the machine
+   drops below zero. It counts down to the next timing() call, and anything
+   which needs that work earlier forces it: raising or unmasking an IRQ,
+   setting IF or TF, HLT, clearing running. */
+#define machine_attention()	(machine->attention = -1)
+
+extern struct machine *machine_create  ( const struct machine *rom );
+extern void            machine_destroy ( struct machine *m );
+extern void            machine_bind    ( struct machine *m );
+extern void            machine_exec    ( struct machine *m, uint32_t execloops );
+
+/* The names of the per-machine state, all of them refer to the current
+   machine of the calling thread. The ones which would be common words
+   carry the machine_ prefix, the others keep their traditional names. */
+#define machine_cpu		(machine->cpu)
+#define machine_ram		(machine->RAM)
+#define machine_readonly	(machine->readonly)
+#define mem_pages		(machine->mem_pages)
+#define machine_running		(machine->running)
+#define makeupticks		(machine->makeupticks)
+#define totalexec		(machine->totalexec)
+#define totalcycles		(machine->totalcycles)
+#define cpu_last_int_seg	(machine->last_int_seg)
+#define cpu_last_int_ip		(machine->last_int_ip)
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+#define flowcache_hits		(machine->flowcache.hits)
+#define flowcache_misses	(machine->flowcache.misses)
+#define flowcache_invalidations	(machine->flowcache.invalidations)
+#endif
+#define portram			(machine->portram)
+#define speakerenabled		(machine->speakerenabled)
+#define i8253			(machine->i8253)
+#define i8259			(machine->i8259)
+#define i8259slave		(machine->i8259slave)
+#define machine_disk		(machine->disk)
+#define bootdrive		(machine->bootdrive)
+#define hdcount			(machine->hdcount)
+#define fdcount			(machine->fdcount)
+#define VRAM			(machine->video.VRAM)
+#define vidmode			(machine->video.vidmode)
+#define cgabg			(machine->video.cgabg)
+#define blankattr		(machine->video.blankattr)
+#define vidgfxmode		(machine->video.vidgfxmode)
+#define vidcolor		(machine->video.vidcolor)
+#define cursx			(machine->video.cursx)
+#define cursy			(machine->video.cursy)
+#define machine_cols		(machine->video.cols)
+#define machine_rows		(machine->video.rows)
+#define cursorposition		(machine->video.cursorposition)
+#define cursorvisible		(machine->video.cursorvisible)
+#define updatedscreen		(machine->video.updatedscreen)
+#define clocksafe		(machine->video.clocksafe)
+#define port3da			(machine->video.port3da)
+#define port6			(machine->video.port6)
+#define VGA_SC			(machine->video.VGA_SC)
+#define VGA_CRTC		(machine->video.VGA_CRTC)
+#define VGA_ATTR		(machine->video.VGA_ATTR)
+#define VGA_GC			(machine->video.VGA_GC)
+#define videobase		(machine->video.videobase)
+#define textbase		(machine->video.textbase)
+#define palettevga		(machine->video.palettevga)
+#define vtotal			(machine->video.vtotal)
+
+#endif
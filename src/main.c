@@ -58,19 +58,60 @@
 #include "parsecl.h"
 #include "sndsource.h"
 #include "blaster.h"
+#include "snapshot.h"
+#include "fanout.h"
+#include "diskcache.h"
 #include "sermouse.h"
 #include "input.h"
 #include "bios.h"
+#include "profiler.h"
 #ifdef NETWORKING_ENABLED
 #	include "packet.h"
 #endif
 #ifdef USE_KVM
 #	include "kvm.h"
 #endif
+#ifdef USE_JIT
+#	include "jit.h"
+#endif
 
 static uint64_t starttick, endtick;
 
 
+static void print_stdout ( const char *s )
+{
+	fputs(s, stdout);
+}
+
+
+// The statistics of the CPU emulator, printed at exit
+static void cpu_statistics ( void )
+{
+#ifdef CPU_PROFILER
+	prof_report(print_stdout);
+#endif
+#ifdef CPU_ADDR_MODE_CACHE
+	printf("\n  Cached modregrm data access count: %lu\n", (long unsigned int)cached_access_count);
+	printf("Uncached modregrm data access count: %lu\n", (long unsigned int)uncached_access_count);
+#endif
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+	printf("\nFlow cache block lookup hits: %lu, misses: %lu, page invalidations: %lu\n", (long unsigned int)flowcache_hits, (long unsigned int)flowcache_misses, (long unsigned int)flowcache_invalidations);
+#endif
+#ifdef CPU_SUPERINSTRUCTIONS
+	printf("Fused instruction pairs:");
+	for (int i = 0; i < FUSE_KINDS; i++) {
+		const uint64_t pairs = machine->flowcache.pairs[i], fused = machine->flowcache.fused[i];
+		printf(" %s %lu/%lu (%.1f%%)", cpu_fusion_names[i], (long unsigned int)fused, (long unsigned int)pairs, pairs ? 100.0 * fused / pairs : 0.0);
+	}
+	printf("\n");
+#endif
+#ifdef USE_JIT
+	if (usejit)
+		printf("JIT: %lu blocks translated, %lu instructions executed as native code.\n", (long unsigned int)jit_translations, (long unsigned int)jit_executed);
+#endif
+}
+
+
 #ifdef DO_NOT_FORCE_UNREACHABLE
 void UNREACHABLE_FATAL_ERROR ( void )
 {
@@ -86,9 +127,9 @@ static uint32_t loadbios ( const char *filename )
 	int readsize = hostfs_load_binary(filename, bios, 1, 0x10000, "BIOS");
 	if (readsize <= 0)
 		return 0;
-	memcpy(RAM + 0x100000 - readsize, bios, readsize);
+	memcpy(machine_ram + 0x100000 - readsize, bios, readsize);
 	printf("BIOS %s loaded at 0x%05X (%d KB)\n", filename, 0x100000 - readsize, readsize >> 10);
-	memset(readonly + 0x100000 - readsize, 1, readsize);
+	memset(machine_readonly + 0x100000 - readsize, 1, readsize);
 	return readsize;
 }
 
@@ -133,6 +174,8 @@ static int inithardware( void )
 	if (doaudio)
 		initaudio();
 	inittiming();
+	if (benchmode)
+		return initscreen_offscreen();
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | (doaudio ? SDL_INIT_AUDIO : 0)))
 		return sdl_error("Cannot initialize SDL2");
 	if (initscreen(FAKE86_RELEASE_STRING))
@@ -147,11 +190,11 @@ static int EmuThread(void *ptr)
 	puts("CPU: starting to execute.");
 #ifdef USE_KVM
 	if (usekvm)
-		while (running) {
+		while (machine_running) {
 			cpu_regs_to_kvm();
 			if (kvm_run()) {
 				fprintf(stderr, "FATAL ERROR: exiting because of KVM problem.\n");
-				running = 0;
+				machine_running = 0;
 				break;
 			}
 			cpu_regs_from_kvm();
@@ -178,8 +221,8 @@ static int EmuThread(void *ptr)
 					// cpu_hlt_handler() is designed for the software x86 emulation
 					// it expects the saveip (!) of the HLT, but it seems we passed it already with KVM, let's decrement IP ;)
 					// And also populate it as 'saveip' what bios.c uses by cpu_hlt_handler()
-					cpu.ip--;
-					cpu.saveip = cpu.ip;
+					machine_cpu.ip--;
+					machine_cpu.saveip = machine_cpu.ip;
 					if (cpu_hlt_handler() == 0) {	// Fake86 bios internal trap! :)
 						continue;
 					}
@@ -187,16 +230,22 @@ static int EmuThread(void *ptr)
 					break;
 			}
 			printf("KVM is not ready yet :(\n");
-			running = 0;
+			machine_running = 0;
 			break;
 		}
 	else
 #endif
-	while (running) {
-		if (!speed)
+	while (machine_running) {
+		if (cpuclock) {
+			// 10 ms slices of machine time, paced to the host clock
+			exec86_cycles(cpuclock / 100);
+			timing_pace();
+		} else if (!speed) {
 			exec86(10000);
-		else {
+			timing_pace();
+		} else {
 			exec86(speed / 100);
+			timing_pace();
 			while (!audiobufferfilled()) {
 				timing();
 				tickaudio();
@@ -213,11 +262,183 @@ static int EmuThread(void *ptr)
 			reset86();
 			dohardreset = 0;
 		}
+		snapshot_handle_request();
 	}
 	return 0;
 }
 
 
+static uint64_t ram_checksum ( void )
+{
+	uint64_t checksum = 14695981039346656037ULL;	// FNV-1a
+	for (uint32_t i = 0; i < RAM_SIZE; i++) {
+		checksum ^= machine_ram[i];
+		checksum *= 1099511628211ULL;
+	}
+	return checksum;
+}
+
+
+// -benchmachines: the further machines of -bench, each of them on its own thread
+struct benchmachine {
+	struct machine	*m;
+	SDL_Thread	*thread;
+	uint64_t	hostticks;
+};
+
+
+// Runs a further machine for the same budget as the main one, without frames
+static int benchmachine_thread ( void *ptr )
+{
+	struct benchmachine *b = ptr;
+	machine_bind(b->m);
+	const uint64_t clock = cpuclock ? cpuclock : DEFAULT_CPU_CLOCK;
+	const uint64_t endexec = totalexec + benchinsns, endcycles = totalcycles + (uint64_t)(benchsecs * clock);
+	const uint64_t start = SDL_GetPerformanceCounter();
+	while (machine_running) {
+		if (benchinsns) {
+			if (totalexec >= endexec)
+				break;
+			const uint64_t left = endexec - totalexec;
+			exec86(left < 10000 ? (uint32_t)left : 10000);
+		} else {
+			if (totalcycles >= endcycles)
+				break;
+			const uint64_t left = endcycles - totalcycles;
+			exec86_cycles(left < clock / 50 ? (uint32_t)left : (uint32_t)(clock / 50));
+		}
+	}
+	b->hostticks = SDL_GetPerformanceCounter() - start;
+	return 0;
+}
+
+
+// Creates the further machines with the ROM and the disks of the main one,
+// and starts them. The disks of all the machines become private, so none
+// of them sees the writes of the others.
+static struct benchmachine *benchmachines_start ( void )
+{
+	struct benchmachine *b = calloc(benchmachines, sizeof(struct benchmachine));
+	const uint8_t boot = bootdrive;
+	if (!b)
+		return NULL;
+	for (unsigned int i = 0; i < benchmachines; i++) {
+		if (!(b[i].m = machine_create(&machine_main)))
+			return NULL;
+		b[i].m->timing.virtualtime = 1;
+		machine_bind(b[i].m);
+		for (int d = 0; d < 256; d++)
+			if (machine_main.disk[d].inserted && insertdisk(d, machine_main.disk[d].filename))
+				return NULL;
+		bootdrive = boot;
+		disk_make_private();
+		reset86();
+	}
+	machine_bind(&machine_main);
+	disk_make_private();
+	for (unsigned int i = 0; i < benchmachines; i++)
+		if (!(b[i].thread = SDL_CreateThread(benchmachine_thread, "Fake86BenchMachine", &b[i])))
+			return NULL;
+	return b;
+}
+
+
+// Waits for the further machines, and prints their results
+static void benchmachines_finish ( struct benchmachine *b )
+{
+	const uint64_t freq = SDL_GetPerformanceFrequency();
+	for (unsigned int i = 0; i < benchmachines; i++) {
+		SDL_WaitThread(b[i].thread, NULL);
+		machine_bind(b[i].m);
+		printf("BENCH: machine %u: %llu instructions, %llu clock cycles, %.3f seconds of host time, RAM checksum: %016llx\n",
+			i + 1, (unsigned long long)totalexec, (unsigned long long)totalcycles,
+			(double)b[i].hostticks / freq, (unsigned long long)ram_checksum());
+		for (int d = 0; d < 256; d++)
+			ejectdisk(d);
+		machine_destroy(b[i].m);
+	}
+	machine_bind(&machine_main);
+	free(b);
+}
+
+
+// -bench: runs the machine on this thread for the given number of instructions
+// or seconds of machine time, drawing a frame into memory for every 20 ms of
+// the machine time, then prints the results
+static int benchmark ( void )
+{
+	const uint64_t clock = cpuclock ? cpuclock : DEFAULT_CPU_CLOCK;
+	const uint64_t framecycles = clock / 50;
+	const uint64_t freq = SDL_GetPerformanceFrequency();
+	const uint64_t startexec = totalexec, startcycles = totalcycles;
+	const uint64_t endexec = startexec + benchinsns, endcycles = startcycles + (uint64_t)(benchsecs * clock);
+	uint64_t cputime = 0, videotime = 0, nextframe = startcycles + framecycles;
+	struct benchmachine *others = NULL;
+	if (benchmachines && !(others = benchmachines_start())) {
+		fprintf(stderr, "BENCH: cannot start the further machines\n");
+		return 1;
+	}
+	memset(machine->timing.account, 0, sizeof(machine->timing.account));
+	machine->timing.accounting = 1;
+	if (benchinsns)
+		printf("BENCH: running %llu instructions\n", (unsigned long long)benchinsns);
+	else
+		printf("BENCH: running %.3f seconds of machine time\n", benchsecs);
+	const uint64_t start = SDL_GetPerformanceCounter();
+	while (machine_running) {
+		const uint64_t t0 = SDL_GetPerformanceCounter();
+		if (benchinsns) {
+			if (totalexec >= endexec)
+				break;
+			const uint64_t left = endexec - totalexec;
+			exec86(left < 10000 ? (uint32_t)left : 10000);
+		} else {
+			if (totalcycles >= endcycles)
+				break;
+			const uint64_t left = (nextframe < endcycles ? nextframe : endcycles) - totalcycles;
+			exec86_cycles((uint32_t)left);
+		}
+		const uint64_t t1 = SDL_GetPerformanceCounter();
+		cputime += t1 - t0;
+		if (totalcycles >= nextframe) {
+			render_frame();
+			videotime += SDL_GetPerformanceCounter() - t1;
+			while (nextframe <= totalcycles)
+				nextframe += framecycles;
+		}
+		if (dohardreset) {
+			reset86();
+			dohardreset = 0;
+		}
+	}
+	const double hosttime = (double)(SDL_GetPerformanceCounter() - start) / freq;
+	machine->timing.accounting = 0;
+	// the events, port handlers and disk services ran within the CPU time
+	const double eventtime = (double)machine->timing.account[TIMING_ACCOUNT_EVENTS] / hostfreq;
+	const double porttime = (double)machine->timing.account[TIMING_ACCOUNT_PORTS] / hostfreq;
+	const double disktime = (double)machine->timing.account[TIMING_ACCOUNT_DISK] / hostfreq;
+	double cpuonly = (double)cputime / freq - eventtime - porttime - disktime;
+	if (cpuonly < 0)
+		cpuonly = 0;
+	const uint64_t insns = totalexec - startexec, cycles = totalcycles - startcycles;
+	const uint64_t checksum = ram_checksum();
+	printf("\nBENCH: %llu instructions, %llu clock cycles, %.3f seconds of machine time at %.2f MHz\n",
+		(unsigned long long)insns, (unsigned long long)cycles, (double)cycles / clock, clock / 1000000.0);
+	printf("BENCH: %.3f seconds of host time, CPU: %.3f s, device events: %.3f s, ports: %.3f s, disk: %.3f s, video: %.3f s (%llu frames)\n",
+		hosttime, cpuonly, eventtime, porttime, disktime, (double)videotime / freq, (unsigned long long)totalframes);
+	printf("BENCH: %.2f MIPS, %.2f times the real time\n",
+		insns / hosttime / 1000000.0, (double)cycles / clock / hosttime);
+	printf("BENCH: RAM checksum: %016llx\n", (unsigned long long)checksum);
+	if (others)
+		benchmachines_finish(others);
+	cpu_statistics();
+	diskcache_report(print_stdout);
+	if (savestatefile && snapshot_save(savestatefile))
+		return 1;
+	return fanout_status;
+}
+
+
 int main ( int argc, char *argv[] )
 {
 	puts(FAKE86_BANNER_STRING);
@@ -229,29 +450,42 @@ int main ( int argc, char *argv[] )
 	if (hostfs_init())
 		return -1;
 	parsecl(argc, argv);
+	if (benchmode) {
+		// no window, audio or input, and a machine time independent from the host
+		doaudio = 0;
+		machine->headless = 1;
+		machine->timing.virtualtime = 1;
+	}
 #ifdef USE_KVM
 	if (!usekvm) {
-		RAM = SDL_malloc(RAM_SIZE);
-		if (!RAM) {
+		machine_ram = SDL_malloc(RAM_SIZE);
+		if (!machine_ram) {
 			fprintf(stderr, "Cannot allocate memory!\n");
 			return -1;
 		}
-		printf("MEM: allocated system memory (%uK) at %p for software CPU\n", (RAM_SIZE >> 10), RAM);
+		printf("MEM: allocated system memory (%uK) at %p for software CPU\n", (RAM_SIZE >> 10), machine_ram);
 	} else {
 		if (kvm_init(RAM_SIZE)) {
 			fprintf(stderr, "Cannot initialize KVM!\n");
 			return -1;
 		}
-		RAM = kvm.mem;
-		printf("MEM: allocated system memory (%uK) at %p via mmap() for KVM\n", (RAM_SIZE >> 10), RAM);
+		machine_ram = kvm.mem;
+		printf("MEM: allocated system memory (%uK) at %p via mmap() for KVM\n", (RAM_SIZE >> 10), machine_ram);
 		//fprintf(stderr, "KVM: yet unimplemented...\n");
 		//return -1;
 	}
 #else
 	printf("MEM: using static memory (%uK) for software CPU\n", (RAM_SIZE >> 10));
 #endif
-	memset(readonly, 0, RAM_SIZE);
-	memset(RAM, 0, RAM_SIZE);
+#ifdef USE_JIT
+	if (usejit && jit_init()) {
+		fprintf(stderr, "WARNING: JIT cannot be initialized, using the interpreter only.\n");
+		usejit = 0;
+	}
+	machine->jit = usejit;
+#endif
+	memset(machine_readonly, 0, RAM_SIZE);
+	memset(machine_ram, 0, RAM_SIZE);
 	if (!internalbios) {
 		uint32_t biossize = loadbios(biosfile);
 		if (!biossize)
@@ -262,7 +496,7 @@ int main ( int argc, char *argv[] )
 				return -1;
 		}
 	} else {
-		memset(readonly + 0xC0000, 1, 0x40000);
+		memset(machine_readonly + 0xC0000, 1, 0x40000);
 		bios_internal_install();
 	}
 #ifdef DISK_CONTROLLER_ATA
@@ -270,7 +504,7 @@ int main ( int argc, char *argv[] )
 		return -1;
 #endif
 	printf("\nInitializing CPU... ");
-	running = 1;
+	machine_running = 1;
 	reset86();
 	puts("OK!");
 #if !defined(_WIN32) && !defined(__APPLE__) && defined(USE_XINITTHREADS)
@@ -278,6 +512,13 @@ int main ( int argc, char *argv[] )
 #endif
 	if (inithardware())
 		return -1;
+	if (loadstatefile) {
+		if (snapshot_load(loadstatefile))
+			return -1;
+		fanout_start();	// the snapshot is the ready point
+	}
+	if (benchmode)
+		return benchmark();
 #ifdef _WIN32
 	initmenus();
 	//InitializeCriticalSection(&screenmutex);
@@ -287,12 +528,13 @@ int main ( int argc, char *argv[] )
 			fprintf(stderr, "WARNING: console thread cannot be created, console will be unavailable: %s\n", SDL_GetError());
 		}
 	}
-	if (!SDL_CreateThread(EmuThread, "Fake86EmuThread", NULL)) {
+	SDL_Thread *emuthread = SDL_CreateThread(EmuThread, "Fake86EmuThread", NULL);
+	if (!emuthread) {
 		fprintf(stderr, "Could not create the main emuthread: %s\n", SDL_GetError());
 		return -1;
 	}
-	lasttick = starttick = SDL_GetTicks();
-	while (running) {
+	starttick = SDL_GetTicks();
+	while (machine_running) {
 		handleinput();
 #ifdef NETWORKING_ENABLED
 		if (ethif < 254)
@@ -304,6 +546,10 @@ int main ( int argc, char *argv[] )
 		usleep(1000);
 #endif
 	}
+	if (savestatefile) {
+		SDL_WaitThread(emuthread, NULL);	// the machine must be stopped between two instructions
+		snapshot_save(savestatefile);
+	}
 	endtick = (SDL_GetTicks() - starttick) / 1000;
 	if (endtick == 0)
 		endtick = 1; //avoid divide-by-zero exception in the code below, if ran for less than 1 second
@@ -314,10 +560,9 @@ int main ( int argc, char *argv[] )
 	}
 	printf("\n%lu instructions executed in %lu seconds.\n", (long unsigned int)totalexec, (long unsigned int)endtick);
 	printf("Average speed: %lu instructions/second.\n", (long unsigned int)(totalexec / endtick));
-#ifdef CPU_ADDR_MODE_CACHE
-	printf("\n  Cached modregrm data access count: %lu\n", (long unsigned int)cached_access_count);
-	printf("Uncached modregrm data access count: %lu\n", (long unsigned int)uncached_access_count);
-#endif
+	printf("%llu clock cycles executed, effective clock: %.2f MHz\n", (unsigned long long)totalcycles, (double)totalcycles / endtick / 1000000.0);
+	cpu_statistics();
+	diskcache_report(print_stdout);
 	if (useconsole)
 		exit(0); //makes sure console thread quits even if blocking
 	return 0;
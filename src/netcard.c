@@ -52,7 +52,7 @@ void nethandler( void ) {
 			if (verbose) {
 				printf ("Sending packet of %u bytes.\n", regs.wordregs[regcx]);
 			}
-			sendpkt(&RAM[((uint32_t)segregs[regds] << 4) + (uint32_t)regs.wordregs[regsi]], regs.wordregs[regcx]);
+			sendpkt(&machine_ram[((uint32_t)segregs[regds] << 4) + (uint32_t)regs.wordregs[regsi]], regs.wordregs[regcx]);
 			return;
 		case 0x02: //return packet info (packet buffer in DS:SI, length in CX)
 			segregs[regds] = 0xD000;
@@ -60,7 +60,10 @@ void nethandler( void ) {
 			regs.wordregs[regcx] = net.pktlen;
 			return;
 		case 0x03: //copy packet to final destination (given in ES:DI)
-			memcpy(&RAM[((uint32_t)segregs[reges] << 4) + (uint32_t)regs.wordregs[regdi]], &RAM[0xD0000], net.pktlen);
+			memcpy(&machine_ram[((uint32_t)segregs[reges] << 4) + (uint32_t)regs.wordregs[regdi]], &machine_ram[0xD0000], net.pktlen);
+#ifdef CPU_INSTRUCTION_FLOW_CACHE
+			cpu_flowcache_invalidate(((uint32_t)segregs[reges] << 4) + (uint32_t)regs.wordregs[regdi], net.pktlen);
+#endif
 			return;
 		case 0x04: //disable packets
 			net.enabled = 0;
@@ -68,7 +71,7 @@ void nethandler( void ) {
 			return;
 		case 0x05: //DEBUG: dump packet (DS:SI) of CX bytes to stdout
 			for (int i = 0; i < regs.wordregs[regcx]; i++) {
-				printf("%c", RAM[((uint32_t)segregs[regds] << 4) + (uint32_t)regs.wordregs[regsi] + i]);
+				printf("%c", machine_ram[((uint32_t)segregs[regds] << 4) + (uint32_t)regs.wordregs[regsi] + i]);
 			}
 			return;
 		case 0x06: //DEBUG: print milestone string
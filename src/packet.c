@@ -131,7 +131,7 @@ void initpcap(void) {
 }
 
 static void setmac(void) {
-	memcpy(&RAM[0xE0000], &maclocal[0], 6);
+	memcpy(&machine_ram[0xE0000], &maclocal[0], 6);
 }
 
 #ifndef NETWORKING_OLDCARD
@@ -168,7 +168,7 @@ void dispatch(void) {
 	if (hdr->len==0) return;
 
 	net.canrecv = 0;
-	memcpy (&RAM[0xD0000], &pktdata[0], hdr->len);
+	memcpy (&machine_ram[0xD0000], &pktdata[0], hdr->len);
 	net.pktlen = (uint16_t) hdr->len;
 	if (verbose) {
 			printf ("Received packet of %u bytes.\n", net.pktlen);
@@ -37,6 +37,7 @@
 #include "packet.h"
 #include "hostfs.h"
 #include "bios.h"
+#include "diskcache.h"
 
 #ifndef _WIN32
 #define strcmpi strcasecmp
@@ -51,6 +52,21 @@ uint8_t slowsystem = 0;
 
 char *biosfile = NULL;
 uint32_t speed = 0;
+uint32_t cpuclock = 0;
+uint8_t fastforward = 0;
+uint8_t usetsc = 0;
+uint8_t slavepic = 0;
+uint8_t benchmode = 0;
+uint64_t benchinsns = 0;
+double benchsecs = 0;
+const char *loadstatefile = NULL;
+const char *savestatefile = NULL;
+unsigned int fanoutjobs = 0;
+unsigned int benchmachines = 0;
+const char *fanoutlog = "job";
+uint32_t diskcachesize = DISKCACHE_DEFAULT_KB;
+uint8_t diskwritethrough = 0;
+uint32_t diskreadahead = DISKCACHE_DEFAULT_READAHEAD;
 uint8_t verbose = 0;
 uint8_t useconsole = 0;
 // uint8_t cgaonly = 0;
@@ -58,6 +74,9 @@ uint8_t usessource = 0;
 #ifdef USE_KVM
 int usekvm = 0;
 #endif
+#ifdef USE_JIT
+int usejit = 0;
+#endif
 
 
 static uint32_t hextouint(char *src) {
@@ -98,6 +117,9 @@ static void showhelp ( void )
 #ifdef USE_KVM
 		"  -kvm             Try to use KVM (WIP!)\n"
 #endif
+#ifdef USE_JIT
+		"  -jit             Translate hot code to native x86-64 code.\n"
+#endif
 #ifdef NETWORKING_ENABLED
 #ifdef _WIN32
 		"  -net #           Enable ethernet emulation via winpcap, where # is the\n"
@@ -107,6 +129,35 @@ static void showhelp ( void )
 		"                   numeric ID of your host's network interface to bridge.\n"
 		"                   To get a list of possible interfaces, use -net list\n"
 #endif
+		"  -mhz #           Run the CPU at the given clock in MHz, as estimated by the\n"
+		"                   8088 cycle table. Example: -mhz 4.77 for an IBM PC.\n"
+		"  -fastforward     Skip the time the CPU is halted (HLT) instead of waiting\n"
+		"                   for the next timer tick, for batch runs.\n"
+		"  -tsc             Pace the machine with the time stamp counter of the host\n"
+		"                   CPU (x86-64 with an invariant TSC only), which is cheaper\n"
+		"                   to read than the monotonic clock of the system.\n"
+		"  -slavepic        Add the slave 8259 interrupt controller of an AT at A0h,\n"
+		"                   for IRQ 8-15 (vectors 70h-77h).\n"
+		"  -bench #         Run # instructions (or # seconds of machine time, with an\n"
+		"                   s suffix, like -bench 30s) without a window, audio or\n"
+		"                   input, then exit with the speed and a checksum of the RAM.\n"
+		"                   The machine time follows the executed cycles, so the\n"
+		"                   runs are repeatable.\n"
+		"  -loadstate file  Resume the machine from a snapshot saved by -savestate.\n"
+		"  -savestate file  Save a snapshot of the machine into the file at exit.\n"
+		"  -fanout #        With -bench, fork # jobs from the machine when the guest\n"
+		"                   reaches its ready point (or after -loadstate), each of them\n"
+		"                   with private disks. See fanout.c for the guest interface.\n"
+		"  -fanoutlog pfx   The output of job # goes into file pfx#.log (default: job)\n"
+		"  -benchmachines # With -bench, run # more headless machines at the same time,\n"
+		"                   each on its own thread, booting from the same ROM and disks\n"
+		"                   (the sectors written by any machine are kept in memory).\n"
+		"                   They have the core devices only, no sound cards or JIT.\n"
+		"  -diskcache #     Size of the write-back cache of each disk image, in Kbytes\n"
+		"                   (default: 1024), 0 writes the images directly.\n"
+		"  -diskwritethrough  Write every sector into the image file immediately.\n"
+		"  -diskreadahead #  Number of cylinders to read ahead in the background of\n"
+		"                   sequential disk reads (default: 1), 0 disables it.\n"
 		"  -nosound         Disable audio emulation and output.\n"
 		"  -fullscreen      Start Fake86 in fullscreen mode.\n"
 		"  -verbose         Verbose mode. Operation details will be written to stdout.\n"
@@ -141,7 +192,7 @@ static void showhelp ( void )
 
 uint32_t loadrom ( uint32_t addr32, const char *filename, uint8_t failure_fatal )
 {
-	int readsize = hostfs_load_binary(filename, RAM + addr32, 1, 0x10000, "ROM");
+	int readsize = hostfs_load_binary(filename, machine_ram + addr32, 1, 0x10000, "ROM");
 	if (readsize <= 0) {
 		if (failure_fatal)
 			fprintf(stderr, "FATAL: Unable to load %s\n", filename);
@@ -169,6 +220,15 @@ void parsecl ( int argc, char *argv[] )
 	ethif = 254;
 	usefullscreen = 0;
 	biosfile = DEFAULT_BIOS_FILE;
+	// the disk cache options are needed already when the disks are attached below
+	for (int i = 1; i < argc; i++) {
+		if (!strcmpi(argv[i], "-diskcache") && i < argc - 1)
+			diskcachesize = (uint32_t)atol(argv[++i]);
+		else if (!strcmpi(argv[i], "-diskwritethrough"))
+			diskwritethrough = 1;
+		else if (!strcmpi(argv[i], "-diskreadahead") && i < argc - 1)
+			diskreadahead = (uint32_t)atol(argv[++i]);
+	}
 	for (int i = 1; i < argc; i++) {
 		if (!strcmpi(argv[i], "-h") || !strcmpi(argv[i], "-?") || !strcmpi(argv[i], "-help")) {
 			showhelp();
@@ -219,11 +279,45 @@ void parsecl ( int argc, char *argv[] )
 		} else if (!strcmpi(argv[i], "-resh")) {
 			i++;
 			constanth = (uint16_t)atoi(argv[i]);
+		} else if (!strcmpi(argv[i], "-mhz")) {
+			i++;
+			cpuclock = (uint32_t)(atof(argv[i]) * 1000000.0);
+		} else if (!strcmpi(argv[i], "-bench")) {
+			i++;
+			benchmode = 1;
+			char *end;
+			const double n = strtod(argv[i], &end);
+			if (*end == 's' || *end == 'S')
+				benchsecs = n;
+			else
+				benchinsns = (uint64_t)n;
+			if (n <= 0) {
+				fprintf(stderr, "FATAL: Invalid -bench budget: %s\n", argv[i]);
+				exit(1);
+			}
+		} else if (!strcmpi(argv[i], "-loadstate")) {
+			loadstatefile = argv[++i];
+		} else if (!strcmpi(argv[i], "-savestate")) {
+			savestatefile = argv[++i];
+		} else if (!strcmpi(argv[i], "-fanout")) {
+			i++;
+			fanoutjobs = (unsigned int)atoi(argv[i]);
+		} else if (!strcmpi(argv[i], "-fanoutlog")) {
+			fanoutlog = argv[++i];
+		} else if (!strcmpi(argv[i], "-benchmachines")) {
+			i++;
+			benchmachines = (unsigned int)atoi(argv[i]);
+		} else if (!strcmpi(argv[i], "-diskcache") || !strcmpi(argv[i], "-diskreadahead")) {
+			i++;	// see above
 		} else if (!strcmpi(argv[i], "-speed")) {
 			i++;
 			speed = (uint32_t)atol(argv[i]);
 		} else if (!strcmpi(argv[i], "-noscale"))	noscale = 1;
 		else if (!strcmpi(argv[i], "-verbose"))		verbose = 1;
+		else if (!strcmpi(argv[i], "-fastforward"))	fastforward = 1;
+		else if (!strcmpi(argv[i], "-tsc"))		usetsc = 1;
+		else if (!strcmpi(argv[i], "-slavepic"))	slavepic = 1;
+		else if (!strcmpi(argv[i], "-diskwritethrough"))	;	// see above
 		else if (!strcmpi(argv[i], "-smooth"))		nosmooth = 0;
 		else if (!strcmpi(argv[i], "-fps"))		renderbenchmark = 1;
 		else if (!strcmpi(argv[i], "-nosound"))		doaudio = 0;
@@ -234,6 +328,9 @@ void parsecl ( int argc, char *argv[] )
 		else if (!strcmpi(argv[i], "-internalbios"))	internalbios = 1;
 #ifdef USE_KVM
 		else if (!strcmpi(argv[i], "-kvm"))		usekvm = 1;
+#endif
+#ifdef USE_JIT
+		else if (!strcmpi(argv[i], "-jit"))		usejit = 1;
 #endif
 		else if (!strcmpi(argv[i], "-oprom")) {
 			i++;
@@ -244,10 +341,18 @@ void parsecl ( int argc, char *argv[] )
 			exit (1);
 		}
 	}
+	if (fanoutjobs && !benchmode) {
+		fprintf(stderr, "FATAL: -fanout needs -bench, the jobs run without a window\n");
+		exit(1);
+	}
+	if (benchmachines && (!benchmode || fanoutjobs)) {
+		fprintf(stderr, "FATAL: -benchmachines needs -bench, and cannot be used with -fanout\n");
+		exit(1);
+	}
 	if (bootdrive == 254) {
-		if (disk[0x80].inserted)
+		if (machine_disk[0x80].inserted)
 			bootdrive = 0x80;
-		else if (disk[0x00].inserted)
+		else if (machine_disk[0x00].inserted)
 			bootdrive = 0;
 		else
 			bootdrive = 0xFF; //ROM BASIC fallback
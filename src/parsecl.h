@@ -28,12 +28,30 @@ extern uint16_t constantw;
 extern uint8_t slowsystem;
 extern char *biosfile;
 extern uint32_t speed;
+extern uint32_t cpuclock;
+extern uint8_t fastforward;
+extern uint8_t usetsc;
+extern uint8_t slavepic;
+extern uint8_t benchmode;
+extern uint64_t benchinsns;
+extern double benchsecs;
+extern const char *loadstatefile;
+extern const char *savestatefile;
+extern unsigned int fanoutjobs;
+extern const char *fanoutlog;
+extern unsigned int benchmachines;
+extern uint32_t diskcachesize;
+extern uint8_t diskwritethrough;
+extern uint32_t diskreadahead;
 extern uint8_t verbose;
 extern uint8_t useconsole;
 extern uint8_t usessource;
 #ifdef USE_KVM
 extern int usekvm;
 #endif
+#ifdef USE_JIT
+extern int usejit;
+#endif
 
 extern uint8_t dohardreset;
 
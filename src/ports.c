@@ -28,17 +28,16 @@
 #include "ports.h"
 
 #include "cpu.h"
+#include "i8253.h"
 #include "speaker.h"
+#include "timing.h"
 
 //#define DEBUG_PORT_TRAFFIC
 
-uint8_t portram[0x10000];
-
-
-static io_write8_cb_t  port_write_callback  [0x10000];
-static io_read8_cb_t   port_read_callback   [0x10000];
-static io_write16_cb_t port_write_callback16[0x10000];
-static io_read16_cb_t  port_read_callback16 [0x10000];
+#define port_write_callback	(machine->port_write_callback)
+#define port_read_callback	(machine->port_read_callback)
+#define port_write_callback16	(machine->port_write_callback16)
+#define port_read_callback16	(machine->port_read_callback16)
 
 
 
@@ -84,7 +83,7 @@ void ports_init ( void )
 }
 
 
-void portout (uint16_t portnum, uint8_t value)
+static void portout_device (uint16_t portnum, uint8_t value)
 {
 #ifdef DEBUG_PORT_TRAFFIC
 	printf("IO: writing BYTE port %Xh with data %02Xh\n", portnum, value);
@@ -97,23 +96,25 @@ void portout (uint16_t portnum, uint8_t value)
 				speakerenabled = 1;
 			else
 				speakerenabled = 0;
+			i8253_gate(2, value & 1);
 			return;
 	}
 	port_write_callback[portnum](portnum, value);
 }
 
 
-uint8_t portin (uint16_t portnum)
+static uint8_t portin_device (uint16_t portnum)
 {
 #ifdef DEBUG_PORT_TRAFFIC
 	printf("IO: reading BYTE port %Xh\n", portnum);
 #endif
 	//if (verbose) printf("portin(0x%X);\n", portnum);
 	switch (portnum) {
-		case 0x62:
-			return 0x00;
+		case 0x61:	// the OUT of PIT channel 2 in bit 5, like on an AT
+			return (portram[0x61] & ~0x20) | (i8253_out(2) << 5);
+		case 0x62:	// and the same on the XT
+			return i8253_out(2) << 5;
 		case 0x60:
-		case 0x61:
 		case 0x63:
 		case 0x64:
 			return portram[portnum];
@@ -122,6 +123,24 @@ uint8_t portin (uint16_t portnum)
 }
 
 
+// The time of the device handlers is accounted here, the 16 bit accesses are sliced into these
+void portout (uint16_t portnum, uint8_t value)
+{
+	const uint64_t start = TIMING_ACCOUNT_START();
+	portout_device(portnum, value);
+	TIMING_ACCOUNT_STOP(TIMING_ACCOUNT_PORTS, start);
+}
+
+
+uint8_t portin (uint16_t portnum)
+{
+	const uint64_t start = TIMING_ACCOUNT_START();
+	const uint8_t value = portin_device(portnum);
+	TIMING_ACCOUNT_STOP(TIMING_ACCOUNT_PORTS, start);
+	return value;
+}
+
+
 void portout16 (uint16_t portnum, uint16_t value)
 {
 	port_write_callback16[portnum](portnum, value);
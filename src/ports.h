@@ -28,8 +28,6 @@ typedef uint8_t  (*io_read8_cb_t)   (uint16_t portnum);
 typedef void     (*io_write16_cb_t) (uint16_t portnum, uint16_t value);
 typedef uint16_t (*io_read16_cb_t)  (uint16_t portnum);
 
-extern uint8_t portram[0x10000];
-
 extern void set_port_write_redirector (uint16_t startport, uint16_t endport, io_write8_cb_t callback);
 extern void set_port_read_redirector (uint16_t startport, uint16_t endport, io_read8_cb_t callback);
 // Seems these are not used??
@@ -42,4 +40,6 @@ extern void portout16(uint16_t portnum, uint16_t value);
 extern void portout(uint16_t portnum, uint8_t value);
 extern void ports_init ( void );
 
+#include "machine.h"
+
 #endif
@@ -0,0 +1,286 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* profiler.c: optional execution profiler of the CPU emulator (see
+   CPU_PROFILER in config.h).
+
+   exec86() reports every instruction to prof_insn() after its prefixes and
+   opcode are fetched, which counts the opcode by its prefixes, and charges
+   the host time elapsed since the previous report to the class of the
+   previous instruction. Every PROF_SAMPLE_INTERVAL-th instruction address
+   goes into a histogram of the 1M linear address space. The time outside
+   of exec86() is not charged to anything, the time in translated code is
+   charged to the "JIT" class. All the data is process wide, and it's only
+   meaningful with one machine executing at a time. */
+
+#include "config.h"
+
+#ifdef CPU_PROFILER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "profiler.h"
+
+#define PROF_SAMPLE_INTERVAL	64	// must be a power of two
+#define PROF_TOP_OPCODES	24
+#define PROF_TOP_ADDRESSES	16
+
+enum {
+	PROF_ALU, PROF_TRANSFER, PROF_STACK, PROF_BRANCH, PROF_STRING, PROF_SHIFT,
+	PROF_MULDIV, PROF_IO, PROF_INTERRUPT, PROF_OTHER, PROF_JIT, PROF_CLASSES
+};
+
+static const char *const prof_class_names[PROF_CLASSES] = {
+	"ALU", "transfer", "stack", "branch", "string", "shift/rotate",
+	"mul/div", "I/O", "interrupt", "other", "JIT"
+};
+
+static uint64_t prof_count[0x100][4];	// by opcode, [segment override | REP prefix << 1]
+static uint64_t prof_mem[0x100];	// executions with a memory operand in ModR/M
+static uint64_t prof_class_count[PROF_CLASSES], prof_class_ns[PROF_CLASSES];
+static uint32_t prof_hits[0x100000];	// sampled linear addresses of the instructions
+static uint16_t prof_hits_cs[0x100000];	// the last CS seen by a sample at the linear address
+static uint8_t  prof_class[0x100];
+static uint64_t prof_last, prof_samples;
+static int      prof_current = PROF_OTHER, prof_inited = 0;
+
+
+static uint64_t prof_now ( void )
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER counter;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return (counter.QuadPart / freq.QuadPart) * 1000000000ULL + (counter.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+static int prof_classify ( uint8_t op )
+{
+	if (op < 0x40) {
+		switch (op & 7) {
+			case 6: case 7:	// PUSH/POP segment registers, or prefixes and the BCD adjust instructions
+				return op < 0x20 ? PROF_STACK : PROF_ALU;
+			default:
+				return PROF_ALU;
+		}
+	}
+	if (op < 0x50)
+		return PROF_ALU;	// INC, DEC
+	if (op < 0x62 || op == 0x68 || op == 0x6A || op == 0x8F || op == 0x9C || op == 0x9D || op == 0xC8 || op == 0xC9)
+		return PROF_STACK;
+	if (op == 0x69 || op == 0x6B || op == 0xD4 || op == 0xD5 || op == 0xF6 || op == 0xF7)
+		return PROF_MULDIV;
+	if ((op >= 0x6C && op <= 0x6F) || (op >= 0xA4 && op <= 0xA7) || (op >= 0xAA && op <= 0xAF))
+		return PROF_STRING;
+	if ((op >= 0x70 && op <= 0x7F) || (op >= 0xE0 && op <= 0xE3) || (op >= 0xE8 && op <= 0xEB) ||
+	    op == 0x9A || op == 0xC2 || op == 0xC3 || op == 0xCA || op == 0xCB || op == 0xFF)
+		return PROF_BRANCH;
+	if ((op >= 0x80 && op <= 0x85) || op == 0x98 || op == 0x99 || op == 0xA8 || op == 0xA9 || op == 0xFE ||
+	    op == 0xF5 || (op >= 0xF8 && op <= 0xFD))
+		return PROF_ALU;
+	if ((op >= 0x86 && op <= 0x8E) || (op >= 0x90 && op <= 0x97) || op == 0x9E || op == 0x9F ||
+	    (op >= 0xA0 && op <= 0xA3) || (op >= 0xB0 && op <= 0xBF) || (op >= 0xC4 && op <= 0xC7) || op == 0xD7)
+		return PROF_TRANSFER;
+	if (op == 0xC0 || op == 0xC1 || (op >= 0xD0 && op <= 0xD3))
+		return PROF_SHIFT;
+	if ((op >= 0xE4 && op <= 0xE7) || (op >= 0xEC && op <= 0xEF))
+		return PROF_IO;
+	if ((op >= 0xCC && op <= 0xCF) || op == 0xF4)
+		return PROF_INTERRUPT;
+	return PROF_OTHER;
+}
+
+
+void prof_reset ( void )
+{
+	if (!prof_inited) {
+		for (int op = 0; op < 0x100; op++)
+			prof_class[op] = prof_classify(op);
+		prof_inited = 1;
+	}
+	memset(prof_count, 0, sizeof prof_count);
+	memset(prof_mem, 0, sizeof prof_mem);
+	memset(prof_class_count, 0, sizeof prof_class_count);
+	memset(prof_class_ns, 0, sizeof prof_class_ns);
+	memset(prof_hits, 0, sizeof prof_hits);
+	prof_samples = 0;
+	prof_last = prof_now();
+}
+
+
+// Charges the host time since the last call to the current class, and switches to a new one
+static inline void prof_switch ( int class )
+{
+	const uint64_t now = prof_now();
+	prof_class_ns[prof_current] += now - prof_last;
+	prof_last = now;
+	prof_current = class;
+}
+
+
+void prof_insn ( uint8_t opcode, int reptype, int segoverride, uint16_t cs, uint16_t ip )
+{
+	// Without the flow cache, threaded dispatch reaches the prefix handlers,
+	// which report the byte after the prefix again.
+	switch (opcode) {
+		case 0x26: case 0x2E: case 0x36: case 0x3E: case 0xF2: case 0xF3:
+			return;
+	}
+	if (UNLIKELY(!prof_inited))
+		prof_reset();
+	prof_switch(prof_class[opcode]);
+	prof_class_count[prof_current]++;
+	prof_count[opcode][(segoverride ? 1 : 0) | (reptype ? 2 : 0)]++;
+	if (!(++prof_samples & (PROF_SAMPLE_INTERVAL - 1))) {
+		const uint32_t linear = (((uint32_t)cs << 4) + ip) & 0xFFFFF;
+		prof_hits[linear]++;
+		prof_hits_cs[linear] = cs;
+	}
+}
+
+
+void prof_memform ( uint8_t opcode )
+{
+	prof_mem[opcode]++;
+}
+
+
+void prof_enter ( void )
+{
+	prof_last = prof_now();
+}
+
+
+void prof_leave ( void )
+{
+	prof_switch(prof_current);
+}
+
+
+void prof_jit_begin ( void )
+{
+	prof_switch(PROF_JIT);
+}
+
+
+void prof_jit_end ( uint32_t executed )
+{
+	prof_class_count[PROF_JIT] += executed;
+}
+
+
+static uint64_t opcode_total ( int op )
+{
+	return prof_count[op][0] + prof_count[op][1] + prof_count[op][2] + prof_count[op][3];
+}
+
+
+void prof_report ( void (*print)(const char *line) )
+{
+	char line[256];
+	uint64_t total = 0, ns = 0;
+	for (int c = 0; c < PROF_CLASSES; c++) {
+		total += prof_class_count[c];
+		ns += prof_class_ns[c];
+	}
+	if (!total) {
+		print("Profiler: no instructions were executed yet.\n");
+		return;
+	}
+	snprintf(line, sizeof line, "\nProfiler: %llu instructions, %.3f seconds in exec86()\n", (unsigned long long)total, ns / 1e9);
+	print(line);
+	print("  class            count      %   host ms  ns/insn\n");
+	for (int c = 0; c < PROF_CLASSES; c++) {
+		if (!prof_class_count[c])
+			continue;
+		snprintf(line, sizeof line, "  %-12s %12llu %6.2f %9.1f %8.1f\n",
+			prof_class_names[c], (unsigned long long)prof_class_count[c],
+			100.0 * prof_class_count[c] / total, prof_class_ns[c] / 1e6,
+			prof_class_count[c] ? (double)prof_class_ns[c] / prof_class_count[c] : 0.0
+		);
+		print(line);
+	}
+	// Selection of the top opcodes, the table is small enough to do it the naive way
+	uint8_t done[0x100] = { 0 };
+	print("  opcode           count      %   seg:   rep:   memory operand:\n");
+	for (int n = 0; n < PROF_TOP_OPCODES; n++) {
+		int best = -1;
+		for (int op = 0; op < 0x100; op++)
+			if (!done[op] && opcode_total(op) && (best < 0 || opcode_total(op) > opcode_total(best)))
+				best = op;
+		if (best < 0)
+			break;
+		done[best] = 1;
+		const uint64_t count = opcode_total(best);
+		snprintf(line, sizeof line, "  %02X (%-12s) %12llu %6.2f %5.1f%% %5.1f%% %5.1f%%\n",
+			best, prof_class_names[prof_class[best]], (unsigned long long)count, 100.0 * count / total,
+			100.0 * (prof_count[best][1] + prof_count[best][3]) / count,
+			100.0 * (prof_count[best][2] + prof_count[best][3]) / count,
+			100.0 * prof_mem[best] / count
+		);
+		print(line);
+	}
+	// Hot addresses, one pass per entry over the histogram
+	uint64_t samples = 0;
+	for (uint32_t a = 0; a < 0x100000; a++)
+		samples += prof_hits[a];
+	if (!samples)
+		return;
+	snprintf(line, sizeof line, "  hot addresses (one sample per %d instructions, %llu samples):\n", PROF_SAMPLE_INTERVAL, (unsigned long long)samples);
+	print(line);
+	uint32_t prev = UINT32_MAX, prev_addr = 0;
+	for (int n = 0; n < PROF_TOP_ADDRESSES; n++) {
+		uint32_t best = 0, best_addr = 0;
+		for (uint32_t a = 0; a < 0x100000; a++) {
+			const uint32_t h = prof_hits[a];
+			// strictly ordered by (count desc, address asc) after the previous pick
+			if ((h < prev || (h == prev && a > prev_addr)) && (h > best || (h == best && best && a < best_addr))) {
+				best = h;
+				best_addr = a;
+			}
+		}
+		if (!best)
+			break;
+		snprintf(line, sizeof line, "  %04X:%04X %05X %10u %6.2f%%\n",
+			prof_hits_cs[best_addr], (best_addr - ((uint32_t)prof_hits_cs[best_addr] << 4)) & 0xFFFF,
+			best_addr, best, 100.0 * best / samples
+		);
+		print(line);
+		prev = best;
+		prev_addr = best_addr;
+	}
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_PROFILER_H_INCLUDED
+#define FAKE86_PROFILER_H_INCLUDED
+#include "config.h"
+#ifdef CPU_PROFILER
+
+#include <stdint.h>
+
+extern void prof_insn      ( uint8_t opcode, int reptype, int segoverride, uint16_t cs, uint16_t ip );
+extern void prof_memform   ( uint8_t opcode );
+extern void prof_enter     ( void );
+extern void prof_leave     ( void );
+extern void prof_jit_begin ( void );
+extern void prof_jit_end   ( uint32_t executed );
+extern void prof_reset     ( void );
+extern void prof_report    ( void (*print)(const char *line) );
+
+#endif
+#endif
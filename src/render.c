@@ -77,6 +77,7 @@ SDL_Window   *sdl_win = NULL;
 static SDL_Renderer *sdl_ren = NULL;
 static SDL_Texture  *sdl_tex = NULL;
 SDL_PixelFormat *sdl_pixfmt = NULL;
+static uint32_t *offscreen = NULL;	// pixels of the frames without a window, see initscreen_offscreen()
 
 int sdl_error ( const char *msg )
 {
@@ -154,6 +155,22 @@ int initscreen ( const char *ver )
 	return 0;
 }
 
+// Sets up rendering without a window (-bench): the frames are drawn into a
+// buffer in memory by render_frame(), and there is no video thread.
+int initscreen_offscreen ( void )
+{
+	offscreen = SDL_malloc(TEXTURE_WIDTH * TEXTURE_HEIGHT * 4);
+	if (!offscreen) {
+		fprintf(stderr, "FATAL: Cannot allocate memory for the offscreen frame buffer\n");
+		return -1;
+	}
+	if (initcga()) {
+		fprintf(stderr, "FATAL: Cannot initialize CGA subsystem\n");
+		return -1;
+	}
+	return 0;
+}
+
 //uint32_t prestretch[1024][1024];
 //uint32_t nw, nh; //native width and height, pre-stretching (i.e. 320x200 for mode 13h)
 static void createscalemap(void) {
@@ -185,13 +202,22 @@ static void createscalemap(void) {
 
 static void draw(void);
 
+// Draws a frame of the current screen on the calling thread (for the offscreen rendering)
+void render_frame ( void )
+{
+	if (regenscalemap)
+		createscalemap();
+	draw();
+	totalframes++;
+}
+
 static int VideoThread( void *ptr )
 {
 	uint32_t cursorprevtick, cursorcurtick, delaycalc;
 	cursorprevtick = SDL_GetTicks();
 	cursorvisible = 0;
 
-	while (running) {
+	while (machine_running) {
 		cursorcurtick = SDL_GetTicks();
 		if ( (cursorcurtick - cursorprevtick) >= 250) {
 			updatedscreen = 1;
@@ -296,7 +322,10 @@ static uint32_t *start_pixel_access ( int nw, int nh )
 		exit(1);
 	}
 	void *pixels;
-	if (SDL_LockTexture(sdl_tex, &pia.rect, &pixels, &pia.texture_pitch))
+	if (offscreen) {
+		pixels = offscreen;
+		pia.texture_pitch = TEXTURE_WIDTH * 4;
+	} else if (SDL_LockTexture(sdl_tex, &pia.rect, &pixels, &pia.texture_pitch))
 		exit(sdl_error("Cannot lock texture"));
 	// "tail" is in DWORDS, which must be added at every end of line to a uint32 pointer
 	pia.tail = (pia.texture_pitch - 4 * nw) / 4;
@@ -322,12 +351,12 @@ static void draw ( void )
 			{
 #define NEW_RENDER_DRAW
 #ifdef NEW_RENDER_DRAW
-			uint32_t *pix = start_pixel_access(cols * 8, 400);
+			uint32_t *pix = start_pixel_access(machine_cols * 8, 400);
 			const uint32_t vgapage = ((uint32_t)VGA_CRTC[0xC] << 8) + (uint32_t)VGA_CRTC[0xD];
-			const uint8_t *vp = RAM + (((portram[0x3D8] == 9) && (portram[0x3D4] == 9)) ? vgapage : 0) + videobase;
+			const uint8_t *vp = machine_ram + (((portram[0x3D8] == 9) && (portram[0x3D4] == 9)) ? vgapage : 0) + videobase;
 			const uint8_t *fp = fontcga;
 			for (int y = 0; y < 400; y++) {
-				for (int x = 0; x < cols; x++) {
+				for (int x = 0; x < machine_cols; x++) {
 					const uint8_t dat = fp[(*vp++) << 4];
 					const uint8_t ci = *vp++;
 					const uint32_t fg = vidcolor ? palettecga[ci & 15] : ((!(ci & 0x70)) ? palettecga[7] : palettecga[0]);
@@ -343,7 +372,7 @@ static void draw ( void )
 				}
 				pix += pia.tail;
 				if ((y & 15) != 15) {
-					vp -= cols * 2;
+					vp -= machine_cols * 2;
 					fp++;
 				} else
 					fp = fontcga;
@@ -354,7 +383,7 @@ static void draw ( void )
 			for (int y = 0; y < 400; y++) {
 				for (int x = 0; x < 640; x++) {
 					uint32_t charx, chary, divx, vidptr, curchar, color;
-					if (cols==80) {
+					if (machine_cols==80) {
 						charx = x/8;
 						divx = 1;
 					} else {
@@ -363,24 +392,24 @@ static void draw ( void )
 					}
 					if ( (portram[0x3D8]==9) && (portram[0x3D4]==9) ) {
 						chary = y/4;
-						vidptr = vgapage + videobase + chary*cols*2 + charx*2;
-						curchar = RAM[vidptr];
+						vidptr = vgapage + videobase + chary*machine_cols*2 + charx*2;
+						curchar = machine_ram[vidptr];
 						color = fontcga[curchar*128 + (y%4) *8 + ( (x/divx) %8) ];
 					} else {
 						chary = y/16;
-						vidptr = videobase + chary*cols*2 + charx*2;
-						curchar = RAM[vidptr];
+						vidptr = videobase + chary*machine_cols*2 + charx*2;
+						curchar = machine_ram[vidptr];
 						color = fontcga[curchar*128 + (y%16) *8 + ( (x/divx) %8) ];
 					}
 					if (vidcolor) {
 						/*if (!color) if (portram[0x3D8]&128) color = palettecga[ (RAM[vidptr+1]/16) &7];
 							else*/
 						if (!color)
-							color = palettecga[RAM[vidptr+1]/16]; //high intensity background
+							color = palettecga[machine_ram[vidptr+1]/16]; //high intensity background
 						else
-							color = palettecga[RAM[vidptr+1]&15];
+							color = palettecga[machine_ram[vidptr+1]&15];
 					} else {
-						if ( (RAM[vidptr+1] & 0x70) ) {
+						if ( (machine_ram[vidptr+1] & 0x70) ) {
 							if (!color)
 								color = palettecga[7];
 							else
@@ -411,7 +440,7 @@ static void draw ( void )
 					uint32_t charx = x;
 					uint32_t chary = y;
 					uint32_t vidptr = videobase + ( (chary>>1) * 80) + ( (chary & 1) * 8192) + (charx >> 2);
-					uint32_t curpixel = RAM[vidptr];
+					uint32_t curpixel = machine_ram[vidptr];
 					uint32_t color;
 					switch (charx & 3) {
 						case 3:
@@ -453,7 +482,7 @@ static void draw ( void )
 					uint32_t charx = x;
 					uint32_t chary = y;
 					uint32_t vidptr = videobase + ( (chary>>1) * 80) + ( (chary&1) * 8192) + (charx>>3);
-					uint32_t curpixel = (RAM[vidptr]>> (7- (charx&7) ) ) &1;
+					uint32_t curpixel = (machine_ram[vidptr]>> (7- (charx&7) ) ) &1;
 					uint32_t color = palettecga[curpixel*15];
 					//prestretch[y][x] = color;
 					//prestretch[y+1][x] = color;
@@ -471,7 +500,7 @@ static void draw ( void )
 					uint32_t charx = x;
 					//uint32_t chary = y>>1;
 					uint32_t vidptr = videobase + ( (y & 3) << 13) + (y >> 2) *90 + (x >> 3);
-					uint32_t curpixel = (RAM[vidptr]>> (7- (charx&7) ) ) &1;
+					uint32_t curpixel = (machine_ram[vidptr]>> (7- (charx&7) ) ) &1;
 #if 0
 #ifdef __BIG_ENDIAN__
 					if (curpixel)
@@ -500,9 +529,9 @@ static void draw ( void )
 					uint32_t vidptr = 0xB8000 + (y>>2) *80 + (x>>3) + ( (y>>1) &1) *8192;
 					uint32_t color;
 					if ( ( (x>>1) &1) ==0)
-						color = palettecga[RAM[vidptr] >> 4];
+						color = palettecga[machine_ram[vidptr] >> 4];
 					else
-						color = palettecga[RAM[vidptr] & 15];
+						color = palettecga[machine_ram[vidptr] & 15];
 					//prestretch[y][x] = color;
 					*pix++ = color;
 				}
@@ -520,9 +549,9 @@ static void draw ( void )
 					uint32_t vidptr = 0xB8000 + (y>>3) *160 + (x>>2) + ( (y>>1) &3) *8192;
 					uint32_t color;
 					if ( ( (x>>1) &1) ==0)
-						color = palettecga[RAM[vidptr] >> 4];
+						color = palettecga[machine_ram[vidptr] >> 4];
 					else
-						color = palettecga[RAM[vidptr] & 15];
+						color = palettecga[machine_ram[vidptr] & 15];
 					//prestretch[y][x] = color;
 					*pix++ = color;
 				}
@@ -619,7 +648,7 @@ static void draw ( void )
 				for (int x = 0; x < pia.rect.w; x++) {
 					uint32_t color;
 					if (!planemode) {
-						color = palettevga[RAM[videobase + ((vgapage + y*pia.rect.w + x) & 0xFFFF) ]];
+						color = palettevga[machine_ram[videobase + ((vgapage + y*pia.rect.w + x) & 0xFFFF) ]];
 					//if (!planemode) {
 					//	color = palettevga[RAM[videobase + y*nw + x]];
 					} else {
@@ -644,7 +673,7 @@ static void draw ( void )
 		if (cursorvisible) {
 			int curheight = 2;
 			int blockw;
-			if (cols == 80)
+			if (machine_cols == 80)
 				blockw = 8;
 			else
 				blockw = 16;
@@ -652,13 +681,15 @@ static void draw ( void )
 			int y1 = cursy * 8 + 8 - curheight;
 			for (int y = y1 * 2; y <= y1 * 2 + curheight - 1; y++)
 				for (int x = x1; x <= x1 + blockw - 1; x++) {
-					uint32_t color = palettecga[RAM[videobase + cursy * cols * 2 + cursx * 2 + 1] & 15];
+					uint32_t color = palettecga[machine_ram[videobase + cursy * machine_cols * 2 + cursx * 2 + 1] & 15];
 					//prestretch[y & 1023][x & 1023] = color;
 					pia.pix[y * TEXTURE_WIDTH + x] = color;
 
 				}
 		}
 	}
+	if (offscreen)
+		return;
 	SDL_UnlockTexture(sdl_tex);
 	SDL_RenderClear(sdl_ren);
 	SDL_RenderCopy(sdl_ren, sdl_tex, &pia.rect, NULL);
@@ -39,6 +39,8 @@ extern uint8_t	noscale, nosmooth;
 extern int      sdl_error       ( const char *msg   );
 extern void     sdl_shutdown    ( void );
 extern int	initscreen	( const char *ver   );
+extern int	initscreen_offscreen ( void );
+extern void	render_frame	( void );
 extern void	setwindowtitle	( const char *extra );
 extern void	doscrmodechange	( void );
 
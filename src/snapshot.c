@@ -0,0 +1,425 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* snapshot.c: saving the complete state of the machine into a file, and
+   restoring it, to resume an already booted system in an instant
+   (-savestate, -loadstate and the "savestate" console command).
+
+   The file is a header (magic, version, number of chunks) and a table of
+   the chunks (name, offset and size of the data), followed by the data of
+   the chunks. Every piece of the state is a chunk of its own, named after
+   its variable, and a snapshot can be loaded only if all of them are
+   there with the same size, ie. it was saved by the same build of Fake86.
+   The host side of the emulation is not saved: the caches of the CPU
+   emulator and the open disk image files are rebuilt on load, and the
+   timestamps are moved to the current time. The disks are attached again
+   by their file names, their contents are not part of the snapshot.
+   Loading maps the file into the memory and copies the chunks into place,
+   after checking every one of them and opening the disk images first, so
+   a failed load leaves the machine as it was. */
+
+#include "config.h"
+#include <SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "snapshot.h"
+
+#include "adlib.h"
+#include "blaster.h"
+#include "cpu.h"
+#include "disk.h"
+#include "timing.h"
+
+#define SNAPSHOT_MAGIC		"FAKE86SS"
+#define SNAPSHOT_VERSION	5
+#define SNAPSHOT_MAX_CHUNKS	64
+#define SNAPSHOT_ALIGN		64	// of the chunk data within the file
+
+struct snapshot_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	chunks;
+};
+
+struct snapshot_chunk {
+	char		id[24];
+	uint32_t	offset;		// of the data, from the beginning of the file
+	uint32_t	size;
+};
+
+enum { SNAPSHOT_SAVE, SNAPSHOT_CHECK, SNAPSHOT_LOAD };
+
+struct snapshot {
+	int			mode;
+	int			error;
+	uint32_t		chunks;
+	struct snapshot_chunk	chunk[SNAPSHOT_MAX_CHUNKS];
+	const void		*data[SNAPSHOT_MAX_CHUNKS];	// SNAPSHOT_SAVE: the data of the chunks
+	const uint8_t		*file;				// SNAPSHOT_CHECK/LOAD: the mapped file
+};
+
+static char request_filename[1024];
+static volatile int request_pending = 0;
+
+// For the fields of the machine without a traditional name (see machine.h)
+#define MACHINE_ITEM(s, field)	snapshot_item(s, #field, &machine->field, sizeof(machine->field))
+
+
+static const struct snapshot_chunk *snapshot_find ( const struct snapshot *s, const char *id )
+{
+	for (uint32_t i = 0; i < s->chunks; i++)
+		if (!strncmp(s->chunk[i].id, id, sizeof(s->chunk[i].id)))
+			return &s->chunk[i];
+	return NULL;
+}
+
+
+static void snapshot_add ( struct snapshot *s, const char *id, const void *data, uint32_t size )
+{
+	if (s->chunks >= SNAPSHOT_MAX_CHUNKS || strlen(id) >= sizeof(s->chunk[0].id)) {
+		fprintf(stderr, "SNAPSHOT: too many chunks or too long chunk name: %s\n", id);
+		s->error = 1;
+		return;
+	}
+	struct snapshot_chunk *c = &s->chunk[s->chunks];
+	memset(c, 0, sizeof(*c));
+	strcpy(c->id, id);
+	c->size = size;
+	s->data[s->chunks++] = data;
+}
+
+
+void snapshot_item ( struct snapshot *s, const char *id, void *data, uint32_t size )
+{
+	if (s->mode == SNAPSHOT_SAVE) {
+		snapshot_add(s, id, data, size);
+		return;
+	}
+	const struct snapshot_chunk *c = snapshot_find(s, id);
+	if (!c) {
+		fprintf(stderr, "SNAPSHOT: chunk %s is missing\n", id);
+		s->error = 1;
+	} else if (c->size != size) {
+		fprintf(stderr, "SNAPSHOT: chunk %s has a size of %u bytes instead of %u, the snapshot is from another build\n", id, c->size, size);
+		s->error = 1;
+	} else if (s->mode == SNAPSHOT_LOAD)
+		memcpy(data, s->file + c->offset, size);
+}
+
+
+// Everything in the state of the current machine, and the devices of the main one
+static void snapshot_items ( struct snapshot *s )
+{
+	MACHINE_ITEM(s, cpu);
+	SNAPSHOT_ITEM(s, totalexec);
+	SNAPSHOT_ITEM(s, totalcycles);
+	SNAPSHOT_ITEM(s, makeupticks);
+	SNAPSHOT_ITEM(s, cpu_last_int_seg);
+	SNAPSHOT_ITEM(s, cpu_last_int_ip);
+	MACHINE_ITEM(s, last_int10ax);
+	MACHINE_ITEM(s, trap_toggle);
+	MACHINE_ITEM(s, didbootstrap);
+	snapshot_item(s, "RAM", machine_ram, RAM_SIZE);	// a pointer with KVM
+	MACHINE_ITEM(s, readonly);
+	SNAPSHOT_ITEM(s, portram);
+	SNAPSHOT_ITEM(s, speakerenabled);
+	SNAPSHOT_ITEM(s, i8253);
+	SNAPSHOT_ITEM(s, i8259);
+	SNAPSHOT_ITEM(s, i8259slave);
+	MACHINE_ITEM(s, i8237);
+	MACHINE_ITEM(s, video);
+	timing_snapshot(s);
+	SNAPSHOT_ITEM(s, bootdrive);
+	MACHINE_ITEM(s, lastdiskah);
+	MACHINE_ITEM(s, lastdiskcf);
+	MACHINE_ITEM(s, bios_color);
+	MACHINE_ITEM(s, bios_x);
+	MACHINE_ITEM(s, bios_y);
+	if (machine == &machine_main) {
+		SNAPSHOT_ITEM(s, blaster);
+		adlib_snapshot(s);
+	}
+}
+
+
+// The attached disks, as lines of "drive filename"
+static char *snapshot_disks ( void )
+{
+	size_t len = 1;
+	for (int d = 0; d < 256; d++)
+		if (machine_disk[d].inserted && machine_disk[d].filename)
+			len += strlen(machine_disk[d].filename) + 4;
+	char *list = malloc(len), *p = list;
+	if (!list)
+		return NULL;
+	for (int d = 0; d < 256; d++)
+		if (machine_disk[d].inserted && machine_disk[d].filename)
+			p += sprintf(p, "%02X %s\n", d, machine_disk[d].filename);
+	*p = '\0';
+	return list;
+}
+
+
+// The disks of a snapshot being loaded, from its "disks" chunk
+struct snapshot_disks {
+	char			*wanted[256];	// the file names
+	struct struct_drive	opened[256];	// the images which are not attached already
+};
+
+
+// Opens the images of the snapshot which are not attached already, before
+// anything is restored: if one of them cannot be, the load fails
+static int snapshot_open_disks ( struct snapshot_disks *sd, const char *list, uint32_t size )
+{
+	const char *end = list + size;
+	while (list < end) {
+		const char *eol = memchr(list, '\n', end - list);
+		if (!eol)
+			break;
+		unsigned int d;
+		if (eol - list > 3 && sscanf(list, "%2X", &d) == 1 && d < 256 && list[2] == ' ' && !sd->wanted[d]) {
+			if (!(sd->wanted[d] = malloc(eol - list - 2)))
+				return 1;
+			memcpy(sd->wanted[d], list + 3, eol - list - 3);
+			sd->wanted[d][eol - list - 3] = '\0';
+		}
+		list = eol + 1;
+	}
+	for (int d = 0; d < 256; d++)
+		if (sd->wanted[d] && !(machine_disk[d].inserted && machine_disk[d].filename && !strcmp(machine_disk[d].filename, sd->wanted[d])) &&
+		    disk_open(d, sd->wanted[d], &sd->opened[d]))
+			return 1;
+	return 0;
+}
+
+
+// Attaches the disks of the snapshot, and ejects the ones which are not in it
+static void snapshot_attach_disks ( struct snapshot_disks *sd )
+{
+	for (int d = 0; d < 256; d++) {
+		if (sd->opened[d].inserted)
+			disk_attach(d, &sd->opened[d]);
+		else if (machine_disk[d].inserted && !sd->wanted[d])
+			ejectdisk(d);
+	}
+}
+
+
+static void snapshot_free_disks ( struct snapshot_disks *sd )
+{
+	for (int d = 0; d < 256; d++) {
+		disk_close(&sd->opened[d]);
+		free(sd->wanted[d]);
+	}
+	free(sd);
+}
+
+
+int snapshot_save ( const char *filename )
+{
+	static const uint8_t padding[SNAPSHOT_ALIGN];
+	struct snapshot s;
+	memset(&s, 0, sizeof(s));
+	s.mode = SNAPSHOT_SAVE;
+	snapshot_items(&s);
+	char *disks = snapshot_disks();
+	if (!disks) {
+		fprintf(stderr, "SNAPSHOT: out of memory\n");
+		return 1;
+	}
+	snapshot_add(&s, "disks", disks, strlen(disks));
+	if (s.error) {
+		free(disks);
+		return 1;
+	}
+	struct snapshot_header header;
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.chunks = s.chunks;
+	uint32_t offset = sizeof(header) + s.chunks * sizeof(struct snapshot_chunk);
+	for (uint32_t i = 0; i < s.chunks; i++) {
+		offset = (offset + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1);
+		s.chunk[i].offset = offset;
+		offset += s.chunk[i].size;
+	}
+	FILE *f = fopen(filename, "wb");
+	int ok = f &&
+		fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(s.chunk, sizeof(struct snapshot_chunk), s.chunks, f) == s.chunks;
+	for (uint32_t i = 0; ok && i < s.chunks; i++) {
+		const long pad = s.chunk[i].offset - ftell(f);
+		ok = (!pad || fwrite(padding, pad, 1, f) == 1) &&
+			(!s.chunk[i].size || fwrite(s.data[i], s.chunk[i].size, 1, f) == 1);
+	}
+	if (f && fclose(f))
+		ok = 0;
+	free(disks);
+	if (!ok) {
+		fprintf(stderr, "SNAPSHOT: cannot write file %s\n", filename);
+		return 1;
+	}
+	printf("SNAPSHOT: saved to %s (%u chunks, %uK)\n", filename, s.chunks, offset >> 10);
+	return 0;
+}
+
+
+// Maps the whole file into the memory (reads it on Windows)
+static const uint8_t *map_file ( const char *filename, size_t *size )
+{
+#ifdef _WIN32
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return NULL;
+	uint8_t *data = NULL;
+	if (!fseek(f, 0, SEEK_END) && (*size = ftell(f)) > 0 && !fseek(f, 0, SEEK_SET) && (data = malloc(*size))) {
+		if (fread(data, *size, 1, f) != 1) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(f);
+	return data;
+#else
+	const int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		*size = st.st_size;
+		data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+
+static void unmap_file ( const uint8_t *data, size_t size )
+{
+#ifdef _WIN32
+	free((void*)data);
+#else
+	munmap((void*)data, size);
+#endif
+}
+
+
+int snapshot_load ( const char *filename )
+{
+	const Uint64 start = SDL_GetPerformanceCounter();
+	struct snapshot s;
+	memset(&s, 0, sizeof(s));
+	size_t size;
+	s.file = map_file(filename, &size);
+	if (!s.file) {
+		fprintf(stderr, "SNAPSHOT: cannot open file %s\n", filename);
+		return 1;
+	}
+	const char *err = NULL;
+	struct snapshot_disks *sd = NULL;
+	struct snapshot_header header;
+	if (size < sizeof(header)) {
+		err = "not a snapshot";
+		goto error;
+	}
+	memcpy(&header, s.file, sizeof(header));
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))) {
+		err = "not a snapshot";
+		goto error;
+	}
+	if (header.version != SNAPSHOT_VERSION) {
+		err = "unsupported version";
+		goto error;
+	}
+	if (header.chunks > SNAPSHOT_MAX_CHUNKS || size < sizeof(header) + header.chunks * sizeof(struct snapshot_chunk)) {
+		err = "bad chunk table";
+		goto error;
+	}
+	s.chunks = header.chunks;
+	memcpy(s.chunk, s.file + sizeof(header), s.chunks * sizeof(struct snapshot_chunk));
+	for (uint32_t i = 0; i < s.chunks; i++)
+		if (s.chunk[i].offset > size || s.chunk[i].size > size - s.chunk[i].offset) {
+			err = "truncated file";
+			goto error;
+		}
+	s.mode = SNAPSHOT_CHECK;
+	snapshot_items(&s);
+	if (s.error) {
+		err = "incompatible snapshot";
+		goto error;
+	}
+	if (!(sd = calloc(1, sizeof(struct snapshot_disks)))) {
+		err = "out of memory";
+		goto error;
+	}
+	const struct snapshot_chunk *disks = snapshot_find(&s, "disks");
+	if (disks && snapshot_open_disks(sd, (const char*)s.file + disks->offset, disks->size)) {
+		err = "cannot attach its disks";
+		goto error;
+	}
+	s.mode = SNAPSHOT_LOAD;
+	snapshot_items(&s);
+	snapshot_attach_disks(sd);
+	snapshot_free_disks(sd);
+	unmap_file(s.file, size);
+	// Rebuild everything derived from the restored state
+	cpu_mem_reload();
+	timing_snapshot_loaded();
+	updatedscreen = 1;
+	printf("SNAPSHOT: loaded from %s in %.2f msecs\n", filename, (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+	return 0;
+error:
+	if (sd)
+		snapshot_free_disks(sd);
+	unmap_file(s.file, size);
+	fprintf(stderr, "SNAPSHOT: cannot load %s: %s\n", filename, err);
+	return 1;
+}
+
+
+// The console thread asks the emulation thread to save a snapshot between two time slices
+void snapshot_request ( const char *filename )
+{
+	if (request_pending) {
+		fprintf(stderr, "SNAPSHOT: another snapshot is being saved\n");
+		return;
+	}
+	snprintf(request_filename, sizeof(request_filename), "%s", filename);
+	request_pending = 1;
+}
+
+
+void snapshot_handle_request ( void )
+{
+	if (request_pending) {
+		snapshot_save(request_filename);
+		request_pending = 0;
+	}
+}
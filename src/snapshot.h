@@ -0,0 +1,38 @@
+/*
+  Fake86: A portable, open-source 8086 PC emulator.
+  Copyright (C)2010-2013 Mike Chambers
+            (C)2020      Gabor Lenart "LGB"
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKE86_SNAPSHOT_H_INCLUDED
+#define FAKE86_SNAPSHOT_H_INCLUDED
+
+#include <stdint.h>
+
+struct snapshot;
+
+extern int  snapshot_save           ( const char *filename );
+extern int  snapshot_load           ( const char *filename );
+extern void snapshot_request        ( const char *filename );
+extern void snapshot_handle_request ( void );
+
+/* Saves or restores 'size' bytes at 'data' as the chunk named 'id', for the
+   snapshot_items() of the modules with their own state. */
+extern void snapshot_item           ( struct snapshot *s, const char *id, void *data, uint32_t size );
+#define SNAPSHOT_ITEM(s, var)	snapshot_item(s, #var, &(var), sizeof(var))
+
+#endif
@@ -27,6 +27,7 @@
 
 #include "ports.h"
 #include "cpu.h"
+#include "timing.h"
 
 static uint8_t ssourcebuf[16], ssourceptr = 0, ssourceactive = 0;
 static int16_t ssourcecursample = 0;
@@ -97,4 +98,7 @@ void initsoundsource( void )
 	set_port_write_redirector(0x37A, 0x37A, &outsoundsource);
 	set_port_read_redirector(0x379, 0x379, &insoundsource);
 	ssourceactive = 1;
+	timing_register(TIMING_SSOURCE, tickssource);
+	if (!machine->headless)
+		timing_periodic(TIMING_SSOURCE, 1, 8000);
 }
@@ -30,7 +30,6 @@
 #include "timing.h"
 
 static uint64_t speakerfullstep, speakerhalfstep, speakercurstep = 0;
-uint8_t speakerenabled = 0;
 
 int16_t speakergensample ( void )
 {
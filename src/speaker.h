@@ -21,7 +21,6 @@
 #ifndef FAKE86_SPEAKER_H_INCLUDED
 #define FAKE86_SPEAKER_H_INCLUDED
 
-extern uint8_t speakerenabled;
 extern int16_t speakergensample ( void );
 
 #endif
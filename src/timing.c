@@ -18,8 +18,9 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
-/* timing.c: critical functions to provide accurate timing for the
-   system timer interrupt, and to generate new audio output samples. */
+/* timing.c: the device event scheduler of the machines, which provides the
+   system timer interrupt, the new audio output samples, and paces the
+   machine time to the host clock. */
 
 #include "config.h"
 #include <SDL.h>
@@ -27,114 +28,525 @@
 #include <stdio.h>
 #ifdef _WIN32
 #include <windows.h>
-LARGE_INTEGER queryperf;
 #else
-#include <sys/time.h>
-static struct timeval tv;
+#include <time.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#define HOST_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 #endif
 
 #include "timing.h"
 
-#include "i8253.h"
 #include "i8259.h"
-#include "blaster.h"
-#include "adlib.h"
-#include "audio.h"
-#include "video.h"
-#include "sndsource.h"
 #include "parsecl.h"
+#include "snapshot.h"
 
-uint64_t lasttick;
+uint64_t hostfreq = 1000000000;
+uint64_t gensamplerate;
+// the handlers are the same on all the machines
+static timing_handler handlers[TIMING_EVENTS];
 
-uint64_t hostfreq = 1000000, tickgap;
-static uint64_t curtick = 0, lastscanlinetick, curscanline = 0, i8253tickgap, lasti8253tick, scanlinetiming;
-uint64_t sampleticks, gensamplerate;
-static uint64_t lastsampletick, ssourceticks, lastssourcetick, adlibticks, lastadlibtick, lastblastertick;
+// per-machine state, see timing_s
+#define vbase		(machine->timing.vbase)
+#define cbase		(machine->timing.cbase)
+#define rate		(machine->timing.rate)
+#define next		(machine->timing.next)
+#define ev		(machine->timing.ev)
+#define heap		(machine->timing.heap)
+#define events		(machine->timing.events)
+#define hostbase	(machine->timing.hostbase)
+#define pacebase	(machine->timing.pacebase)
+#define pacehost	(machine->timing.pacehost)
+#define pacecycles	(machine->timing.pacecycles)
+#define virtualtime	(machine->timing.virtualtime)
 
-static uint16_t pit0counter = 65535;
+// machine time in the scanline of the CGA (31.5 kHz), 525 lines per frame
+#define SCANLINE(clock)	((clock) / 31500)
 
 
-void inittiming(void)
-{
+/* The host clocks, one of them paces the machines at hostfreq ticks per
+   second. The default is the monotonic clock of the system, which is not
+   adjusted by NTP either, or the performance counter on Windows. */
 #ifdef _WIN32
+static uint64_t systemfreq ( void )
+{
+	LARGE_INTEGER queryperf;
 	QueryPerformanceFrequency(&queryperf);
-	hostfreq = queryperf.QuadPart;
+	return queryperf.QuadPart;
+}
+
+
+static uint64_t systemtick ( void )
+{
+	LARGE_INTEGER queryperf;
 	QueryPerformanceCounter(&queryperf);
-	curtick = queryperf.QuadPart;
+	return queryperf.QuadPart;
+}
 #else
-	hostfreq = 1000000;
-	gettimeofday (&tv, NULL);
-	curtick = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW	CLOCK_MONOTONIC
 #endif
-	lasti8253tick = lastblastertick = lastadlibtick = lastssourcetick = lastsampletick = lastscanlinetick = lasttick = curtick;
-	scanlinetiming = hostfreq / 31500;
-	ssourceticks = hostfreq / 8000;
-	adlibticks = hostfreq / 48000;
-	if (doaudio)
-		sampleticks = hostfreq / gensamplerate;
-	else
-		sampleticks = -1;
-	i8253tickgap = hostfreq / 119318;
+static uint64_t systemfreq ( void )
+{
+	return 1000000000;
 }
 
 
+static uint64_t systemtick ( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * (uint64_t)1000000000 + (uint64_t)ts.tv_nsec;
+}
+#endif
 
-void timing(void)
+
+static void systemsleep ( uint32_t usecs )
 {
 #ifdef _WIN32
-	QueryPerformanceCounter(&queryperf);
-	curtick = queryperf.QuadPart;
+	Sleep(usecs / 1000);
 #else
-	gettimeofday(&tv, NULL);
-	curtick = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+	usleep(usecs);
 #endif
-	if (curtick >= (lastscanlinetick + scanlinetiming)) {
-		curscanline = (curscanline + 1) % 525;
-		if (curscanline > 479)
-			port3da = 8;
-		else
-			port3da = 0;
-		if (curscanline & 1)
-			port3da |= 1;
-		pit0counter++;
-		lastscanlinetick = curtick;
+}
+
+
+#ifdef HOST_TSC
+// -tsc: the time stamp counter, only if it is invariant (does not stop or
+// change its rate with the power states of the host CPU)
+static uint64_t tsctick ( void )
+{
+	return __rdtsc();
+}
+
+
+static int tsc_invariant ( void )
+{
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0x80000000);
+	if ((unsigned int)regs[0] < 0x80000007)
+		return 0;
+	__cpuid(regs, 0x80000007);
+	return (regs[3] >> 8) & 1;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (edx >> 8) & 1;
+#endif
+}
+
+
+// The frequency of the TSC in two 20 ms runs against the system clock,
+// which have to agree within 0.1%, or 0 if the TSC cannot be used
+static uint64_t tsc_calibrate ( void )
+{
+	if (!tsc_invariant())
+		return 0;
+	const uint64_t sysfreq = systemfreq();
+	uint64_t freq[2];
+	for (int i = 0; i < 2; i++) {
+		const uint64_t s0 = systemtick(), t0 = tsctick();
+		systemsleep(20000);
+		const uint64_t s1 = systemtick(), t1 = tsctick();
+		if (s1 <= s0 || t1 <= t0)
+			return 0;
+		freq[i] = (t1 - t0) / (s1 - s0) * sysfreq + (t1 - t0) % (s1 - s0) * sysfreq / (s1 - s0);
 	}
-	if (i8253.active[0]) { //timer interrupt channel on i8253
-		if (curtick >= (lasttick + tickgap)) {
-			lasttick = curtick;
-			doirq(0);
-		}
+	const uint64_t diff = freq[0] > freq[1] ? freq[0] - freq[1] : freq[1] - freq[0];
+	if (diff > freq[0] / 1000)
+		return 0;
+	return (freq[0] + freq[1]) / 2;
+}
+#endif
+
+
+static uint64_t (*hosttick)( void ) = systemtick;
+
+uint64_t timing_hosttick ( void )
+{
+	return hosttick();
+}
+
+
+static void hostsleep ( uint64_t ticks )
+{
+	systemsleep(ticks / hostfreq * 1000000 + ticks % hostfreq * 1000000 / hostfreq);
+}
+
+
+// Selects the host clock, at the first call only
+static void init_hostclock ( void )
+{
+	static int done = 0;
+	if (done)
+		return;
+	done = 1;
+	hostfreq = systemfreq();
+	if (!usetsc)
+		return;
+#ifdef HOST_TSC
+	const uint64_t freq = tsc_calibrate();
+	if (freq) {
+		hostfreq = freq;
+		hosttick = tsctick;
+		printf("Host clock: TSC at %.3f MHz\n", (double)freq / 1000000.0);
+		return;
 	}
-	if (curtick >= (lasti8253tick + i8253tickgap)) {
-		for (int i8253chan = 0; i8253chan < 3; i8253chan++) {
-			if (i8253.active[i8253chan]) {
-				if (i8253.counter[i8253chan] < 10) i8253.counter[i8253chan] = i8253.chandata[i8253chan];
-					i8253.counter[i8253chan] -= 10;
-			}
-		}
-		lasti8253tick = curtick;
+#endif
+	fprintf(stderr, "WARNING: the TSC of the host cannot be used, staying with the system clock.\n");
+}
+
+
+// The machine time runs at this frequency
+uint64_t timing_clock ( void )
+{
+	return cpuclock ? cpuclock : DEFAULT_CPU_CLOCK;
+}
+
+
+// The machine time of the current machine, from its cycles
+uint64_t timing_now ( void )
+{
+	if (rate == TIMING_RATE_ONE)
+		return vbase + (totalcycles - cbase);
+	return vbase + ((totalcycles - cbase) * rate >> 16);
+}
+
+
+// totalcycles when the machine time reaches 'when', rounded up
+static uint64_t cycles_at ( uint64_t when )
+{
+	if (when <= vbase)
+		return cbase;
+	if (rate == TIMING_RATE_ONE)
+		return cbase + (when - vbase);
+	return cbase + (((when - vbase) << 16) + rate - 1) / rate;
+}
+
+
+// Conversions between host ticks and machine time, without overflowing
+static uint64_t ticks_to_machine ( uint64_t ticks )
+{
+	const uint64_t clock = timing_clock();
+	return ticks / hostfreq * clock + ticks % hostfreq * clock / hostfreq;
+}
+
+
+static uint64_t machine_to_ticks ( uint64_t time )
+{
+	const uint64_t clock = timing_clock();
+	return time / clock * hostfreq + time % clock * hostfreq / clock;
+}
+
+
+// The machine time at the host tick 'now', when it is paced to the host
+static uint64_t host_to_machine ( uint64_t now )
+{
+	return pacebase + ticks_to_machine(now - hostbase);
+}
+
+
+// Continues the machine time from now with a new rate of the cycles
+static void rebase ( uint32_t newrate )
+{
+	vbase = timing_now();
+	cbase = totalcycles;
+	rate = newrate;
+}
+
+
+static inline int earlier ( int a, int b )
+{
+	return ev[heap[a]].when < ev[heap[b]].when;
+}
+
+
+static inline void heap_swap ( int a, int b )
+{
+	const uint8_t id = heap[a];
+	heap[a] = heap[b];
+	heap[b] = id;
+	ev[heap[a]].pos = a + 1;
+	ev[heap[b]].pos = b + 1;
+}
+
+
+static void heap_up ( int i )
+{
+	while (i && earlier(i, (i - 1) / 2)) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
 	}
-	if (curtick >= (lastssourcetick + ssourceticks)) {
-		tickssource();
-		lastssourcetick = curtick - (curtick - (lastssourcetick + ssourceticks));
+}
+
+
+static void heap_down ( int i )
+{
+	for (;;) {
+		int first = i;
+		if (2 * i + 1 < events && earlier(2 * i + 1, first))
+			first = 2 * i + 1;
+		if (2 * i + 2 < events && earlier(2 * i + 2, first))
+			first = 2 * i + 2;
+		if (first == i)
+			return;
+		heap_swap(i, first);
+		i = first;
 	}
-	if (blaster.samplerate > 0) {
-		if (curtick >= (lastblastertick + blaster.sampleticks)) {
-			tickBlaster();
-			lastblastertick = curtick - (curtick - (lastblastertick + blaster.sampleticks));
-		}
+}
+
+
+static void heap_remove ( int id )
+{
+	const int i = ev[id].pos - 1;
+	ev[id].pos = 0;
+	if (i != --events) {
+		heap[i] = heap[events];
+		ev[heap[i]].pos = i + 1;
+		heap_up(i);
+		heap_down(i);
+	}
+}
+
+
+static void update_next ( void )
+{
+	next = events ? cycles_at(ev[heap[0]].when) : UINT64_MAX;
+}
+
+
+// Moves the event (scheduled or not) to machine time 'when'
+static void schedule ( int id, uint64_t when )
+{
+	ev[id].when = when;
+	if (!ev[id].pos) {
+		heap[events] = id;
+		ev[id].pos = ++events;
+	}
+	heap_up(ev[id].pos - 1);
+	heap_down(ev[id].pos - 1);
+	update_next();
+}
+
+
+// Advances a periodic event by its period
+static uint64_t period ( struct timing_event *e )
+{
+	const uint64_t clock = timing_clock();
+	// num/den seconds in cycles, the fraction is carried to the next one
+	const uint64_t whole = e->num * clock + e->frac;
+	e->frac = whole % e->den;
+	return whole / e->den;
+}
+
+
+void timing_register ( enum timing_event_id id, timing_handler handler )
+{
+	handlers[id] = handler;
+}
+
+
+// Fires the event every num/den seconds, starting one period from now
+void timing_periodic ( enum timing_event_id id, uint64_t num, uint64_t den )
+{
+	struct timing_event *e = &ev[id];
+	e->num = num;
+	e->den = den;
+	e->frac = 0;
+	schedule(id, timing_now() + period(e));
+}
+
+
+// Fires the event once, at the machine time 'when'
+void timing_at ( enum timing_event_id id, uint64_t when )
+{
+	ev[id].num = 0;
+	schedule(id, when);
+}
+
+
+void timing_stop ( enum timing_event_id id )
+{
+	ev[id].num = 0;
+	if (ev[id].pos) {
+		heap_remove(id);
+		update_next();
 	}
-	if (curtick >= (lastsampletick + sampleticks)) {
-		tickaudio();
-		if (slowsystem) {
-			tickaudio();
-			tickaudio();
-			tickaudio();
+}
+
+
+// Runs the events which are due, called by timing() when the first one is
+void timing_run ( void )
+{
+	const uint64_t start = TIMING_ACCOUNT_START();
+	const uint64_t now = timing_now();
+	while (events && ev[heap[0]].when <= now) {
+		const int id = heap[0];
+		struct timing_event *e = &ev[id];
+		// rescheduled first, so the handler can change or stop it
+		if (e->num) {
+			e->when += period(e);
+			heap_down(0);
+		} else
+			heap_remove(id);
+		if (handlers[id])
+			handlers[id]();
+	}
+	update_next();
+	TIMING_ACCOUNT_STOP(TIMING_ACCOUNT_EVENTS, start);
+}
+
+
+// The status bits of the CGA (port 3DA) from the machine time: the retrace
+// and the display enable
+uint8_t timing_retrace ( void )
+{
+	const uint64_t scanline = SCANLINE(timing_clock());
+	const unsigned int line = (timing_now() / scanline) % 525;
+	return (line > 479 ? 8 : 0) | (line & 1);
+}
+
+
+// Starts the machine time of the current machine from now, where it is
+void resettiming ( void )
+{
+	vbase = timing_now();
+	cbase = totalcycles;
+	rate = TIMING_RATE_ONE;
+	pacehost = hostbase = hosttick();
+	pacebase = vbase;
+	pacecycles = totalcycles;
+	update_next();
+}
+
+
+/* Paces the machine time of a realtime machine to the host clock, called
+   between slices of the emulation. With -mhz, the machine waits for the host
+   when it is ahead. Otherwise the CPU runs as fast as it can, and the machine
+   time per cycle is adjusted about every 10 ms, so that the machine time
+   follows the host clock. In both cases, when the machine falls behind more
+   than 100 ms, it does not try to catch up. */
+void timing_pace ( void )
+{
+	if (virtualtime)
+		return;
+	const uint64_t clock = timing_clock();
+	const uint64_t now = hosttick();
+	const uint64_t target = host_to_machine(now);
+	const uint64_t vnow = timing_now();
+	if (cpuclock) {
+		if (vnow > target)
+			hostsleep(machine_to_ticks(vnow - target));
+		else if (target - vnow > clock / 10) {
+			hostbase = now;
+			pacebase = vnow;
 		}
-		lastsampletick = curtick - (curtick - (lastsampletick + sampleticks) );
+		return;
 	}
-	if (curtick >= (lastadlibtick + adlibticks)) {
-		tickadlib();
-		lastadlibtick = curtick - (curtick - (lastadlibtick + adlibticks) );
+	if (now - pacehost < hostfreq / 100 || totalcycles == pacecycles)
+		return;
+	int64_t error = (int64_t)(target - vnow);
+	if (error > (int64_t)clock / 10 || error < -(int64_t)clock / 10) {
+		hostbase = now;
+		pacebase = vnow;
+		error = 0;
+	}
+	// the same time in the next period as in the last one, and a quarter of the error
+	const int64_t wanted = (int64_t)ticks_to_machine(now - pacehost) + error / 4;
+	uint64_t newrate = wanted > 0 ? ((uint64_t)wanted << 16) / (totalcycles - pacecycles) : 1;
+	if (newrate < 1)
+		newrate = 1;
+	else if (newrate > 64 * TIMING_RATE_ONE)
+		newrate = 64 * TIMING_RATE_ONE;
+	rebase(newrate);
+	update_next();
+	pacehost = now;
+	pacecycles = totalcycles;
+}
+
+
+// The scheduler state of the current machine for the snapshots. The machine
+// time is restored as it was, so the deadlines are valid as they are.
+void timing_snapshot ( struct snapshot *s )
+{
+	SNAPSHOT_ITEM(s, vbase);
+	SNAPSHOT_ITEM(s, cbase);
+	SNAPSHOT_ITEM(s, rate);
+	SNAPSHOT_ITEM(s, ev);
+	SNAPSHOT_ITEM(s, heap);
+	SNAPSHOT_ITEM(s, events);
+}
+
+
+// After loading a snapshot: paced from the host clock of now
+void timing_snapshot_loaded ( void )
+{
+	if (virtualtime || cpuclock)
+		rebase(TIMING_RATE_ONE);
+	pacehost = hostbase = hosttick();
+	pacebase = timing_now();
+	pacecycles = totalcycles;
+	update_next();
+}
+
+
+void inittiming ( void )
+{
+	init_hostclock();
+	resettiming();
+}
+
+
+/* The CPU is halted, so nothing happens until an interrupt, and those only
+   come from device events (or from the input, on the main machine). Sleeps
+   until the next one, or on headless machines and with -fastforward, jumps
+   the machine time straight to it. Then runs timing(). At most 'maxcycles'
+   CPU cycles worth of time passes, which is charged to totalcycles. Without
+   any events, the machine waits for 1 ms at most. */
+void timing_halt ( uint64_t maxcycles )
+{
+	const uint64_t start = totalcycles;
+	uint64_t until = events ? next : cycles_at(timing_now() + timing_clock() / 1000);
+	if (until <= start) {
+		timing_run();
+		return;
+	}
+	if (until - start > maxcycles)
+		until = start + maxcycles;
+	if (!virtualtime) {
+		const uint64_t vuntil = vbase + (rate == TIMING_RATE_ONE ? until - cbase : (until - cbase) * rate >> 16);
+		if (fastforward || machine->headless) {
+			// the machine time gets ahead of the host clock
+			pacebase += vuntil - timing_now();
+		} else {
+			// in steps of at most 1 ms, to answer the input quickly
+			for (;;) {
+				const uint64_t vhost = host_to_machine(hosttick());
+				if (vhost >= vuntil)
+					break;
+				if (i8259.deliverable) {
+					// woken up early, by the input
+					const uint64_t woken = cycles_at(vhost);
+					if (woken < until)
+						until = woken > start ? woken : start;
+					break;
+				}
+				uint64_t wait = machine_to_ticks(vuntil - vhost);
+				if (wait > hostfreq / 1000)
+					wait = hostfreq / 1000;
+				hostsleep(wait ? wait : 1);
+			}
+		}
 	}
+	totalcycles = until;
+	timing_run();
 }
@@ -21,14 +21,89 @@
 #ifndef FAKE86_TIMING_H_INCLUDED
 #define FAKE86_TIMING_H_INCLUDED
 
-//uint64_t sampleticks, lastsampletick, ssourceticks, lastssourcetick, adlibticks, lastadlibtick, lastblastertick, gensamplerate;
+#include <stdint.h>
+
 extern uint64_t gensamplerate;
 extern uint64_t hostfreq;
-extern uint64_t sampleticks;
-extern uint64_t tickgap;
-extern uint64_t lasttick;
 
-extern void timing ( void );
+// CPU clock of an IBM PC, for converting between the machine time and
+// cycles when -mhz is not given
+#define DEFAULT_CPU_CLOCK	4772727
+
+/* The device events. Their deadlines are in machine time, which counts the
+   cycles of the nominal CPU clock (-mhz, or DEFAULT_CPU_CLOCK), and they are
+   kept in a min-heap per machine. timing() only compares totalcycles with the
+   first deadline, the host clock is only read for pacing the machine time. */
+enum timing_event_id {
+	TIMING_PIT,		// IRQ0 of the 8253 channel 0
+	TIMING_BLASTER,
+	TIMING_SSOURCE,
+	TIMING_ADLIB,
+	TIMING_AUDIO,		// the next output sample
+	TIMING_EVENTS
+};
+
+// -bench: the host time spent in some subsystems, in host clock ticks (hostfreq)
+enum timing_account_id {
+	TIMING_ACCOUNT_EVENTS,	// the device events, timing_run()
+	TIMING_ACCOUNT_PORTS,	// the port handlers
+	TIMING_ACCOUNT_DISK,	// the INT 13h services
+	TIMING_ACCOUNTS
+};
+
+// the rate when the machine time is the cycles
+#define TIMING_RATE_ONE	0x10000
+
+struct timing_event {
+	uint64_t when;		// machine time of the next firing
+	uint64_t num, den;	// the period is num/den seconds, 0 for one-shot events
+	uint64_t frac;		// remainder of the period in 1/den cycles, so periodic events do not drift
+	uint8_t  pos;		// position in the heap plus one, 0 if not scheduled
+};
+
+struct timing_s {
+	uint64_t vbase, cbase;	// the machine time was vbase when totalcycles was cbase
+	uint32_t rate;		// machine time per cycle since then, 16.16 fixed point
+	uint64_t next;		// totalcycles when the first event is due, UINT64_MAX if none is scheduled
+	struct timing_event ev[TIMING_EVENTS];
+	uint8_t  heap[TIMING_EVENTS];
+	uint8_t  events;	// scheduled ones, in the heap
+	uint64_t hostbase, pacebase;	// pacing: the machine time should be pacebase at host tick hostbase
+	uint64_t pacehost, pacecycles;	// the last adjustment of the rate
+	uint8_t  virtualtime;	// the machine time is derived from totalcycles only, not paced to the host clock
+	uint8_t  accounting;	// -bench: account the host time of the subsystems, see TIMING_ACCOUNT_START()
+	uint64_t account[TIMING_ACCOUNTS];
+};
+
+typedef void (*timing_handler)( void );
+
+extern uint64_t timing_hosttick ( void );
+
+// -bench: the host time spent in some subsystems of the current machine (see struct timing_s)
+#define TIMING_ACCOUNT_START()		(UNLIKELY(machine->timing.accounting) ? timing_hosttick() : 0)
+#define TIMING_ACCOUNT_STOP(id, start)	do { if (UNLIKELY(machine->timing.accounting)) machine->timing.account[id] += timing_hosttick() - (start); } while (0)
+
+extern void     timing_register ( enum timing_event_id id, timing_handler handler );
+extern void     timing_periodic ( enum timing_event_id id, uint64_t num, uint64_t den );
+extern void     timing_at ( enum timing_event_id id, uint64_t when );
+extern void     timing_stop ( enum timing_event_id id );
+extern uint64_t timing_now ( void );
+extern uint64_t timing_clock ( void );
+extern uint8_t  timing_retrace ( void );
+extern void     timing_run ( void );
+extern void     timing_pace ( void );
+
 extern void inittiming ( void );
+extern void resettiming ( void );
+extern void timing_halt ( uint64_t maxcycles );
+
+struct snapshot;
+extern void timing_snapshot ( struct snapshot *s );
+extern void timing_snapshot_loaded ( void );
+
+#include "machine.h"
+
+// The first deadline of the current machine has passed
+#define timing()	do { if (UNLIKELY(totalcycles >= machine->timing.next)) timing_run(); } while (0)
 
 #endif
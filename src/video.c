@@ -35,21 +35,29 @@
 #include "parsecl.h"
 #include "hostfs.h"
 #include "bindata.h"
+#include "timing.h"
 
-uint8_t VRAM[262144], vidmode, cgabg, blankattr, vidgfxmode, vidcolor;
-uint16_t cursx, cursy, cols = 80, rows = 25, vgapage, cursorposition, cursorvisible;
-uint8_t updatedscreen, clocksafe, port3da, port6;
-uint16_t VGA_SC[0x100], VGA_CRTC[0x100], VGA_ATTR[0x100], VGA_GC[0x100];
-uint32_t videobase= 0xB8000, textbase = 0xB8000;
+uint16_t vgapage;
 const uint8_t *fontcga;
-uint32_t palettecga[16], palettevga[256];
+uint32_t palettecga[16];
 uint32_t usefullscreen = 0, usegrabmode = 0;
 
-static uint8_t latchRGB = 0, latchPal = 0, VGA_latch[4], stateDAC = 0;
-static uint8_t latchReadRGB = 0, latchReadPal = 0;
-static uint32_t tempRGB;
+// the rest of the adapter state is in the machine, see video_s
+#define latchRGB	(machine->video.latchRGB)
+#define latchPal	(machine->video.latchPal)
+#define VGA_latch	(machine->video.VGA_latch)
+#define stateDAC	(machine->video.stateDAC)
+#define latchReadRGB	(machine->video.latchReadRGB)
+#define latchReadPal	(machine->video.latchReadPal)
+#define tempRGB		(machine->video.tempRGB)
 uint16_t oldw, oldh; //used when restoring screen mode
 
+// Pixel format of the palette entries for headless machines, which have no screen
+static const SDL_PixelFormat headless_pixfmt = {
+	.Rshift = 16, .Gshift = 8, .Bshift = 0, .Ashift = 24
+};
+#define PIXFMT		(sdl_pixfmt ? sdl_pixfmt : &headless_pixfmt)
+
 static inline uint32_t rgb(uint8_t r, uint8_t g, uint8_t b) {
 #if 0
 #ifdef __BIG_ENDIAN__
@@ -60,10 +68,10 @@ static inline uint32_t rgb(uint8_t r, uint8_t g, uint8_t b) {
 #endif
 	//return SDL_MapRGBA(sdl_pixfmt, r, g, b, 0xFF);
 	return
-		(r    << sdl_pixfmt->Rshift) |
-		(g    << sdl_pixfmt->Gshift) |
-		(b    << sdl_pixfmt->Bshift) |
-		(0xFF << sdl_pixfmt->Ashift)
+		(r    << PIXFMT->Rshift) |
+		(g    << PIXFMT->Gshift) |
+		(b    << PIXFMT->Bshift) |
+		(0xFF << PIXFMT->Ashift)
 	;
 }
 
@@ -80,66 +88,66 @@ void vidinterrupt(void) {
 				switch (CPU_AL & 0x7F) {
 						case 0: //40x25 mono text
 							videobase = textbase;
-							cols = 40;
-							rows = 25;
+							machine_cols = 40;
+							machine_rows = 25;
 							vidcolor = 0;
 							vidgfxmode = 0;
 							blankattr = 7;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							break;
 						case 1: //40x25 color text
 							videobase = textbase;
-							cols = 40;
-							rows = 25;
+							machine_cols = 40;
+							machine_rows = 25;
 							vidcolor = 1;
 							vidgfxmode = 0;
 							blankattr = 7;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
 						case 2: //80x25 mono text
 							videobase = textbase;
-							cols = 80;
-							rows = 25;
+							machine_cols = 80;
+							machine_rows = 25;
 							vidcolor = 1;
 							vidgfxmode = 0;
 							blankattr = 7;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
 						case 3: //80x25 color text
 							videobase = textbase;
-							cols = 80;
-							rows = 25;
+							machine_cols = 80;
+							machine_rows = 25;
 							vidcolor = 1;
 							vidgfxmode = 0;
 							blankattr = 7;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
 						case 4:
 						case 5: //80x25 color text
 							videobase = textbase;
-							cols = 40;
-							rows = 25;
+							machine_cols = 40;
+							machine_rows = 25;
 							vidcolor = 1;
 							vidgfxmode = 1;
 							blankattr = 7;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							if (CPU_AL == 4)
 								portram[0x3D9] = 48;
@@ -148,39 +156,39 @@ void vidinterrupt(void) {
 							break;
 						case 6:
 							videobase = textbase;
-							cols = 80;
-							rows = 25;
+							machine_cols = 80;
+							machine_rows = 25;
 							vidcolor = 0;
 							vidgfxmode = 1;
 							blankattr = 7;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
 						case 127:
 							videobase = 0xB8000;
-							cols = 90;
-							rows = 25;
+							machine_cols = 90;
+							machine_rows = 25;
 							vidcolor = 0;
 							vidgfxmode = 1;
 							for (tempcalc = videobase; tempcalc<videobase+16384; tempcalc++) {
-									RAM[tempcalc] = 0;
+									machine_ram[tempcalc] = 0;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
 						case 0x9: //320x200 16-color
 							videobase = 0xB8000;
-							cols = 40;
-							rows = 25;
+							machine_cols = 40;
+							machine_rows = 25;
 							vidcolor = 1;
 							vidgfxmode = 1;
 							blankattr = 0;
 							if ((CPU_AL & 0x80) == 0)
 								for (tempcalc = videobase; tempcalc<videobase+65535; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
@@ -188,27 +196,28 @@ void vidinterrupt(void) {
 						case 0x12: //640x480 16-color
 						case 0x13: //320x200 256-color
 							videobase = 0xA0000;
-							cols = 40;
-							rows = 25;
+							machine_cols = 40;
+							machine_rows = 25;
 							vidcolor = 1;
 							vidgfxmode = 1;
 							blankattr = 0;
 							for (tempcalc = videobase; tempcalc<videobase+65535; tempcalc+=2) {
-									RAM[tempcalc] = 0;
-									RAM[tempcalc+1] = blankattr;
+									machine_ram[tempcalc] = 0;
+									machine_ram[tempcalc+1] = blankattr;
 								}
 							portram[0x3D8] = portram[0x3D8] & 0xFE;
 							break;
 					}
 				vidmode = CPU_AL & 0x7F;
-				RAM[0x449] = vidmode;
-				RAM[0x44A] = (uint8_t) cols;
-				RAM[0x44B] = 0;
-				RAM[0x484] = (uint8_t) (rows - 1);
+				cpu_mem_remap();	// VGA window access depends on the mode
+				machine_ram[0x449] = vidmode;
+				machine_ram[0x44A] = (uint8_t) machine_cols;
+				machine_ram[0x44B] = 0;
+				machine_ram[0x484] = (uint8_t) (machine_rows - 1);
 				cursx = 0;
 				cursy = 0;
 				if ((CPU_AL & 0x80) == 0x00) {
-						memset (&RAM[0xA0000], 0, 0x1FFFF);
+						memset (&machine_ram[0xA0000], 0, 0x1FFFF);
 						memset (VRAM, 0, 262144);
 					}
 // TODO: removed ... FIXME
@@ -551,9 +560,10 @@ int initcga ( void )
 	return 0;
 }
 
-uint16_t vtotal = 0;
+#define oldah		(machine->video.oldah)
+#define oldal		(machine->video.oldal)
+
 static void outVGA (uint16_t portnum, uint8_t value) {
-	static uint8_t oldah, oldal;
 	uint8_t flip3c0 = 0;
 	updatedscreen = 1;
 	switch (portnum) {
@@ -637,14 +647,14 @@ static void outVGA (uint16_t portnum, uint8_t value) {
 #endif
 #endif
 						case 0: //red
-							tempRGB =  value << (sdl_pixfmt->Rshift + 2);
+							tempRGB =  value << (PIXFMT->Rshift + 2);
 							break;
 						case 1: //green
-							tempRGB |= value << (sdl_pixfmt->Gshift + 2);
+							tempRGB |= value << (PIXFMT->Gshift + 2);
 							break;
 						case 2: //blue
-							tempRGB |= value << (sdl_pixfmt->Bshift + 2);
-							tempRGB |= 0xFF  <<  sdl_pixfmt->Ashift;
+							tempRGB |= value << (PIXFMT->Bshift + 2);
+							tempRGB |= 0xFF  <<  PIXFMT->Ashift;
 							palettevga[latchPal] = tempRGB;
 							latchPal = latchPal + 1;
 							break;
@@ -655,8 +665,8 @@ static void outVGA (uint16_t portnum, uint8_t value) {
 				VGA_CRTC[portram[0x3D4]] = value & 255;
 				if (portram[0x3D4]==0xE) cursorposition = (cursorposition&0xFF) | (value<<8);
 				else if (portram[0x3D4]==0xF) cursorposition = (cursorposition&0xFF00) |value;
-				cursy = cursorposition/cols;
-				cursx = cursorposition%cols;
+				cursy = cursorposition/machine_cols;
+				cursx = cursorposition%machine_cols;
 				if (portram[0x3D4] == 6) {
 						vtotal = value | ( ( (uint16_t) VGA_GC[7] & 1) << 8) | ( ( (VGA_GC[7] & 32) ? 1 : 0) << 9);
 						//printf("Vertical total: %u\n", vtotal);
@@ -685,14 +695,15 @@ static uint8_t inVGA (uint16_t portnum) {
 			case 0x3C9: //RGB data register
 				switch (latchReadRGB++) {
 						case 0: //blue
-							return (palettevga[latchReadPal] >> (sdl_pixfmt->Rshift + 2)) & 63;
+							return (palettevga[latchReadPal] >> (PIXFMT->Rshift + 2)) & 63;
 						case 1: //green
-							return (palettevga[latchReadPal] >> (sdl_pixfmt->Gshift + 2)) & 63;
+							return (palettevga[latchReadPal] >> (PIXFMT->Gshift + 2)) & 63;
 						case 2: //red
 							latchReadRGB = 0;
-							return (palettevga[latchReadPal++] >> (sdl_pixfmt->Bshift + 2)) & 63;
+							return (palettevga[latchReadPal++] >> (PIXFMT->Bshift + 2)) & 63;
 					}
 			case 0x3DA:
+				port3da = timing_retrace();
 				return port3da;
 		}
 	return portram[portnum]; //this won't be reached, but without it the compiler gives a warning
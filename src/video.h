@@ -23,42 +23,35 @@
 
 #include <stdint.h>
 
-extern uint16_t cols;
-extern uint16_t cursorposition;
-extern uint16_t cursorvisible;
-extern uint16_t cursx;
-extern uint16_t cursy;
+struct video_s {
+	uint8_t		VRAM[262144];
+	uint8_t		vidmode, cgabg, blankattr, vidgfxmode, vidcolor;
+	uint16_t	cursx, cursy, cols, rows, cursorposition, cursorvisible;
+	uint8_t		updatedscreen, clocksafe, port3da, port6;
+	uint16_t	VGA_SC[0x100], VGA_CRTC[0x100], VGA_ATTR[0x100], VGA_GC[0x100];
+	uint32_t	videobase, textbase;
+	uint32_t	palettevga[256];
+	uint16_t	vtotal;
+	uint8_t		latchRGB, latchPal, VGA_latch[4], stateDAC;
+	uint8_t		latchReadRGB, latchReadPal;
+	uint32_t	tempRGB;
+	uint8_t		oldah, oldal;
+};
+
 extern uint16_t oldh;
 extern uint16_t oldw;
-extern uint16_t rows;
-extern uint16_t VGA_ATTR[0x100];
-extern uint16_t VGA_CRTC[0x100];
-extern uint16_t VGA_GC[0x100];
 extern uint16_t vgapage;
-extern uint16_t VGA_SC[0x100];
-extern uint16_t vtotal;
 extern uint32_t palettecga[16];
-extern uint32_t palettevga[256];
-extern uint32_t textbase;
 extern uint32_t usefullscreen;
 extern uint32_t usegrabmode;
-extern uint32_t videobase;
-extern uint8_t blankattr;
-extern uint8_t cgabg;
-extern uint8_t clocksafe;
 //extern uint8_t fontcga[32768];
 extern const uint8_t *fontcga;
-extern uint8_t port3da;
-extern uint8_t port6;
 extern uint8_t readVGA(uint32_t addr32);
-extern uint8_t updatedscreen;
-extern uint8_t vidcolor;
-extern uint8_t vidgfxmode;
-extern uint8_t vidmode;
-extern uint8_t VRAM[262144];
 extern void initVideoPorts(void);
 extern void vidinterrupt(void);
 extern void writeVGA(uint32_t addr32, uint8_t value);
 extern int  initcga ( void );
 
+#include "machine.h"
+
 #endif